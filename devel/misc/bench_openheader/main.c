@@ -0,0 +1,122 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Benchmark the number of files opened per second when only accessing header
+//info (nparticles, source name and stat:sum values), with mcpl_open_file and
+//mcpl_open_header_only. Usage:
+//
+//   bench_openheader [NFILES [BLOBSIZE]]
+//
+//Creates NFILES small files (plain and gzipped) in the current directory, each
+//with a few comments, stat:sum entries and a blob of BLOBSIZE bytes.
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static void create_file( const char * filename, unsigned blobsize, int do_gzip )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_hdr_set_srcname(f,"bench_openheader");
+  mcpl_hdr_add_comment(f,"Some comment describing the simulation.");
+  mcpl_hdr_add_comment(f,"Another comment with more details about the setup.");
+  mcpl_hdr_add_stat_sum(f,"nsrc",1.0e6);
+  mcpl_hdr_add_stat_sum(f,"tally",123.456);
+  char * blob = (char*)calloc(blobsize ? blobsize : 1,1);
+  for ( unsigned i = 0; i < blobsize; ++i )
+    blob[i] = (char)( i % 97 );
+  mcpl_hdr_add_data(f,"config",blobsize,blob);
+  free(blob);
+  mcpl_particle_t * p = mcpl_get_empty_particle(f);
+  for ( unsigned i = 0; i < 1000; ++i ) {
+    p->pdgcode = 2112;
+    p->ekin = 0.001 * i;
+    p->direction[2] = 1.0;
+    p->weight = 1.0;
+    mcpl_add_particle(f,p);
+  }
+  if ( do_gzip )
+    mcpl_closeandgzip_outfile(f);
+  else
+    mcpl_close_outfile(f);
+}
+
+static void silent_print( const char * msg )
+{
+  (void)msg;
+}
+
+typedef mcpl_file_t (*openfct_t)(const char *);
+
+static void bench( const char * label, openfct_t openfct,
+                   unsigned nfiles, const char * fmt )
+{
+  char filename[128];
+  double sum = 0.0;
+  unsigned long long ntot = 0;
+  unsigned nopened = 0;
+  clock_t t0 = clock();
+  //Repeat the scan until at least a second has passed:
+  while ( nopened == 0 || clock() - t0 < CLOCKS_PER_SEC ) {
+    for ( unsigned i = 0; i < nfiles; ++i ) {
+      snprintf(filename,sizeof(filename),fmt,i);
+      mcpl_file_t f = openfct(filename);
+      ntot += mcpl_hdr_nparticles(f);
+      sum += mcpl_hdr_stat_sum(f,"nsrc") + (double)mcpl_hdr_srcname(f)[0];
+      mcpl_close_file(f);
+    }
+    nopened += nfiles;
+  }
+  double t = (double)( clock() - t0 ) / CLOCKS_PER_SEC;
+  printf("  %-36s : %10.0f files/s (checksum %llu %g)\n",
+         label, nopened / t, ntot, sum);
+}
+
+int main(int argc,char**argv) {
+  unsigned nfiles = ( argc > 1 ? (unsigned)atoi(argv[1]) : 200 );
+  unsigned blobsize = ( argc > 2 ? (unsigned)atoi(argv[2]) : 65536 );
+  if ( !nfiles ) {
+    printf("Usage: %s [NFILES [BLOBSIZE]]\n",argv[0]);
+    return 1;
+  }
+
+  char filename[128];
+  mcpl_set_print_handler(silent_print);
+  for ( unsigned i = 0; i < nfiles; ++i ) {
+    snprintf(filename,sizeof(filename),"benchfile_%u.mcpl",i);
+    create_file( filename, blobsize, 0 );
+    snprintf(filename,sizeof(filename),"benchfilegz_%u.mcpl",i);
+    create_file( filename, blobsize, 1 );
+  }
+  mcpl_set_print_handler(NULL);
+
+  printf("Opening %u files with %u byte blobs:\n",nfiles,blobsize);
+  bench( "mcpl_open_file (.mcpl)", mcpl_open_file,
+         nfiles, "benchfile_%u.mcpl" );
+  bench( "mcpl_open_header_only (.mcpl)", mcpl_open_header_only,
+         nfiles, "benchfile_%u.mcpl" );
+  bench( "mcpl_open_file (.mcpl.gz)", mcpl_open_file,
+         nfiles, "benchfilegz_%u.mcpl.gz" );
+  bench( "mcpl_open_header_only (.mcpl.gz)", mcpl_open_header_only,
+         nfiles, "benchfilegz_%u.mcpl.gz" );
+  return 0;
+}
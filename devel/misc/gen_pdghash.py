@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# Generates the perfect hash tables used for converting PDG codes to MCNPX and
+# MCNP6 SSW types (sswread.c) and to PHITS codes (phitsread.c). The tables of
+# codes are parsed from the C sources, so after modifying one of them, run:
+#
+#   devel/misc/gen_pdghash.py --search
+#
+# and paste the printed #define and hash table into the C file. Without
+# arguments, the script instead verifies that the multipliers and hash tables
+# currently in the C files are consistent with the tables of codes.
+#
+# Slot number ((uint32_t)pdgcode*K)>>(32-nbits) of a hash table holds the index
+# of pdgcode in the table of codes, with the 0x80 bit set if it is the
+# antiparticle of the code at that index (unused slots hold 255). The SSW tables
+# include all codes in the tables (including 0 and the light ions), while the
+# PHITS table omits the antiparticles of particles which are their own
+# antiparticles (22, 111 and 331).
+
+import pathlib
+import random
+import re
+import sys
+
+reporoot = pathlib.Path(__file__).resolve().absolute().parent.parent.parent
+srcdir = reporoot.joinpath('mcpl_extra','src')
+
+hashdefs = [
+    dict( srcfile = srcdir.joinpath('ssw','common','sswread.c'),
+          codes = 'conv_mcnpx_to_pdg_0to34',
+          hashtable = 'conv_pdg_to_mcnpx_hash',
+          prefix = 'SSW_MCNPX_PDGHASH',
+          selfanti = () ),
+    dict( srcfile = srcdir.joinpath('ssw','common','sswread.c'),
+          codes = 'conv_mcnp6_to_pdg_0to36',
+          hashtable = 'conv_pdg_to_mcnp6_hash',
+          prefix = 'SSW_MCNP6_PDGHASH',
+          selfanti = () ),
+    dict( srcfile = srcdir.joinpath('phits','common','phitsread.c'),
+          codes = 'phits_known_nonion_codes',
+          hashtable = 'phits_known_nonion_hash',
+          prefix = 'PHITS_PDGHASH',
+          selfanti = (22,111,331) ),
+]
+
+def parse_c_array( src, name ):
+    m = re.search( r'\b%s\s*\[\s*\w*\s*\]\s*=\s*\{([^}]*)\}'%name, src )
+    if not m:
+        raise SystemExit(f'Could not find array {name}')
+    return [ int(e) for e in m.group(1).replace('\n',' ').split(',')
+             if e.strip() ]
+
+def parse_c_define( src, name ):
+    m = re.search( r'^#define\s+%s\s+(\w+?)u?$'%name, src, re.MULTILINE )
+    if not m:
+        raise SystemExit(f'Could not find #define {name}')
+    return int( m.group(1), 0 )
+
+def hash_keys( codes, selfanti ):
+    keys = {}
+    for i, c in enumerate(codes):
+        keys.setdefault( c, i )
+    for i, c in enumerate(codes):
+        if c and c not in selfanti and -c not in keys:
+            keys[-c] = 0x80 | i
+    return keys
+
+def build_table( keys, K, nbits ):
+    slots = [ 255 ] * ( 1 << nbits )
+    for c, v in keys.items():
+        s = ( ( ( c & 0xffffffff ) * K ) & 0xffffffff ) >> ( 32 - nbits )
+        if slots[s] != 255:
+            return None#collision
+        slots[s] = v
+    return slots
+
+def search_multiplier( keys, nbits, seed = 1 ):
+    rng = random.Random( seed )
+    for _ in range(10000000):
+        K = rng.getrandbits(32) | 1
+        table = build_table( keys, K, nbits )
+        if table:
+            return K, table
+    raise SystemExit(f'No multiplier found for {nbits} bits')
+
+def format_table( d, K, nbits, table ):
+    lines = [ '#define %s_K 0x%08xu'%(d['prefix'],K),
+              '#define %s_NBITS %i'%(d['prefix'],nbits),
+              'static const unsigned char %s[%i] = {'%(d['hashtable'],
+                                                       len(table)) ]
+    for i in range(0,len(table),16):
+        row = ', '.join( '%3i'%e for e in table[i:i+16] )
+        lines.append( '  ' + row + ( ',' if i + 16 < len(table) else '' ) )
+    lines.append('};')
+    return '\n'.join(lines)
+
+def main():
+    args = sys.argv[1:]
+    if args not in ( [], ['--search'] ):
+        raise SystemExit('Usage: %s [--search]'%sys.argv[0])
+    ok = True
+    for d in hashdefs:
+        src = d['srcfile'].read_text()
+        keys = hash_keys( parse_c_array( src, d['codes'] ), d['selfanti'] )
+        current = parse_c_array( src, d['hashtable'] )
+        nbits = parse_c_define( src, d['prefix'] + '_NBITS' )
+        if args:
+            #Use the smallest table size with at most 50% occupancy:
+            nbits = max( 1, ( 2 * len(keys) - 1 ).bit_length() )
+            K, table = search_multiplier( keys, nbits )
+            print( '//%s:'%d['srcfile'].relative_to(reporoot) )
+            print( format_table( d, K, nbits, table ) )
+            print()
+        else:
+            K = parse_c_define( src, d['prefix'] + '_K' )
+            if build_table( keys, K, nbits ) == current:
+                print( 'OK: %s'%d['hashtable'] )
+            else:
+                print( 'OUTDATED: %s'%d['hashtable'] )
+                ok = False
+    if not ok:
+        raise SystemExit('Run with --search to regenerate outdated tables.')
+
+if __name__ == '__main__':
+    main()
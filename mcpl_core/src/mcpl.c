@@ -53,76 +53,14 @@
 //  1: Format used during early development. No longer supported.             //
 ////////////////////////////////////////////////////////////////////////////////
 
-//Before including mcpl.h, we attempt to get PRIu64 defined in a relatively
-//robust manner by enabling feature test macros for gcc and including relevant
-//headers:
-#ifndef __STDC_FORMAT_MACROS
-#  define __STDC_FORMAT_MACROS
-#endif
-#ifndef _POSIX_C_SOURCE
-#  define _POSIX_C_SOURCE 200809L
-#endif
-#ifndef _ISOC99_SOURCE
-#  define _ISOC99_SOURCE 1
-#endif
-#ifndef _C99_SOURCE
-#  define _C99_SOURCE 1
-#endif
-#ifdef _FILE_OFFSET_BITS
-#  undef _FILE_OFFSET_BITS
-#endif
-#define _FILE_OFFSET_BITS 64
-#include <inttypes.h>
-#include <stdio.h>
-#ifndef PRIu64//bad compiler - fallback to guessing
-#  if defined(_MSC_VER) && (_MSC_VER<1900)
-#    define PRIu64 "I64u"
-#  else
-#    if defined(__WORDSIZE) && (__WORDSIZE==64)
-#      define PRIu64 "lu"
-#    else
-#      define PRIu64 "llu"
-#    endif
-#  endif
-#endif
 
-#include "mcpl.h"
-#include "zlib.h"
-#include <stdlib.h>
-#include <string.h>
-#include <assert.h>
-#include <math.h>
-#include <limits.h>
-
-#ifdef Z_SOLO
-#  error "MCPL needs zlib with gzip functionality"
-#endif
-
-#ifndef INFINITY
-//Missing in ICC 12 C99 compilation:
-#  define  INFINITY (__builtin_inf())
-#endif
-
-#include "mcpl_fileutils.h"
-
-#define MCPLIMP_NPARTICLES_POS 8
-#define MCPLIMP_MAX_PARTICLE_SIZE 96
-#define MCPL_STATIC_ASSERT0(COND,MSG) { typedef char mcpl_##MSG[(COND)?1:-1]; mcpl_##MSG dummy; (void)dummy; }
-#define MCPL_STATIC_ASSERT3(expr,x) MCPL_STATIC_ASSERT0(expr,fail_at_line_##x)
-#define MCPL_STATIC_ASSERT2(expr,x) MCPL_STATIC_ASSERT3(expr,x)
-#define MCPL_STATIC_ASSERT(expr)    MCPL_STATIC_ASSERT2(expr,__LINE__)
+#include "mcpl_internal.h"
 
 MCPL_LOCAL void mcpl_default_print_handler( const char * msg )
 {
-  printf("%s",msg);
+  fputs(msg,stdout);
 }
 
-//Make sure we don't have any raw printf's below
-#ifdef printf
-#  undef printf
-#endif
-#define printf MCPLNOUSEPRINTF
-
 typedef void (*MCPL_CHARTOVOID_FCT)(const char *);
 
 MCPL_LOCAL MCPL_CHARTOVOID_FCT* mcpl_current_print_handler(void)
@@ -265,49 +203,6 @@ MCPL_LOCAL int mcpl_internal_fakeconstantversion( int enable )
   return fakev;
 }
 
-#define MCPL_STATSUMINI "stat:sum:"
-#define MCPL_STATSUMINI_LENGTH (sizeof(MCPL_STATSUMINI)-1)
-#define MCPL_STATSUMKEY_MAXLENGTH 64
-#define MCPL_STATSUMVAL_LENGTH 24
-#define MCPL_STATSUMVAL_ENCODEDZERO   "                       0"
-#define MCPL_STATSUMBUF_MAXLENGTH ( MCPL_STATSUMKEY_MAXLENGTH + \
-                                    MCPL_STATSUMVAL_LENGTH +    \
-                                    MCPL_STATSUMINI_LENGTH +   \
-                                    1 ) //+1 for final colon
-
-typedef struct MCPL_LOCAL {
-  char key[MCPL_STATSUMKEY_MAXLENGTH+1];
-  double value;
-  uint32_t writtenstrlen;
-  uint64_t writtenpos;
-} mcpl_internal_statsuminfo_t;
-
-typedef struct MCPL_LOCAL {
-  char * filename;
-  FILE * file;
-  char * hdr_srcprogname;
-  uint32_t ncomments;
-  char ** comments;
-  uint32_t nblobs;
-  char ** blobkeys;
-  uint32_t * bloblengths;
-  char ** blobs;
-  int opt_userflags;
-  int opt_polarisation;
-  int opt_singleprec;
-  int32_t opt_universalpdgcode;
-  double opt_universalweight;
-  int header_notwritten;
-  uint64_t nparticles;
-  unsigned particle_size;
-  mcpl_particle_t* puser;
-  unsigned opt_signature;
-  char particle_buffer[MCPLIMP_MAX_PARTICLE_SIZE];
-  mcpl_internal_statsuminfo_t * statsuminfo;
-  unsigned nstatsuminfo;
-} mcpl_outfileinternal_t;
-
-#define MCPLIMP_OUTFILEDECODE mcpl_outfileinternal_t * f = (mcpl_outfileinternal_t *)of.internal; assert(f)
 
 MCPL_LOCAL void mcpl_recalc_psize(mcpl_outfile_t of)
 {
@@ -486,19 +381,6 @@ MCPL_LOCAL int mcpl_check_isidentifier( const char * c )
            && mcpl_check_char( c, 0 ) );
 }
 
-#define MCPL_COMMENT_IS_STATSUM(x) ( *x == 's' \
-                                     && strncmp(x,MCPL_STATSUMINI,      \
-                                                MCPL_STATSUMINI_LENGTH)==0 )
-
-
-typedef struct MCPL_LOCAL {
-  //The rest is only if actually starts with "stat:sum:":
-
-  //Error message in case of syntax errors (NULL means OK):
-  const char * errmsg;
-  double value;//-1 or >=0 (never inf or nan)
-  char key[MCPL_STATSUMKEY_MAXLENGTH+1];
-} mcpl_internal_statsum_t;
 
 MCPL_LOCAL void mcpl_internal_statsumparse( const char * comment,
                                             mcpl_internal_statsum_t* res )
@@ -862,17 +744,6 @@ MCPL_LOCAL void mcpl_internal_encodestatsum( const char * key,
     mcpl_error("Unexpected encoding of stat:sum: value");
 }
 
-#ifdef _WIN32
-#  define MCPL_FSEEK( fh, pos)  _fseeki64(fh,(__int64)(pos), SEEK_SET)
-#  define MCPL_FSEEK_CUR( fh, pos)  _fseeki64(fh,(__int64)(pos), SEEK_CUR)
-#  define MCPL_FSEEK_END( fh)  _fseeki64(fh,(__int64)(0), SEEK_END)
-#  define MCPL_FTELL( fh)  _ftelli64(fh)
-#else
-#  define MCPL_FSEEK( fh, pos) fseek(fh,(ssize_t)(pos), SEEK_SET)
-#  define MCPL_FSEEK_CUR( fh, pos) fseek(fh,(ssize_t)(pos), SEEK_CUR)
-#  define MCPL_FSEEK_END( fh) fseek(fh,(ssize_t)(0), SEEK_END)
-#  define MCPL_FTELL( fh) ftell(fh)
-#endif
 
 MCPL_LOCAL void mcpl_write_header(mcpl_outfileinternal_t * f)
 {
@@ -1107,11 +978,12 @@ MCPL_LOCAL void mcpl_unitvect_unpack_oct(const double* in, double* out) {
   out[0] *= n; out[1] *= n; out[2] *= n;
 }
 
-MCPL_LOCAL void mcpl_internal_serialise_particle_to_buffer( const mcpl_particle_t* particle,
-                                                            mcpl_outfileinternal_t * f ) {
+MCPL_LOCAL void mcpl_internal_serialise_particle( const mcpl_particle_t* particle,
+                                                  const mcpl_outfileinternal_t * f,
+                                                  char * pbuf ) {
 
-  //Serialise the provided particle into the particle_buffer of the output file
-  //(according to the settings of the output file).
+  //Serialise the provided particle into pbuf (according to the settings of the
+  //output file).
 
   double pack_ekindir[3];
 
@@ -1132,7 +1004,6 @@ MCPL_LOCAL void mcpl_internal_serialise_particle_to_buffer( const mcpl_particle_
 
   //serialise particle object to buffer:
   unsigned ibuf = 0;
-  char * pbuf = &(f->particle_buffer[0]);
   int i;
   if (f->opt_singleprec) {
     if (f->opt_polarisation) {
@@ -1190,6 +1061,12 @@ MCPL_LOCAL void mcpl_internal_serialise_particle_to_buffer( const mcpl_particle_
   assert(ibuf==f->particle_size);
 }
 
+MCPL_LOCAL void mcpl_internal_serialise_particle_to_buffer( const mcpl_particle_t* particle,
+                                                            mcpl_outfileinternal_t * f ) {
+  //Serialise the provided particle into the particle_buffer of the output file:
+  mcpl_internal_serialise_particle( particle, f, &(f->particle_buffer[0]) );
+}
+
 MCPL_LOCAL void mcpl_internal_write_particle_buffer_to_file(mcpl_outfileinternal_t * f ) {
   //Ensure header is written:
   if (f->header_notwritten)
@@ -1251,7 +1128,11 @@ void mcpl_close_outfile(mcpl_outfile_t of)
   mcpl_internal_cleanup_outfile(f);
 }
 
-void mcpl_transfer_metadata(mcpl_file_t source, mcpl_outfile_t target)
+//Transfer metadata like mcpl_transfer_metadata, except for the blob with the
+//key skipblobkey (if not NULL):
+MCPL_LOCAL void mcpl_internal_transfer_metadata( mcpl_file_t source,
+                                                 mcpl_outfile_t target,
+                                                 const char * skipblobkey )
 {
   //Note that MCPL format version 2 and 3 have the same meta-data in the header,
   //except of course the version number itself.
@@ -1270,6 +1151,8 @@ void mcpl_transfer_metadata(mcpl_file_t source, mcpl_outfile_t target)
     const char * data;
     int ii;
     for (ii = 0; ii < nblobs; ++ii) {
+      if ( skipblobkey && strcmp( blobkeys[ii], skipblobkey ) == 0 )
+        continue;
       int res = mcpl_hdr_blob(source,blobkeys[ii],&ldata,&data);
       if (!res)
         mcpl_error("unexpected key problem in mcpl_transfer_metadata");
@@ -1291,6 +1174,11 @@ void mcpl_transfer_metadata(mcpl_file_t source, mcpl_outfile_t target)
     mcpl_enable_universal_weight(target,uw);
 }
 
+void mcpl_transfer_metadata(mcpl_file_t source, mcpl_outfile_t target)
+{
+  mcpl_internal_transfer_metadata( source, target, NULL );
+}
+
 int mcpl_closeandgzip_outfile_rc(mcpl_outfile_t of)
 {
   mcpl_print("MCPL WARNING: Usage of function mcpl_closeandgzip_outfile_rc is obsolete as"
@@ -1310,35 +1198,6 @@ int mcpl_closeandgzip_outfile(mcpl_outfile_t of)
   return rc;
 }
 
-typedef struct {
-  FILE * file;
-  gzFile filegz;
-  char * hdr_srcprogname;
-  unsigned format_version;
-  int opt_userflags;
-  int opt_polarisation;
-  int opt_singleprec;
-  int32_t opt_universalpdgcode;
-  double opt_universalweight;
-  int is_little_endian;
-  uint64_t nparticles;
-  uint32_t ncomments;
-  char ** comments;
-  uint32_t nblobs;
-  char ** blobkeys;
-  uint32_t * bloblengths;
-  char ** blobs;
-  unsigned particle_size;
-  uint64_t first_particle_pos;
-  uint64_t current_particle_idx;
-  mcpl_particle_t* particle;
-  unsigned opt_signature;
-  char particle_buffer[MCPLIMP_MAX_PARTICLE_SIZE];
-  uint64_t first_comment_pos;
-  uint32_t * repaired_statsum_icomments;
-} mcpl_fileinternal_t;
-
-#define MCPLIMP_FILEDECODE mcpl_fileinternal_t * f = (mcpl_fileinternal_t *)ff.internal; assert(f)
 
 MCPL_LOCAL uint64_t mcpl_read_buffer(mcpl_fileinternal_t* f, unsigned* n, char ** buf, const char * errmsg)
 {
@@ -1457,6 +1316,34 @@ MCPL_LOCAL void mcpl_internal_cleanup_file(mcpl_fileinternal_t * f)
 {
   if (!f)
     return;
+  if ( f->hdrbuf ) {
+    //Header-only mode, only blobs loaded on demand are separately allocated:
+    if ( f->blobs && f->blobpos ) {
+      for ( uint32_t i = 0; i < f->nblobs; ++i ) {
+        if ( f->blobpos[i] && f->blobs[i] )
+          free(f->blobs[i]);
+      }
+    }
+    free(f->blobs);
+    free(f->blobpos);
+    free(f->hdrstrs);
+    free(f->hdrbuf);
+    f->blobs = NULL;
+    f->blobpos = NULL;
+    f->hdrstrs = NULL;
+    f->hdrbuf = NULL;
+    f->hdr_srcprogname = NULL;
+    f->comments = NULL;
+    f->blobkeys = NULL;
+  }
+  if ( f->filename ) {
+    free(f->filename);
+    f->filename = NULL;
+  }
+  if ( f->selection ) {
+    mcpl_internal_selection_free(f->selection);
+    f->selection = NULL;
+  }
   if ( f->hdr_srcprogname ) {
     free(f->hdr_srcprogname);
     f->hdr_srcprogname = NULL;
@@ -1515,25 +1402,17 @@ MCPL_LOCAL void mcpl_internal_cleanup_file(mcpl_fileinternal_t * f)
   free(f);
 }
 
-MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair_status)
+MCPL_LOCAL mcpl_fileinternal_t * mcpl_internal_open_for_reading( const char * filename )
 {
-  int caller_is_mcpl_repair = *repair_status;
-  *repair_status = 0;//file not broken
-
-  if (!filename)
-    mcpl_error("mcpl_open_file called with null string");
-
-  mcpl_platform_compatibility_check();
-
-  mcpl_file_t out;
-  out.internal = NULL;
-
   mcpl_fileinternal_t * f
     = (mcpl_fileinternal_t*)mcpl_internal_calloc(1,sizeof(mcpl_fileinternal_t));
 
   //open file (with gzopen if filename ends with .gz):
   f->file = NULL;
   f->filegz = NULL;
+  size_t lfn = strlen(filename);
+  f->filename = mcpl_internal_malloc(lfn+1);
+  memcpy(f->filename,filename,lfn+1);
   const char * lastdot = strrchr(filename, '.');
   if (lastdot && strcmp(lastdot, ".gz") == 0) {
     f->filegz = mcpl_gzopen( filename, "rb" );
@@ -1548,17 +1427,34 @@ MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair
       mcpl_error("Unable to open file!");
     }
   }
+  return f;
+}
 
-  //First read and check magic word, format version and endianness.
-  unsigned char start[8];// = {'M','C','P','L','0','0','0','L'};
-  size_t nb;
-  if (f->filegz)
-    nb = gzread(f->filegz, start, sizeof(start));
-  else
-    nb = fread(start, 1, sizeof(start), f->file);
+MCPL_LOCAL size_t mcpl_internal_read_bytes( mcpl_fileinternal_t * f,
+                                            void * dest, size_t n )
+{
+  if ( !f->filegz )
+    return fread( dest, 1, n, f->file );
+  int nb = gzread( f->filegz, dest, (unsigned)n );
+  return nb > 0 ? (size_t)nb : 0;
+}
+
+MCPL_LOCAL int mcpl_internal_seek_bytes( mcpl_fileinternal_t * f, uint64_t pos )
+{
+  if ( f->filegz )
+    return mcpl_gzseek( f->filegz, (int64_t)pos );
+  return MCPL_FSEEK( f->file, pos ) == 0;
+}
+
+//Check magic word, format version and endianness in the first nb (at most 8)
+//bytes of the file:
+MCPL_LOCAL void mcpl_internal_check_file_start( mcpl_fileinternal_t * f,
+                                                const unsigned char * start,
+                                                size_t nb )
+{
   if (nb>=4&&(start[0]!='M'||start[1]!='C'||start[2]!='P'||start[3]!='L'))
     mcpl_error("File is not an MCPL file!");
-  if (nb!=sizeof(start))
+  if (nb!=8)
     mcpl_error("Error while reading first bytes of file!");
   f->format_version = (start[4]-'0')*100 + (start[5]-'0')*10 + (start[6]-'0');
   if (f->format_version!=2&&f->format_version!=3)
@@ -1570,31 +1466,11 @@ MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair
     else
       mcpl_error("Unexpected value in endianness field!");
   }
-  int64_t current_pos = sizeof(start);
-
-  //proceed reading header, knowing we have a consistent version and endian-ness.
-  const char * errmsg = "Errors encountered while attempting to read header";
-
-  uint64_t numpart;
-  if (f->filegz)
-    nb = gzread(f->filegz, &numpart, sizeof(numpart));
-  else
-    nb = fread(&numpart, 1, sizeof(numpart), f->file);
-  if (nb!=sizeof(numpart))
-    mcpl_error(errmsg);
-  current_pos += nb;
-  f->nparticles = numpart;
-
-  uint32_t arr[8];
-  MCPL_STATIC_ASSERT(sizeof(arr)==32);
-  if (f->filegz)
-    nb = gzread(f->filegz, arr, sizeof(arr));
-  else
-    nb=fread(arr, 1, sizeof(arr), f->file);
-  if (nb!=sizeof(arr))
-    mcpl_error(errmsg);
-  current_pos += nb;
+}
 
+MCPL_LOCAL void mcpl_internal_decode_hdr_flags( mcpl_fileinternal_t * f,
+                                                const uint32_t * arr )
+{
   f->ncomments = arr[0];
   f->nblobs = arr[1];
   f->opt_userflags = arr[2];
@@ -1604,37 +1480,24 @@ MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair
   f->particle_size = arr[6];//We could check consistency here with the calculated value.
   if ( ! (f->particle_size<=MCPLIMP_MAX_PARTICLE_SIZE) )
     mcpl_error("unexpected particle size");
+}
 
-  if (arr[7]) {
-    //file has universal weight
-    if (f->filegz)
-      nb = gzread(f->filegz, (void*)&(f->opt_universalweight), sizeof(f->opt_universalweight));
-    else
-      nb=fread((void*)&(f->opt_universalweight), 1, sizeof(f->opt_universalweight), f->file);
-    if (nb!=sizeof(f->opt_universalweight))
-      mcpl_error(errmsg);
-    current_pos += nb;
-  }
-
+MCPL_LOCAL void mcpl_internal_update_signature( mcpl_fileinternal_t * f )
+{
   f->opt_signature = 0
     + 1 * f->opt_singleprec
     + 2 * f->opt_polarisation
     + 4 * (f->opt_universalpdgcode?1:0)
     + 8 * (f->opt_universalweight?1:0)
     + 16 * f->opt_userflags;
+}
 
-  //Then some strings:
-  current_pos += mcpl_read_string(f,&f->hdr_srcprogname,errmsg);
-  f->comments = ( f->ncomments
-                  ? (char **)mcpl_internal_calloc(f->ncomments,sizeof(char*))
-                  : NULL );
-  f->first_comment_pos = current_pos;
-
-  //Validate stat: entries to get error on load rather than later on use:
+//Validate stat: entries to get error on load rather than later on use:
+MCPL_LOCAL void mcpl_internal_check_stat_comments( mcpl_fileinternal_t * f )
+{
   int unknown_stat_syntax = 0;
   uint32_t n_statsum_comments = 0;
   for (uint32_t i = 0; i < f->ncomments; ++i) {
-    current_pos += mcpl_read_string(f,&(f->comments[i]),errmsg);
     if ( strncmp( f->comments[i], "stat:", 5 ) != 0 )
       continue;
     if ( MCPL_COMMENT_IS_STATSUM(f->comments[i]) )
@@ -1676,6 +1539,181 @@ MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair
                " for \"stat:sum:...\" comments. It might be a sign that your"
                " installation of MCPL is too old.\n");
   }
+}
+
+//Check (and possibly recover) files which were not closed properly. Must be
+//called with the file positioned at the first particle:
+MCPL_LOCAL void mcpl_internal_check_unclosed( mcpl_fileinternal_t * f,
+                                              int caller_is_mcpl_repair,
+                                              int * repair_status )
+{
+  //TODO: Perhaps the placeholder nparticles should be UINT64_MAX instead of
+  //0, so we know that nparticles=0 is a properly closed file.
+
+  //Although empty files are permitted, it is possible that the file was never
+  //closed properly (maybe the writing program ended prematurely). Let us
+  //check to possibly recover usage of the file. If caller is mcpl_repair, we
+  //always check since the file might have been truncated after it was first
+  //closed properly.
+  if (f->filegz) {
+    //SEEK_END is not supported by zlib, and there is no reliable way to get
+    //the input size. Thus, all we can do is to uncompress the whole thing,
+    //which we won't since it might stall operations for a long time. But we
+    //can at least try to check whether the file is indeed empty or not, and
+    //give an error in the latter case:
+    if (f->nparticles==0) {
+      char testbuf[4];
+      int nb = gzread(f->filegz, testbuf, sizeof(testbuf));
+      if (nb>0) {
+        if (caller_is_mcpl_repair) {
+          *repair_status = 1;//file broken but can't recover since gzip.
+        } else {
+          mcpl_error("Input file appears to not have been closed properly"
+                     " and data recovery is disabled for gzipped files.");
+        }
+      }
+    } else {
+      if (!caller_is_mcpl_repair)
+        mcpl_error("logic error (!caller_is_mcpl_repair)");
+      *repair_status = 2;//file brokenness can not be determined since gzip.
+    }
+    if (!mcpl_gzseek( f->filegz, f->first_particle_pos ) )
+      mcpl_error("Unexpected issue skipping to start of empty gzipped file");
+  } else {
+    //SEEK_END is not guaranteed to always work, so we fail our recovery
+    //attempt silently:
+    if (f->file && !MCPL_FSEEK_END( f->file )) {
+      int64_t endpos = MCPL_FTELL(f->file);
+      if (endpos > (int64_t)f->first_particle_pos && (uint64_t)endpos != f->first_particle_pos) {
+        uint64_t np = ( endpos - f->first_particle_pos ) / f->particle_size;
+        if ( f->nparticles != np ) {
+          if ( f->nparticles > 0 && np > f->nparticles ) {
+            //should really not happen unless file was corrupted or file was
+            //first closed properly and then something was appended to it.
+            mcpl_error("Input file has invalid combination of meta-data & filesize.");
+          }
+          if (caller_is_mcpl_repair) {
+            *repair_status = 3;//file broken and should be able to repair
+          } else {
+            if (f->nparticles!=0)
+              mcpl_error("unexpected nparticles value");
+            char buf[256];
+            snprintf(buf,sizeof(buf),"MCPL WARNING: Input file appears to"
+                     " not have been closed properly. Recovered %"
+                     PRIu64 " particles.\n",np);
+            mcpl_print(buf);
+          }
+          f->nparticles = np;
+          //If we have any stat:sum: entries, their values will be
+          //untrustworthy, so we mark them as unavailable.
+          for (uint32_t i = 0; i < f->ncomments; ++i) {
+            if (!MCPL_COMMENT_IS_STATSUM(f->comments[i]))
+              continue;
+            mcpl_internal_statsum_t sc;
+            mcpl_internal_statsum_parse_or_emit_err( f->comments[i], &sc );
+            if ( sc.value == -1.0 )
+              continue;//already marked as not available
+            char buf[256+MCPL_STATSUMKEY_MAXLENGTH];
+            snprintf(buf,sizeof(buf),
+                     "MCPL WARNING: Marking stat:sum:%s entry as not avail"
+                     "able (-1) since file not closed properly.\n",sc.key);
+            mcpl_print(buf);
+
+            if ( caller_is_mcpl_repair ) {
+              //record indices of statsum comments that must be repaired
+              //also on-disk later.
+              if (!f->repaired_statsum_icomments) {
+                //allocate array. First entry will be the size.
+                f->repaired_statsum_icomments
+                  = (uint32_t *)mcpl_internal_calloc(f->ncomments+1,
+                                                     sizeof(uint32_t));
+                f->repaired_statsum_icomments[0] = 0;
+              }
+              uint32_t ir = ((f->repaired_statsum_icomments[0])++) + 1;
+              f->repaired_statsum_icomments[ir] = i;
+            }
+            char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
+            mcpl_internal_encodestatsum( sc.key, -1.0, new_comment );
+            size_t nn = strlen(f->comments[i]);
+            if ( nn != strlen(new_comment) )
+              mcpl_error("inconsistent length of stat:sum: comment");
+            memcpy(f->comments[i],new_comment,nn);
+          }
+        }
+      }
+    }
+    MCPL_FSEEK( f->file, f->first_particle_pos );//if this fseek failed, it
+                                                 //might just be that we are
+                                                 //at EOF with no particles.
+  }
+}
+
+MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair_status)
+{
+  int caller_is_mcpl_repair = *repair_status;
+  *repair_status = 0;//file not broken
+
+  if (!filename)
+    mcpl_error("mcpl_open_file called with null string");
+
+  mcpl_platform_compatibility_check();
+
+  mcpl_file_t out;
+  out.internal = NULL;
+
+  mcpl_fileinternal_t * f = mcpl_internal_open_for_reading( filename );
+
+  //First read and check magic word, format version and endianness.
+  unsigned char start[8];// = {'M','C','P','L','0','0','0','L'};
+  size_t nb = mcpl_internal_read_bytes( f, start, sizeof(start) );
+  mcpl_internal_check_file_start( f, start, nb );
+  int64_t current_pos = sizeof(start);
+
+  //proceed reading header, knowing we have a consistent version and endian-ness.
+  const char * errmsg = "Errors encountered while attempting to read header";
+
+  uint64_t numpart;
+  if (f->filegz)
+    nb = gzread(f->filegz, &numpart, sizeof(numpart));
+  else
+    nb = fread(&numpart, 1, sizeof(numpart), f->file);
+  if (nb!=sizeof(numpart))
+    mcpl_error(errmsg);
+  current_pos += nb;
+  f->nparticles = numpart;
+
+  uint32_t arr[8];
+  MCPL_STATIC_ASSERT(sizeof(arr)==32);
+  if (f->filegz)
+    nb = gzread(f->filegz, arr, sizeof(arr));
+  else
+    nb=fread(arr, 1, sizeof(arr), f->file);
+  if (nb!=sizeof(arr))
+    mcpl_error(errmsg);
+  current_pos += nb;
+  mcpl_internal_decode_hdr_flags( f, arr );
+
+  if (arr[7]) {
+    //file has universal weight
+    if (f->filegz)
+      nb = gzread(f->filegz, (void*)&(f->opt_universalweight), sizeof(f->opt_universalweight));
+    else
+      nb=fread((void*)&(f->opt_universalweight), 1, sizeof(f->opt_universalweight), f->file);
+    if (nb!=sizeof(f->opt_universalweight))
+      mcpl_error(errmsg);
+    current_pos += nb;
+  }
+  mcpl_internal_update_signature( f );
+
+  //Then some strings:
+  current_pos += mcpl_read_string(f,&f->hdr_srcprogname,errmsg);
+  f->comments = ( f->ncomments
+                  ? (char **)mcpl_internal_calloc(f->ncomments,sizeof(char*))
+                  : NULL );
+  f->first_comment_pos = current_pos;
+  for (uint32_t i = 0; i < f->ncomments; ++i)
+    current_pos += mcpl_read_string(f,&(f->comments[i]),errmsg);
+  mcpl_internal_check_stat_comments( f );
 
   f->blobkeys = NULL;
   f->bloblengths = NULL;
@@ -1696,107 +1734,8 @@ MCPL_LOCAL mcpl_file_t mcpl_actual_open_file(const char * filename, int * repair
   f->first_particle_pos = current_pos;
   f->repaired_statsum_icomments = NULL;
 
-  if ( f->nparticles==0 || caller_is_mcpl_repair ) {
-    //TODO: Perhaps the placeholder nparticles should be UINT64_MAX instead of
-    //0, so we know that nparticles=0 is a properly closed file.
-
-    //Although empty files are permitted, it is possible that the file was never
-    //closed properly (maybe the writing program ended prematurely). Let us
-    //check to possibly recover usage of the file. If caller is mcpl_repair, we
-    //always check since the file might have been truncated after it was first
-    //closed properly.
-    if (f->filegz) {
-      //SEEK_END is not supported by zlib, and there is no reliable way to get
-      //the input size. Thus, all we can do is to uncompress the whole thing,
-      //which we won't since it might stall operations for a long time. But we
-      //can at least try to check whether the file is indeed empty or not, and
-      //give an error in the latter case:
-      if (f->nparticles==0) {
-        char testbuf[4];
-        nb = gzread(f->filegz, testbuf, sizeof(testbuf));
-        if (nb>0) {
-          if (caller_is_mcpl_repair) {
-            *repair_status = 1;//file broken but can't recover since gzip.
-          } else {
-            mcpl_error("Input file appears to not have been closed properly"
-                       " and data recovery is disabled for gzipped files.");
-          }
-        }
-      } else {
-        if (!caller_is_mcpl_repair)
-          mcpl_error("logic error (!caller_is_mcpl_repair)");
-        *repair_status = 2;//file brokenness can not be determined since gzip.
-      }
-      if (!mcpl_gzseek( f->filegz, f->first_particle_pos ) )
-        mcpl_error("Unexpected issue skipping to start of empty gzipped file");
-    } else {
-      //SEEK_END is not guaranteed to always work, so we fail our recovery
-      //attempt silently:
-      if (f->file && !MCPL_FSEEK_END( f->file )) {
-        int64_t endpos = MCPL_FTELL(f->file);
-        if (endpos > (int64_t)f->first_particle_pos && (uint64_t)endpos != f->first_particle_pos) {
-          uint64_t np = ( endpos - f->first_particle_pos ) / f->particle_size;
-          if ( f->nparticles != np ) {
-            if ( f->nparticles > 0 && np > f->nparticles ) {
-              //should really not happen unless file was corrupted or file was
-              //first closed properly and then something was appended to it.
-              mcpl_error("Input file has invalid combination of meta-data & filesize.");
-            }
-            if (caller_is_mcpl_repair) {
-              *repair_status = 3;//file broken and should be able to repair
-            } else {
-              if (f->nparticles!=0)
-                mcpl_error("unexpected nparticles value");
-              char buf[256];
-              snprintf(buf,sizeof(buf),"MCPL WARNING: Input file appears to"
-                       " not have been closed properly. Recovered %"
-                       PRIu64 " particles.\n",np);
-              mcpl_print(buf);
-            }
-            f->nparticles = np;
-            //If we have any stat:sum: entries, their values will be
-            //untrustworthy, so we mark them as unavailable.
-            for (uint32_t i = 0; i < f->ncomments; ++i) {
-              if (!MCPL_COMMENT_IS_STATSUM(f->comments[i]))
-                continue;
-              mcpl_internal_statsum_t sc;
-              mcpl_internal_statsum_parse_or_emit_err( f->comments[i], &sc );
-              if ( sc.value == -1.0 )
-                continue;//already marked as not available
-              char buf[256+MCPL_STATSUMKEY_MAXLENGTH];
-              snprintf(buf,sizeof(buf),
-                       "MCPL WARNING: Marking stat:sum:%s entry as not avail"
-                       "able (-1) since file not closed properly.\n",sc.key);
-              mcpl_print(buf);
-
-              if ( caller_is_mcpl_repair ) {
-                //record indices of statsum comments that must be repaired
-                //also on-disk later.
-                if (!f->repaired_statsum_icomments) {
-                  //allocate array. First entry will be the size.
-                  f->repaired_statsum_icomments
-                    = (uint32_t *)mcpl_internal_calloc(f->ncomments+1,
-                                                       sizeof(uint32_t));
-                  f->repaired_statsum_icomments[0] = 0;
-                }
-                uint32_t ir = ((f->repaired_statsum_icomments[0])++) + 1;
-                f->repaired_statsum_icomments[ir] = i;
-              }
-              char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
-              mcpl_internal_encodestatsum( sc.key, -1.0, new_comment );
-              size_t nn = strlen(f->comments[i]);
-              if ( nn != strlen(new_comment) )
-                mcpl_error("inconsistent length of stat:sum: comment");
-              memcpy(f->comments[i],new_comment,nn);
-            }
-          }
-        }
-      }
-      MCPL_FSEEK( f->file, f->first_particle_pos );//if this fseek failed, it
-                                                   //might just be that we are
-                                                   //at EOF with no particles.
-    }
-  }
+  if ( f->nparticles==0 || caller_is_mcpl_repair )
+    mcpl_internal_check_unclosed( f, caller_is_mcpl_repair, repair_status );
 
   out.internal = f;
   return out;
@@ -1808,28 +1747,198 @@ mcpl_file_t mcpl_open_file(const char * filename)
   return mcpl_actual_open_file(filename,&repair_status);
 }
 
-MCPL_LOCAL void mcpl_internal_updatestatsum( FILE * f,
-                                             mcpl_internal_statsuminfo_t*sc,
-                                             const char * new_comment )
+//Make sure the first n bytes of the file are available in f->hdrbuf, reading
+//more (and growing the buffer) as needed:
+MCPL_LOCAL void mcpl_internal_hdrbuf_require( mcpl_fileinternal_t * f,
+                                              size_t * nbuf, size_t * capacity,
+                                              uint64_t n, const char * errmsg )
 {
-  //Seek and update comment at correct location in header.
+  while ( n > *nbuf ) {
+    if ( *nbuf == *capacity ) {
+      size_t newcap = 2 * (*capacity);
+      if ( newcap < n )
+        newcap = (size_t)n;
+      f->hdrbuf = (char*)mcpl_internal_realloc( f->hdrbuf, newcap );
+      *capacity = newcap;
+    }
+    size_t nb = mcpl_internal_read_bytes( f, f->hdrbuf + *nbuf,
+                                          *capacity - *nbuf );
+    if (!nb)
+      mcpl_error(errmsg);
+    *nbuf += nb;
+  }
+}
 
-  const char * errmsg = ( "Errors encountered while attempting "
-                          "to update stat:sum: header in file." );
-  if (!f||!sc||!new_comment)
-    mcpl_error(errmsg);
+mcpl_file_t mcpl_open_header_only(const char * filename)
+{
+  if (!filename)
+    mcpl_error("mcpl_open_header_only called with null string");
 
-  uint32_t n = sc->writtenstrlen;
-  if ( n != strlen(new_comment) )
-    mcpl_error("preallocated space for stat:sum: update does not fit (2)");
+  mcpl_platform_compatibility_check();
 
-  int64_t savedpos = MCPL_FTELL(f);
-  if (savedpos<0)
-    mcpl_error(errmsg);
-  uint64_t updatepos = sc->writtenpos;
-  updatepos += sizeof(uint32_t);//skip strlen data (no, we can't read it since
-                                //the file is in output mode)
-  if (MCPL_FSEEK( f, updatepos ))
+  mcpl_fileinternal_t * f = mcpl_internal_open_for_reading( filename );
+
+  //Read the first chunk of the file in one go, which usually contains the
+  //entire header. All strings are parsed in-place in this buffer, and so are
+  //blobs if they happen to be fully contained in it:
+  const char * errmsg = "Errors encountered while attempting to read header";
+  size_t capacity = 4096;
+  f->hdrbuf = (char*)mcpl_internal_malloc( capacity );
+  size_t nbuf = mcpl_internal_read_bytes( f, f->hdrbuf, capacity );
+  mcpl_internal_check_file_start( f, (const unsigned char*)f->hdrbuf,
+                                  ( nbuf < 8 ? nbuf : 8 ) );
+
+  uint64_t pos = 8;
+  uint32_t arr[8];
+  MCPL_STATIC_ASSERT(sizeof(arr)==32);
+  mcpl_internal_hdrbuf_require( f, &nbuf, &capacity, pos + 8 + sizeof(arr), errmsg );
+  memcpy( &f->nparticles, f->hdrbuf + pos, sizeof(f->nparticles) );
+  memcpy( arr, f->hdrbuf + pos + 8, sizeof(arr) );
+  pos += 8 + sizeof(arr);
+  mcpl_internal_decode_hdr_flags( f, arr );
+  if (arr[7]) {
+    //file has universal weight
+    mcpl_internal_hdrbuf_require( f, &nbuf, &capacity, pos + 8, errmsg );
+    memcpy( &f->opt_universalweight, f->hdrbuf + pos, 8 );
+    pos += 8;
+  }
+  mcpl_internal_update_signature( f );
+
+  //Locate the strings (source name, comments and blob keys), making sure they
+  //are all in the buffer:
+  uint64_t nstrs = 1 + (uint64_t)f->ncomments + f->nblobs;
+  uint64_t strpos = pos;
+  for ( uint64_t i = 0; i < nstrs; ++i ) {
+    uint32_t n;
+    mcpl_internal_hdrbuf_require( f, &nbuf, &capacity, pos + 4, errmsg );
+    memcpy( &n, f->hdrbuf + pos, sizeof(n) );
+    pos += sizeof(n) + (uint64_t)n;
+    mcpl_internal_hdrbuf_require( f, &nbuf, &capacity, pos, errmsg );
+    if ( i == 0 )
+      f->first_comment_pos = pos;
+  }
+
+  //The buffer will not be reallocated from here on, so we can now turn the
+  //strings into null-terminated ones by moving each over its length field:
+  f->hdrstrs = (char**)mcpl_internal_malloc( nstrs * sizeof(char*) );
+  char * p = f->hdrbuf + strpos;
+  for ( uint64_t i = 0; i < nstrs; ++i ) {
+    uint32_t n;
+    memcpy( &n, p, sizeof(n) );
+    memmove( p, p + sizeof(n), n );
+    p[n] = '\0';
+    if ( memchr( p, '\0', n ) )
+      mcpl_error("encountered unexpected null-byte in string read from file");
+    f->hdrstrs[i] = p;
+    p += sizeof(n) + n;
+  }
+  f->hdr_srcprogname = f->hdrstrs[0];
+  f->comments = ( f->ncomments ? f->hdrstrs + 1 : NULL );
+  f->blobkeys = ( f->nblobs ? f->hdrstrs + 1 + f->ncomments : NULL );
+  mcpl_internal_check_stat_comments( f );
+
+  //Blob payloads outside the buffer are skipped until requested (only reading
+  //their length fields when needed):
+  if (f->nblobs) {
+    f->blobs = (char **)mcpl_internal_calloc(f->nblobs,sizeof(char*));
+    f->bloblengths = (uint32_t *)mcpl_internal_calloc(f->nblobs,sizeof(uint32_t));
+    f->blobpos = (uint64_t *)mcpl_internal_calloc(f->nblobs,sizeof(uint64_t));
+    for (uint32_t i =0; i < f->nblobs; ++i) {
+      uint32_t n;
+      if ( pos + sizeof(n) <= nbuf ) {
+        memcpy( &n, f->hdrbuf + pos, sizeof(n) );
+      } else if ( !mcpl_internal_seek_bytes( f, pos )
+                  || mcpl_internal_read_bytes( f, &n, sizeof(n) ) != sizeof(n) ) {
+        mcpl_error(errmsg);
+      }
+      pos += sizeof(n);
+      f->bloblengths[i] = n;
+      if ( pos + n <= nbuf )
+        f->blobs[i] = f->hdrbuf + pos;
+      else
+        f->blobpos[i] = pos;
+      pos += n;
+    }
+  }
+  f->particle = (mcpl_particle_t*)mcpl_internal_calloc(1,sizeof(mcpl_particle_t));
+
+  if ( pos > nbuf && !f->filegz ) {
+    //Header extends beyond the buffer, so make sure the file is not truncated
+    //(for gzipped files this would require decompressing the skipped blobs,
+    //so truncation is only detected once they or the particles are read):
+    char c;
+    if ( !mcpl_internal_seek_bytes( f, pos - 1 )
+         || mcpl_internal_read_bytes( f, &c, 1 ) != 1 )
+      mcpl_error(errmsg);
+  }
+
+  //At first event now (for gzipped files, zlib postpones the actual seek until
+  //the next read):
+  f->current_particle_idx = 0;
+  f->first_particle_pos = pos;
+  f->repaired_statsum_icomments = NULL;
+  if ( f->filegz ) {
+    if ( !mcpl_gzseek( f->filegz, (int64_t)pos ) )
+      mcpl_error(errmsg);
+  } else {
+    MCPL_FSEEK( f->file, pos );//failure handled on first read as in
+                               //mcpl_open_file.
+  }
+
+  if ( f->nparticles==0 ) {
+    int repair_status = 0;
+    mcpl_internal_check_unclosed( f, 0, &repair_status );
+  }
+
+  mcpl_file_t out;
+  out.internal = f;
+  return out;
+}
+
+//Access blob data, loading it first in case it was skipped by
+//mcpl_open_header_only:
+MCPL_LOCAL const char * mcpl_internal_blobdata( mcpl_fileinternal_t * f,
+                                                uint32_t i )
+{
+  if ( f->blobs[i] || !f->blobpos )
+    return f->blobs[i];
+  const char * errmsg = "Errors encountered while attempting to read blob";
+  uint32_t n = f->bloblengths[i];
+  char * data = mcpl_internal_malloc( n ? n : 1 );
+  if ( !mcpl_internal_seek_bytes( f, f->blobpos[i] )
+       || mcpl_internal_read_bytes( f, data, n ) != n )
+    mcpl_error(errmsg);
+  f->blobs[i] = data;
+  //Restore position in particle list:
+  if ( f->current_particle_idx < f->nparticles
+       && !mcpl_internal_seek_bytes( f, f->first_particle_pos
+                                     + f->current_particle_idx * f->particle_size ) )
+    mcpl_error(errmsg);
+  return data;
+}
+
+MCPL_LOCAL void mcpl_internal_updatestatsum( FILE * f,
+                                             mcpl_internal_statsuminfo_t*sc,
+                                             const char * new_comment )
+{
+  //Seek and update comment at correct location in header.
+
+  const char * errmsg = ( "Errors encountered while attempting "
+                          "to update stat:sum: header in file." );
+  if (!f||!sc||!new_comment)
+    mcpl_error(errmsg);
+
+  uint32_t n = sc->writtenstrlen;
+  if ( n != strlen(new_comment) )
+    mcpl_error("preallocated space for stat:sum: update does not fit (2)");
+
+  int64_t savedpos = MCPL_FTELL(f);
+  if (savedpos<0)
+    mcpl_error(errmsg);
+  uint64_t updatepos = sc->writtenpos;
+  updatepos += sizeof(uint32_t);//skip strlen data (no, we can't read it since
+                                //the file is in output mode)
+  if (MCPL_FSEEK( f, updatepos ))
     mcpl_error(errmsg);
   size_t nb = fwrite( new_comment, 1, n, f);
   if ( nb != n )
@@ -1985,7 +2094,7 @@ int mcpl_hdr_blob(mcpl_file_t ff, const char* key,
   uint32_t i;
   for (i = 0; i < f->nblobs; ++i) {
     if (strcmp(f->blobkeys[i],key)==0) {
-      *data = f->blobs[i];
+      *data = mcpl_internal_blobdata(f,i);
       *ldata = f->bloblengths[i];
       return 1;
     }
@@ -2022,6 +2131,13 @@ int mcpl_hdr_has_doubleprec(mcpl_file_t ff)
 const mcpl_particle_t* mcpl_read(mcpl_file_t ff)
 {
   MCPLIMP_FILEDECODE;
+  if ( f->selection )
+    return mcpl_internal_read_selected(f);
+  return mcpl_internal_read(f);
+}
+
+MCPL_LOCAL const mcpl_particle_t* mcpl_internal_read( mcpl_fileinternal_t * f )
+{
   f->current_particle_idx += 1;
   if ( f->current_particle_idx > f->nparticles ) {
     f->current_particle_idx = f->nparticles;//overflow guard
@@ -2039,9 +2155,16 @@ const mcpl_particle_t* mcpl_read(mcpl_file_t ff)
   if (nb!=lbuf)
     mcpl_error("Errors encountered while attempting to read particle data.");
 
-  //Transfer to particle struct:
+  mcpl_internal_decode_particle( f, pbuf, f->particle );
+  return f->particle;
+}
+
+MCPL_LOCAL void mcpl_internal_decode_particle( const mcpl_fileinternal_t * f,
+                                               const char * pbuf,
+                                               mcpl_particle_t * p )
+{
+  //Transfer raw particle record to particle struct:
   unsigned ibuf = 0;
-  mcpl_particle_t * p = f->particle;
   double pack_ekindir[3];
   p->weight = f->opt_universalweight;
   int i;
@@ -2107,9 +2230,9 @@ const mcpl_particle_t* mcpl_read(mcpl_file_t ff)
     ibuf += sizeof(uint32_t);
 #endif
   } else {
-    f->opt_userflags = 0;
+    p->userflags = 0;
   }
-  assert(ibuf==lbuf);
+  assert(ibuf==f->particle_size);
 
   //Unpack direction and ekin:
 
@@ -2126,7 +2249,43 @@ const mcpl_particle_t* mcpl_read(mcpl_file_t ff)
       p->direction[2] = 0.0;
     }
   }
-  return p;
+}
+
+#define MCPLIMP_READPARTS_CHUNKSIZE 1024
+
+uint64_t mcpl_read_particles( mcpl_file_t ff, mcpl_particle_t * buf, uint64_t n )
+{
+  MCPLIMP_FILEDECODE;
+  uint64_t nread = 0;
+  if ( f->selection ) {
+    for ( ; nread < n; ++nread ) {
+      const mcpl_particle_t * p = mcpl_internal_read_selected( f );
+      if ( !p )
+        break;
+      buf[nread] = *p;
+    }
+    return nread;
+  }
+  //Read raw records in chunks and decode them directly into the buffer:
+  const unsigned psize = f->particle_size;
+  char * raw = mcpl_internal_malloc( (size_t)MCPLIMP_READPARTS_CHUNKSIZE * psize );
+  while ( nread < n ) {
+    uint64_t nleft = n - nread;
+    unsigned nchunk = ( nleft < MCPLIMP_READPARTS_CHUNKSIZE
+                        ? (unsigned)nleft : MCPLIMP_READPARTS_CHUNKSIZE );
+    nchunk = mcpl_internal_read_raw_particles( f, raw, nchunk );
+    if ( !nchunk )
+      break;
+    for ( unsigned i = 0; i < nchunk; ++i )
+      mcpl_internal_decode_particle( f, raw + (size_t)i * psize, buf + nread + i );
+    nread += nchunk;
+    //Keep state of last read particle consistent with mcpl_read (needed by
+    //mcpl_transfer_last_read_particle):
+    memcpy( f->particle_buffer, raw + (size_t)(nchunk-1) * psize, psize );
+    *(f->particle) = buf[nread-1];
+  }
+  free( raw );
+  return nread;
 }
 
 int mcpl_skipforward(mcpl_file_t ff,uint64_t n)
@@ -2196,6 +2355,44 @@ int mcpl_seek(mcpl_file_t ff,uint64_t ipos)
   return notEOF;
 }
 
+//Internal functions for reading or writing blocks of raw particle records,
+//bypassing the per-particle encoding and decoding. The read function reads up
+//to n particles (returning the number actually read):
+MCPL_LOCAL unsigned mcpl_internal_read_raw_particles( mcpl_fileinternal_t * f,
+                                                      char * buf, unsigned n )
+{
+  uint64_t np_remaining = f->nparticles - f->current_particle_idx;
+  if ( n > np_remaining )
+    n = (unsigned)np_remaining;
+  if (!n)
+    return 0;
+  size_t nbytes = (size_t)n * f->particle_size;
+  size_t nb;
+  if (f->filegz) {
+    assert( nbytes < UINT32_MAX );
+    nb = (size_t)gzread( f->filegz, buf, (unsigned)nbytes );
+  } else {
+    nb = fread( buf, 1, nbytes, f->file );
+  }
+  if ( nb != nbytes )
+    mcpl_error("Errors encountered while attempting to read particle data.");
+  f->current_particle_idx += n;
+  return n;
+}
+
+MCPL_LOCAL void mcpl_internal_write_raw_particles( mcpl_outfileinternal_t * f,
+                                                   const char * buf, unsigned n )
+{
+  if (f->header_notwritten)
+    mcpl_write_header(f);
+  if (!n)
+    return;
+  size_t nbytes = (size_t)n * f->particle_size;
+  if ( fwrite( buf, 1, nbytes, f->file ) != nbytes )
+    mcpl_error("Errors encountered while attempting to write particle data.");
+  f->nparticles += n;
+}
+
 uint64_t mcpl_currentposition(mcpl_file_t ff)
 {
   MCPLIMP_FILEDECODE;
@@ -2400,14 +2597,9 @@ void mcpl_dump_header(mcpl_file_t f)
            "    Number of blobs    : %i\n",nblobs);
   mcpl_print(buf);
   for (uint32_t ib = 0; ib < nblobs; ++ib) {
-    const char * data;
-    uint32_t ldata;
-    int ok = mcpl_hdr_blob(f, blobkeys[ib], &ldata, &data);
-    if (!ok) {
-      if ( flexbuf != buf )
-        free(flexbuf);
-      mcpl_error("Unexpected blob access error");
-    }
+    //Get length directly, to avoid loading blobs skipped by
+    //mcpl_open_header_only:
+    uint32_t ldata = ((const mcpl_fileinternal_t *)f.internal)->bloblengths[ib];
     snprintf(flexbuf,lflexbuf,
              "          -> %lu bytes of data with key \"%s\"\n",
              (unsigned long)ldata,blobkeys[ib]);
@@ -2513,7 +2705,9 @@ void mcpl_dump(const char * filename, int parts, uint64_t nskip, uint64_t nlimit
 {
   if (parts<0||parts>2)
     mcpl_error("mcpl_dump got forbidden value for argument parts");
-  mcpl_file_t f = mcpl_open_file(filename);
+  mcpl_file_t f = ( parts==1
+                    ? mcpl_open_header_only(filename)
+                    : mcpl_open_file(filename) );
   {
     char * bn = mcpl_basename(filename);
     size_t n = 128 + strlen(bn);
@@ -2574,7 +2768,8 @@ MCPL_LOCAL int mcpl_actual_can_merge(mcpl_file_t ff1, mcpl_file_t ff2)
   for (i = 0; i<f1->nblobs; ++i) {
     if (f1->bloblengths[i]!=f2->bloblengths[i]) return 0;
     if (strcmp(f1->blobkeys[i],f2->blobkeys[i])!=0) return 0;
-    if (memcmp(f1->blobs[i],f2->blobs[i],f1->bloblengths[i])!=0) return 0;
+    if (memcmp(mcpl_internal_blobdata(f1,i),mcpl_internal_blobdata(f2,i),
+               f1->bloblengths[i])!=0) return 0;
   }
   return 1;
 }
@@ -2622,6 +2817,76 @@ MCPL_LOCAL void mcpl_error_on_dups(unsigned n, const char ** filenames)
 }
 
 
+#if defined(__linux__) && defined(__GLIBC__)
+// for fallocate(..) and copy_file_range(..)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <errno.h>
+#  define MCPL_HAS_FALLOCATE
+#  if __GLIBC__ > 2 || ( __GLIBC__ == 2 && __GLIBC_MINOR__ >= 27 )
+#    define MCPL_HAS_COPY_FILE_RANGE
+#  endif
+#endif
+
+//Internal function which reserves disk space for nbytes of data at position pos
+//in the file, without changing the apparent size of the file (so a failing
+//in-place merge can still be fixed with mcpl_repair). Returns 0 only if the
+//file system positively reported a lack of space, platforms and file systems
+//without support for preallocation will simply fall back to allocate space
+//during the actual writes:
+MCPL_LOCAL int mcpl_internal_preallocate( FILE * f, uint64_t pos, uint64_t nbytes )
+{
+#ifdef MCPL_HAS_FALLOCATE
+  if ( nbytes && fallocate( fileno(f), FALLOC_FL_KEEP_SIZE,
+                            (off_t)pos, (off_t)nbytes ) != 0 )
+    return errno == ENOSPC ? 0 : 1;
+#else
+  (void)f;
+  (void)pos;
+  (void)nbytes;
+#endif
+  return 1;
+}
+
+#ifdef MCPL_HAS_COPY_FILE_RANGE
+//Internal function for in-kernel transfer of up to nparticles particles,
+//starting at position pos_in of fi, into the current position of fo. Returns
+//the number of particles actually transferred (which can be less than
+//requested, e.g. if the file system does not support the operation), and
+//leaves both file handles positioned after the transferred particles:
+MCPL_LOCAL uint64_t mcpl_internal_copy_file_range( FILE * fo, FILE * fi,
+                                                   uint64_t pos_in,
+                                                   unsigned particle_size,
+                                                   uint64_t nparticles )
+{
+  if ( fflush(fo) != 0 )
+    mcpl_error("Unexpected write-error while merging");
+  int64_t pos_out = MCPL_FTELL(fo);
+  if ( pos_out < 0 )
+    return 0;
+  off_t off_in = (off_t)pos_in;
+  off_t off_out = (off_t)pos_out;
+  const uint64_t nbytes = nparticles * particle_size;
+  uint64_t ncopied = 0;
+  while ( ncopied < nbytes ) {
+    uint64_t nleft = nbytes - ncopied;
+    size_t nreq = (size_t)( nleft > 0x40000000 ? 0x40000000 : nleft );
+    ssize_t nb = copy_file_range( fileno(fi), &off_in, fileno(fo), &off_out,
+                                  nreq, 0 );
+    if ( nb <= 0 )
+      break;//unsupported or unexpected end of file, leave rest to caller
+    ncopied += (uint64_t)nb;
+  }
+  //Discard any partially copied particle, and reposition both files:
+  uint64_t ntransferred = ncopied / particle_size;
+  if ( MCPL_FSEEK( fi, pos_in + ntransferred * particle_size ) )
+    mcpl_error("Unexpected read-error while merging");
+  if ( MCPL_FSEEK( fo, (uint64_t)pos_out + ntransferred * particle_size ) )
+    mcpl_error("Unexpected write-error while merging");
+  return ntransferred;
+}
+#endif
+
 //Internal function for merges which will transfer the particle data in the
 //input file into an output file handle which must already be open and ready to
 //be written to, and otherwise be associated with an MCPL file with a compatible
@@ -2635,15 +2900,30 @@ void mcpl_transfer_particle_contents(FILE * fo, mcpl_file_t ffi, uint64_t nparti
     return;//no particles to transfer
 
   unsigned particle_size = fi->particle_size;
+  uint64_t np_remaining = nparticles;
 
-  //buffer for transferring up to 1000 particles at a time:
-  const unsigned npbufsize = 1000;
+#ifdef MCPL_HAS_COPY_FILE_RANGE
+  if (!fi->filegz) {
+    //Attempt efficient in-kernel transfer of data between the two files (on
+    //some file systems this can even share the data blocks rather than copying
+    //them). Anything not transferred this way is handled by the loop below:
+    np_remaining -= mcpl_internal_copy_file_range( fo, fi->file,
+                                                   ( fi->first_particle_pos
+                                                     + fi->current_particle_idx
+                                                     * particle_size ),
+                                                   particle_size,
+                                                   np_remaining );
+    if (!np_remaining)
+      return;
+  }
+#endif
+
+  //buffer for transferring ~1MB of particles at a time (gzipped input files
+  //are thus inflated in large chunks):
+  const unsigned npbufsize = (1u<<20) / particle_size;
   char * buf = mcpl_internal_malloc(npbufsize*particle_size);
-  uint64_t np_remaining = nparticles;
 
   while(np_remaining) {
-    //NB: On linux > 2.6.33 we could use sendfile for more efficient in-kernel
-    //transfer of data between two files!
     uint64_t toread = np_remaining >= npbufsize ? npbufsize : np_remaining;
     np_remaining -= toread;
 
@@ -2667,6 +2947,310 @@ void mcpl_transfer_particle_contents(FILE * fo, mcpl_file_t ffi, uint64_t nparti
   free(buf);
 }
 
+//Internal machinery for transcoding blocks of raw particle records between two
+//different particle data layouts, without going through the generic (and
+//slower) mcpl_read+mcpl_transfer_last_read_particle path. The transcoding is
+//described by a short list of operations, prepared once per pair of layouts:
+
+typedef enum { MCPLIMP_TC_COPY,       //copy n bytes
+               MCPLIMP_TC_WIDEN,      //convert n floats to doubles
+               MCPLIMP_TC_NARROW,     //convert n doubles to floats
+               MCPLIMP_TC_FILLF,      //fill n floats with fillval
+               MCPLIMP_TC_FILLD,      //fill n doubles with fillval
+               MCPLIMP_TC_FILLI32,    //fill n int32's with fillval
+               MCPLIMP_TC_REPACKDIR   //re-pack single prec ekin+dir in double prec
+} mcpl_internal_tcoptype_t;
+
+typedef struct MCPL_LOCAL {
+  mcpl_internal_tcoptype_t type;
+  unsigned src;
+  unsigned dst;
+  unsigned n;
+  double fillval;
+} mcpl_internal_tcop_t;
+
+
+MCPL_LOCAL void mcpl_internal_layout_init( mcpl_internal_layout_t * l,
+                                           int singleprec, int pol,
+                                           int universalweight,
+                                           int universalpdgcode,
+                                           int userflags )
+{
+  //Must be kept consistent with mcpl_internal_serialise_particle_to_buffer:
+  int off = 0;
+  l->fpsize = singleprec ? (int)sizeof(float) : (int)sizeof(double);
+  l->pol = pol ? off : -1;
+  off += pol ? 3 * l->fpsize : 0;
+  l->pos = off;
+  off += 3 * l->fpsize;
+  l->packekindir = off;
+  off += 3 * l->fpsize;
+  l->time = off;
+  off += l->fpsize;
+  l->weight = universalweight ? -1 : off;
+  off += universalweight ? 0 : l->fpsize;
+  l->pdgcode = universalpdgcode ? -1 : off;
+  off += universalpdgcode ? 0 : (int)sizeof(int32_t);
+  l->userflags = userflags ? off : -1;
+  off += userflags ? (int)sizeof(uint32_t) : 0;
+  l->particle_size = (unsigned)off;
+}
+
+MCPL_LOCAL void mcpl_internal_tcop_add( mcpl_internal_tcop_t * ops,
+                                        unsigned * nops,
+                                        mcpl_internal_tcoptype_t type,
+                                        int src, int dst, unsigned n,
+                                        double fillval )
+{
+  assert( dst >= 0 );
+  if ( type == MCPLIMP_TC_COPY && *nops ) {
+    //Merge with previous copy when contiguous in both source and target:
+    mcpl_internal_tcop_t * prev = &ops[*nops-1];
+    if ( prev->type == MCPLIMP_TC_COPY
+         && prev->src + prev->n == (unsigned)src
+         && prev->dst + prev->n == (unsigned)dst ) {
+      prev->n += n;
+      return;
+    }
+  }
+  mcpl_internal_tcop_t * op = &ops[(*nops)++];
+  op->type = type;
+  op->src = src >= 0 ? (unsigned)src : 0;
+  op->dst = (unsigned)dst;
+  op->n = n;
+  op->fillval = fillval;
+}
+
+MCPL_LOCAL void mcpl_internal_tcop_addfp( mcpl_internal_tcop_t * ops,
+                                          unsigned * nops,
+                                          const mcpl_internal_layout_t * ls,
+                                          const mcpl_internal_layout_t * lt,
+                                          int src, int dst, unsigned n )
+{
+  //Transfer n floating point fields, converting precision if needed:
+  if ( ls->fpsize == lt->fpsize )
+    mcpl_internal_tcop_add( ops, nops, MCPLIMP_TC_COPY,
+                            src, dst, n * (unsigned)ls->fpsize, 0.0 );
+  else
+    mcpl_internal_tcop_add( ops, nops,
+                            ( lt->fpsize == (int)sizeof(double)
+                              ? MCPLIMP_TC_WIDEN : MCPLIMP_TC_NARROW ),
+                            src, dst, n, 0.0 );
+}
+
+MCPL_LOCAL void mcpl_internal_tcop_addfill( mcpl_internal_tcop_t * ops,
+                                            unsigned * nops,
+                                            const mcpl_internal_layout_t * lt,
+                                            int dst, unsigned n, double val )
+{
+  mcpl_internal_tcop_add( ops, nops,
+                          ( lt->fpsize == (int)sizeof(double)
+                            ? MCPLIMP_TC_FILLD : MCPLIMP_TC_FILLF ),
+                          -1, dst, n, val );
+}
+
+//Prepare list of operations needed to transcode particles from fs into ft,
+//returning the number of operations (or 0 if not possible, in which case the
+//generic path must be used):
+MCPL_LOCAL unsigned mcpl_internal_tcop_prepare( const mcpl_fileinternal_t * fs,
+                                                const mcpl_outfileinternal_t * ft,
+                                                mcpl_internal_tcop_t * ops,
+                                                mcpl_internal_layout_t * ls,
+                                                mcpl_internal_layout_t * lt )
+{
+  if ( fs->format_version != MCPL_FORMATVERSION )
+    return 0;//different unit vector packing
+  if ( ft->opt_universalpdgcode
+       && ft->opt_universalpdgcode != fs->opt_universalpdgcode )
+    return 0;//leave error reporting to mcpl_transfer_last_read_particle
+  if ( ft->opt_universalweight
+       && ft->opt_universalweight != fs->opt_universalweight )
+    return 0;//leave error reporting to mcpl_transfer_last_read_particle
+
+  mcpl_internal_layout_init( ls, fs->opt_singleprec, fs->opt_polarisation,
+                             fs->opt_universalweight != 0.0,
+                             fs->opt_universalpdgcode != 0,
+                             fs->opt_userflags );
+  mcpl_internal_layout_init( lt, ft->opt_singleprec, ft->opt_polarisation,
+                             ft->opt_universalweight != 0.0,
+                             ft->opt_universalpdgcode != 0,
+                             ft->opt_userflags );
+  if ( ls->particle_size != fs->particle_size
+       || lt->particle_size != ft->particle_size )
+    mcpl_error("unexpected particle size in transcoding");
+
+  unsigned nops = 0;
+  if ( lt->pol >= 0 ) {
+    if ( ls->pol >= 0 )
+      mcpl_internal_tcop_addfp( ops, &nops, ls, lt, ls->pol, lt->pol, 3 );
+    else
+      mcpl_internal_tcop_addfill( ops, &nops, lt, lt->pol, 3, 0.0 );
+  }
+  mcpl_internal_tcop_addfp( ops, &nops, ls, lt, ls->pos, lt->pos, 3 );
+  if ( ls->fpsize == (int)sizeof(float) && lt->fpsize == (int)sizeof(double) ) {
+    //Increasing precision requires full unpacking+repacking (as in
+    //mcpl_transfer_last_read_particle):
+    mcpl_internal_tcop_add( ops, &nops, MCPLIMP_TC_REPACKDIR,
+                            ls->packekindir, lt->packekindir, 3, 0.0 );
+  } else {
+    mcpl_internal_tcop_addfp( ops, &nops, ls, lt,
+                              ls->packekindir, lt->packekindir, 3 );
+  }
+  mcpl_internal_tcop_addfp( ops, &nops, ls, lt, ls->time, lt->time, 1 );
+  if ( lt->weight >= 0 ) {
+    if ( ls->weight >= 0 )
+      mcpl_internal_tcop_addfp( ops, &nops, ls, lt, ls->weight, lt->weight, 1 );
+    else
+      mcpl_internal_tcop_addfill( ops, &nops, lt, lt->weight, 1,
+                                  fs->opt_universalweight );
+  }
+  if ( lt->pdgcode >= 0 ) {
+    if ( ls->pdgcode >= 0 )
+      mcpl_internal_tcop_add( ops, &nops, MCPLIMP_TC_COPY,
+                              ls->pdgcode, lt->pdgcode, sizeof(int32_t), 0.0 );
+    else
+      mcpl_internal_tcop_add( ops, &nops, MCPLIMP_TC_FILLI32, -1, lt->pdgcode,
+                              1, (double)fs->opt_universalpdgcode );
+  }
+  if ( lt->userflags >= 0 ) {
+    if ( ls->userflags >= 0 )
+      mcpl_internal_tcop_add( ops, &nops, MCPLIMP_TC_COPY, ls->userflags,
+                              lt->userflags, sizeof(uint32_t), 0.0 );
+    else
+      mcpl_internal_tcop_add( ops, &nops, MCPLIMP_TC_FILLI32, -1,
+                              lt->userflags, 1, 0.0 );
+  }
+  return nops;
+}
+
+MCPL_LOCAL void mcpl_internal_tcop_repackdir( const char * src, char * dst )
+{
+  //Unpack as in mcpl_read and pack again as in
+  //mcpl_internal_serialise_particle_to_buffer:
+  double pack_ekindir[3];
+  double dir[3];
+  for ( unsigned i = 0; i < 3; ++i ) {
+    float v;
+    memcpy( &v, src + i * sizeof(float), sizeof(float) );
+    pack_ekindir[i] = v;
+  }
+  double ekin = fabs(pack_ekindir[2]);
+  pack_ekindir[2] = copysign(1.0,pack_ekindir[2]);
+  mcpl_unitvect_unpack_adaptproj(pack_ekindir,dir);
+  double dirsq = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+  if (fabs(dirsq-1.0)>1.0e-5)
+    mcpl_error("attempting to add particle with non-unit direction vector");
+  mcpl_unitvect_pack_adaptproj(dir,pack_ekindir);
+  pack_ekindir[2] = copysign(ekin,pack_ekindir[2]);
+  memcpy( dst, pack_ekindir, sizeof(pack_ekindir) );
+}
+
+MCPL_LOCAL void mcpl_internal_tcop_apply( const mcpl_internal_tcop_t * ops,
+                                          unsigned nops,
+                                          const char * src, unsigned src_size,
+                                          char * dst, unsigned dst_size,
+                                          unsigned nparticles )
+{
+  //Apply the operations one at a time to the entire block of particles, to
+  //keep the inner loops simple:
+  for ( unsigned iop = 0; iop < nops; ++iop ) {
+    const mcpl_internal_tcop_t * op = &ops[iop];
+    const char * s = src + op->src;
+    char * d = dst + op->dst;
+    const unsigned n = op->n;
+    unsigned ip, i;
+    switch ( op->type ) {
+    case MCPLIMP_TC_COPY:
+      for ( ip = 0; ip < nparticles; ++ip, s += src_size, d += dst_size )
+        memcpy( d, s, n );
+      break;
+    case MCPLIMP_TC_WIDEN:
+      for ( ip = 0; ip < nparticles; ++ip, s += src_size, d += dst_size ) {
+        for ( i = 0; i < n; ++i ) {
+          float v;
+          memcpy( &v, s + i * sizeof(float), sizeof(float) );
+          double dv = v;
+          memcpy( d + i * sizeof(double), &dv, sizeof(double) );
+        }
+      }
+      break;
+    case MCPLIMP_TC_NARROW:
+      for ( ip = 0; ip < nparticles; ++ip, s += src_size, d += dst_size ) {
+        for ( i = 0; i < n; ++i ) {
+          double v;
+          memcpy( &v, s + i * sizeof(double), sizeof(double) );
+          float fv = (float)v;
+          memcpy( d + i * sizeof(float), &fv, sizeof(float) );
+        }
+      }
+      break;
+    case MCPLIMP_TC_FILLF:
+      {
+        float fv = (float)op->fillval;
+        for ( ip = 0; ip < nparticles; ++ip, d += dst_size )
+          for ( i = 0; i < n; ++i )
+            memcpy( d + i * sizeof(float), &fv, sizeof(float) );
+      }
+      break;
+    case MCPLIMP_TC_FILLD:
+      for ( ip = 0; ip < nparticles; ++ip, d += dst_size )
+        for ( i = 0; i < n; ++i )
+          memcpy( d + i * sizeof(double), &op->fillval, sizeof(double) );
+      break;
+    case MCPLIMP_TC_FILLI32:
+      {
+        int32_t iv = (int32_t)op->fillval;
+        for ( ip = 0; ip < nparticles; ++ip, d += dst_size )
+          for ( i = 0; i < n; ++i )
+            memcpy( d + i * sizeof(int32_t), &iv, sizeof(int32_t) );
+      }
+      break;
+    case MCPLIMP_TC_REPACKDIR:
+      for ( ip = 0; ip < nparticles; ++ip, s += src_size, d += dst_size )
+        mcpl_internal_tcop_repackdir( s, d );
+      break;
+    default:
+      mcpl_error("logic error in transcoding");
+    }
+  }
+}
+
+//Transfer all remaining particles in source to target, by transcoding blocks of
+//raw particle records. Returns 0 without doing anything if this is not possible
+//(in which case the generic path must be used):
+MCPL_LOCAL int mcpl_internal_transcode_particles( mcpl_file_t source,
+                                                  mcpl_outfile_t target )
+{
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)source.internal;
+  mcpl_outfileinternal_t * ft = (mcpl_outfileinternal_t *)target.internal;
+  assert(fs);
+  assert(ft);
+
+  mcpl_internal_tcop_t ops[16];
+  mcpl_internal_layout_t ls, lt;
+  unsigned nops = mcpl_internal_tcop_prepare( fs, ft, ops, &ls, &lt );
+  if (!nops)
+    return 0;
+
+  //Blocks of up to 16384 particles (~1.5MB for the largest particle size):
+  const unsigned npbufsize = 16384;
+  char * srcbuf = mcpl_internal_malloc( (size_t)npbufsize * fs->particle_size );
+  char * dstbuf = mcpl_internal_malloc( (size_t)npbufsize * ft->particle_size );
+
+  mcpl_internal_write_raw_particles( ft, dstbuf, 0 );//ensure header is written
+  for (;;) {
+    unsigned np = mcpl_internal_read_raw_particles( fs, srcbuf, npbufsize );
+    if (!np)
+      break;
+    mcpl_internal_tcop_apply( ops, nops, srcbuf, fs->particle_size,
+                              dstbuf, ft->particle_size, np );
+    mcpl_internal_write_raw_particles( ft, dstbuf, np );
+  }
+
+  free(srcbuf);
+  free(dstbuf);
+  return 1;
+}
 
 mcpl_outfile_t mcpl_forcemerge_files( const char * file_output,
                                       unsigned nfiles,
@@ -2794,8 +3378,10 @@ mcpl_outfile_t mcpl_forcemerge_files( const char * file_output,
              " particle%s from file %s\n",
              np,(np==1?"":"s"),files[ifile]);
     mcpl_print(buf);
-    while ( mcpl_read(f) != 0 )
-      mcpl_transfer_last_read_particle(f, out);//lossless transfer when possible
+    if ( !mcpl_internal_transcode_particles( f, out ) ) {
+      while ( mcpl_read(f) != 0 )
+        mcpl_transfer_last_read_particle(f, out);//lossless transfer when possible
+    }
     mcpl_close_file(f);
   }
 
@@ -2810,8 +3396,6 @@ mcpl_outfile_t mcpl_forcemerge_files( const char * file_output,
   return out;
 }
 
-MCPL_LOCAL void mcpl_internal_delete_file( const char * filename );
-
 MCPL_LOCAL void mcpl_impl_stablesum_add( double* s1, double* s2, double x )
 {
   //Numerically stable summation, based on Neumaier's algorithm
@@ -3045,63 +3629,48 @@ void mcpl_merge(const char * file1, const char* file2)
 
 void mcpl_merge_inplace(const char * file1, const char* file2)
 {
+  const char * files[1];
+  files[0] = file2;
+  mcpl_merge_inplace_files( file1, 1, files );
+}
+
+void mcpl_merge_inplace_files( const char * file1,
+                               unsigned nfiles, const char ** files )
+{
+  if (!nfiles)
+    mcpl_error("mcpl_merge_inplace_files must be called with at least one"
+               " input file");
+
   {
     mcu8str file1_str = mcu8str_view_cstr( file1 );
-    mcu8str file2_str = mcu8str_view_cstr( file2 );
-    if ( mctools_is_same_file(&file1_str, &file2_str) )
-      mcpl_error("Merging file with itself");
+    for ( unsigned ifile = 0; ifile < nfiles; ++ifile ) {
+      mcu8str file2_str = mcu8str_view_cstr( files[ifile] );
+      if ( mctools_is_same_file(&file1_str, &file2_str) )
+        mcpl_error("Merging file with itself");
+    }
   }
 
   mcpl_file_t ff1 = mcpl_open_file(file1);
-  mcpl_file_t ff2 = mcpl_open_file(file2);
-  int can_merge = mcpl_actual_can_merge(ff1,ff2);
-  if (!can_merge) {
-    mcpl_close_file(ff1);
-    mcpl_close_file(ff2);
-    mcpl_error("Attempting to merge incompatible files");
-  }
-
-  //Access internals:
   mcpl_fileinternal_t * f1 = (mcpl_fileinternal_t *)ff1.internal;
-  mcpl_fileinternal_t * f2 = (mcpl_fileinternal_t *)ff2.internal;
   assert(f1);
-  assert(f2);
-
-  if (f1->format_version!=f2->format_version) {
-    mcpl_close_file(ff1);
-    mcpl_close_file(ff2);
-    mcpl_error("Attempting to merge incompatible files (can not mix"
-               " MCPL format versions when merging inplace)");
-  }
 
   if (f1->filegz) {
     mcpl_close_file(ff1);
-    mcpl_close_file(ff2);
     mcpl_error("direct modification of gzipped files is not supported.");
   }
 
   uint64_t np1 = f1->nparticles;
-  uint64_t np2 = f2->nparticles;
-  if (!np2) {
-    //nothing to take from file 2.
-    mcpl_close_file(ff1);
-    mcpl_close_file(ff2);
-    return;
-  }
-
   unsigned particle_size = f1->particle_size;
   uint64_t first_particle_pos = f1->first_particle_pos;
 
-  //Should be same since can_merge:
-  if ( particle_size != f2->particle_size
-       || first_particle_pos != f2->first_particle_pos )
-    mcpl_error("mcpl_merge_inplace: unexpected particle size or position");
-
-  //Collect information on any stat:sum entries needing to be updated
-  //post-merge:
+  //Collect information on any stat:sum entries in file1 needing to be updated
+  //post-merge. Values are kept in two doubles, s1 and s2, for use with
+  //stablesum (so the result is the same as with mcpl_merge_files):
 
   mcpl_internal_statsuminfo_t * statsuminfo = NULL;
-  double * statsuminfo_newvalues = NULL;
+  double * statsuminfo_s1 = NULL;
+  double * statsuminfo_s2 = NULL;
+  uint32_t * statsuminfo_icomment = NULL;
   uint32_t nssi = 0;
   {
     uint64_t next_comment_pos = f1->first_comment_pos;
@@ -3112,29 +3681,25 @@ void mcpl_merge_inplace(const char * file1, const char* file2)
       next_comment_pos += ( lcomment + sizeof(uint32_t) );
       if ( !MCPL_COMMENT_IS_STATSUM(comment) )
         continue;
-      mcpl_internal_statsum_t sc, sc2;
+      mcpl_internal_statsum_t sc;
       mcpl_internal_statsum_parse_or_emit_err( comment, &sc );
-      mcpl_internal_statsum_parse_or_emit_err( f2->comments[i], &sc2 );
       if (!statsuminfo) {
+        uint32_t nmax = f1->ncomments-i;
         statsuminfo = (mcpl_internal_statsuminfo_t *)
-          mcpl_internal_calloc( f1->ncomments-i,
-                                sizeof(mcpl_internal_statsuminfo_t) );
-        statsuminfo_newvalues = (double*) mcpl_internal_calloc( f1->ncomments-i,
-                                                                sizeof(double) );
+          mcpl_internal_calloc( nmax, sizeof(mcpl_internal_statsuminfo_t) );
+        statsuminfo_s1 = (double*) mcpl_internal_calloc( nmax, sizeof(double) );
+        statsuminfo_s2 = (double*) mcpl_internal_calloc( nmax, sizeof(double) );
+        statsuminfo_icomment = (uint32_t*) mcpl_internal_calloc( nmax,
+                                                                 sizeof(uint32_t) );
       }
       uint32_t idx = nssi++;
       mcpl_internal_statsuminfo_t * s = &statsuminfo[idx];
-      statsuminfo_newvalues[idx] = -1;
-      if ( sc.value != -1.0 && sc2.value != -1.0 ) {
-        statsuminfo_newvalues[idx] = sc.value + sc2.value;
-        if ( isinf(statsuminfo_newvalues[idx]) ) {
-          mcpl_print("MCPL WARNING: Merging files results in one or more"
-                     " stat:sum: entries overflowing floating point"
-                     " range and producing infinity. Reverting value to -1"
-                     " to indicate that a precise result is not available.\n");
-          statsuminfo_newvalues[idx] = -1.0;
-        }
-      }
+      if ( sc.value == -1.0 )
+        statsuminfo_s1[idx] = -1.0;
+      else
+        mcpl_impl_stablesum_add( statsuminfo_s1+idx, statsuminfo_s2+idx,
+                                 sc.value );
+      statsuminfo_icomment[idx] = i;
       memcpy( s->key, sc.key, strlen(sc.key) + 1 );
       if ( lcomment > (size_t)(UINT32_MAX) )
         mcpl_error("logic error: unexpected large stat:sum comment strlen");
@@ -3143,26 +3708,83 @@ void mcpl_merge_inplace(const char * file1, const char* file2)
     }
   }
 
+  //Check all input files for compatibility, and add up their stat:sum and
+  //nparticles values. Files are closed again immediately, in order to not have
+  //too many file handles open at once:
+  uint64_t * npinput = (uint64_t*) mcpl_internal_calloc( nfiles,
+                                                         sizeof(uint64_t) );
+  uint64_t np2 = 0;
+  for ( unsigned ifile = 0; ifile < nfiles; ++ifile ) {
+    mcpl_file_t ff2 = mcpl_open_file(files[ifile]);
+    mcpl_fileinternal_t * f2 = (mcpl_fileinternal_t *)ff2.internal;
+    assert(f2);
+    const char * errmsg = NULL;
+    if (!mcpl_actual_can_merge(ff1,ff2))
+      errmsg = "Attempting to merge incompatible files";
+    else if (f1->format_version!=f2->format_version)
+      errmsg = ( "Attempting to merge incompatible files (can not mix"
+                 " MCPL format versions when merging inplace)" );
+    else if ( particle_size != f2->particle_size
+              || first_particle_pos != f2->first_particle_pos )
+      errmsg = "mcpl_merge_inplace: unexpected particle size or position";
+    if ( errmsg ) {
+      mcpl_close_file(ff1);
+      mcpl_close_file(ff2);
+      mcpl_error(errmsg);
+    }
+    for ( uint32_t isc = 0; isc < nssi; ++isc ) {
+      if ( statsuminfo_s1[isc] == -1.0 && statsuminfo_s2[isc] == 0.0 )
+        continue;//-1 combines with anything to give -1
+      mcpl_internal_statsum_t sc2;
+      mcpl_internal_statsum_parse_or_emit_err( f2->comments[statsuminfo_icomment[isc]],
+                                               &sc2 );
+      if ( sc2.value == -1.0 ) {
+        statsuminfo_s1[isc] = -1.0;
+        statsuminfo_s2[isc] = 0.0;
+      } else {
+        mcpl_impl_stablesum_add( statsuminfo_s1+isc, statsuminfo_s2+isc,
+                                 sc2.value );
+      }
+    }
+    npinput[ifile] = f2->nparticles;
+    np2 += f2->nparticles;
+    mcpl_close_file(ff2);
+  }
+  free(statsuminfo_icomment);
+
+  if ( !np2 && !nssi ) {
+    //nothing to take from the input files.
+    mcpl_close_file(ff1);
+    free(npinput);
+    free(statsuminfo);
+    free(statsuminfo_s1);
+    free(statsuminfo_s2);
+    return;
+  }
+
   //Now, close file1 and reopen a file handle in append mode:
   mcpl_close_file(ff1);
   FILE * f1a = mcpl_internal_fopen(file1,"r+b");
 
-  //Update file positions. Note that f2->file is already at the position for the
-  //first particle and that the seek operation on f1a correctly discards any
-  //partial entries at the end, which could be there if the file was in need of
-  //mcpl_repair:
-  if (!f1a) {
+  //Update file positions. Note that the seek operation on f1a correctly
+  //discards any partial entries at the end, which could be there if the file
+  //was in need of mcpl_repair:
+  const char * errmsg = NULL;
+  uint64_t append_pos = first_particle_pos + particle_size*np1;
+  if (!f1a)
+    errmsg = "Unable to open file1 in update mode!";
+  else if (MCPL_FSEEK( f1a, append_pos ))
+    errmsg = "Unable to seek to end of file1 in update mode";
+  else if (!mcpl_internal_preallocate( f1a, append_pos, particle_size*np2 ))
+    errmsg = "Insufficient disk space for appending particles to file1";
+  if ( errmsg ) {
+    free(npinput);
     free(statsuminfo);
-    free(statsuminfo_newvalues);
-    mcpl_close_file(ff2);
-    mcpl_error("Unable to open file1 in update mode!");
-  }
-  if (MCPL_FSEEK( f1a, first_particle_pos + particle_size*np1 )) {
-    free(statsuminfo);
-    free(statsuminfo_newvalues);
-    mcpl_close_file(ff2);
-    fclose(f1a);
-    mcpl_error("Unable to seek to end of file1 in update mode");
+    free(statsuminfo_s1);
+    free(statsuminfo_s2);
+    if (f1a)
+      fclose(f1a);
+    mcpl_error(errmsg);
   }
 
   //Transfer particle contents, and update stat:sum: comments. We set nparticles
@@ -3173,39 +3795,59 @@ void mcpl_merge_inplace(const char * file1, const char* file2)
   fflush(f1a);
 
   //Set stat:sum entries to -1:
-  if ( nssi && statsuminfo && statsuminfo_newvalues ) {
-    for ( uint32_t i = 0; i < nssi; ++i ) {
-      char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
-      mcpl_internal_encodestatsum( statsuminfo[i].key, -1.0, new_comment );
-      mcpl_internal_updatestatsum( f1a, &statsuminfo[i], new_comment );
-      statsuminfo[i].value = -1.0;
-    }
+  for ( uint32_t i = 0; i < nssi; ++i ) {
+    char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
+    mcpl_internal_encodestatsum( statsuminfo[i].key, -1.0, new_comment );
+    mcpl_internal_updatestatsum( f1a, &statsuminfo[i], new_comment );
+    statsuminfo[i].value = -1.0;
   }
+
   //Transfer particles (potentially a lot of work and chance of running out of
   //quota, etc.):
-  mcpl_transfer_particle_contents(f1a, ff2, np2);
+  for ( unsigned ifile = 0; ifile < nfiles; ++ifile ) {
+    if ( !npinput[ifile] )
+      continue;
+    mcpl_file_t ff2 = mcpl_open_file(files[ifile]);
+    mcpl_fileinternal_t * f2 = (mcpl_fileinternal_t *)ff2.internal;
+    assert(f2);
+    if ( f2->nparticles != npinput[ifile] || f2->particle_size != particle_size )
+      mcpl_error("Aborting merge of suddenly modified input file.");
+    mcpl_transfer_particle_contents(f1a, ff2, npinput[ifile]);
+    mcpl_close_file(ff2);
+  }
 
   //Set stat:sum entries to final values:
-  if ( nssi && statsuminfo && statsuminfo_newvalues ) {
-    for ( uint32_t i = 0; i < nssi; ++i ) {
-      double newval = statsuminfo_newvalues[i];
-      if ( newval == -1.0 )
-        continue;//already fine
-      char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
-      mcpl_internal_encodestatsum( statsuminfo[i].key, newval, new_comment );
-      mcpl_internal_updatestatsum( f1a, &statsuminfo[i], new_comment );
-      statsuminfo[i].value = newval;
+  int warned_statsuminf = 0;
+  for ( uint32_t i = 0; i < nssi; ++i ) {
+    double newval = statsuminfo_s1[i] + statsuminfo_s2[i];
+    if ( newval == -1.0 )
+      continue;//already fine
+    if ( isinf(newval) ) {
+      if ( !warned_statsuminf ) {
+        warned_statsuminf = 1;
+        mcpl_print("MCPL WARNING: Merging files results in one or more"
+                   " stat:sum: entries overflowing floating point"
+                   " range and producing infinity. Reverting value to -1"
+                   " to indicate that a precise result is not available.\n");
+      }
+      continue;//leave at -1
     }
+    char new_comment[MCPL_STATSUMBUF_MAXLENGTH+1];
+    mcpl_internal_encodestatsum( statsuminfo[i].key, newval, new_comment );
+    mcpl_internal_updatestatsum( f1a, &statsuminfo[i], new_comment );
+    statsuminfo[i].value = newval;
   }
 
   //Finally we can update nparticles:
   mcpl_update_nparticles(f1a,np1+np2);
 
   //Finish up.
-  fclose(f1a);
-  mcpl_close_file(ff2);
+  if (fclose(f1a))
+    mcpl_error("Unexpected write-error while merging");
+  free(npinput);
   free(statsuminfo);
-  free(statsuminfo_newvalues);
+  free(statsuminfo_s1);
+  free(statsuminfo_s2);
 }
 
 #define MCPLIMP_TOOL_DEFAULT_NLIMIT 10
@@ -3267,6 +3909,24 @@ MCPL_LOCAL int mcpl_tool_usage( char** argv, const char * errmsg ) {
   snprintf(buf,nbuf,
            "  %s --repair FILE\n",progname);
   mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --sort KEYS [--threads=N] FILE1 FILE2\n",progname);
+  mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --sample K [--seed SEED] FILE1 FILE2\n",progname);
+  mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --rebalance-weights W [--seed SEED] [--threads=N] FILE1 FILE2\n",progname);
+  mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --stats [--threads=N] FILE\n",progname);
+  mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --index FILE\n",progname);
+  mcpl_print(buf);
+  snprintf(buf,nbuf,
+           "  %s --json-header FILE1 [FILE2 ...]\n",progname);
+  mcpl_print(buf);
   snprintf(buf,nbuf,
            "  %s --version\n",progname);
   mcpl_print(buf);
@@ -3308,14 +3968,79 @@ MCPL_LOCAL int mcpl_tool_usage( char** argv, const char * errmsg ) {
   mcpl_print("                    Extracts particles from FILE1 into a new FILE2.\n");
   mcpl_print("  -lN, -sN        : Select range of particles in FILE1 (as above).\n");
   mcpl_print("  -pPDGCODE       : Select particles of type given by PDGCODE.\n");
+  mcpl_print("  --where EXPR    : Select particles for which EXPR is true, for instance\n");
+  mcpl_print("                    --where \"pdgcode==2112 && ekin>1e-3 && z<0\". Available\n");
+  mcpl_print("                    fields are pdgcode, ekin, x, y, z, ux, uy, uz, time,\n");
+  mcpl_print("                    weight, polx, poly, polz, and userflags, which can be\n");
+  mcpl_print("                    combined with numbers, the operators + - * / == != < <=\n");
+  mcpl_print("                    > >= && || !, parentheses and abs(..).\n");
+  mcpl_print("  --threads=N     : Use N threads for decoding and selecting particles\n");
+  mcpl_print("                    (--threads=0 means one thread per available processor\n");
+  mcpl_print("                    core).\n");
+  mcpl_print("\n");
+  mcpl_print("Sort options:\n");
+  mcpl_print("  --sort KEYS FILE1 FILE2\n");
+  mcpl_print("                    Sorts particles from FILE1 into a new FILE2, by the comma\n");
+  mcpl_print("                    separated list of fields in KEYS (as for --where), for\n");
+  mcpl_print("                    instance \"pdgcode,ekin\". Prefix a field with - to sort\n");
+  mcpl_print("                    it in descending order. Files larger than 512MB are sorted\n");
+  mcpl_print("                    with temporary files next to FILE2. KEYS can also be\n");
+  mcpl_print("                    \"morton\" or \"hilbert\", to sort particles along a space-\n");
+  mcpl_print("                    filling curve through their positions, which also adds\n");
+  mcpl_print("                    a spatial index to FILE2 (for use with mcpl_query_box).\n");
+  mcpl_print("  --threads=N     : Use N threads for sorting (as above).\n");
+  mcpl_print("\n");
+  mcpl_print("Sample options:\n");
+  mcpl_print("  --sample K FILE1 FILE2\n");
+  mcpl_print("                    Selects K particles from FILE1 uniformly at random, and\n");
+  mcpl_print("                    writes them in their original order into a new FILE2.\n");
+  mcpl_print("                    Any stat:sum entries are scaled accordingly.\n");
+  mcpl_print("  --seed SEED     : Seed for the random selection (default 0). The same seed\n");
+  mcpl_print("                    always gives the same selection.\n");
+  mcpl_print("\n");
+  mcpl_print("Rebalance options:\n");
+  mcpl_print("  --rebalance-weights W FILE1 FILE2\n");
+  mcpl_print("                    Copies particles from FILE1 into a new FILE2, applying\n");
+  mcpl_print("                    Russian roulette to particles with weights below W\n");
+  mcpl_print("                    (keeping them with probability weight/W and weight W)\n");
+  mcpl_print("                    and splitting particles with weights above W into\n");
+  mcpl_print("                    copies of weight close to W. The expected total weight\n");
+  mcpl_print("                    is unchanged, so stat:sum entries are kept.\n");
+  mcpl_print("  --seed SEED     : Seed for the Russian roulette (as above).\n");
+  mcpl_print("  --threads=N     : Use N threads (as above). Results do not depend on N.\n");
+  mcpl_print("\n");
+  mcpl_print("Stats options:\n");
+  mcpl_print("  --stats FILE    : Print statistics summary of particle state data from FILE,\n");
+  mcpl_print("                    in a single pass through the file (same output as with\n");
+  mcpl_print("                    pymcpltool --stats).\n");
+  mcpl_print("  --threads=N     : Use N threads (as above). Results do not depend on N.\n");
   mcpl_print("\n");
   mcpl_print("Other options:\n");
   mcpl_print("  -r, --repair FILE\n");
   mcpl_print("                    Attempt to repair FILE which was not properly closed, by up-\n");
   mcpl_print("                    dating the file header with the correct number of particles.\n");
+  mcpl_print("  --index FILE\n");
+  mcpl_print("                    Create index file FILE.idx with the ranges of ekin, x, y, z,\n");
+  mcpl_print("                    time and weight, and the pdgcodes, in each block of 65536\n");
+  mcpl_print("                    particles in FILE. When extracting particles with -p or\n");
+  mcpl_print("                    --where, blocks without selected particles are then skipped.\n");
+  mcpl_print("                    The index must be recreated if FILE is modified.\n");
+  mcpl_print("  --json-header FILE1 [FILE2 ...]\n");
+  mcpl_print("                    Print header info (including stat:sum values and blob\n");
+  mcpl_print("                    sizes) of each file as a single line of JSON. Only the\n");
+  mcpl_print("                    header is read, making this suitable for scanning many\n");
+  mcpl_print("                    files.\n");
   mcpl_print("  -t, --text MCPLFILE OUTFILE\n");
   mcpl_print("                    Read particle contents of MCPLFILE and write into OUTFILE\n");
   mcpl_print("                    using a simple ASCII-based format.\n");
+  mcpl_print("  --from-text TEXTFILE MCPLFILE\n");
+  mcpl_print("                    Read particles from TEXTFILE in the ASCII-based format\n");
+  mcpl_print("                    written by --text, and write them into a new MCPLFILE.\n");
+  mcpl_print("                    Universal pdgcode and weight, polarisation, userflags and\n");
+  mcpl_print("                    double precision are enabled as needed by the contents.\n");
+  mcpl_print("  --threads=N     : Use N threads for formatting (--text) or parsing\n");
+  mcpl_print("                    (--from-text) particles (as above). The output does not\n");
+  mcpl_print("                    depend on N.\n");
   mcpl_print("  -v, --version   : Display version of MCPL installation.\n");
   mcpl_print("  -h, --help      : Display this usage information (ignores all other options).\n");
 
@@ -3380,10 +4105,17 @@ int mcpl_tool(int argc,char** argv) {
   char ** filenames = NULL;
   const char * blobkey = NULL;
   const char * pdgcode_str = NULL;
+  const char * where_str = NULL;
+  const char * sort_str = NULL;
+  const char * sample_str = NULL;
+  const char * seed_str = NULL;
+  const char * rebalance_str = NULL;
   int opt_justhead = 0;
+  int opt_stats = 0;
   int opt_nohead = 0;
   int64_t opt_num_limit = -1;
   int64_t opt_num_skip = -1;
+  int64_t opt_nthreads = -1;
   int opt_merge = 0;
   int opt_forcemerge = 0;
   int opt_keepuserflags = 0;
@@ -3391,8 +4123,11 @@ int mcpl_tool(int argc,char** argv) {
   int opt_extract = 0;
   int opt_preventcomment = 0;//undocumented unoffical flag for mcpl unit tests
   int opt_repair = 0;
+  int opt_index = 0;
+  int opt_jsonheader = 0;
   int opt_version = 0;
   int opt_text = 0;
+  int opt_fromtext = 0;
   int opt_fakeversion = 0;//undocumented unoffical flag for mcpl unit tests
 
   int i;
@@ -3477,14 +4212,31 @@ int mcpl_tool(int argc,char** argv) {
       const char * lo_nohead = "nohead";
       const char * lo_merge = "merge";
       const char * lo_inplace = "inplace";
+      const char * lo_index = "index";
+      const char * lo_jsonheader = "json-header";
       const char * lo_extract = "extract";
       const char * lo_preventcomment = "preventcomment";
       const char * lo_fakeversion = "fakeversion";
       const char * lo_repair = "repair";
       const char * lo_version = "version";
       const char * lo_text = "text";
+      const char * lo_fromtext = "from-text";
       const char * lo_forcemerge = "forcemerge";
       const char * lo_keepuserflags = "keepuserflags";
+      const char * lo_where = "where";
+      const char * lo_sort = "sort";
+      const char * lo_sample = "sample";
+      const char * lo_seed = "seed";
+      const char * lo_rebalance = "rebalance-weights";
+      const char * lo_stats = "stats";
+      //--threads=N takes its argument in the same word:
+      if (strncmp(a,"threads=",8)==0) {
+        if (opt_nthreads!=-1)
+          return free(filenames),mcpl_tool_usage(argv,"--threads specified more than once");
+        if (!mcpl_str2int(a+8,0,&opt_nthreads) || opt_nthreads<0)
+          return free(filenames),mcpl_tool_usage(argv,"Bad argument for --threads (expected number)");
+        continue;
+      }
       //Use strstr instead of "strcmp(a,"--help")==0" to support shortened
       //versions (works since all our long-opts start with unique char).
       if (strstr(lo_help,a)==lo_help) return free(filenames), mcpl_tool_usage(argv,0);
@@ -3494,12 +4246,51 @@ int mcpl_tool(int argc,char** argv) {
       else if (strstr(lo_forcemerge,a)==lo_forcemerge) opt_forcemerge = 1;
       else if (strstr(lo_keepuserflags,a)==lo_keepuserflags) opt_keepuserflags = 1;
       else if (strstr(lo_inplace,a)==lo_inplace) opt_inplace = 1;
+      else if (strstr(lo_index,a)==lo_index) opt_index = 1;
+      else if (strstr(lo_jsonheader,a)==lo_jsonheader) opt_jsonheader = 1;
       else if (strstr(lo_extract,a)==lo_extract) opt_extract = 1;
       else if (strstr(lo_repair,a)==lo_repair) opt_repair = 1;
+      else if (strstr(lo_rebalance,a)==lo_rebalance) {
+        if (rebalance_str)
+          return free(filenames),mcpl_tool_usage(argv,"--rebalance-weights specified more than once");
+        if (i+1==argc)
+          return free(filenames),mcpl_tool_usage(argv,"Missing argument for --rebalance-weights");
+        rebalance_str = argv[++i];
+      }
       else if (strstr(lo_version,a)==lo_version) opt_version = 1;
       else if (strstr(lo_preventcomment,a)==lo_preventcomment) opt_preventcomment = 1;
       else if (strstr(lo_fakeversion,a)==lo_fakeversion) opt_fakeversion = 1;
       else if (strstr(lo_text,a)==lo_text) opt_text = 1;
+      else if (strstr(lo_fromtext,a)==lo_fromtext) opt_fromtext = 1;
+      else if (strstr(lo_stats,a)==lo_stats) opt_stats = 1;
+      else if (strstr(lo_where,a)==lo_where) {
+        if (where_str)
+          return free(filenames),mcpl_tool_usage(argv,"--where specified more than once");
+        if (i+1==argc)
+          return free(filenames),mcpl_tool_usage(argv,"Missing argument for --where");
+        where_str = argv[++i];
+      }
+      else if (strstr(lo_sort,a)==lo_sort) {
+        if (sort_str)
+          return free(filenames),mcpl_tool_usage(argv,"--sort specified more than once");
+        if (i+1==argc)
+          return free(filenames),mcpl_tool_usage(argv,"Missing argument for --sort");
+        sort_str = argv[++i];
+      }
+      else if (strstr(lo_sample,a)==lo_sample) {
+        if (sample_str)
+          return free(filenames),mcpl_tool_usage(argv,"--sample specified more than once");
+        if (i+1==argc)
+          return free(filenames),mcpl_tool_usage(argv,"Missing argument for --sample");
+        sample_str = argv[++i];
+      }
+      else if (strstr(lo_seed,a)==lo_seed) {
+        if (seed_str)
+          return free(filenames),mcpl_tool_usage(argv,"--seed specified more than once");
+        if (i+1==argc)
+          return free(filenames),mcpl_tool_usage(argv,"Missing argument for --seed");
+        seed_str = argv[++i];
+      }
       else return free(filenames),mcpl_tool_usage(argv,"Unrecognised option");
     } else if (n>=1&&a[0]!='-') {
       //input file
@@ -3518,6 +4309,18 @@ int mcpl_tool(int argc,char** argv) {
   if ( opt_extract==0 && pdgcode_str )
     return free(filenames),mcpl_tool_usage(argv,"-p can only be used with --extract.");
 
+  if ( opt_extract==0 && where_str )
+    return free(filenames),mcpl_tool_usage(argv,"--where can only be used with --extract.");
+
+  if ( opt_extract==0 && sort_str==0 && rebalance_str==0 && opt_stats==0 && opt_text==0 && opt_fromtext==0 && opt_nthreads!=-1 )
+    return free(filenames),mcpl_tool_usage(argv,"--threads can only be used with --extract, --sort, --rebalance-weights, --stats, --text or --from-text.");
+
+  if ( sample_str==0 && rebalance_str==0 && seed_str )
+    return free(filenames),mcpl_tool_usage(argv,"--seed can only be used with --sample or --rebalance-weights.");
+
+  if ( opt_nthreads > MCPLIMP_MAX_NTHREADS )
+    return free(filenames),mcpl_tool_usage(argv,"Number of threads requested with --threads is too large.");
+
   if ( opt_merge==0 && opt_inplace!=0 )
     return free(filenames),mcpl_tool_usage(argv,"--inplace can only be used with --merge.");
 
@@ -3531,10 +4334,13 @@ int mcpl_tool(int argc,char** argv) {
   if (opt_extract==0)
     number_dumpopts += (opt_num_limit!=-1) + (opt_num_skip!=-1);
   int any_dumpopts = number_dumpopts != 0;
-  int any_extractopts = (opt_extract!=0||pdgcode_str!=0);
+  int any_extractopts = (opt_extract!=0||pdgcode_str!=0||where_str!=0);
   int any_mergeopts = (opt_merge!=0||opt_forcemerge!=0);
-  int any_textopts = (opt_text!=0);
-  if (any_dumpopts+any_mergeopts+any_extractopts+any_textopts+opt_repair+opt_version>1)
+  int any_textopts = (opt_text!=0) + (opt_fromtext!=0);
+  int any_sortopts = (sort_str!=0);
+  int any_sampleopts = (sample_str!=0);
+  int any_rebalanceopts = (rebalance_str!=0);
+  if (any_dumpopts+any_mergeopts+any_extractopts+any_textopts+any_sortopts+any_sampleopts+any_rebalanceopts+opt_stats+opt_repair+opt_index+opt_jsonheader+opt_version>1)
     return free(filenames),mcpl_tool_usage(argv,"Conflicting options specified.");
 
   if (blobkey&&(number_dumpopts>1))
@@ -3552,6 +4358,15 @@ int mcpl_tool(int argc,char** argv) {
     return 0;
   }
 
+  if (opt_jsonheader) {
+    if (!nfilenames)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify input file(s) with --json-header.");
+    for (i = 0; i < nfilenames; ++i)
+      mcpl_internal_print_json_header(filenames[i]);
+    free(filenames);
+    return 0;
+  }
+
   if (any_mergeopts) {
 
     if (nfilenames<2)
@@ -3568,11 +4383,9 @@ int mcpl_tool(int argc,char** argv) {
     if (opt_inplace) {
       if ( ! ( !opt_forcemerge && opt_merge) )
         mcpl_error("logic error in argument parsing");
-      //Note that if there are more than two files merged this way, that we do
-      //not get the same stablesum combination of stat:sum: values as with
-      //mcpl_merge_files!
-      for (i = ifirstinfile+1; i < nfilenames; ++i)
-        mcpl_merge_inplace(filenames[ifirstinfile],filenames[i]);
+      mcpl_merge_inplace_files( filenames[ifirstinfile],
+                                nfilenames-(ifirstinfile+1),
+                                (const char**)filenames + ifirstinfile + 1 );
     } else {
       if (mcpl_file_certainly_exists(filenames[0]))
         return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
@@ -3622,6 +4435,16 @@ int mcpl_tool(int argc,char** argv) {
     if (mcpl_file_certainly_exists(filenames[1]))
       return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
 
+    mcpl_internal_filter_t filter;
+    filter.ncode = 0;
+    filter.stacksize = 0;
+    filter.fieldmask = 0;
+    if (where_str) {
+      char errmsg[512];
+      if (!mcpl_internal_filter_compile(where_str, &filter, errmsg, sizeof(errmsg)))
+        return free(filenames),mcpl_tool_usage(argv,errmsg);
+    }
+
     mcpl_file_t fi = mcpl_open_file(filenames[0]);
     mcpl_outfile_t fo = mcpl_create_outfile(filenames[1]);
     mcpl_transfer_metadata(fi, fo);
@@ -3634,12 +4457,11 @@ int mcpl_tool(int argc,char** argv) {
       mcpl_hdr_add_comment(fo,comment);
     }
 
-    int32_t pdgcode_select = 0;
     if (pdgcode_str) {
       int64_t pdgcode64;
       if (!mcpl_str2int(pdgcode_str, 0, &pdgcode64) || -pdgcode64>2147483648 || pdgcode64>2147483647 || !pdgcode64)
         return free(filenames),mcpl_tool_usage(argv,"Must specify non-zero 32bit integer as argument to -p.");
-      pdgcode_select = (int32_t)pdgcode64;
+      mcpl_internal_filter_add_pdgcode_select(&filter, (int32_t)pdgcode64);
     }
 
     if ( fi_nparticles > 0
@@ -3671,19 +4493,13 @@ int mcpl_tool(int argc,char** argv) {
 
     //uint64_t(-1) instead of UINT64_MAX to fix clang c++98 compilation
     uint64_t left = opt_num_limit>0 ? (uint64_t)opt_num_limit : (uint64_t)-1;
-    uint64_t added = 0;
-
-    //Writing the next loop in an annoying way to silence MSVC C4706 warning:
-    for (;left;) {
-      --left;
-      const mcpl_particle_t* particle = mcpl_read(fi);
-      if (!particle)
-        break;
-      if (pdgcode_select && pdgcode_select!= particle->pdgcode)
-        continue;
-      mcpl_transfer_last_read_particle(fi, fo);
-      ++added;
-    }
+    unsigned nthreads = mcpl_internal_resolve_nthreads( opt_nthreads == -1
+                                                        ? 1
+                                                        : (unsigned)opt_nthreads );
+    uint64_t added = mcpl_internal_extract_particles( fi, fo, left,
+                                                      ( filter.ncode
+                                                        ? &filter : NULL ),
+                                                      nthreads );
 
     const char * outfile_fn = mcpl_outfile_filename(fo);
     size_t nn = strlen(outfile_fn);
@@ -3711,6 +4527,194 @@ int mcpl_tool(int argc,char** argv) {
     return 0;
   }
 
+  if (sort_str) {
+    if (nfilenames>2)
+      return free(filenames),mcpl_tool_usage(argv,"Too many arguments.");
+
+    if (nfilenames!=2)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify both input and output files with --sort.");
+
+    if (mcpl_file_certainly_exists(filenames[1]))
+      return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
+
+    mcpl_internal_sortspec_t spec;
+    char errmsg[256];
+    if (!mcpl_internal_sortspec_parse(sort_str, &spec, errmsg, sizeof(errmsg)))
+      return free(filenames),mcpl_tool_usage(argv,errmsg);
+
+    unsigned nthreads = ( opt_nthreads == -1 ? 1 : (unsigned)opt_nthreads );
+    mcpl_outfile_t fo = mcpl_sort_file( filenames[0], filenames[1], sort_str,
+                                        nthreads, 0 );
+    uint64_t nsorted = ((mcpl_outfileinternal_t *)fo.internal)->nparticles;
+
+    const char * outfile_fn = mcpl_outfile_filename(fo);
+    size_t nn = strlen(outfile_fn);
+    char *fo_filename = mcpl_internal_malloc(nn+4);
+    memcpy(fo_filename,outfile_fn,nn+1);
+    if (mcpl_closeandgzip_outfile(fo))
+      memcpy(fo_filename+nn,".gz",4);
+
+    char buf[256];
+    snprintf(buf,sizeof(buf),
+             "MCPL: Successfully sorted %" PRIu64 " particles from ",nsorted);
+    mcpl_print(buf);
+    mcpl_print(filenames[0]);
+    mcpl_print(" into ");
+    mcpl_print(fo_filename);
+    mcpl_print("\n");
+    free(fo_filename);
+    free(filenames);
+    return 0;
+  }
+
+  if (sample_str) {
+    if (nfilenames>2)
+      return free(filenames),mcpl_tool_usage(argv,"Too many arguments.");
+
+    if (nfilenames!=2)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify both input and output files with --sample.");
+
+    int64_t nsample, seed = 0;
+    if (!mcpl_str2int(sample_str, 0, &nsample) || nsample<=0)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify positive integer as argument to --sample.");
+    if (seed_str && (!mcpl_str2int(seed_str, 0, &seed) || seed<0))
+      return free(filenames),mcpl_tool_usage(argv,"Must specify non-negative integer as argument to --seed.");
+
+    if (mcpl_file_certainly_exists(filenames[1]))
+      return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
+
+    mcpl_file_t fi = mcpl_open_file(filenames[0]);
+    uint64_t fi_nparticles = mcpl_hdr_nparticles(fi);
+    mcpl_close_file(fi);
+
+    mcpl_outfile_t fo = mcpl_sample_file( filenames[0], filenames[1],
+                                          (uint64_t)nsample, (uint64_t)seed );
+    uint64_t nsampled = ((mcpl_outfileinternal_t *)fo.internal)->nparticles;
+
+    const char * outfile_fn = mcpl_outfile_filename(fo);
+    size_t nn = strlen(outfile_fn);
+    char *fo_filename = mcpl_internal_malloc(nn+4);
+    memcpy(fo_filename,outfile_fn,nn+1);
+    if (mcpl_closeandgzip_outfile(fo))
+      memcpy(fo_filename+nn,".gz",4);
+
+    char buf[256];
+    snprintf(buf,sizeof(buf),
+             "MCPL: Successfully sampled %" PRIu64 " / %" PRIu64 " particles from ",
+             nsampled, fi_nparticles);
+    mcpl_print(buf);
+    mcpl_print(filenames[0]);
+    mcpl_print(" into ");
+    mcpl_print(fo_filename);
+    mcpl_print("\n");
+    free(fo_filename);
+    free(filenames);
+    return 0;
+  }
+
+  if (rebalance_str) {
+    if (nfilenames>2)
+      return free(filenames),mcpl_tool_usage(argv,"Too many arguments.");
+
+    if (nfilenames!=2)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify both input and output files with --rebalance-weights.");
+
+    char * str_end;
+    double target_weight = strtod(rebalance_str, &str_end);
+    if (str_end==rebalance_str || *str_end || !(target_weight>0.0) || isinf(target_weight))
+      return free(filenames),mcpl_tool_usage(argv,"Must specify positive number as argument to --rebalance-weights.");
+    int64_t seed = 0;
+    if (seed_str && (!mcpl_str2int(seed_str, 0, &seed) || seed<0))
+      return free(filenames),mcpl_tool_usage(argv,"Must specify non-negative integer as argument to --seed.");
+
+    if (mcpl_file_certainly_exists(filenames[1]))
+      return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
+
+    mcpl_file_t fi = mcpl_open_file(filenames[0]);
+    uint64_t fi_nparticles = mcpl_hdr_nparticles(fi);
+    mcpl_close_file(fi);
+
+    unsigned nthreads = ( opt_nthreads == -1 ? 1 : (unsigned)opt_nthreads );
+    mcpl_outfile_t fo = mcpl_rebalance_weights( filenames[0], filenames[1],
+                                                target_weight, (uint64_t)seed,
+                                                nthreads );
+    uint64_t nout = ((mcpl_outfileinternal_t *)fo.internal)->nparticles;
+
+    const char * outfile_fn = mcpl_outfile_filename(fo);
+    size_t nn = strlen(outfile_fn);
+    char *fo_filename = mcpl_internal_malloc(nn+4);
+    memcpy(fo_filename,outfile_fn,nn+1);
+    if (mcpl_closeandgzip_outfile(fo))
+      memcpy(fo_filename+nn,".gz",4);
+
+    char buf[256];
+    snprintf(buf,sizeof(buf),
+             "MCPL: Successfully rebalanced weights of %" PRIu64 " particles from ",
+             fi_nparticles);
+    mcpl_print(buf);
+    mcpl_print(filenames[0]);
+    snprintf(buf,sizeof(buf)," into %" PRIu64 " particles in ",nout);
+    mcpl_print(buf);
+    mcpl_print(fo_filename);
+    mcpl_print("\n");
+    free(fo_filename);
+    free(filenames);
+    return 0;
+  }
+
+  if (opt_stats) {
+    if (nfilenames>1)
+      return free(filenames),mcpl_tool_usage(argv,"Too many arguments.");
+
+    if (nfilenames!=1)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify input file with --stats.");
+
+    unsigned nthreads = ( opt_nthreads == -1 ? 1 : (unsigned)opt_nthreads );
+    mcpl_stats_t stats = mcpl_collect_stats( filenames[0], nthreads );
+    if (!stats.nparticles) {
+      mcpl_free_stats( &stats );
+      return free(filenames),mcpl_tool_usage(argv,"Can not calculate statistics for an empty file.");
+    }
+    mcpl_dump_stats( &stats );
+    mcpl_free_stats( &stats );
+    free(filenames);
+    return 0;
+  }
+
+  if (opt_fromtext) {
+
+    if (nfilenames>2)
+      return free(filenames),mcpl_tool_usage(argv,"Too many arguments.");
+
+    if (nfilenames!=2)
+      return free(filenames),mcpl_tool_usage(argv,"Must specify both input and output files with --from-text.");
+
+    if (mcpl_file_certainly_exists(filenames[1]))
+      return free(filenames),mcpl_tool_usage(argv,"Requested output file already exists.");
+
+    unsigned nthreads = ( opt_nthreads == -1 ? 1 : (unsigned)opt_nthreads );
+    mcpl_outfile_t fo = mcpl_internal_read_text( filenames[0], filenames[1], nthreads );
+    uint64_t nout = ((mcpl_outfileinternal_t *)fo.internal)->nparticles;
+
+    const char * outfile_fn = mcpl_outfile_filename(fo);
+    size_t nn = strlen(outfile_fn);
+    char *fo_filename = mcpl_internal_malloc(nn+4);
+    memcpy(fo_filename,outfile_fn,nn+1);
+    if (mcpl_closeandgzip_outfile(fo))
+      memcpy(fo_filename+nn,".gz",4);
+
+    char buf[256];
+    snprintf(buf,sizeof(buf),"MCPL: Successfully converted %" PRIu64 " particles from ",nout);
+    mcpl_print(buf);
+    mcpl_print(filenames[0]);
+    mcpl_print(" into ");
+    mcpl_print(fo_filename);
+    mcpl_print("\n");
+    free(fo_filename);
+    free(filenames);
+    return 0;
+  }
+
   if (opt_text) {
 
     if (nfilenames>2)
@@ -3730,24 +4734,8 @@ int mcpl_tool(int argc,char** argv) {
       return mcpl_tool_usage(argv,"Could not open output file.");
     }
 
-    fprintf(fout,"#MCPL-ASCII\n#ASCII-FORMAT: v1\n#NPARTICLES: %" PRIu64 "\n#END-HEADER\n",mcpl_hdr_nparticles(fi));
-    fprintf(fout,"index     pdgcode               ekin[MeV]                   x[cm]          "
-            "         y[cm]                   z[cm]                      ux                  "
-            "    uy                      uz                time[ms]                  weight  "
-            "                 pol-x                   pol-y                   pol-z  userflags\n");
-    //Writing the next loop in an annoying way to silence MSVC C4706 warning:
-    while (1) {
-      const mcpl_particle_t* p = mcpl_read(fi);
-      if (!p)
-        break;
-      uint64_t idx = mcpl_currentposition(fi)-1;//-1 since mcpl_read skipped ahead
-      fprintf( fout,"%5" PRIu64
-               " %11i %23.18g %23.18g %23.18g %23.18g %23.18g %23.18g %23.18g"
-               " %23.18g %23.18g %23.18g %23.18g %23.18g 0x%08x\n",
-               idx,p->pdgcode,p->ekin,p->position[0],p->position[1],p->position[2],
-               p->direction[0],p->direction[1],p->direction[2],p->time,p->weight,
-               p->polarisation[0],p->polarisation[1],p->polarisation[2],p->userflags);
-    }
+    mcpl_internal_write_text( fi, fout,
+                              ( opt_nthreads == -1 ? 1 : (unsigned)opt_nthreads ) );
     fclose(fout);
     mcpl_close_file(fi);
     free(filenames);
@@ -3766,6 +4754,12 @@ int mcpl_tool(int argc,char** argv) {
     return 0;
   }
 
+  if (opt_index) {
+    mcpl_create_index(filenames[0]);
+    free(filenames);
+    return 0;
+  }
+
   //Dump mode:
   if (blobkey) {
     mcpl_file_t mcplfile = mcpl_open_file(filenames[0]);
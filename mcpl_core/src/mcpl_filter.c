@@ -0,0 +1,615 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Compilation and evaluation of particle filter expressions (as used by
+//mcpltool --where and mcpl_set_filter).
+
+#include "mcpl_internal.h"
+
+//Particle filter expressions, like "pdgcode==2112 && ekin>1e-3 && z<0", which
+//are compiled into a small stack-based bytecode program and evaluated on
+//entire blocks of particles at a time (with the particle fields decoded into
+//columns).
+
+MCPL_LOCAL const char * mcpl_internal_field_name( mcpl_internal_field_t fld )
+{
+  static const char * names[MCPLIMP_NFIELDS] = { "pdgcode", "ekin",
+                                                 "x", "y", "z",
+                                                 "ux", "uy", "uz",
+                                                 "time", "weight",
+                                                 "polx", "poly", "polz",
+                                                 "userflags" };
+  return names[fld];
+}
+
+//Field with given name (or one of a few shorter aliases), or -1 if unknown:
+MCPL_LOCAL int mcpl_internal_field_lookup( const char * c, size_t n )
+{
+  static const char * aliases[4][2] = { { "pdg", "pdgcode" },
+                                        { "t", "time" },
+                                        { "w", "weight" },
+                                        { "uf", "userflags" } };
+  char name[16];
+  if ( n >= sizeof(name) )
+    return -1;
+  memcpy( name, c, n );
+  name[n] = '\0';
+  for ( unsigned ia = 0; ia < 4; ++ia )
+    if ( strcmp( name, aliases[ia][0] ) == 0 )
+      memcpy( name, aliases[ia][1], strlen(aliases[ia][1]) + 1 );
+  for ( int ifld = 0; ifld < MCPLIMP_NFIELDS; ++ifld )
+    if ( strcmp( name, mcpl_internal_field_name((mcpl_internal_field_t)ifld) ) == 0 )
+      return ifld;
+  return -1;
+}
+
+typedef struct MCPL_LOCAL {
+  const char * expr;
+  const char * pos;
+  mcpl_internal_filter_t * flt;
+  unsigned depth;
+  char errmsg[256];
+} mcpl_internal_fltparser_t;
+
+MCPL_LOCAL void mcpl_internal_fltparser_err( mcpl_internal_fltparser_t * p,
+                                             const char * msg )
+{
+  if ( p->errmsg[0] )
+    return;//keep first error
+  snprintf( p->errmsg, sizeof(p->errmsg),
+            "Invalid filter expression (%s at position %i).",
+            msg, (int)(p->pos - p->expr) + 1 );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_emit( mcpl_internal_fltparser_t * p,
+                                              mcpl_internal_fop_t op,
+                                              mcpl_internal_field_t field,
+                                              double value )
+{
+  mcpl_internal_filter_t * flt = p->flt;
+  if ( flt->ncode + 4 >= MCPLIMP_FILTER_MAXCODE ) {//leave room for -p
+    mcpl_internal_fltparser_err( p, "expression too long" );
+    return;
+  }
+  mcpl_internal_fltinstr_t * instr = &flt->code[flt->ncode++];
+  instr->op = op;
+  instr->field = field;
+  instr->value = value;
+  if ( op == MCPLIMP_FOP_FIELD || op == MCPLIMP_FOP_CONST ) {
+    if ( ++(p->depth) > flt->stacksize )
+      flt->stacksize = p->depth;
+    if ( op == MCPLIMP_FOP_FIELD )
+      flt->fieldmask |= ( 1u << field );
+  } else if ( op >= MCPLIMP_FOP_ADD ) {
+    --(p->depth);//binary operator
+  }
+}
+
+MCPL_LOCAL int mcpl_internal_fltparser_accept( mcpl_internal_fltparser_t * p,
+                                               const char * token )
+{
+  while ( *p->pos == ' ' || *p->pos == '\t' )
+    ++(p->pos);
+  size_t n = strlen(token);
+  if ( strncmp( p->pos, token, n ) != 0 )
+    return 0;
+  //Do not mistake "<=" for "<", "!=" for "!", etc.:
+  if ( n == 1 && ( token[0]=='<' || token[0]=='>' || token[0]=='!' )
+       && p->pos[1] == '=' )
+    return 0;
+  p->pos += n;
+  return 1;
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_or( mcpl_internal_fltparser_t * p );
+
+MCPL_LOCAL void mcpl_internal_fltparser_primary( mcpl_internal_fltparser_t * p )
+{
+  if ( p->errmsg[0] )
+    return;
+  if ( mcpl_internal_fltparser_accept( p, "(" ) ) {
+    mcpl_internal_fltparser_or( p );
+    if ( !mcpl_internal_fltparser_accept( p, ")" ) )
+      mcpl_internal_fltparser_err( p, "expected \")\"" );
+    return;
+  }
+  const char * c = p->pos;
+  if ( ( *c >= '0' && *c <= '9' ) || *c == '.' ) {
+    char * endptr = NULL;
+    double value = strtod( c, &endptr );
+    if ( endptr == c ) {
+      mcpl_internal_fltparser_err( p, "invalid number" );
+      return;
+    }
+    p->pos = endptr;
+    mcpl_internal_fltparser_emit( p, MCPLIMP_FOP_CONST,
+                                  MCPLIMP_FLD_PDGCODE, value );
+    return;
+  }
+  size_t n = 0;
+  while ( ( c[n] >= 'a' && c[n] <= 'z' ) || ( c[n] >= 'A' && c[n] <= 'Z' )
+          || ( n && c[n] >= '0' && c[n] <= '9' ) || c[n] == '_' )
+    ++n;
+  if ( !n ) {
+    mcpl_internal_fltparser_err( p, *c ? "unexpected character"
+                                 : "unexpected end of expression" );
+    return;
+  }
+  if ( n == 3 && strncmp( c, "abs", 3 ) == 0 ) {
+    p->pos += n;
+    if ( !mcpl_internal_fltparser_accept( p, "(" ) ) {
+      mcpl_internal_fltparser_err( p, "expected \"(\"" );
+      return;
+    }
+    mcpl_internal_fltparser_or( p );
+    if ( !mcpl_internal_fltparser_accept( p, ")" ) )
+      mcpl_internal_fltparser_err( p, "expected \")\"" );
+    mcpl_internal_fltparser_emit( p, MCPLIMP_FOP_ABS, MCPLIMP_FLD_PDGCODE, 0.0 );
+    return;
+  }
+  int ifld = mcpl_internal_field_lookup( c, n );
+  if ( ifld < 0 ) {
+    mcpl_internal_fltparser_err( p, "unknown field name" );
+    return;
+  }
+  p->pos += n;
+  mcpl_internal_fltparser_emit( p, MCPLIMP_FOP_FIELD,
+                                (mcpl_internal_field_t)ifld, 0.0 );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_unary( mcpl_internal_fltparser_t * p )
+{
+  if ( p->errmsg[0] )
+    return;
+  if ( mcpl_internal_fltparser_accept( p, "-" ) ) {
+    mcpl_internal_fltparser_unary( p );
+    mcpl_internal_fltparser_emit( p, MCPLIMP_FOP_NEG, MCPLIMP_FLD_PDGCODE, 0.0 );
+  } else if ( mcpl_internal_fltparser_accept( p, "!" ) ) {
+    mcpl_internal_fltparser_unary( p );
+    mcpl_internal_fltparser_emit( p, MCPLIMP_FOP_NOT, MCPLIMP_FLD_PDGCODE, 0.0 );
+  } else if ( mcpl_internal_fltparser_accept( p, "+" ) ) {
+    mcpl_internal_fltparser_unary( p );
+  } else {
+    mcpl_internal_fltparser_primary( p );
+  }
+}
+
+//Generic parsing of left-associative binary operators, with the operators and
+//corresponding opcodes given in a list:
+MCPL_LOCAL void mcpl_internal_fltparser_binary( mcpl_internal_fltparser_t * p,
+                                                void(*operand)(mcpl_internal_fltparser_t*),
+                                                unsigned nops,
+                                                const char ** tokens,
+                                                const mcpl_internal_fop_t * ops )
+{
+  (*operand)( p );
+  while ( !p->errmsg[0] ) {
+    unsigned i;
+    for ( i = 0; i < nops; ++i )
+      if ( mcpl_internal_fltparser_accept( p, tokens[i] ) )
+        break;
+    if ( i == nops )
+      return;
+    (*operand)( p );
+    mcpl_internal_fltparser_emit( p, ops[i], MCPLIMP_FLD_PDGCODE, 0.0 );
+  }
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_mul( mcpl_internal_fltparser_t * p )
+{
+  static const char * tokens[2] = { "*", "/" };
+  static const mcpl_internal_fop_t ops[2] = { MCPLIMP_FOP_MUL, MCPLIMP_FOP_DIV };
+  mcpl_internal_fltparser_binary( p, mcpl_internal_fltparser_unary, 2, tokens, ops );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_add( mcpl_internal_fltparser_t * p )
+{
+  static const char * tokens[2] = { "+", "-" };
+  static const mcpl_internal_fop_t ops[2] = { MCPLIMP_FOP_ADD, MCPLIMP_FOP_SUB };
+  mcpl_internal_fltparser_binary( p, mcpl_internal_fltparser_mul, 2, tokens, ops );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_cmp( mcpl_internal_fltparser_t * p )
+{
+  //NB: Order matters ("<=" must be tried before "<"):
+  static const char * tokens[6] = { "==", "!=", "<=", ">=", "<", ">" };
+  static const mcpl_internal_fop_t ops[6] = { MCPLIMP_FOP_EQ, MCPLIMP_FOP_NE,
+                                              MCPLIMP_FOP_LE, MCPLIMP_FOP_GE,
+                                              MCPLIMP_FOP_LT, MCPLIMP_FOP_GT };
+  mcpl_internal_fltparser_binary( p, mcpl_internal_fltparser_add, 6, tokens, ops );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_and( mcpl_internal_fltparser_t * p )
+{
+  static const char * tokens[1] = { "&&" };
+  static const mcpl_internal_fop_t ops[1] = { MCPLIMP_FOP_AND };
+  mcpl_internal_fltparser_binary( p, mcpl_internal_fltparser_cmp, 1, tokens, ops );
+}
+
+MCPL_LOCAL void mcpl_internal_fltparser_or( mcpl_internal_fltparser_t * p )
+{
+  static const char * tokens[1] = { "||" };
+  static const mcpl_internal_fop_t ops[1] = { MCPLIMP_FOP_OR };
+  mcpl_internal_fltparser_binary( p, mcpl_internal_fltparser_and, 1, tokens, ops );
+}
+
+//Compile expression into flt. Returns 1 on success, and 0 in case of errors (in
+//which case a message is placed in errmsg):
+MCPL_LOCAL int mcpl_internal_filter_compile( const char * expr,
+                                             mcpl_internal_filter_t * flt,
+                                             char * errmsg, size_t lerrmsg )
+{
+  mcpl_internal_fltparser_t p;
+  p.expr = expr;
+  p.pos = expr;
+  p.flt = flt;
+  p.depth = 0;
+  p.errmsg[0] = '\0';
+  flt->ncode = 0;
+  flt->stacksize = 0;
+  flt->fieldmask = 0;
+  mcpl_internal_fltparser_or( &p );
+  while ( *p.pos == ' ' || *p.pos == '\t' )
+    ++p.pos;
+  if ( *p.pos )
+    mcpl_internal_fltparser_err( &p, "unexpected trailing characters" );
+  if ( p.errmsg[0] ) {
+    snprintf( errmsg, lerrmsg, "%s", p.errmsg );
+    return 0;
+  }
+  assert( p.depth == 1 );
+  return 1;
+}
+
+MCPL_LOCAL void mcpl_internal_filtereval_init( mcpl_internal_filtereval_t * e,
+                                               const mcpl_internal_filter_t * flt,
+                                               unsigned blocksize )
+{
+  e->blocksize = blocksize;
+  for ( int ifld = 0; ifld < MCPLIMP_NFIELDS; ++ifld )
+    e->cols[ifld] = ( ( flt->fieldmask & ( 1u << ifld ) )
+                      ? (double*)mcpl_internal_malloc( sizeof(double) * blocksize )
+                      : NULL );
+  unsigned ns = flt->stacksize ? flt->stacksize : 1;
+  e->stack = (double*)mcpl_internal_malloc( sizeof(double) * ns * blocksize );
+  e->stackptr = (const double**)mcpl_internal_malloc( sizeof(double*) * ns );
+  e->pass = (unsigned char*)mcpl_internal_malloc( blocksize );
+}
+
+MCPL_LOCAL void mcpl_internal_filtereval_dealloc( mcpl_internal_filtereval_t * e )
+{
+  for ( int ifld = 0; ifld < MCPLIMP_NFIELDS; ++ifld )
+    free( e->cols[ifld] );
+  free( e->stack );
+  free( (void*)e->stackptr );
+  free( e->pass );
+}
+
+MCPL_LOCAL double mcpl_internal_loadfp( int singleprec, const char * ptr )
+{
+  if ( singleprec ) {
+    float v;
+    memcpy( &v, ptr, sizeof(v) );
+    return v;
+  }
+  double v;
+  memcpy( &v, ptr, sizeof(v) );
+  return v;
+}
+
+//Decode the fields needed by the filter from n raw particle records into the
+//columns (must be kept consistent with mcpl_read):
+MCPL_LOCAL void mcpl_internal_filtereval_decode( mcpl_internal_filtereval_t * e,
+                                                 const mcpl_fileinternal_t * f,
+                                                 const char * raw, unsigned n )
+{
+  mcpl_internal_layout_t l;
+  mcpl_internal_layout_init( &l, f->opt_singleprec, f->opt_polarisation,
+                             f->opt_universalweight != 0.0,
+                             f->opt_universalpdgcode != 0,
+                             f->opt_userflags );
+  const unsigned psize = f->particle_size;
+  const int sp = f->opt_singleprec;
+  double ** cols = e->cols;
+  for ( int ifld = 0; ifld < MCPLIMP_NFIELDS; ++ifld ) {
+    double * col = cols[ifld];
+    if ( !col )
+      continue;
+    unsigned i;
+    const char * r;
+    int off = -1;
+    switch( (mcpl_internal_field_t)ifld ) {
+    case MCPLIMP_FLD_X: off = l.pos; break;
+    case MCPLIMP_FLD_Y: off = l.pos + l.fpsize; break;
+    case MCPLIMP_FLD_Z: off = l.pos + 2*l.fpsize; break;
+    case MCPLIMP_FLD_TIME: off = l.time; break;
+    case MCPLIMP_FLD_WEIGHT: off = l.weight; break;
+    case MCPLIMP_FLD_POLX: off = l.pol; break;
+    case MCPLIMP_FLD_POLY: off = l.pol < 0 ? -1 : l.pol + l.fpsize; break;
+    case MCPLIMP_FLD_POLZ: off = l.pol < 0 ? -1 : l.pol + 2*l.fpsize; break;
+    case MCPLIMP_FLD_PDGCODE:
+      if ( l.pdgcode < 0 ) {
+        for ( i = 0; i < n; ++i )
+          col[i] = f->opt_universalpdgcode;
+      } else {
+        for ( i = 0, r = raw + l.pdgcode; i < n; ++i, r += psize ) {
+          int32_t v;
+          memcpy( &v, r, sizeof(v) );
+          col[i] = v;
+        }
+      }
+      continue;
+    case MCPLIMP_FLD_USERFLAGS:
+      if ( l.userflags < 0 ) {
+        for ( i = 0; i < n; ++i )
+          col[i] = 0.0;
+      } else {
+        for ( i = 0, r = raw + l.userflags; i < n; ++i, r += psize ) {
+          uint32_t v;
+          memcpy( &v, r, sizeof(v) );
+          col[i] = v;
+        }
+      }
+      continue;
+    case MCPLIMP_FLD_EKIN:
+      if ( f->format_version >= 3 ) {
+        for ( i = 0, r = raw + l.packekindir + 2*l.fpsize; i < n; ++i, r += psize )
+          col[i] = fabs( mcpl_internal_loadfp( sp, r ) );
+        continue;
+      }
+      //Fall through to generic unpacking for MCPL-2
+      off = -2;
+      break;
+    case MCPLIMP_FLD_UX:
+    case MCPLIMP_FLD_UY:
+    case MCPLIMP_FLD_UZ:
+      off = -2;
+      break;
+    default:
+      mcpl_error("logic error in filter decoding");
+    }
+    if ( off >= 0 ) {
+      for ( i = 0, r = raw + off; i < n; ++i, r += psize )
+        col[i] = mcpl_internal_loadfp( sp, r );
+    } else if ( off == -1 ) {
+      //absent field
+      double val = ( ifld == MCPLIMP_FLD_WEIGHT ? f->opt_universalweight : 0.0 );
+      for ( i = 0; i < n; ++i )
+        col[i] = val;
+    }
+  }
+
+  //Unit vectors (and ekin for MCPL-2) require full unpacking:
+  int need_unpack = ( cols[MCPLIMP_FLD_UX] || cols[MCPLIMP_FLD_UY]
+                      || cols[MCPLIMP_FLD_UZ]
+                      || ( cols[MCPLIMP_FLD_EKIN] && f->format_version < 3 ) );
+  if ( need_unpack ) {
+    const char * r = raw + l.packekindir;
+    for ( unsigned i = 0; i < n; ++i, r += psize ) {
+      double pack_ekindir[3];
+      double dir[3];
+      double ekin;
+      for ( int k = 0; k < 3; ++k )
+        pack_ekindir[k] = mcpl_internal_loadfp( sp, r + k * l.fpsize );
+      if ( f->format_version >= 3 ) {
+        ekin = fabs(pack_ekindir[2]);
+        pack_ekindir[2] = copysign(1.0,pack_ekindir[2]);
+        mcpl_unitvect_unpack_adaptproj(pack_ekindir,dir);
+      } else {
+        mcpl_unitvect_unpack_oct(pack_ekindir,dir);
+        ekin = pack_ekindir[2];
+        if (signbit(pack_ekindir[2])) {
+          ekin = -ekin;
+          dir[2] = 0.0;
+        }
+      }
+      if ( cols[MCPLIMP_FLD_UX] )
+        cols[MCPLIMP_FLD_UX][i] = dir[0];
+      if ( cols[MCPLIMP_FLD_UY] )
+        cols[MCPLIMP_FLD_UY][i] = dir[1];
+      if ( cols[MCPLIMP_FLD_UZ] )
+        cols[MCPLIMP_FLD_UZ][i] = dir[2];
+      if ( cols[MCPLIMP_FLD_EKIN] && f->format_version < 3 )
+        cols[MCPLIMP_FLD_EKIN][i] = ekin;
+    }
+  }
+}
+
+//Evaluate filter on the n particles currently decoded into the columns,
+//setting e->pass[i] to 1 or 0 and returning the number of passing particles:
+MCPL_LOCAL unsigned mcpl_internal_filtereval_run( mcpl_internal_filtereval_t * e,
+                                                  const mcpl_internal_filter_t * flt,
+                                                  unsigned n )
+{
+  assert( n <= e->blocksize );
+  unsigned sp = 0;
+  for ( unsigned ic = 0; ic < flt->ncode; ++ic ) {
+    const mcpl_internal_fltinstr_t * instr = &flt->code[ic];
+    unsigned i;
+    if ( instr->op == MCPLIMP_FOP_FIELD ) {
+      e->stackptr[sp++] = e->cols[instr->field];
+      continue;
+    }
+    if ( instr->op == MCPLIMP_FOP_CONST ) {
+      double * out = e->stack + (size_t)sp * e->blocksize;
+      const double v = instr->value;
+      for ( i = 0; i < n; ++i )
+        out[i] = v;
+      e->stackptr[sp++] = out;
+      continue;
+    }
+    if ( instr->op < MCPLIMP_FOP_ADD ) {
+      //unary:
+      const double * a = e->stackptr[sp-1];
+      double * out = e->stack + (size_t)(sp-1) * e->blocksize;
+      switch ( instr->op ) {
+      case MCPLIMP_FOP_NEG: for ( i = 0; i < n; ++i ) out[i] = -a[i]; break;
+      case MCPLIMP_FOP_NOT: for ( i = 0; i < n; ++i ) out[i] = !a[i]; break;
+      case MCPLIMP_FOP_ABS: for ( i = 0; i < n; ++i ) out[i] = fabs(a[i]); break;
+      default: mcpl_error("logic error in filter evaluation");
+      }
+      e->stackptr[sp-1] = out;
+      continue;
+    }
+    //binary:
+    const double * a = e->stackptr[sp-2];
+    const double * b = e->stackptr[sp-1];
+    double * out = e->stack + (size_t)(sp-2) * e->blocksize;
+    switch ( instr->op ) {
+    case MCPLIMP_FOP_ADD: for ( i = 0; i < n; ++i ) out[i] = a[i] + b[i]; break;
+    case MCPLIMP_FOP_SUB: for ( i = 0; i < n; ++i ) out[i] = a[i] - b[i]; break;
+    case MCPLIMP_FOP_MUL: for ( i = 0; i < n; ++i ) out[i] = a[i] * b[i]; break;
+    case MCPLIMP_FOP_DIV: for ( i = 0; i < n; ++i ) out[i] = a[i] / b[i]; break;
+    case MCPLIMP_FOP_LT: for ( i = 0; i < n; ++i ) out[i] = a[i] < b[i]; break;
+    case MCPLIMP_FOP_LE: for ( i = 0; i < n; ++i ) out[i] = a[i] <= b[i]; break;
+    case MCPLIMP_FOP_GT: for ( i = 0; i < n; ++i ) out[i] = a[i] > b[i]; break;
+    case MCPLIMP_FOP_GE: for ( i = 0; i < n; ++i ) out[i] = a[i] >= b[i]; break;
+    case MCPLIMP_FOP_EQ: for ( i = 0; i < n; ++i ) out[i] = a[i] == b[i]; break;
+    case MCPLIMP_FOP_NE: for ( i = 0; i < n; ++i ) out[i] = a[i] != b[i]; break;
+    case MCPLIMP_FOP_AND: for ( i = 0; i < n; ++i ) out[i] = a[i] && b[i]; break;
+    case MCPLIMP_FOP_OR: for ( i = 0; i < n; ++i ) out[i] = a[i] || b[i]; break;
+    default: mcpl_error("logic error in filter evaluation");
+    }
+    e->stackptr[sp-2] = out;
+    --sp;
+  }
+  assert( sp == 1 );
+  const double * res = e->stackptr[0];
+  unsigned npass = 0;
+  for ( unsigned i = 0; i < n; ++i ) {
+    e->pass[i] = ( res[i] != 0.0 );
+    npass += e->pass[i];
+  }
+  return npass;
+}
+
+//Move the raw records of passing particles to the front of the buffer,
+//returning their number:
+MCPL_LOCAL unsigned mcpl_internal_filtereval_compact( const mcpl_internal_filtereval_t * e,
+                                                      char * raw, unsigned psize,
+                                                      unsigned n )
+{
+  unsigned npass = 0;
+  for ( unsigned i = 0; i < n; ++i ) {
+    if ( !e->pass[i] )
+      continue;
+    if ( npass != i )
+      memcpy( raw + (size_t)npass * psize, raw + (size_t)i * psize, psize );
+    ++npass;
+  }
+  return npass;
+}
+
+//Append "&& pdgcode==pdgcode_select" to a compiled filter (or make it the
+//entire filter, if empty):
+MCPL_LOCAL void mcpl_internal_filter_add_pdgcode_select( mcpl_internal_filter_t * flt,
+                                                         int32_t pdgcode_select )
+{
+  assert( flt->ncode + 4 <= MCPLIMP_FILTER_MAXCODE );
+  int had_code = ( flt->ncode > 0 );
+  mcpl_internal_fltinstr_t * c = flt->code + flt->ncode;
+  c[0].op = MCPLIMP_FOP_FIELD; c[0].field = MCPLIMP_FLD_PDGCODE; c[0].value = 0.0;
+  c[1].op = MCPLIMP_FOP_CONST; c[1].field = MCPLIMP_FLD_PDGCODE; c[1].value = pdgcode_select;
+  c[2].op = MCPLIMP_FOP_EQ; c[2].field = MCPLIMP_FLD_PDGCODE; c[2].value = 0.0;
+  c[3].op = MCPLIMP_FOP_AND; c[3].field = MCPLIMP_FLD_PDGCODE; c[3].value = 0.0;
+  flt->ncode += ( had_code ? 4 : 3 );
+  unsigned needed_stack = ( had_code ? 3 : 2 );
+  if ( flt->stacksize < needed_stack )
+    flt->stacksize = needed_stack;
+  flt->fieldmask |= ( 1u << MCPLIMP_FLD_PDGCODE );
+}
+
+//Fill the first entry of the columns from an already decoded particle:
+MCPL_LOCAL void mcpl_internal_filtereval_setparticle( mcpl_internal_filtereval_t * e,
+                                                      const mcpl_particle_t * p )
+{
+  double ** cols = e->cols;
+  if ( cols[MCPLIMP_FLD_PDGCODE] ) cols[MCPLIMP_FLD_PDGCODE][0] = p->pdgcode;
+  if ( cols[MCPLIMP_FLD_EKIN] ) cols[MCPLIMP_FLD_EKIN][0] = p->ekin;
+  if ( cols[MCPLIMP_FLD_X] ) cols[MCPLIMP_FLD_X][0] = p->position[0];
+  if ( cols[MCPLIMP_FLD_Y] ) cols[MCPLIMP_FLD_Y][0] = p->position[1];
+  if ( cols[MCPLIMP_FLD_Z] ) cols[MCPLIMP_FLD_Z][0] = p->position[2];
+  if ( cols[MCPLIMP_FLD_UX] ) cols[MCPLIMP_FLD_UX][0] = p->direction[0];
+  if ( cols[MCPLIMP_FLD_UY] ) cols[MCPLIMP_FLD_UY][0] = p->direction[1];
+  if ( cols[MCPLIMP_FLD_UZ] ) cols[MCPLIMP_FLD_UZ][0] = p->direction[2];
+  if ( cols[MCPLIMP_FLD_TIME] ) cols[MCPLIMP_FLD_TIME][0] = p->time;
+  if ( cols[MCPLIMP_FLD_WEIGHT] ) cols[MCPLIMP_FLD_WEIGHT][0] = p->weight;
+  if ( cols[MCPLIMP_FLD_POLX] ) cols[MCPLIMP_FLD_POLX][0] = p->polarisation[0];
+  if ( cols[MCPLIMP_FLD_POLY] ) cols[MCPLIMP_FLD_POLY][0] = p->polarisation[1];
+  if ( cols[MCPLIMP_FLD_POLZ] ) cols[MCPLIMP_FLD_POLZ][0] = p->polarisation[2];
+  if ( cols[MCPLIMP_FLD_USERFLAGS] ) cols[MCPLIMP_FLD_USERFLAGS][0] = p->userflags;
+}
+
+MCPL_LOCAL void mcpl_internal_selection_free( void * vsel )
+{
+  mcpl_internal_selection_t * sel = (mcpl_internal_selection_t*)vsel;
+  if ( !sel )
+    return;
+  mcpl_internal_filtereval_dealloc( &sel->feval );
+  free( sel->blocks.candidate );
+  free( sel );
+}
+
+void mcpl_set_filter( mcpl_file_t ff, const char * expr )
+{
+  MCPLIMP_FILEDECODE;
+  mcpl_internal_selection_free( f->selection );
+  f->selection = NULL;
+  if ( !expr || !expr[0] )
+    return;
+  mcpl_internal_selection_t * sel
+    = (mcpl_internal_selection_t*)mcpl_internal_calloc( 1, sizeof(mcpl_internal_selection_t) );
+  char errmsg[512];
+  if ( !mcpl_internal_filter_compile( expr, &sel->filter, errmsg, sizeof(errmsg) ) ) {
+    free( sel );
+    mcpl_error( errmsg );
+  }
+  mcpl_internal_filtereval_init( &sel->feval, &sel->filter, 1 );
+  uint64_t pos = f->current_particle_idx;
+  sel->has_blocks = mcpl_internal_blockselection_init( &sel->blocks, f, &sel->filter );
+  mcpl_seek( ff, pos );
+  f->selection = sel;
+}
+
+MCPL_LOCAL const mcpl_particle_t* mcpl_internal_read_selected( mcpl_fileinternal_t * f )
+{
+  mcpl_internal_selection_t * sel = (mcpl_internal_selection_t*)f->selection;
+  mcpl_file_t ff;
+  ff.internal = f;
+  for (;;) {
+    if ( sel->has_blocks && f->current_particle_idx < f->nparticles ) {
+      uint64_t ib = f->current_particle_idx / MCPLIMP_INDEX_BLOCKSIZE;
+      if ( !sel->blocks.candidate[ib] ) {
+        uint64_t jb = ib;
+        while ( jb < sel->blocks.nblocks && !sel->blocks.candidate[jb] )
+          ++jb;
+        mcpl_seek( ff, jb * MCPLIMP_INDEX_BLOCKSIZE );
+        continue;
+      }
+    }
+    const mcpl_particle_t * p = mcpl_internal_read( f );
+    if ( !p )
+      return NULL;
+    mcpl_internal_filtereval_setparticle( &sel->feval, p );
+    if ( mcpl_internal_filtereval_run( &sel->feval, &sel->filter, 1 ) )
+      return p;
+  }
+}
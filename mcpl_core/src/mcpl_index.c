@@ -0,0 +1,562 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Index files with zone maps for skipping blocks of particles when filtering.
+
+#include "mcpl_internal.h"
+
+//Optional index files (FILE.idx next to FILE), which contain "zone maps" with
+//the ranges of a few particle fields and the set of pdgcodes present for each
+//block of MCPLIMP_INDEX_BLOCKSIZE particles in FILE. When a filter expression
+//is applied, the index allows entire blocks to be skipped without reading them,
+//whenever the filter can be proven to fail for all particles in the block.
+
+#define MCPLIMP_INDEX_MAXPDG 32
+#define MCPLIMP_INDEX_NRANGES 6
+#define MCPLIMP_INDEX_MAGIC "MCPLIDX1"
+
+MCPL_LOCAL int mcpl_internal_index_rangeidx( mcpl_internal_field_t fld )
+{
+  switch( fld ) {
+  case MCPLIMP_FLD_EKIN: return 0;
+  case MCPLIMP_FLD_X: return 1;
+  case MCPLIMP_FLD_Y: return 2;
+  case MCPLIMP_FLD_Z: return 3;
+  case MCPLIMP_FLD_TIME: return 4;
+  case MCPLIMP_FLD_WEIGHT: return 5;
+  default: return -1;
+  }
+}
+
+typedef struct MCPL_LOCAL {
+  uint64_t nblocks;
+  double * ranges;//(min,max) for each range field for each block
+  int32_t * pdgrange;//(min,max) pdgcode for each block
+  uint64_t * pdgbegin;//pdgs[pdgbegin[i]..pdgbegin[i+1]] are pdgcodes in block i
+  int32_t * pdgs;
+  unsigned char * pdgoverflow;//1 if block has >MCPLIMP_INDEX_MAXPDG pdgcodes
+} mcpl_internal_index_t;
+
+MCPL_LOCAL void mcpl_internal_index_free( mcpl_internal_index_t * idx )
+{
+  if (!idx)
+    return;
+  free( idx->ranges );
+  free( idx->pdgrange );
+  free( idx->pdgbegin );
+  free( idx->pdgs );
+  free( idx->pdgoverflow );
+  free( idx );
+}
+
+MCPL_LOCAL char * mcpl_internal_index_filename( const char * filename )
+{
+  size_t n = strlen(filename);
+  char * res = mcpl_internal_malloc( n + 5 );
+  memcpy( res, filename, n );
+  memcpy( res + n, ".idx", 5 );
+  return res;
+}
+
+//Checksum of the header and first particle of an opened file, used to detect
+//outdated index files (note that the file position might be changed):
+MCPL_LOCAL uint32_t mcpl_internal_index_fingerprint( mcpl_fileinternal_t * f )
+{
+  uLong crc = crc32( 0L, Z_NULL, 0 );
+#define MCPLIMP_CRC(ptr,n) crc = crc32( crc, (const Bytef*)(ptr), (uInt)(n) )
+  uint64_t vals[6];
+  vals[0] = f->format_version;
+  vals[1] = f->opt_signature;
+  vals[2] = f->nparticles;
+  vals[3] = f->particle_size;
+  vals[4] = f->first_particle_pos;
+  vals[5] = (uint64_t)f->opt_universalpdgcode;
+  MCPLIMP_CRC( vals, sizeof(vals) );
+  MCPLIMP_CRC( &f->opt_universalweight, sizeof(double) );
+  if ( f->hdr_srcprogname )
+    MCPLIMP_CRC( f->hdr_srcprogname, strlen(f->hdr_srcprogname) );
+  for ( uint32_t i = 0; i < f->ncomments; ++i )
+    MCPLIMP_CRC( f->comments[i], strlen(f->comments[i]) + 1 );
+  for ( uint32_t i = 0; i < f->nblobs; ++i ) {
+    MCPLIMP_CRC( f->blobkeys[i], strlen(f->blobkeys[i]) + 1 );
+    MCPLIMP_CRC( mcpl_internal_blobdata(f,i), f->bloblengths[i] );
+  }
+  if ( f->nparticles ) {
+    mcpl_file_t ff;
+    ff.internal = f;
+    mcpl_seek( ff, 0 );
+    char buf[MCPLIMP_MAX_PARTICLE_SIZE];
+    mcpl_internal_read_raw_particles( f, buf, 1 );
+    MCPLIMP_CRC( buf, f->particle_size );
+  }
+#undef MCPLIMP_CRC
+  return (uint32_t)crc;
+}
+
+MCPL_LOCAL void mcpl_internal_index_fwrite( FILE * fh, const void * data,
+                                            size_t n )
+{
+  if ( n && fwrite( data, 1, n, fh ) != n )
+    mcpl_error("Errors encountered while writing index file.");
+}
+
+//Zone map data for one block of particles while creating an index:
+typedef struct MCPL_LOCAL {
+  uint32_t n;
+  double ranges[2*MCPLIMP_INDEX_NRANGES];
+  int32_t pdgrange[2];
+  uint32_t npdg;//npdg>MCPLIMP_INDEX_MAXPDG means that pdgs is incomplete
+  int32_t pdgs[MCPLIMP_INDEX_MAXPDG];
+} mcpl_internal_indexblock_t;
+
+MCPL_LOCAL void mcpl_internal_indexblock_reset( mcpl_internal_indexblock_t * b )
+{
+  b->n = 0;
+  for ( int i = 0; i < MCPLIMP_INDEX_NRANGES; ++i ) {
+    b->ranges[2*i] = INFINITY;
+    b->ranges[2*i+1] = -INFINITY;
+  }
+  b->pdgrange[0] = INT32_MAX;
+  b->pdgrange[1] = INT32_MIN;
+  b->npdg = 0;
+}
+
+MCPL_LOCAL void mcpl_internal_indexblock_add( mcpl_internal_indexblock_t * b,
+                                              const mcpl_particle_t * p )
+{
+  ++(b->n);
+  double v[MCPLIMP_INDEX_NRANGES];
+  v[0] = p->ekin;
+  v[1] = p->position[0];
+  v[2] = p->position[1];
+  v[3] = p->position[2];
+  v[4] = p->time;
+  v[5] = p->weight;
+  for ( int i = 0; i < MCPLIMP_INDEX_NRANGES; ++i ) {
+    if ( v[i] != v[i] ) {
+      //NaN, so no useful range can be provided:
+      b->ranges[2*i] = -INFINITY;
+      b->ranges[2*i+1] = INFINITY;
+    } else {
+      if ( v[i] < b->ranges[2*i] )
+        b->ranges[2*i] = v[i];
+      if ( v[i] > b->ranges[2*i+1] )
+        b->ranges[2*i+1] = v[i];
+    }
+  }
+  if ( p->pdgcode < b->pdgrange[0] )
+    b->pdgrange[0] = p->pdgcode;
+  if ( p->pdgcode > b->pdgrange[1] )
+    b->pdgrange[1] = p->pdgcode;
+  if ( b->npdg > MCPLIMP_INDEX_MAXPDG )
+    return;
+  for ( uint32_t i = 0; i < b->npdg; ++i )
+    if ( b->pdgs[i] == p->pdgcode )
+      return;
+  if ( b->npdg < MCPLIMP_INDEX_MAXPDG )
+    b->pdgs[b->npdg] = p->pdgcode;
+  ++(b->npdg);
+}
+
+MCPL_LOCAL void mcpl_internal_indexblock_write( FILE * fh,
+                                                const mcpl_internal_indexblock_t * b )
+{
+  mcpl_internal_index_fwrite( fh, b->ranges, sizeof(b->ranges) );
+  mcpl_internal_index_fwrite( fh, b->pdgrange, sizeof(b->pdgrange) );
+  mcpl_internal_index_fwrite( fh, &b->npdg, sizeof(b->npdg) );
+  if ( b->npdg <= MCPLIMP_INDEX_MAXPDG )
+    mcpl_internal_index_fwrite( fh, b->pdgs, sizeof(int32_t) * b->npdg );
+}
+
+void mcpl_create_index( const char * filename )
+{
+  mcpl_file_t ff = mcpl_open_file( filename );
+  mcpl_fileinternal_t * f = (mcpl_fileinternal_t *)ff.internal;
+  uint32_t fingerprint = mcpl_internal_index_fingerprint( f );
+  mcpl_rewind( ff );
+
+  char * idxfn = mcpl_internal_index_filename( filename );
+  FILE * fh = mcpl_internal_fopen( idxfn, "wb" );
+  free( idxfn );
+  if ( !fh )
+    mcpl_error("Unable to create index file!");
+
+  const uint32_t blocksize = MCPLIMP_INDEX_BLOCKSIZE;
+  const uint32_t endian_marker = 0x01020304;
+  const uint64_t nparticles = f->nparticles;
+  const uint64_t nblocks = ( nparticles + blocksize - 1 ) / blocksize;
+  mcpl_internal_index_fwrite( fh, MCPLIMP_INDEX_MAGIC, 8 );
+  mcpl_internal_index_fwrite( fh, &endian_marker, sizeof(endian_marker) );
+  mcpl_internal_index_fwrite( fh, &blocksize, sizeof(blocksize) );
+  mcpl_internal_index_fwrite( fh, &nparticles, sizeof(nparticles) );
+  mcpl_internal_index_fwrite( fh, &nblocks, sizeof(nblocks) );
+  mcpl_internal_index_fwrite( fh, &fingerprint, sizeof(fingerprint) );
+
+  mcpl_internal_indexblock_t block;
+  mcpl_internal_indexblock_reset( &block );
+  uint64_t nblocks_written = 0;
+  for (;;) {
+    const mcpl_particle_t * p = mcpl_read( ff );
+    if ( block.n && ( !p || block.n == blocksize ) ) {
+      mcpl_internal_indexblock_write( fh, &block );
+      mcpl_internal_indexblock_reset( &block );
+      ++nblocks_written;
+    }
+    if ( !p )
+      break;
+    mcpl_internal_indexblock_add( &block, p );
+  }
+  if ( nblocks_written != nblocks )
+    mcpl_error("Unexpected number of particles encountered while creating index file.");
+  if ( fclose( fh ) != 0 )
+    mcpl_error("Errors encountered while writing index file.");
+  mcpl_close_file( ff );
+}
+
+//Load index file for the given file, returning NULL if not available or not
+//matching the file (the file position of f might be changed):
+MCPL_LOCAL mcpl_internal_index_t * mcpl_internal_index_load( mcpl_fileinternal_t * f )
+{
+  if ( !f->filename )
+    return NULL;
+  char * idxfn = mcpl_internal_index_filename( f->filename );
+  mcu8str idxfn_u8 = mcu8str_view_cstr( idxfn );
+  if ( !mctools_is_file( &idxfn_u8 ) ) {
+    free( idxfn );
+    return NULL;
+  }
+  FILE * fh = mcpl_internal_fopen( idxfn, "rb" );
+  free( idxfn );
+  if ( !fh )
+    return NULL;
+
+  char magic[8];
+  uint32_t endian_marker, blocksize, fingerprint;
+  uint64_t nparticles, nblocks;
+  int ok = ( fread( magic, 1, 8, fh ) == 8
+             && memcmp( magic, MCPLIMP_INDEX_MAGIC, 8 ) == 0
+             && fread( &endian_marker, sizeof(endian_marker), 1, fh ) == 1
+             && endian_marker == 0x01020304
+             && fread( &blocksize, sizeof(blocksize), 1, fh ) == 1
+             && blocksize == MCPLIMP_INDEX_BLOCKSIZE
+             && fread( &nparticles, sizeof(nparticles), 1, fh ) == 1
+             && nparticles == f->nparticles
+             && fread( &nblocks, sizeof(nblocks), 1, fh ) == 1
+             && nblocks == ( nparticles + blocksize - 1 ) / blocksize
+             && fread( &fingerprint, sizeof(fingerprint), 1, fh ) == 1
+             && fingerprint == mcpl_internal_index_fingerprint( f ) );
+  mcpl_internal_index_t * idx = NULL;
+  if ( ok ) {
+    idx = (mcpl_internal_index_t*)mcpl_internal_calloc( 1, sizeof(mcpl_internal_index_t) );
+    idx->nblocks = nblocks;
+    idx->ranges = (double*)mcpl_internal_malloc( sizeof(double) * 2 * MCPLIMP_INDEX_NRANGES
+                                                 * ( nblocks ? nblocks : 1 ) );
+    idx->pdgrange = (int32_t*)mcpl_internal_malloc( sizeof(int32_t) * 2 * ( nblocks ? nblocks : 1 ) );
+    idx->pdgbegin = (uint64_t*)mcpl_internal_malloc( sizeof(uint64_t) * ( nblocks + 1 ) );
+    idx->pdgoverflow = (unsigned char*)mcpl_internal_malloc( nblocks ? nblocks : 1 );
+    uint64_t npdgs_alloc = 64;
+    idx->pdgs = (int32_t*)mcpl_internal_malloc( sizeof(int32_t) * npdgs_alloc );
+    idx->pdgbegin[0] = 0;
+    for ( uint64_t ib = 0; ok && ib < nblocks; ++ib ) {
+      uint32_t npdg;
+      ok = ( fread( idx->ranges + 2 * MCPLIMP_INDEX_NRANGES * ib, sizeof(double),
+                    2 * MCPLIMP_INDEX_NRANGES, fh ) == 2 * MCPLIMP_INDEX_NRANGES
+             && fread( idx->pdgrange + 2 * ib, sizeof(int32_t), 2, fh ) == 2
+             && fread( &npdg, sizeof(npdg), 1, fh ) == 1 );
+      if ( !ok )
+        break;
+      idx->pdgoverflow[ib] = ( npdg > MCPLIMP_INDEX_MAXPDG );
+      uint32_t nstore = ( idx->pdgoverflow[ib] ? 0 : npdg );
+      uint64_t b = idx->pdgbegin[ib];
+      if ( b + nstore > npdgs_alloc ) {
+        npdgs_alloc = 2 * ( b + nstore );
+        idx->pdgs = (int32_t*)mcpl_internal_realloc( idx->pdgs,
+                                                     sizeof(int32_t) * npdgs_alloc );
+      }
+      ok = ( fread( idx->pdgs + b, sizeof(int32_t), nstore, fh ) == nstore );
+      idx->pdgbegin[ib+1] = b + nstore;
+    }
+    if ( ok ) {
+      //Should be at the end of the file now:
+      char dummy;
+      ok = ( fread( &dummy, 1, 1, fh ) == 0 );
+    }
+  }
+  fclose( fh );
+  if ( !ok ) {
+    mcpl_print("MCPL WARNING: Ignoring outdated or invalid index file (recreate it"
+               " with mcpltool --index).\n");
+    mcpl_internal_index_free( idx );
+    return NULL;
+  }
+  return idx;
+}
+
+//Interval arithmetic (with a few special cases for pdgcodes), proving that a
+//filter fails for all particles in a block, given their ranges as found in the
+//index. Only the interval [0,0] means that the filter is known to fail:
+typedef struct MCPL_LOCAL {
+  double lo;
+  double hi;
+  int is_pdgcode;//value is the pdgcode field itself
+} mcpl_internal_interval_t;
+
+MCPL_LOCAL void mcpl_internal_interval_set( mcpl_internal_interval_t * r,
+                                            double lo, double hi )
+{
+  if ( lo != lo || hi != hi ) {
+    //NaN
+    lo = -INFINITY;
+    hi = INFINITY;
+  }
+  r->lo = lo;
+  r->hi = hi;
+  r->is_pdgcode = 0;
+}
+
+MCPL_LOCAL void mcpl_internal_interval_set4( mcpl_internal_interval_t * r,
+                                             double v0, double v1,
+                                             double v2, double v3 )
+{
+  //Range spanned by four values (for multiplication and division):
+  double lo = v0, hi = v0;
+  double v[3];
+  v[0] = v1;
+  v[1] = v2;
+  v[2] = v3;
+  for ( int i = 0; i < 3; ++i ) {
+    if ( v[i] != v[i] ) {
+      lo = hi = v[i];//NaN
+      break;
+    }
+    lo = ( v[i] < lo ? v[i] : lo );
+    hi = ( v[i] > hi ? v[i] : hi );
+  }
+  mcpl_internal_interval_set( r, lo, hi );
+}
+
+//Result of a pdgcode==value comparison: 0 (no particles pass), 1 (all
+//particles pass) or -1 (unknown):
+MCPL_LOCAL int mcpl_internal_index_pdgeq( const mcpl_internal_index_t * idx,
+                                          uint64_t ib, double value )
+{
+  const int32_t * pr = idx->pdgrange + 2 * ib;
+  if ( value < pr[0] || value > pr[1] )
+    return 0;
+  if ( pr[0] == pr[1] )
+    return 1;//value==pr[0]==pr[1]
+  if ( idx->pdgoverflow[ib] )
+    return -1;
+  for ( uint64_t i = idx->pdgbegin[ib]; i < idx->pdgbegin[ib+1]; ++i )
+    if ( idx->pdgs[i] == value )
+      return -1;
+  return 0;
+}
+
+MCPL_LOCAL int mcpl_internal_filter_block_may_match( const mcpl_internal_filter_t * flt,
+                                                     const mcpl_internal_index_t * idx,
+                                                     uint64_t ib )
+{
+  mcpl_internal_interval_t stack[MCPLIMP_FILTER_MAXCODE];
+  unsigned sp = 0;
+  const double * ranges = idx->ranges + 2 * MCPLIMP_INDEX_NRANGES * ib;
+  for ( unsigned ic = 0; ic < flt->ncode; ++ic ) {
+    const mcpl_internal_fltinstr_t * instr = &flt->code[ic];
+    if ( instr->op == MCPLIMP_FOP_FIELD ) {
+      mcpl_internal_interval_t * r = &stack[sp++];
+      int irange = mcpl_internal_index_rangeidx( instr->field );
+      if ( irange >= 0 ) {
+        mcpl_internal_interval_set( r, ranges[2*irange], ranges[2*irange+1] );
+      } else if ( instr->field == MCPLIMP_FLD_PDGCODE ) {
+        mcpl_internal_interval_set( r, idx->pdgrange[2*ib], idx->pdgrange[2*ib+1] );
+        r->is_pdgcode = 1;
+      } else if ( instr->field == MCPLIMP_FLD_UX || instr->field == MCPLIMP_FLD_UY
+                  || instr->field == MCPLIMP_FLD_UZ ) {
+        mcpl_internal_interval_set( r, -1.0, 1.0 );
+      } else {
+        mcpl_internal_interval_set( r, -INFINITY, INFINITY );
+      }
+      continue;
+    }
+    if ( instr->op == MCPLIMP_FOP_CONST ) {
+      mcpl_internal_interval_set( &stack[sp++], instr->value, instr->value );
+      continue;
+    }
+    if ( instr->op < MCPLIMP_FOP_ADD ) {
+      //unary:
+      mcpl_internal_interval_t * a = &stack[sp-1];
+      double lo = a->lo, hi = a->hi;
+      switch ( instr->op ) {
+      case MCPLIMP_FOP_NEG:
+        mcpl_internal_interval_set( a, -hi, -lo );
+        break;
+      case MCPLIMP_FOP_NOT:
+        if ( lo == 0.0 && hi == 0.0 )
+          mcpl_internal_interval_set( a, 1.0, 1.0 );
+        else if ( lo > 0.0 || hi < 0.0 )
+          mcpl_internal_interval_set( a, 0.0, 0.0 );
+        else
+          mcpl_internal_interval_set( a, 0.0, 1.0 );
+        break;
+      case MCPLIMP_FOP_ABS:
+        if ( lo >= 0.0 )
+          mcpl_internal_interval_set( a, lo, hi );
+        else if ( hi <= 0.0 )
+          mcpl_internal_interval_set( a, -hi, -lo );
+        else
+          mcpl_internal_interval_set( a, 0.0, ( -lo > hi ? -lo : hi ) );
+        break;
+      default:
+        mcpl_error("logic error in filter evaluation");
+      }
+      continue;
+    }
+    //binary:
+    mcpl_internal_interval_t * a = &stack[sp-2];
+    const mcpl_internal_interval_t * b = &stack[sp-1];
+    --sp;
+    double alo = a->lo, ahi = a->hi, blo = b->lo, bhi = b->hi;
+    if ( ( instr->op == MCPLIMP_FOP_EQ || instr->op == MCPLIMP_FOP_NE )
+         && ( ( a->is_pdgcode && blo == bhi ) || ( b->is_pdgcode && alo == ahi ) ) ) {
+      //Comparing pdgcode to a value, use the set of pdgcodes in the block:
+      int res = mcpl_internal_index_pdgeq( idx, ib, ( a->is_pdgcode ? blo : alo ) );
+      if ( res >= 0 && instr->op == MCPLIMP_FOP_NE )
+        res = !res;
+      if ( res < 0 )
+        mcpl_internal_interval_set( a, 0.0, 1.0 );
+      else
+        mcpl_internal_interval_set( a, res, res );
+      continue;
+    }
+    double t = -1.0;//for comparisons and logical operators: 0, 1 or -1 (unknown)
+    switch ( instr->op ) {
+    case MCPLIMP_FOP_ADD: mcpl_internal_interval_set( a, alo + blo, ahi + bhi ); continue;
+    case MCPLIMP_FOP_SUB: mcpl_internal_interval_set( a, alo - bhi, ahi - blo ); continue;
+    case MCPLIMP_FOP_MUL:
+      mcpl_internal_interval_set4( a, alo * blo, alo * bhi, ahi * blo, ahi * bhi );
+      continue;
+    case MCPLIMP_FOP_DIV:
+      if ( blo <= 0.0 && bhi >= 0.0 )
+        mcpl_internal_interval_set( a, -INFINITY, INFINITY );
+      else
+        mcpl_internal_interval_set4( a, alo / blo, alo / bhi, ahi / blo, ahi / bhi );
+      continue;
+    case MCPLIMP_FOP_LT: t = ( ahi < blo ? 1.0 : ( alo >= bhi ? 0.0 : -1.0 ) ); break;
+    case MCPLIMP_FOP_LE: t = ( ahi <= blo ? 1.0 : ( alo > bhi ? 0.0 : -1.0 ) ); break;
+    case MCPLIMP_FOP_GT: t = ( alo > bhi ? 1.0 : ( ahi <= blo ? 0.0 : -1.0 ) ); break;
+    case MCPLIMP_FOP_GE: t = ( alo >= bhi ? 1.0 : ( ahi < blo ? 0.0 : -1.0 ) ); break;
+    case MCPLIMP_FOP_EQ:
+    case MCPLIMP_FOP_NE:
+      if ( ahi < blo || bhi < alo )
+        t = 0.0;
+      else if ( alo == ahi && blo == bhi && alo == blo )
+        t = 1.0;
+      if ( t >= 0.0 && instr->op == MCPLIMP_FOP_NE )
+        t = 1.0 - t;
+      break;
+    case MCPLIMP_FOP_AND:
+      if ( ( alo == 0.0 && ahi == 0.0 ) || ( blo == 0.0 && bhi == 0.0 ) )
+        t = 0.0;
+      else if ( ( alo > 0.0 || ahi < 0.0 ) && ( blo > 0.0 || bhi < 0.0 ) )
+        t = 1.0;
+      break;
+    case MCPLIMP_FOP_OR:
+      if ( ( alo > 0.0 || ahi < 0.0 ) || ( blo > 0.0 || bhi < 0.0 ) )
+        t = 1.0;
+      else if ( alo == 0.0 && ahi == 0.0 && blo == 0.0 && bhi == 0.0 )
+        t = 0.0;
+      break;
+    default:
+      mcpl_error("logic error in filter evaluation");
+    }
+    if ( t < 0.0 )
+      mcpl_internal_interval_set( a, 0.0, 1.0 );
+    else
+      mcpl_internal_interval_set( a, t, t );
+  }
+  assert( sp == 1 );
+  return !( stack[0].lo == 0.0 && stack[0].hi == 0.0 );
+}
+
+//Loads index and determines candidate blocks for the filter. Returns 0 if no
+//usable index is available (the file position of f might be changed):
+MCPL_LOCAL int mcpl_internal_blockselection_init( mcpl_internal_blockselection_t * bs,
+                                                  mcpl_fileinternal_t * f,
+                                                  const mcpl_internal_filter_t * flt )
+{
+  bs->nblocks = 0;
+  bs->ncandidates = 0;
+  bs->candidate = NULL;
+  mcpl_internal_index_t * idx = mcpl_internal_index_load( f );
+  if ( !idx )
+    return 0;
+  bs->nblocks = idx->nblocks;
+  bs->candidate = (unsigned char*)mcpl_internal_malloc( idx->nblocks ? idx->nblocks : 1 );
+  for ( uint64_t ib = 0; ib < idx->nblocks; ++ib ) {
+    bs->candidate[ib] = (unsigned char)mcpl_internal_filter_block_may_match( flt, idx, ib );
+    bs->ncandidates += bs->candidate[ib];
+  }
+  mcpl_internal_index_free( idx );
+  return 1;
+}
+
+//Like mcpl_internal_read_raw_particles, but skipping past non-candidate blocks
+//(bs may be NULL). The number of particles consumed from the file (read or
+//skipped) is returned in nconsumed, which is never larger than n:
+MCPL_LOCAL unsigned mcpl_internal_read_raw_candidates( mcpl_fileinternal_t * f,
+                                                       const mcpl_internal_blockselection_t * bs,
+                                                       char * buf, unsigned n,
+                                                       unsigned * nconsumed )
+{
+  uint64_t i = f->current_particle_idx;
+  if ( !bs || i >= f->nparticles ) {
+    unsigned np = mcpl_internal_read_raw_particles( f, buf, n );
+    *nconsumed = np;
+    return np;
+  }
+  const uint64_t blocksize = MCPLIMP_INDEX_BLOCKSIZE;
+  uint64_t ib = i / blocksize;
+  uint64_t jb = ib;
+  if ( !bs->candidate[ib] ) {
+    //skip to the next candidate block:
+    while ( jb < bs->nblocks && !bs->candidate[jb] )
+      ++jb;
+    uint64_t target = jb * blocksize;
+    if ( target > f->nparticles )
+      target = f->nparticles;
+    if ( target - i > n )
+      target = i + n;
+    mcpl_file_t ff;
+    ff.internal = f;
+    mcpl_seek( ff, target );
+    *nconsumed = (unsigned)( target - i );
+    return 0;
+  }
+  //read until the next non-candidate block:
+  while ( jb < bs->nblocks && bs->candidate[jb] )
+    ++jb;
+  uint64_t nmax = jb * blocksize - i;
+  if ( n > nmax )
+    n = (unsigned)nmax;
+  unsigned np = mcpl_internal_read_raw_particles( f, buf, n );
+  *nconsumed = np;
+  return np;
+}
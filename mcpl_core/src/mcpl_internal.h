@@ -0,0 +1,443 @@
+
+/******************************************************************************/
+/*                                                                            */
+/*  This file is part of MCPL (see https://mctools.github.io/mcpl/)           */
+/*                                                                            */
+/*  Copyright 2015-2026 MCPL developers.                                      */
+/*                                                                            */
+/*  Licensed under the Apache License, Version 2.0 (the "License");           */
+/*  you may not use this file except in compliance with the License.          */
+/*  You may obtain a copy of the License at                                   */
+/*                                                                            */
+/*      http://www.apache.org/licenses/LICENSE-2.0                            */
+/*                                                                            */
+/*  Unless required by applicable law or agreed to in writing, software       */
+/*  distributed under the License is distributed on an "AS IS" BASIS,         */
+/*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  */
+/*  See the License for the specific language governing permissions and       */
+/*  limitations under the License.                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef mcpl_internal_h
+#define mcpl_internal_h
+
+//Private header shared by the translation units of libmcpl (mcpl.c and the
+//mcpl_*.c files implementing individual subsystems). Not to be used by client
+//code.
+
+//Before including mcpl.h, we attempt to get PRIu64 defined in a relatively
+//robust manner by enabling feature test macros for gcc and including relevant
+//headers:
+#ifndef __STDC_FORMAT_MACROS
+#  define __STDC_FORMAT_MACROS
+#endif
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 200809L
+#endif
+#ifndef _ISOC99_SOURCE
+#  define _ISOC99_SOURCE 1
+#endif
+#ifndef _C99_SOURCE
+#  define _C99_SOURCE 1
+#endif
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+//For fallocate(..) and copy_file_range(..):
+#  define _GNU_SOURCE 1
+#endif
+#ifdef _FILE_OFFSET_BITS
+#  undef _FILE_OFFSET_BITS
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <inttypes.h>
+#include <stdio.h>
+#ifndef PRIu64//bad compiler - fallback to guessing
+#  if defined(_MSC_VER) && (_MSC_VER<1900)
+#    define PRIu64 "I64u"
+#  else
+#    if defined(__WORDSIZE) && (__WORDSIZE==64)
+#      define PRIu64 "lu"
+#    else
+#      define PRIu64 "llu"
+#    endif
+#  endif
+#endif
+
+#include "mcpl.h"
+#include "zlib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <limits.h>
+
+#ifdef Z_SOLO
+#  error "MCPL needs zlib with gzip functionality"
+#endif
+
+#ifndef INFINITY
+//Missing in ICC 12 C99 compilation:
+#  define  INFINITY (__builtin_inf())
+#endif
+
+#include "mcpl_fileutils.h"
+
+#define MCPLIMP_NPARTICLES_POS 8
+#define MCPLIMP_MAX_PARTICLE_SIZE 96
+#define MCPLIMP_SFC_BLOBKEY "mcpl_spatial_index"
+#define MCPL_STATIC_ASSERT0(COND,MSG) { typedef char mcpl_##MSG[(COND)?1:-1]; mcpl_##MSG dummy; (void)dummy; }
+#define MCPL_STATIC_ASSERT3(expr,x) MCPL_STATIC_ASSERT0(expr,fail_at_line_##x)
+#define MCPL_STATIC_ASSERT2(expr,x) MCPL_STATIC_ASSERT3(expr,x)
+#define MCPL_STATIC_ASSERT(expr)    MCPL_STATIC_ASSERT2(expr,__LINE__)
+
+//Make sure we don't have any raw printf's in the library
+#ifdef printf
+#  undef printf
+#endif
+#define printf MCPLNOUSEPRINTF
+
+//Minimal portable wrappers for threads, mutexes and condition variables, used
+//to parallelise particle processing. Define MCPL_NO_THREADS to build without
+//thread support, in which case all such processing is done serially:
+#ifndef MCPL_NO_THREADS
+#  ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#      define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#      define NOMINMAX
+#    endif
+#    include <windows.h>
+#  else
+#    include <pthread.h>
+#    include <unistd.h>
+#  endif
+#endif
+
+#define MCPLIMP_MAX_NTHREADS 1024
+
+#ifndef MCPL_NO_THREADS
+#  ifdef _WIN32
+typedef CRITICAL_SECTION mcpl_internal_mutex_t;
+typedef CONDITION_VARIABLE mcpl_internal_cond_t;
+#  else
+typedef pthread_mutex_t mcpl_internal_mutex_t;
+typedef pthread_cond_t mcpl_internal_cond_t;
+#  endif
+
+typedef struct MCPL_LOCAL {
+#  ifdef _WIN32
+  HANDLE handle;
+#  else
+  pthread_t handle;
+#  endif
+  void (*fct)(void*);
+  void * arg;
+} mcpl_internal_thread_t;
+#endif
+
+//Internal state of input and output files, and stat:sum: comments:
+
+#define MCPL_STATSUMINI "stat:sum:"
+#define MCPL_STATSUMINI_LENGTH (sizeof(MCPL_STATSUMINI)-1)
+#define MCPL_STATSUMKEY_MAXLENGTH 64
+#define MCPL_STATSUMVAL_LENGTH 24
+#define MCPL_STATSUMVAL_ENCODEDZERO   "                       0"
+#define MCPL_STATSUMBUF_MAXLENGTH ( MCPL_STATSUMKEY_MAXLENGTH + \
+                                    MCPL_STATSUMVAL_LENGTH +    \
+                                    MCPL_STATSUMINI_LENGTH +   \
+                                    1 ) //+1 for final colon
+
+typedef struct MCPL_LOCAL {
+  char key[MCPL_STATSUMKEY_MAXLENGTH+1];
+  double value;
+  uint32_t writtenstrlen;
+  uint64_t writtenpos;
+} mcpl_internal_statsuminfo_t;
+
+typedef struct MCPL_LOCAL {
+  char * filename;
+  FILE * file;
+  char * hdr_srcprogname;
+  uint32_t ncomments;
+  char ** comments;
+  uint32_t nblobs;
+  char ** blobkeys;
+  uint32_t * bloblengths;
+  char ** blobs;
+  int opt_userflags;
+  int opt_polarisation;
+  int opt_singleprec;
+  int32_t opt_universalpdgcode;
+  double opt_universalweight;
+  int header_notwritten;
+  uint64_t nparticles;
+  unsigned particle_size;
+  mcpl_particle_t* puser;
+  unsigned opt_signature;
+  char particle_buffer[MCPLIMP_MAX_PARTICLE_SIZE];
+  mcpl_internal_statsuminfo_t * statsuminfo;
+  unsigned nstatsuminfo;
+} mcpl_outfileinternal_t;
+
+#define MCPLIMP_OUTFILEDECODE mcpl_outfileinternal_t * f = (mcpl_outfileinternal_t *)of.internal; assert(f)
+
+typedef struct {
+  FILE * file;
+  gzFile filegz;
+  char * filename;
+  char * hdr_srcprogname;
+  unsigned format_version;
+  int opt_userflags;
+  int opt_polarisation;
+  int opt_singleprec;
+  int32_t opt_universalpdgcode;
+  double opt_universalweight;
+  int is_little_endian;
+  uint64_t nparticles;
+  uint32_t ncomments;
+  char ** comments;
+  uint32_t nblobs;
+  char ** blobkeys;
+  uint32_t * bloblengths;
+  char ** blobs;
+  unsigned particle_size;
+  uint64_t first_particle_pos;
+  uint64_t current_particle_idx;
+  mcpl_particle_t* particle;
+  unsigned opt_signature;
+  char particle_buffer[MCPLIMP_MAX_PARTICLE_SIZE];
+  uint64_t first_comment_pos;
+  uint32_t * repaired_statsum_icomments;
+  void * selection;//filter applied in mcpl_read (see mcpl_set_filter)
+  //Only used in header-only mode (see mcpl_open_header_only), where strings
+  //and blobs point into hdrbuf, except for blobs with a non-zero blobpos entry
+  //which are instead loaded on demand:
+  char * hdrbuf;
+  char ** hdrstrs;
+  uint64_t * blobpos;
+} mcpl_fileinternal_t;
+
+#define MCPLIMP_FILEDECODE mcpl_fileinternal_t * f = (mcpl_fileinternal_t *)ff.internal; assert(f)
+
+#define MCPL_COMMENT_IS_STATSUM(x) ( *x == 's' \
+                                     && strncmp(x,MCPL_STATSUMINI,      \
+                                                MCPL_STATSUMINI_LENGTH)==0 )
+
+typedef struct MCPL_LOCAL {
+  //The rest is only if actually starts with "stat:sum:":
+
+  //Error message in case of syntax errors (NULL means OK):
+  const char * errmsg;
+  double value;//-1 or >=0 (never inf or nan)
+  char key[MCPL_STATSUMKEY_MAXLENGTH+1];
+} mcpl_internal_statsum_t;
+
+#ifdef _WIN32
+#  define MCPL_FSEEK( fh, pos)  _fseeki64(fh,(__int64)(pos), SEEK_SET)
+#  define MCPL_FSEEK_CUR( fh, pos)  _fseeki64(fh,(__int64)(pos), SEEK_CUR)
+#  define MCPL_FSEEK_END( fh)  _fseeki64(fh,(__int64)(0), SEEK_END)
+#  define MCPL_FTELL( fh)  _ftelli64(fh)
+#else
+#  define MCPL_FSEEK( fh, pos) fseek(fh,(ssize_t)(pos), SEEK_SET)
+#  define MCPL_FSEEK_CUR( fh, pos) fseek(fh,(ssize_t)(pos), SEEK_CUR)
+#  define MCPL_FSEEK_END( fh) fseek(fh,(ssize_t)(0), SEEK_END)
+#  define MCPL_FTELL( fh) ftell(fh)
+#endif
+
+typedef struct MCPL_LOCAL {
+  //Byte offsets of fields within a particle record (-1 if absent):
+  int fpsize, pol, pos, packekindir, time, weight, pdgcode, userflags;
+  unsigned particle_size;
+} mcpl_internal_layout_t;
+
+//Particle filter expressions (mcpl_filter.c) and zone-map indices
+//(mcpl_index.c):
+
+typedef enum { MCPLIMP_FLD_PDGCODE, MCPLIMP_FLD_EKIN,
+               MCPLIMP_FLD_X, MCPLIMP_FLD_Y, MCPLIMP_FLD_Z,
+               MCPLIMP_FLD_UX, MCPLIMP_FLD_UY, MCPLIMP_FLD_UZ,
+               MCPLIMP_FLD_TIME, MCPLIMP_FLD_WEIGHT,
+               MCPLIMP_FLD_POLX, MCPLIMP_FLD_POLY, MCPLIMP_FLD_POLZ,
+               MCPLIMP_FLD_USERFLAGS, MCPLIMP_NFIELDS } mcpl_internal_field_t;
+
+typedef enum { MCPLIMP_FOP_FIELD, MCPLIMP_FOP_CONST,
+               MCPLIMP_FOP_NEG, MCPLIMP_FOP_NOT, MCPLIMP_FOP_ABS,
+               MCPLIMP_FOP_ADD, MCPLIMP_FOP_SUB, MCPLIMP_FOP_MUL, MCPLIMP_FOP_DIV,
+               MCPLIMP_FOP_LT, MCPLIMP_FOP_LE, MCPLIMP_FOP_GT, MCPLIMP_FOP_GE,
+               MCPLIMP_FOP_EQ, MCPLIMP_FOP_NE,
+               MCPLIMP_FOP_AND, MCPLIMP_FOP_OR } mcpl_internal_fop_t;
+
+typedef struct MCPL_LOCAL {
+  mcpl_internal_fop_t op;
+  mcpl_internal_field_t field;//for MCPLIMP_FOP_FIELD
+  double value;//for MCPLIMP_FOP_CONST
+} mcpl_internal_fltinstr_t;
+
+#define MCPLIMP_FILTER_MAXCODE 256
+
+typedef struct MCPL_LOCAL {
+  mcpl_internal_fltinstr_t code[MCPLIMP_FILTER_MAXCODE];
+  unsigned ncode;
+  unsigned stacksize;//maximum stack depth needed during evaluation
+  unsigned fieldmask;//bit (1<<field) set for each field used
+} mcpl_internal_filter_t;
+
+//Buffers needed for evaluating a filter on blocks of up to blocksize particles
+//(one per thread if used concurrently):
+typedef struct MCPL_LOCAL {
+  unsigned blocksize;
+  double * cols[MCPLIMP_NFIELDS];//decoded particle data (null if not needed)
+  double * stack;//stacksize * blocksize
+  const double ** stackptr;//stacksize
+  unsigned char * pass;//blocksize
+} mcpl_internal_filtereval_t;
+
+#define MCPLIMP_INDEX_BLOCKSIZE 65536
+
+//Flags indicating which blocks might contain particles passing the filter:
+typedef struct MCPL_LOCAL {
+  uint64_t nblocks;
+  uint64_t ncandidates;
+  unsigned char * candidate;
+} mcpl_internal_blockselection_t;
+
+//Filter applied to particles returned by mcpl_read (see mcpl_set_filter):
+typedef struct MCPL_LOCAL {
+  mcpl_internal_filter_t filter;
+  mcpl_internal_filtereval_t feval;
+  int has_blocks;
+  mcpl_internal_blockselection_t blocks;
+} mcpl_internal_selection_t;
+
+//Sorting (mcpl_sort.c):
+
+#define MCPLIMP_SORT_MAXKEYS 4
+
+//Particles can also be sorted along a space-filling curve (Morton or Hilbert),
+//based on their positions quantised into a grid of 2^17 cells along each axis
+//within the bounding box of all particles. The resulting 51 bit keys can be
+//represented exactly as doubles. Such files get an embedded blob with the range
+//of keys in each block of particles, which is used by mcpl_query_box to only
+//read blocks which might contain particles inside a given box.
+
+#define MCPLIMP_SFC_NONE 0
+#define MCPLIMP_SFC_MORTON 1
+#define MCPLIMP_SFC_HILBERT 2
+#define MCPLIMP_SFC_BITS 17
+#define MCPLIMP_SFC_MAXCELL ( ( 1u << MCPLIMP_SFC_BITS ) - 1 )
+#define MCPLIMP_SFC_BLOCKSIZE 4096
+#define MCPLIMP_SFC_MAGIC "MCPLSFC1"
+#define MCPLIMP_SFC_HDRSIZE 88
+
+typedef struct MCPL_LOCAL {
+  int curve;
+  double lo[3];
+  double scale[3];//cells per unit length (0 if all values are identical)
+} mcpl_internal_sfc_t;
+
+typedef struct MCPL_LOCAL {
+  unsigned nkeys;
+  mcpl_internal_field_t fields[MCPLIMP_SORT_MAXKEYS];
+  int descending[MCPLIMP_SORT_MAXKEYS];
+  mcpl_internal_sfc_t sfc;//if sfc.curve is set, nkeys is 1 and fields unused
+} mcpl_internal_sortspec_t;
+
+//Implemented in mcpl.c:
+MCPL_LOCAL void mcpl_print( const char * msg );
+MCPL_LOCAL void mcpl_error(const char * msg);
+MCPL_LOCAL char * mcpl_internal_malloc(size_t n);
+MCPL_LOCAL char * mcpl_internal_calloc(size_t num, size_t size);
+MCPL_LOCAL void * mcpl_internal_realloc( void* mem, size_t new_size);
+MCPL_LOCAL int mcpl_internal_fakeconstantversion( int enable );
+MCPL_LOCAL FILE * mcpl_internal_fopen( const char * filename, const char * mode );
+MCPL_LOCAL void mcpl_internal_transfer_metadata( mcpl_file_t source,
+                                                 mcpl_outfile_t target,
+                                                 const char * skipblobkey );
+MCPL_LOCAL void mcpl_internal_statsum_parse_or_emit_err( const char * comment,
+                                                         mcpl_internal_statsum_t* res );
+MCPL_LOCAL void mcpl_unitvect_pack_adaptproj(const double* in, double* out);
+MCPL_LOCAL void mcpl_unitvect_unpack_adaptproj( const double* in, double* out );
+MCPL_LOCAL void mcpl_unitvect_unpack_oct(const double* in, double* out);
+MCPL_LOCAL void mcpl_internal_serialise_particle( const mcpl_particle_t* particle,
+                                                  const mcpl_outfileinternal_t * f,
+                                                  char * pbuf );
+MCPL_LOCAL const char * mcpl_internal_blobdata( mcpl_fileinternal_t * f,
+                                                uint32_t i );
+MCPL_LOCAL const mcpl_particle_t* mcpl_internal_read( mcpl_fileinternal_t * f );
+MCPL_LOCAL void mcpl_internal_decode_particle( const mcpl_fileinternal_t * f,
+                                               const char * pbuf,
+                                               mcpl_particle_t * p );
+MCPL_LOCAL unsigned mcpl_internal_read_raw_particles( mcpl_fileinternal_t * f,
+                                                      char * buf, unsigned n );
+MCPL_LOCAL void mcpl_internal_write_raw_particles( mcpl_outfileinternal_t * f,
+                                                   const char * buf, unsigned n );
+MCPL_LOCAL void mcpl_internal_layout_init( mcpl_internal_layout_t * l,
+                                           int singleprec, int pol,
+                                           int universalweight,
+                                           int universalpdgcode,
+                                           int userflags );
+MCPL_LOCAL void mcpl_internal_delete_file( const char * filename );
+
+//Implemented in mcpl_threads.c:
+#ifndef MCPL_NO_THREADS
+MCPL_LOCAL void mcpl_internal_thread_create( mcpl_internal_thread_t * t,
+                                             void (*fct)(void*), void * arg );
+MCPL_LOCAL void mcpl_internal_thread_join( mcpl_internal_thread_t * t );
+#endif
+MCPL_LOCAL unsigned mcpl_internal_resolve_nthreads( unsigned nthreads );
+MCPL_LOCAL uint64_t mcpl_internal_extract_particles( mcpl_file_t fi,
+                                                     mcpl_outfile_t fo,
+                                                     uint64_t nmax,
+                                                     const mcpl_internal_filter_t * filter,
+                                                     unsigned nthreads );
+
+//Implemented in mcpl_filter.c:
+MCPL_LOCAL int mcpl_internal_field_lookup( const char * c, size_t n );
+MCPL_LOCAL int mcpl_internal_filter_compile( const char * expr,
+                                             mcpl_internal_filter_t * flt,
+                                             char * errmsg, size_t lerrmsg );
+MCPL_LOCAL void mcpl_internal_filtereval_init( mcpl_internal_filtereval_t * e,
+                                               const mcpl_internal_filter_t * flt,
+                                               unsigned blocksize );
+MCPL_LOCAL void mcpl_internal_filtereval_dealloc( mcpl_internal_filtereval_t * e );
+MCPL_LOCAL double mcpl_internal_loadfp( int singleprec, const char * ptr );
+MCPL_LOCAL void mcpl_internal_filtereval_decode( mcpl_internal_filtereval_t * e,
+                                                 const mcpl_fileinternal_t * f,
+                                                 const char * raw, unsigned n );
+MCPL_LOCAL unsigned mcpl_internal_filtereval_run( mcpl_internal_filtereval_t * e,
+                                                  const mcpl_internal_filter_t * flt,
+                                                  unsigned n );
+MCPL_LOCAL unsigned mcpl_internal_filtereval_compact( const mcpl_internal_filtereval_t * e,
+                                                      char * raw, unsigned psize,
+                                                      unsigned n );
+MCPL_LOCAL void mcpl_internal_filter_add_pdgcode_select( mcpl_internal_filter_t * flt,
+                                                         int32_t pdgcode_select );
+MCPL_LOCAL void mcpl_internal_filtereval_setparticle( mcpl_internal_filtereval_t * e,
+                                                      const mcpl_particle_t * p );
+MCPL_LOCAL void mcpl_internal_selection_free( void * vsel );
+MCPL_LOCAL const mcpl_particle_t* mcpl_internal_read_selected( mcpl_fileinternal_t * f );
+
+//Implemented in mcpl_index.c:
+MCPL_LOCAL int mcpl_internal_blockselection_init( mcpl_internal_blockselection_t * bs,
+                                                  mcpl_fileinternal_t * f,
+                                                  const mcpl_internal_filter_t * flt );
+MCPL_LOCAL unsigned mcpl_internal_read_raw_candidates( mcpl_fileinternal_t * f,
+                                                       const mcpl_internal_blockselection_t * bs,
+                                                       char * buf, unsigned n,
+                                                       unsigned * nconsumed );
+
+//Implemented in mcpl_sort.c:
+MCPL_LOCAL int mcpl_internal_sortspec_parse( const char * str,
+                                             mcpl_internal_sortspec_t * spec,
+                                             char * errmsg, size_t lerrmsg );
+
+//Implemented in mcpl_text.c:
+MCPL_LOCAL void mcpl_internal_print_json_header( const char * filename );
+MCPL_LOCAL void mcpl_internal_write_text( mcpl_file_t fi, FILE * fout,
+                                          unsigned nthreads );
+MCPL_LOCAL mcpl_outfile_t mcpl_internal_read_text( const char * infile,
+                                                   const char * outfile,
+                                                   unsigned nthreads );
+
+#endif
@@ -0,0 +1,362 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Random sampling of particles and rebalancing of particle weights.
+
+#include "mcpl_internal.h"
+
+//Simple and fast pseudo-random number generator (SplitMix64), giving the same
+//results on all platforms:
+typedef struct MCPL_LOCAL {
+  uint64_t state;
+} mcpl_internal_rng_t;
+
+MCPL_LOCAL void mcpl_internal_rng_seed( mcpl_internal_rng_t * rng, uint64_t seed )
+{
+  rng->state = seed;
+}
+
+MCPL_LOCAL uint64_t mcpl_internal_rng_next( mcpl_internal_rng_t * rng )
+{
+  uint64_t z = ( rng->state += UINT64_C(0x9e3779b97f4a7c15) );
+  z = ( z ^ ( z >> 30 ) ) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = ( z ^ ( z >> 27 ) ) * UINT64_C(0x94d049bb133111eb);
+  return z ^ ( z >> 31 );
+}
+
+//Uniformly distributed integer in [0,n) for n>0 (rejecting values which would
+//otherwise introduce a modulo bias):
+MCPL_LOCAL uint64_t mcpl_internal_rng_below( mcpl_internal_rng_t * rng, uint64_t n )
+{
+  const uint64_t threshold = ( (uint64_t)0 - n ) % n;
+  for (;;) {
+    uint64_t r = mcpl_internal_rng_next( rng );
+    if ( r >= threshold )
+      return r % n;
+  }
+}
+
+//Uniformly distributed number in [0,1):
+MCPL_LOCAL double mcpl_internal_rng_uniform( mcpl_internal_rng_t * rng )
+{
+  return ( mcpl_internal_rng_next( rng ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+MCPL_LOCAL int mcpl_internal_uint64_cmp( const void * va, const void * vb )
+{
+  uint64_t a = *(const uint64_t *)va;
+  uint64_t b = *(const uint64_t *)vb;
+  return ( a == b ? 0 : ( a < b ? -1 : 1 ) );
+}
+
+//Draw k different indices in [0,n) (k<=n) uniformly at random, returned in
+//ascending order:
+MCPL_LOCAL uint64_t * mcpl_internal_sample_indices( mcpl_internal_rng_t * rng,
+                                                    uint64_t n, uint64_t k )
+{
+  uint64_t * idx = (uint64_t*)mcpl_internal_malloc( sizeof(uint64_t) * ( k ? k : 1 ) );
+  uint64_t nidx = 0;
+  if ( k > n / 16 ) {
+    //Selection sampling (Knuth's "Algorithm S"), visiting all indices:
+    for ( uint64_t i = 0; nidx < k; ++i )
+      if ( mcpl_internal_rng_below( rng, n - i ) < k - nidx )
+        idx[nidx++] = i;
+    return idx;
+  }
+  //Draw random indices, sort them and remove duplicates, and repeat for the
+  //missing ones (a few at most, since k is small compared to n):
+  while ( nidx < k ) {
+    for ( uint64_t i = nidx; i < k; ++i )
+      idx[i] = mcpl_internal_rng_below( rng, n );
+    qsort( idx, k, sizeof(uint64_t), mcpl_internal_uint64_cmp );
+    nidx = 0;
+    for ( uint64_t i = 0; i < k; ++i )
+      if ( !nidx || idx[i] != idx[nidx-1] )
+        idx[nidx++] = idx[i];
+  }
+  return idx;
+}
+
+mcpl_outfile_t mcpl_sample_file( const char * infile, const char * outfile,
+                                 uint64_t nsample, uint64_t seed )
+{
+  mcpl_file_t fi = mcpl_open_file( infile );
+  mcpl_outfile_t fo = mcpl_create_outfile( outfile );
+  mcpl_transfer_metadata( fi, fo );
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  mcpl_outfileinternal_t * ft = (mcpl_outfileinternal_t *)fo.internal;
+  const uint64_t nparticles = fs->nparticles;
+  if ( nsample > nparticles )
+    nsample = nparticles;
+  if ( nsample < nparticles )
+    mcpl_hdr_scale_stat_sums( fo, ( nsample
+                                    ? (double)nsample / (double)nparticles
+                                    : -1.0 ) );
+
+  mcpl_internal_rng_t rng;
+  mcpl_internal_rng_seed( &rng, seed );
+  uint64_t * idx = mcpl_internal_sample_indices( &rng, nparticles, nsample );
+
+  int blockwise = ( fs->format_version == MCPL_FORMATVERSION
+                    && ft->opt_signature == fs->opt_signature
+                    && ft->particle_size == fs->particle_size
+                    && ft->opt_universalpdgcode == fs->opt_universalpdgcode
+                    && ft->opt_universalweight == fs->opt_universalweight );
+  if ( !blockwise ) {
+    //Older formats, transfer one particle at a time:
+    for ( uint64_t i = 0; i < nsample; ++i ) {
+      mcpl_seek( fi, idx[i] );
+      if ( !mcpl_read( fi ) )
+        mcpl_error("Unexpected end of file while sampling particles");
+      mcpl_transfer_last_read_particle( fi, fo );
+    }
+  } else {
+    //Nearby indices are coalesced into a single read of raw particle data,
+    //from which the selected particles are picked. Larger gaps are skipped by
+    //seeking (which for gzipped files still means a single streaming pass
+    //through the file, but without copying the data):
+    const unsigned psize = fs->particle_size;
+    const unsigned maxspan = 16384;
+    const uint64_t maxgap = ( fs->filegz ? maxspan : 1 + 65536 / psize );
+    char * buf = mcpl_internal_malloc( (size_t)maxspan * psize );
+    char * outbuf = mcpl_internal_malloc( (size_t)maxspan * psize );
+    mcpl_internal_write_raw_particles( ft, NULL, 0 );//ensure header is written
+    uint64_t i = 0;
+    while ( i < nsample ) {
+      const uint64_t first = idx[i];
+      uint64_t j = i + 1;
+      while ( j < nsample && idx[j] - first < maxspan && idx[j] - idx[j-1] <= maxgap )
+        ++j;
+      const unsigned span = (unsigned)( idx[j-1] - first + 1 );
+      mcpl_seek( fi, first );
+      if ( mcpl_internal_read_raw_particles( fs, buf, span ) != span )
+        mcpl_error("Unexpected end of file while sampling particles");
+      unsigned nout = 0;
+      for ( ; i < j; ++i )
+        memcpy( outbuf + (size_t)psize * nout++,
+                buf + (size_t)psize * ( idx[i] - first ), psize );
+      mcpl_internal_write_raw_particles( ft, outbuf, nout );
+    }
+    free( buf );
+    free( outbuf );
+  }
+  free( idx );
+  mcpl_close_file( fi );
+  return fo;
+}
+
+//Splitting and Russian roulette of particles towards a target weight. The
+//particles are processed in blocks, each with its own random number stream, so
+//results do not depend on the number of threads used:
+#define MCPLIMP_REBALANCE_BLOCKSIZE 16384
+#define MCPLIMP_REBALANCE_MAXSPLIT 1000
+
+MCPL_LOCAL void mcpl_internal_rng_seed_stream( mcpl_internal_rng_t * rng,
+                                               uint64_t seed, uint64_t stream )
+{
+  mcpl_internal_rng_seed( rng, seed ^ ( stream * UINT64_C(0xd1b54a32d192ed03) ) );
+  (void)mcpl_internal_rng_next( rng );
+}
+
+//Number of copies of a particle with weight w to write out (putting the weight
+//of each copy in *neww). Particles below the target weight are either killed
+//or kept with the target weight, while those above are split into copies of
+//approximately the target weight. Negative or non-finite weights are left
+//untouched:
+MCPL_LOCAL unsigned mcpl_internal_rebalance_weight( double w, double target,
+                                                    mcpl_internal_rng_t * rng,
+                                                    double * neww )
+{
+  *neww = w;
+  if ( !( w >= 0.0 ) || isinf(w) || w == target )
+    return 1;
+  if ( w < target ) {
+    *neww = target;
+    return ( mcpl_internal_rng_uniform( rng ) * target < w ? 1 : 0 );
+  }
+  double nsplit = floor( w / target + 0.5 );
+  if ( nsplit > MCPLIMP_REBALANCE_MAXSPLIT )
+    nsplit = MCPLIMP_REBALANCE_MAXSPLIT;
+  *neww = w / nsplit;
+  return (unsigned)nsplit;
+}
+
+MCPL_LOCAL void mcpl_internal_storefp( int singleprec, char * ptr, double v )
+{
+  if ( singleprec ) {
+    float vf = (float)v;
+    memcpy( ptr, &vf, sizeof(vf) );
+  } else {
+    memcpy( ptr, &v, sizeof(v) );
+  }
+}
+
+typedef struct MCPL_LOCAL {
+  //Input:
+  const char * in;
+  unsigned nin;
+  uint64_t iblock;
+  uint64_t seed;
+  double target;
+  unsigned psize;
+  int singleprec;
+  int weightoffset;
+  //Output (buffer reused between blocks):
+  char * out;
+  uint64_t nout;
+  uint64_t outcapacity;
+} mcpl_internal_rebalancepart_t;
+
+MCPL_LOCAL void mcpl_internal_rebalancepart_process( void * arg )
+{
+  mcpl_internal_rebalancepart_t * p = (mcpl_internal_rebalancepart_t*)arg;
+  mcpl_internal_rng_t rng;
+  mcpl_internal_rng_seed_stream( &rng, p->seed, p->iblock );
+  const unsigned psize = p->psize;
+  p->nout = 0;
+  for ( unsigned i = 0; i < p->nin; ++i ) {
+    const char * rec = p->in + (size_t)psize * i;
+    double neww;
+    unsigned n = mcpl_internal_rebalance_weight( mcpl_internal_loadfp( p->singleprec,
+                                                                       rec + p->weightoffset ),
+                                                 p->target, &rng, &neww );
+    if ( p->nout + n > p->outcapacity ) {
+      while ( p->nout + n > p->outcapacity )
+        p->outcapacity *= 2;
+      p->out = (char*)mcpl_internal_realloc( p->out, (size_t)p->outcapacity * psize );
+    }
+    for ( unsigned c = 0; c < n; ++c ) {
+      char * dst = p->out + (size_t)psize * p->nout++;
+      memcpy( dst, rec, psize );
+      mcpl_internal_storefp( p->singleprec, dst + p->weightoffset, neww );
+    }
+  }
+}
+
+MCPL_LOCAL void mcpl_internal_rebalanceparts_process( mcpl_internal_rebalancepart_t * parts,
+                                                      unsigned nparts )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nparts > 1 ) {
+    mcpl_internal_thread_t * threads
+      = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                       * nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_create( &threads[i], mcpl_internal_rebalancepart_process,
+                                   parts + i );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_join( &threads[i] );
+    free( threads );
+    return;
+  }
+#endif
+  for ( unsigned i = 0; i < nparts; ++i )
+    mcpl_internal_rebalancepart_process( parts + i );
+}
+
+mcpl_outfile_t mcpl_rebalance_weights( const char * infile, const char * outfile,
+                                       double target_weight, uint64_t seed,
+                                       unsigned nthreads )
+{
+  if ( !( target_weight > 0.0 ) || isinf(target_weight) )
+    mcpl_error("mcpl_rebalance_weights: target weight must be positive and finite");
+  nthreads = mcpl_internal_resolve_nthreads( nthreads );
+  mcpl_file_t fi = mcpl_open_file( infile );
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  if ( fs->opt_universalweight )
+    mcpl_error("mcpl_rebalance_weights: files with a universal weight are not supported");
+  mcpl_outfile_t fo = mcpl_create_outfile( outfile );
+  mcpl_transfer_metadata( fi, fo );
+  mcpl_outfileinternal_t * ft = (mcpl_outfileinternal_t *)fo.internal;
+  const uint64_t blocksize = MCPLIMP_REBALANCE_BLOCKSIZE;
+
+  int blockwise = ( fs->format_version == MCPL_FORMATVERSION
+                    && ft->opt_signature == fs->opt_signature
+                    && ft->particle_size == fs->particle_size
+                    && ft->opt_universalpdgcode == fs->opt_universalpdgcode
+                    && ft->opt_universalweight == fs->opt_universalweight );
+  if ( !blockwise ) {
+    //Older formats, one particle at a time (using the same random numbers as
+    //below, so results are identical to those for an up to date file):
+    mcpl_internal_rng_t rng;
+    mcpl_internal_rng_seed_stream( &rng, seed, 0 );
+    mcpl_particle_t pcopy;
+    const mcpl_particle_t * p;
+    uint64_t idx = 0;
+    while ( ( p = mcpl_read( fi ) ) ) {
+      if ( idx && idx % blocksize == 0 )
+        mcpl_internal_rng_seed_stream( &rng, seed, idx / blocksize );
+      ++idx;
+      pcopy = *p;
+      unsigned n = mcpl_internal_rebalance_weight( p->weight, target_weight,
+                                                   &rng, &pcopy.weight );
+      for ( unsigned c = 0; c < n; ++c )
+        mcpl_add_particle( fo, &pcopy );
+    }
+    mcpl_close_file( fi );
+    return fo;
+  }
+
+  //Read chunks of raw particle data, with one block per thread, and write out
+  //the results of each block in order:
+  mcpl_internal_layout_t l;
+  mcpl_internal_layout_init( &l, ft->opt_singleprec, ft->opt_polarisation,
+                             0, ft->opt_universalpdgcode != 0,
+                             ft->opt_userflags );
+  const unsigned psize = fs->particle_size;
+  char * buf = mcpl_internal_malloc( (size_t)blocksize * nthreads * psize );
+  mcpl_internal_rebalancepart_t * parts
+    = (mcpl_internal_rebalancepart_t*)mcpl_internal_calloc( nthreads,
+                                                            sizeof(mcpl_internal_rebalancepart_t) );
+  for ( unsigned i = 0; i < nthreads; ++i ) {
+    parts[i].in = buf + (size_t)blocksize * i * psize;
+    parts[i].seed = seed;
+    parts[i].target = target_weight;
+    parts[i].psize = psize;
+    parts[i].singleprec = ft->opt_singleprec;
+    parts[i].weightoffset = l.weight;
+    parts[i].outcapacity = 2 * blocksize;
+    parts[i].out = mcpl_internal_malloc( (size_t)parts[i].outcapacity * psize );
+  }
+  mcpl_internal_write_raw_particles( ft, NULL, 0 );//ensure header is written
+  uint64_t iblock = 0;
+  for (;;) {
+    unsigned nread = mcpl_internal_read_raw_particles( fs, buf,
+                                                      (unsigned)( blocksize * nthreads ) );
+    if ( !nread )
+      break;
+    unsigned nparts = 0;
+    for ( unsigned offset = 0; offset < nread; offset += (unsigned)blocksize ) {
+      mcpl_internal_rebalancepart_t * p = &parts[nparts++];
+      p->nin = ( nread - offset < blocksize ? nread - offset : (unsigned)blocksize );
+      p->iblock = iblock++;
+    }
+    mcpl_internal_rebalanceparts_process( parts, nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_write_raw_particles( ft, parts[i].out, parts[i].nout );
+  }
+  for ( unsigned i = 0; i < nthreads; ++i )
+    free( parts[i].out );
+  free( parts );
+  free( buf );
+  mcpl_close_file( fi );
+  return fo;
+}
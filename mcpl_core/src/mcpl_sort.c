@@ -0,0 +1,951 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Sorting of particles (including along space-filling curves) and spatial
+//queries.
+
+#include "mcpl_internal.h"
+
+//Sorting of particles by one or more fields, using an external merge sort in
+//bounded memory: Chunks of raw particle records are read into memory, split
+//into one part per thread, and each part is sorted by a separate thread. If
+//everything fits in a single chunk, the sorted parts are merged directly into
+//the output file. Otherwise the parts of each chunk are merged into a temporary
+//"run" file next to the output file, and the run files are finally merged into
+//the output file. At most MCPLIMP_SORT_MAXFANIN run files are open and merged
+//at a time, so when there are more runs, some of them are first merged into
+//intermediate run files. The original position of each particle is used as the
+//final sort key, making the result independent of the number of threads and
+//memory used.
+
+#define MCPLIMP_SORT_DEFAULT_MEMORY_MB 512
+#define MCPLIMP_SORT_MAXFANIN 64
+
+//Monotonic mapping of coordinates to grid cells (NaN maps to the last cell):
+MCPL_LOCAL uint32_t mcpl_internal_sfc_cell( double v, double lo, double scale )
+{
+  if ( v != v )
+    return MCPLIMP_SFC_MAXCELL;
+  if ( !scale )
+    return 0;
+  double c = ( v - lo ) * scale;
+  if ( !( c > 0.0 ) )
+    return 0;
+  if ( c >= (double)MCPLIMP_SFC_MAXCELL )
+    return MCPLIMP_SFC_MAXCELL;
+  return (uint32_t)c;
+}
+
+//Spread the lower 17 bits of v out to every third bit:
+MCPL_LOCAL uint64_t mcpl_internal_sfc_spread( uint32_t v )
+{
+  uint64_t x = v & MCPLIMP_SFC_MAXCELL;
+  x = ( x | ( x << 32 ) ) & UINT64_C(0x001f00000000ffff);
+  x = ( x | ( x << 16 ) ) & UINT64_C(0x001f0000ff0000ff);
+  x = ( x | ( x << 8 ) ) & UINT64_C(0x100f00f00f00f00f);
+  x = ( x | ( x << 4 ) ) & UINT64_C(0x10c30c30c30c30c3);
+  x = ( x | ( x << 2 ) ) & UINT64_C(0x1249249249249249);
+  return x;
+}
+
+//Curve key of a grid cell. For both curves, all cells inside an aligned cube
+//of 2^L cells along each axis share the same upper 3*(17-L) bits of the key.
+MCPL_LOCAL uint64_t mcpl_internal_sfc_cellkey( int curve, const uint32_t * cell )
+{
+  uint32_t c[3] = { cell[0], cell[1], cell[2] };
+  if ( curve == MCPLIMP_SFC_HILBERT ) {
+    //Transform to the "transposed" Hilbert index (J. Skilling, "Programming
+    //the Hilbert curve", AIP Conf. Proc. 707, 381 (2004)):
+    const uint32_t m = 1u << ( MCPLIMP_SFC_BITS - 1 );
+    for ( uint32_t q = m; q > 1; q >>= 1 ) {
+      uint32_t p = q - 1;
+      for ( int i = 0; i < 3; ++i ) {
+        if ( c[i] & q ) {
+          c[0] ^= p;
+        } else {
+          uint32_t t = ( c[0] ^ c[i] ) & p;
+          c[0] ^= t;
+          c[i] ^= t;
+        }
+      }
+    }
+    c[1] ^= c[0];
+    c[2] ^= c[1];
+    uint32_t t = 0;
+    for ( uint32_t q = m; q > 1; q >>= 1 )
+      if ( c[2] & q )
+        t ^= q - 1;
+    for ( int i = 0; i < 3; ++i )
+      c[i] ^= t;
+  }
+  return ( mcpl_internal_sfc_spread( c[0] ) << 2 )
+    | ( mcpl_internal_sfc_spread( c[1] ) << 1 )
+    | mcpl_internal_sfc_spread( c[2] );
+}
+
+MCPL_LOCAL uint64_t mcpl_internal_sfc_key( const mcpl_internal_sfc_t * sfc,
+                                           double x, double y, double z )
+{
+  uint32_t cell[3];
+  cell[0] = mcpl_internal_sfc_cell( x, sfc->lo[0], sfc->scale[0] );
+  cell[1] = mcpl_internal_sfc_cell( y, sfc->lo[1], sfc->scale[1] );
+  cell[2] = mcpl_internal_sfc_cell( z, sfc->lo[2], sfc->scale[2] );
+  return mcpl_internal_sfc_cellkey( sfc->curve, cell );
+}
+
+//Parse comma separated list of fields, each optionally prefixed with "-" for
+//descending order (or "+" for ascending order, which is the default):
+MCPL_LOCAL int mcpl_internal_sortspec_parse( const char * str,
+                                             mcpl_internal_sortspec_t * spec,
+                                             char * errmsg, size_t lerrmsg )
+{
+  spec->nkeys = 0;
+  memset( &spec->sfc, 0, sizeof(spec->sfc) );
+  const char * c = str;
+  for (;;) {
+    while ( *c == ' ' || *c == '\t' )
+      ++c;
+    int desc = 0;
+    if ( *c == '-' || *c == '+' ) {
+      desc = ( *c == '-' );
+      ++c;
+    }
+    size_t n = 0;
+    while ( c[n] && c[n] != ',' && c[n] != ' ' && c[n] != '\t' )
+      ++n;
+    int ifld = ( n ? mcpl_internal_field_lookup( c, n ) : -1 );
+    if ( ifld < 0 && ( ( n == 6 && strncmp( c, "morton", 6 ) == 0 )
+                       || ( n == 7 && strncmp( c, "hilbert", 7 ) == 0 ) ) ) {
+      spec->sfc.curve = ( n == 6 ? MCPLIMP_SFC_MORTON : MCPLIMP_SFC_HILBERT );
+      ifld = MCPLIMP_FLD_X;
+    }
+    if ( ifld < 0 ) {
+      snprintf( errmsg, lerrmsg, "Invalid sort keys (unknown field name at"
+                " position %i).", (int)( c - str ) + 1 );
+      return 0;
+    }
+    if ( spec->nkeys == MCPLIMP_SORT_MAXKEYS ) {
+      snprintf( errmsg, lerrmsg, "Invalid sort keys (at most %i fields can"
+                " be specified).", MCPLIMP_SORT_MAXKEYS );
+      return 0;
+    }
+    spec->fields[spec->nkeys] = (mcpl_internal_field_t)ifld;
+    spec->descending[spec->nkeys] = desc;
+    ++(spec->nkeys);
+    c += n;
+    while ( *c == ' ' || *c == '\t' )
+      ++c;
+    if ( !*c && spec->sfc.curve
+         && ( spec->nkeys != 1 || spec->descending[0] ) ) {
+      snprintf( errmsg, lerrmsg, "Invalid sort keys (morton or hilbert must"
+                " be specified alone and without prefix)." );
+      return 0;
+    }
+    if ( !*c )
+      return 1;
+    if ( *c != ',' ) {
+      snprintf( errmsg, lerrmsg, "Invalid sort keys (expected \",\" at"
+                " position %i).", (int)( c - str ) + 1 );
+      return 0;
+    }
+    ++c;
+  }
+}
+
+typedef struct MCPL_LOCAL {
+  double key[MCPLIMP_SORT_MAXKEYS];//unused keys are 0.0
+  uint64_t idx;//original position in file
+  const char * record;
+} mcpl_internal_sortentry_t;
+
+MCPL_LOCAL int mcpl_internal_sortentry_cmp( const void * va, const void * vb )
+{
+  const mcpl_internal_sortentry_t * a = (const mcpl_internal_sortentry_t *)va;
+  const mcpl_internal_sortentry_t * b = (const mcpl_internal_sortentry_t *)vb;
+  for ( int i = 0; i < MCPLIMP_SORT_MAXKEYS; ++i ) {
+    if ( a->key[i] != b->key[i] )
+      return a->key[i] < b->key[i] ? -1 : 1;
+  }
+  return ( a->idx == b->idx ? 0 : ( a->idx < b->idx ? -1 : 1 ) );
+}
+
+//Part of a chunk to be sorted by one thread:
+typedef struct MCPL_LOCAL {
+  const mcpl_internal_sortspec_t * spec;
+  const mcpl_fileinternal_t * fs;
+  const char * records;
+  unsigned n;
+  uint64_t firstidx;
+  mcpl_internal_sortentry_t * entries;
+} mcpl_internal_sortpart_t;
+
+MCPL_LOCAL void mcpl_internal_sortpart_process( void * arg )
+{
+  mcpl_internal_sortpart_t * part = (mcpl_internal_sortpart_t*)arg;
+  const mcpl_internal_sortspec_t * spec = part->spec;
+  const unsigned psize = part->fs->particle_size;
+  const unsigned n = part->n;
+  if ( !n )
+    return;
+  mcpl_internal_filter_t flt;
+  flt.ncode = 0;
+  flt.stacksize = 0;
+  flt.fieldmask = 0;
+  for ( unsigned ik = 0; ik < spec->nkeys; ++ik )
+    flt.fieldmask |= ( 1u << spec->fields[ik] );
+  if ( spec->sfc.curve )
+    flt.fieldmask = ( 1u << MCPLIMP_FLD_X ) | ( 1u << MCPLIMP_FLD_Y )
+      | ( 1u << MCPLIMP_FLD_Z );
+  mcpl_internal_filtereval_t feval;
+  mcpl_internal_filtereval_init( &feval, &flt, n );
+  mcpl_internal_filtereval_decode( &feval, part->fs, part->records, n );
+  mcpl_internal_sortentry_t * entries = part->entries;
+  for ( unsigned i = 0; i < n; ++i ) {
+    mcpl_internal_sortentry_t * e = entries + i;
+    for ( unsigned ik = 0; ik < MCPLIMP_SORT_MAXKEYS; ++ik ) {
+      double v = 0.0;
+      if ( ik == 0 && spec->sfc.curve ) {
+        v = (double)mcpl_internal_sfc_key( &spec->sfc,
+                                           feval.cols[MCPLIMP_FLD_X][i],
+                                           feval.cols[MCPLIMP_FLD_Y][i],
+                                           feval.cols[MCPLIMP_FLD_Z][i] );
+      } else if ( ik < spec->nkeys ) {
+        v = feval.cols[spec->fields[ik]][i];
+        if ( v != v )
+          v = INFINITY;//NaN sorts as infinity
+        if ( spec->descending[ik] )
+          v = -v;
+      }
+      e->key[ik] = v;
+    }
+    e->idx = part->firstidx + i;
+    e->record = part->records + (size_t)i * psize;
+  }
+  mcpl_internal_filtereval_dealloc( &feval );
+  qsort( entries, n, sizeof(mcpl_internal_sortentry_t),
+         mcpl_internal_sortentry_cmp );
+}
+
+MCPL_LOCAL void mcpl_internal_sortparts_process( mcpl_internal_sortpart_t * parts,
+                                                 unsigned nparts )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nparts > 1 ) {
+    mcpl_internal_thread_t * threads
+      = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                       * nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_create( &threads[i], mcpl_internal_sortpart_process,
+                                   parts + i );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_join( &threads[i] );
+    free( threads );
+    return;
+  }
+#endif
+  for ( unsigned i = 0; i < nparts; ++i )
+    mcpl_internal_sortpart_process( parts + i );
+}
+
+//Sorted sequence of entries (in memory or in a run file) used when merging:
+typedef struct MCPL_LOCAL {
+  mcpl_internal_sortentry_t cur;
+  //In memory:
+  const mcpl_internal_sortentry_t * entries;
+  uint64_t nleft;
+  //In run file:
+  FILE * runfile;
+  char * buf;
+  unsigned bufcap;
+  unsigned nbuf;
+  unsigned ibuf;
+} mcpl_internal_sortsrc_t;
+
+//Advance to next entry, returning 0 if none are left:
+MCPL_LOCAL int mcpl_internal_sortsrc_next( mcpl_internal_sortsrc_t * src,
+                                           unsigned nkeys, unsigned psize )
+{
+  if ( !src->nleft )
+    return 0;
+  --(src->nleft);
+  if ( !src->runfile ) {
+    src->cur = *(src->entries++);
+    return 1;
+  }
+  const size_t recsize = sizeof(double) * nkeys + sizeof(uint64_t) + psize;
+  if ( src->ibuf == src->nbuf ) {
+    src->nbuf = ( src->nleft + 1 < src->bufcap
+                  ? (unsigned)( src->nleft + 1 ) : src->bufcap );
+    if ( fread( src->buf, recsize, src->nbuf, src->runfile ) != src->nbuf )
+      mcpl_error("Errors encountered while reading temporary file.");
+    src->ibuf = 0;
+  }
+  const char * r = src->buf + recsize * ( src->ibuf++ );
+  memset( src->cur.key, 0, sizeof(src->cur.key) );
+  memcpy( src->cur.key, r, sizeof(double) * nkeys );
+  memcpy( &src->cur.idx, r + sizeof(double) * nkeys, sizeof(uint64_t) );
+  src->cur.record = r + sizeof(double) * nkeys + sizeof(uint64_t);
+  return 1;
+}
+
+//Merge sources into the output file ft, or into runfile (as records with
+//keys, idx and raw particle data) if ft is null. This uses a binary heap of
+//source indices ordered by their current entries. If blockkeys is not null, the
+//first and last (curve) key of each block of MCPLIMP_SFC_BLOCKSIZE particles
+//written to ft are recorded in it:
+MCPL_LOCAL void mcpl_internal_sort_merge( mcpl_internal_sortsrc_t * srcs,
+                                          unsigned nsrcs, unsigned nkeys,
+                                          unsigned psize,
+                                          mcpl_outfileinternal_t * ft,
+                                          FILE * runfile,
+                                          uint64_t * blockkeys )
+{
+  unsigned * heap = (unsigned*)mcpl_internal_malloc( sizeof(unsigned) * ( nsrcs ? nsrcs : 1 ) );
+  unsigned nheap = 0;
+  for ( unsigned i = 0; i < nsrcs; ++i )
+    if ( mcpl_internal_sortsrc_next( srcs + i, nkeys, psize ) )
+      heap[nheap++] = i;
+#define MCPLIMP_SORTHEAP_LESS(a,b) ( mcpl_internal_sortentry_cmp( &srcs[heap[a]].cur, \
+                                                                  &srcs[heap[b]].cur ) < 0 )
+  //heapify:
+  for ( unsigned k = nheap / 2; k-- > 0; ) {
+    unsigned i = k;
+    for (;;) {
+      unsigned m = i, l = 2 * i + 1, r = 2 * i + 2;
+      if ( l < nheap && MCPLIMP_SORTHEAP_LESS( l, m ) ) m = l;
+      if ( r < nheap && MCPLIMP_SORTHEAP_LESS( r, m ) ) m = r;
+      if ( m == i ) break;
+      unsigned tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+      i = m;
+    }
+  }
+  //Output is collected in a buffer, since records in run file buffers can be
+  //overwritten when advancing:
+  const unsigned outcap = 4096;
+  char * outbuf = mcpl_internal_malloc( (size_t)outcap * psize );
+  unsigned nout = 0;
+  uint64_t ntotal = 0;
+  while ( nheap ) {
+    mcpl_internal_sortsrc_t * src = srcs + heap[0];
+    if ( blockkeys ) {
+      uint64_t ib = ntotal / MCPLIMP_SFC_BLOCKSIZE;
+      if ( ntotal % MCPLIMP_SFC_BLOCKSIZE == 0 )
+        blockkeys[2*ib] = (uint64_t)src->cur.key[0];
+      blockkeys[2*ib+1] = (uint64_t)src->cur.key[0];
+    }
+    ++ntotal;
+    if ( !ft ) {
+      if ( fwrite( src->cur.key, sizeof(double) * nkeys, 1, runfile ) != 1
+           || fwrite( &src->cur.idx, sizeof(uint64_t), 1, runfile ) != 1
+           || fwrite( src->cur.record, psize, 1, runfile ) != 1 )
+        mcpl_error("Errors encountered while writing temporary file.");
+    } else {
+      memcpy( outbuf + (size_t)nout * psize, src->cur.record, psize );
+      if ( ++nout == outcap ) {
+        mcpl_internal_write_raw_particles( ft, outbuf, nout );
+        nout = 0;
+      }
+    }
+    if ( !mcpl_internal_sortsrc_next( src, nkeys, psize ) )
+      heap[0] = heap[--nheap];
+    unsigned i = 0;
+    for (;;) {
+      unsigned m = i, l = 2 * i + 1, r = 2 * i + 2;
+      if ( l < nheap && MCPLIMP_SORTHEAP_LESS( l, m ) ) m = l;
+      if ( r < nheap && MCPLIMP_SORTHEAP_LESS( r, m ) ) m = r;
+      if ( m == i ) break;
+      unsigned tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+      i = m;
+    }
+  }
+#undef MCPLIMP_SORTHEAP_LESS
+  if ( ft )
+    mcpl_internal_write_raw_particles( ft, outbuf, nout );
+  free( outbuf );
+  free( heap );
+}
+
+MCPL_LOCAL char * mcpl_internal_sort_tmpname( const char * outfn, unsigned i )
+{
+  size_t n = strlen( outfn ) + 32;
+  char * res = mcpl_internal_malloc( n );
+  snprintf( res, n, "%s.sorttmp%u", outfn, i );
+  return res;
+}
+
+//Sorted run of particles in a temporary file:
+typedef struct MCPL_LOCAL {
+  char * filename;
+  uint64_t n;
+} mcpl_internal_sortrun_t;
+
+//Merge runs into the output file ft or into runfile (see
+//mcpl_internal_sort_merge), splitting maxmem bytes between the read buffers of
+//the runs. The run files are deleted afterwards:
+MCPL_LOCAL void mcpl_internal_sort_mergeruns( mcpl_internal_sortrun_t * runs,
+                                              unsigned nruns, unsigned nkeys,
+                                              unsigned psize, uint64_t maxmem,
+                                              mcpl_outfileinternal_t * ft,
+                                              FILE * runfile,
+                                              uint64_t * blockkeys )
+{
+  const size_t recsize = sizeof(double) * nkeys + sizeof(uint64_t) + psize;
+  uint64_t bufcap = maxmem / ( recsize * ( nruns ? nruns : 1 ) );
+  if ( bufcap < 1 )
+    bufcap = 1;
+  if ( bufcap > 1048576 )
+    bufcap = 1048576;
+  mcpl_internal_sortsrc_t * srcs
+    = (mcpl_internal_sortsrc_t*)mcpl_internal_calloc( nruns ? nruns : 1,
+                                                      sizeof(mcpl_internal_sortsrc_t) );
+  for ( unsigned i = 0; i < nruns; ++i ) {
+    srcs[i].runfile = mcpl_internal_fopen( runs[i].filename, "rb" );
+    if ( !srcs[i].runfile )
+      mcpl_error("Unable to open temporary file!");
+    srcs[i].nleft = runs[i].n;
+    srcs[i].bufcap = (unsigned)bufcap;
+    srcs[i].buf = mcpl_internal_malloc( (size_t)bufcap * recsize );
+  }
+  mcpl_internal_sort_merge( srcs, nruns, nkeys, psize, ft, runfile, blockkeys );
+  for ( unsigned i = 0; i < nruns; ++i ) {
+    free( srcs[i].buf );
+    fclose( srcs[i].runfile );
+    mcpl_internal_delete_file( runs[i].filename );
+    free( runs[i].filename );
+  }
+  free( srcs );
+}
+
+//Find bounding box of all finite positions in the file (with a separate pass
+//over all particles, using buf for nbuf raw particle records) and setup the
+//grid of sfc accordingly:
+MCPL_LOCAL void mcpl_internal_sfc_findbounds( mcpl_file_t ff, mcpl_internal_sfc_t * sfc,
+                                              char * buf, unsigned nbuf )
+{
+  MCPLIMP_FILEDECODE;
+  double lo[3] = { INFINITY, INFINITY, INFINITY };
+  double hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+  mcpl_internal_filter_t flt;
+  flt.ncode = 0;
+  flt.stacksize = 0;
+  flt.fieldmask = ( 1u << MCPLIMP_FLD_X ) | ( 1u << MCPLIMP_FLD_Y )
+    | ( 1u << MCPLIMP_FLD_Z );
+  mcpl_internal_filtereval_t feval;
+  mcpl_internal_filtereval_init( &feval, &flt, nbuf );
+  mcpl_rewind( ff );
+  unsigned n;
+  while ( ( n = mcpl_internal_read_raw_particles( f, buf, nbuf ) ) ) {
+    mcpl_internal_filtereval_decode( &feval, f, buf, n );
+    for ( int k = 0; k < 3; ++k ) {
+      const double * col = feval.cols[MCPLIMP_FLD_X + k];
+      for ( unsigned i = 0; i < n; ++i ) {
+        double v = col[i];
+        if ( isnan(v) || isinf(v) )
+          continue;
+        if ( v < lo[k] )
+          lo[k] = v;
+        if ( v > hi[k] )
+          hi[k] = v;
+      }
+    }
+  }
+  mcpl_internal_filtereval_dealloc( &feval );
+  mcpl_rewind( ff );
+  for ( int k = 0; k < 3; ++k ) {
+    sfc->lo[k] = ( lo[k] <= hi[k] ? lo[k] : 0.0 );
+    double scale = ( lo[k] < hi[k]
+                     ? ( MCPLIMP_SFC_MAXCELL + 1.0 ) / ( hi[k] - lo[k] ) : 0.0 );
+    sfc->scale[k] = ( isinf(scale) || isnan(scale) ? 0.0 : scale );
+  }
+}
+
+//Spatial index blob layout (in native endianness, like the rest of the file):
+//
+//  char[8]     magic (MCPLIMP_SFC_MAGIC)
+//  uint32_t    curve (MCPLIMP_SFC_MORTON or MCPLIMP_SFC_HILBERT)
+//  uint32_t    number of particles per block (MCPLIMP_SFC_BLOCKSIZE)
+//  uint64_t    number of particles in file
+//  double[3]   lower corner of grid
+//  double[3]   grid cells per unit length along each axis
+//  uint32_t    number of bits per axis (MCPLIMP_SFC_BITS)
+//  uint32_t    unused (0)
+//  uint64_t    number of blocks
+//  uint64_t[]  first and last key for each block
+
+MCPL_LOCAL void mcpl_internal_sfc_encode( char * blob, const mcpl_internal_sfc_t * sfc,
+                                          uint64_t nparticles, const uint64_t * blockkeys )
+{
+  MCPL_STATIC_ASSERT( MCPLIMP_SFC_HDRSIZE == 88 );
+  uint32_t u32[2];
+  uint64_t nblocks = ( nparticles + MCPLIMP_SFC_BLOCKSIZE - 1 ) / MCPLIMP_SFC_BLOCKSIZE;
+  memcpy( blob, MCPLIMP_SFC_MAGIC, 8 );
+  u32[0] = (uint32_t)sfc->curve;
+  u32[1] = MCPLIMP_SFC_BLOCKSIZE;
+  memcpy( blob + 8, u32, 8 );
+  memcpy( blob + 16, &nparticles, 8 );
+  memcpy( blob + 24, sfc->lo, 24 );
+  memcpy( blob + 48, sfc->scale, 24 );
+  u32[0] = MCPLIMP_SFC_BITS;
+  u32[1] = 0;
+  memcpy( blob + 72, u32, 8 );
+  memcpy( blob + 80, &nblocks, 8 );
+  if ( nblocks )
+    memcpy( blob + MCPLIMP_SFC_HDRSIZE, blockkeys, 16 * nblocks );
+}
+
+//Decode spatial index blob, returning 0 if it is absent or invalid:
+MCPL_LOCAL int mcpl_internal_sfc_decode( mcpl_file_t ff, mcpl_internal_sfc_t * sfc,
+                                         unsigned * blocksize, uint64_t * nblocks,
+                                         const char ** blockkeys )
+{
+  uint32_t ldata;
+  const char * data;
+  if ( !mcpl_hdr_blob( ff, MCPLIMP_SFC_BLOBKEY, &ldata, &data ) )
+    return 0;
+  if ( ldata < MCPLIMP_SFC_HDRSIZE || memcmp( data, MCPLIMP_SFC_MAGIC, 8 ) != 0 )
+    return 0;
+  uint32_t u32[4];
+  uint64_t np;
+  memcpy( u32, data + 8, 8 );
+  memcpy( u32 + 2, data + 72, 8 );
+  memcpy( &np, data + 16, 8 );
+  memcpy( sfc->lo, data + 24, 24 );
+  memcpy( sfc->scale, data + 48, 24 );
+  memcpy( nblocks, data + 80, 8 );
+  sfc->curve = (int)u32[0];
+  *blocksize = u32[1];
+  *blockkeys = data + MCPLIMP_SFC_HDRSIZE;
+  if ( ( sfc->curve != MCPLIMP_SFC_MORTON && sfc->curve != MCPLIMP_SFC_HILBERT )
+       || !*blocksize || u32[2] != MCPLIMP_SFC_BITS
+       || np != mcpl_hdr_nparticles( ff )
+       || *nblocks != ( np + *blocksize - 1 ) / *blocksize
+       || ldata != MCPLIMP_SFC_HDRSIZE + 16 * *nblocks )
+    return 0;
+  return 1;
+}
+
+mcpl_outfile_t mcpl_sort_file( const char * infile, const char * outfile,
+                               const char * sortkeys, unsigned nthreads,
+                               unsigned max_memory_mb )
+{
+  mcpl_internal_sortspec_t spec;
+  char errmsg[256];
+  if ( !sortkeys || !mcpl_internal_sortspec_parse( sortkeys, &spec,
+                                                   errmsg, sizeof(errmsg) ) )
+    mcpl_error( sortkeys ? errmsg : "mcpl_sort_file called with null string" );
+  nthreads = mcpl_internal_resolve_nthreads( nthreads );
+  uint64_t maxmem = ( max_memory_mb ? max_memory_mb
+                      : MCPLIMP_SORT_DEFAULT_MEMORY_MB ) * (uint64_t)1048576;
+
+  mcpl_file_t fi = mcpl_open_file( infile );
+  mcpl_outfile_t fo = mcpl_create_outfile( outfile );
+  //A spatial index in the input file is only valid for the original particle
+  //order (a new one is added below when sorting along a space-filling curve):
+  mcpl_internal_transfer_metadata( fi, fo, MCPLIMP_SFC_BLOBKEY );
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  mcpl_outfileinternal_t * ft = (mcpl_outfileinternal_t *)fo.internal;
+  const char * outfn = mcpl_outfile_filename( fo );
+
+  //Raw particle records are sorted, so files in older formats are first
+  //transcoded into a temporary file:
+  char * convfn = NULL;
+  if ( !( fs->format_version == MCPL_FORMATVERSION
+          && ft->opt_signature == fs->opt_signature
+          && ft->particle_size == fs->particle_size
+          && ft->opt_universalpdgcode == fs->opt_universalpdgcode
+          && ft->opt_universalweight == fs->opt_universalweight ) ) {
+    char * fn = mcpl_internal_sort_tmpname( outfn, 0 );
+    mcpl_outfile_t fconv = mcpl_create_outfile( fn );
+    free( fn );
+    mcpl_transfer_metadata( fi, fconv );
+    mcpl_internal_extract_particles( fi, fconv, (uint64_t)-1, NULL, 1 );
+    const char * tmp = mcpl_outfile_filename( fconv );
+    convfn = mcpl_internal_malloc( strlen(tmp) + 1 );
+    memcpy( convfn, tmp, strlen(tmp) + 1 );
+    mcpl_close_outfile( fconv );
+    mcpl_close_file( fi );
+    fi = mcpl_open_file( convfn );
+    fs = (mcpl_fileinternal_t *)fi.internal;
+    if ( ft->opt_signature != fs->opt_signature
+         || ft->particle_size != fs->particle_size )
+      mcpl_error("logic error: unexpected particle format after conversion");
+  }
+  const unsigned psize = fs->particle_size;
+  const uint64_t nparticles = fs->nparticles;
+
+  //Number of particles per chunk (the filtereval columns also need memory):
+  const uint64_t cost = psize + sizeof(mcpl_internal_sortentry_t)
+    + sizeof(double) * ( spec.nkeys + 2 );
+  uint64_t nchunk64 = maxmem / cost;
+  if ( nchunk64 < 1024 )
+    nchunk64 = 1024;
+  if ( nchunk64 > nparticles )
+    nchunk64 = ( nparticles ? nparticles : 1 );
+  if ( nchunk64 > 0x7FFFFFFF )
+    nchunk64 = 0x7FFFFFFF;
+  const unsigned nchunk = (unsigned)nchunk64;
+  const int in_memory = ( nchunk64 >= nparticles );
+  if ( nthreads > nchunk )
+    nthreads = nchunk;
+
+  char * records = mcpl_internal_malloc( (size_t)nchunk * psize );
+  mcpl_internal_sortentry_t * entries
+    = (mcpl_internal_sortentry_t*)mcpl_internal_malloc( sizeof(mcpl_internal_sortentry_t)
+                                                        * nchunk );
+  mcpl_internal_sortpart_t * parts
+    = (mcpl_internal_sortpart_t*)mcpl_internal_calloc( nthreads,
+                                                       sizeof(mcpl_internal_sortpart_t) );
+  mcpl_internal_sortsrc_t * partsrcs
+    = (mcpl_internal_sortsrc_t*)mcpl_internal_calloc( nthreads,
+                                                      sizeof(mcpl_internal_sortsrc_t) );
+
+  //Sorting along a space-filling curve requires the bounding box of all
+  //positions, and a spatial index blob which will be filled after writing:
+  uint64_t * blockkeys = NULL;
+  uint64_t lsfcblob = 0;
+  if ( spec.sfc.curve ) {
+    mcpl_internal_sfc_findbounds( fi, &spec.sfc, records, nchunk );
+    const uint64_t nblocks = ( nparticles + MCPLIMP_SFC_BLOCKSIZE - 1 ) / MCPLIMP_SFC_BLOCKSIZE;
+    lsfcblob = MCPLIMP_SFC_HDRSIZE + 2 * sizeof(uint64_t) * nblocks;
+    if ( lsfcblob > UINT32_MAX )
+      mcpl_error("Too many particles for spatial index");
+    blockkeys = (uint64_t*)mcpl_internal_calloc( 2 * nblocks + 2, sizeof(uint64_t) );
+    char * blob = (char*)mcpl_internal_calloc( (size_t)lsfcblob, 1 );
+    mcpl_hdr_add_data( fo, MCPLIMP_SFC_BLOBKEY, (uint32_t)lsfcblob, blob );
+    free( blob );
+  }
+
+  unsigned nruns = 0;
+  unsigned nruns_alloc = 0;
+  unsigned ntmpfiles = 0;
+  mcpl_internal_sortrun_t * runs = NULL;
+  uint64_t idx = 0;
+  for (;;) {
+    unsigned n = mcpl_internal_read_raw_particles( fs, records, nchunk );
+    if ( !n )
+      break;
+    unsigned offset = 0;
+    for ( unsigned ip = 0; ip < nthreads; ++ip ) {
+      mcpl_internal_sortpart_t * part = parts + ip;
+      unsigned npart = n / nthreads + ( ip < n % nthreads ? 1 : 0 );
+      part->spec = &spec;
+      part->fs = fs;
+      part->records = records + (size_t)offset * psize;
+      part->n = npart;
+      part->firstidx = idx + offset;
+      part->entries = entries + offset;
+      partsrcs[ip].entries = part->entries;
+      partsrcs[ip].nleft = npart;
+      offset += npart;
+    }
+    mcpl_internal_sortparts_process( parts, nthreads );
+    idx += n;
+    if ( in_memory ) {
+      //All particles in a single chunk, merge directly into output:
+      mcpl_internal_sort_merge( partsrcs, nthreads, spec.nkeys, psize, ft, NULL,
+                                blockkeys );
+      break;
+    }
+    if ( nruns == nruns_alloc ) {
+      nruns_alloc = ( nruns_alloc ? 2 * nruns_alloc : 64 );
+      runs = (mcpl_internal_sortrun_t*)mcpl_internal_realloc( runs,
+                                                              sizeof(mcpl_internal_sortrun_t)
+                                                              * nruns_alloc );
+    }
+    runs[nruns].filename = mcpl_internal_sort_tmpname( outfn, ++ntmpfiles );
+    runs[nruns].n = n;
+    FILE * runfile = mcpl_internal_fopen( runs[nruns].filename, "wb" );
+    if ( !runfile )
+      mcpl_error("Unable to create temporary file!");
+    ++nruns;
+    mcpl_internal_sort_merge( partsrcs, nthreads, spec.nkeys, psize, NULL, runfile,
+                              NULL );
+    if ( fclose( runfile ) )
+      mcpl_error("Errors encountered while writing temporary file.");
+  }
+
+  if ( nruns ) {
+    //Release chunk memory, to use it for run file buffers instead:
+    free( records );
+    records = NULL;
+    free( entries );
+    entries = NULL;
+    char msg[256];
+    snprintf( msg, sizeof(msg), "MCPL: Sorting %" PRIu64 " particles using %u"
+              " temporary files.\n", nparticles, nruns );
+    mcpl_print( msg );
+    //Merge the oldest (and thus smallest) runs into intermediate runs until few
+    //enough are left. The first merge takes just enough runs that all later
+    //merges (including the final one) can use the full fan-in:
+    unsigned ifirst = 0;
+    const unsigned fanin = MCPLIMP_SORT_MAXFANIN;
+    while ( nruns - ifirst > fanin ) {
+      const unsigned nleft = nruns - ifirst;
+      const unsigned nmerge = ( ( nleft - 1 ) % ( fanin - 1 )
+                          ? ( nleft - 2 ) % ( fanin - 1 ) + 2 : fanin );
+      if ( nruns == nruns_alloc ) {
+        nruns_alloc *= 2;
+        runs = (mcpl_internal_sortrun_t*)mcpl_internal_realloc( runs,
+                                                                sizeof(mcpl_internal_sortrun_t)
+                                                                * nruns_alloc );
+      }
+      mcpl_internal_sortrun_t * newrun = runs + nruns;
+      newrun->filename = mcpl_internal_sort_tmpname( outfn, ++ntmpfiles );
+      newrun->n = 0;
+      for ( unsigned i = 0; i < nmerge; ++i )
+        newrun->n += runs[ifirst + i].n;
+      FILE * runfile = mcpl_internal_fopen( newrun->filename, "wb" );
+      if ( !runfile )
+        mcpl_error("Unable to create temporary file!");
+      ++nruns;
+      mcpl_internal_sort_mergeruns( runs + ifirst, nmerge, spec.nkeys, psize,
+                                    maxmem, NULL, runfile, NULL );
+      if ( fclose( runfile ) )
+        mcpl_error("Errors encountered while writing temporary file.");
+      ifirst += nmerge;
+    }
+    mcpl_internal_sort_mergeruns( runs + ifirst, nruns - ifirst, spec.nkeys,
+                                  psize, maxmem, ft, NULL, blockkeys );
+  }
+  mcpl_internal_write_raw_particles( ft, NULL, 0 );//ensure header is written
+
+  if ( blockkeys ) {
+    //The spatial index blob is the last entry in the header, so we can seek
+    //back and fill it:
+    char * blob = (char*)mcpl_internal_malloc( (size_t)lsfcblob );
+    mcpl_internal_sfc_encode( blob, &spec.sfc, nparticles, blockkeys );
+    const char * errwrite = "Errors encountered while writing spatial index.";
+    if ( fflush( ft->file ) )
+      mcpl_error( errwrite );
+    int64_t endpos = MCPL_FTELL( ft->file );
+    int64_t blobpos = endpos - (int64_t)( nparticles * psize ) - (int64_t)lsfcblob;
+    if ( endpos < 0 || blobpos <= 0 || MCPL_FSEEK( ft->file, blobpos )
+         || fwrite( blob, 1, (size_t)lsfcblob, ft->file ) != (size_t)lsfcblob
+         || MCPL_FSEEK_END( ft->file ) )
+      mcpl_error( errwrite );
+    free( blob );
+    free( blockkeys );
+  }
+
+  free( partsrcs );
+  free( runs );
+  free( parts );
+  free( entries );
+  free( records );
+  mcpl_close_file( fi );
+  if ( convfn ) {
+    mcpl_internal_delete_file( convfn );
+    free( convfn );
+  }
+  return fo;
+}
+
+//Ranges of curve keys (pairs of first and last key):
+typedef struct MCPL_LOCAL {
+  uint64_t * keys;
+  uint64_t n;
+  uint64_t nalloc;
+} mcpl_internal_sfcranges_t;
+
+MCPL_LOCAL void mcpl_internal_sfcranges_addcell( mcpl_internal_sfcranges_t * r,
+                                                 int curve, const uint32_t * cell,
+                                                 unsigned shift )
+{
+  if ( r->n == r->nalloc ) {
+    r->nalloc = ( r->nalloc ? 2 * r->nalloc : 256 );
+    r->keys = (uint64_t*)mcpl_internal_realloc( r->keys, 2 * sizeof(uint64_t) * r->nalloc );
+  }
+  uint32_t corner[3];
+  for ( int k = 0; k < 3; ++k )
+    corner[k] = cell[k] << shift;
+  const uint64_t mask = ( UINT64_C(1) << ( 3 * shift ) ) - 1;
+  uint64_t key = mcpl_internal_sfc_cellkey( curve, corner ) & ~mask;
+  r->keys[2*r->n] = key;
+  r->keys[2*r->n+1] = key | mask;
+  ++(r->n);
+}
+
+MCPL_LOCAL int mcpl_internal_sfcranges_cmp( const void * va, const void * vb )
+{
+  uint64_t a = *(const uint64_t *)va;
+  uint64_t b = *(const uint64_t *)vb;
+  return ( a == b ? 0 : ( a < b ? -1 : 1 ) );
+}
+
+//Find sorted and merged key ranges covering all grid cells within [cmin,cmax].
+//Starting from the entire grid, cells only partially inside are subdivided
+//level by level. When too many such cells are present, they are instead
+//included as a whole (which might include a few cells too many):
+MCPL_LOCAL void mcpl_internal_sfc_boxranges( int curve, const uint32_t * cmin,
+                                             const uint32_t * cmax,
+                                             mcpl_internal_sfcranges_t * res )
+{
+  const uint64_t maxpartial = 32768;
+  res->keys = NULL;
+  res->n = res->nalloc = 0;
+  uint32_t * cur = (uint32_t*)mcpl_internal_calloc( 3, sizeof(uint32_t) );
+  uint64_t ncur = 1;
+  for ( unsigned shift = MCPLIMP_SFC_BITS; ncur; --shift ) {
+    const int refine = ( ncur * 8 <= maxpartial );
+    uint32_t * next = ( refine
+                        ? (uint32_t*)mcpl_internal_malloc( 3 * 8 * sizeof(uint32_t) * ncur )
+                        : NULL );
+    uint64_t nnext = 0;
+    for ( uint64_t i = 0; i < ncur; ++i ) {
+      if ( !refine ) {
+        mcpl_internal_sfcranges_addcell( res, curve, cur + 3 * i, shift );
+        continue;
+      }
+      for ( unsigned ichild = 0; ichild < 8; ++ichild ) {
+        uint32_t child[3];
+        int outside = 0, inside = 1;
+        for ( int k = 0; k < 3; ++k ) {
+          child[k] = 2 * cur[3*i+k] + ( ( ichild >> k ) & 1 );
+          uint32_t c0 = child[k] << ( shift - 1 );
+          uint32_t c1 = c0 + ( ( 1u << ( shift - 1 ) ) - 1 );
+          if ( c1 < cmin[k] || c0 > cmax[k] )
+            outside = 1;
+          if ( c0 < cmin[k] || c1 > cmax[k] )
+            inside = 0;
+        }
+        if ( outside )
+          continue;
+        if ( inside ) {
+          mcpl_internal_sfcranges_addcell( res, curve, child, shift - 1 );
+        } else {
+          memcpy( next + 3 * nnext, child, sizeof(child) );
+          ++nnext;
+        }
+      }
+    }
+    free( cur );
+    cur = next;
+    ncur = nnext;
+  }
+  free( cur );
+  if ( !res->n )
+    return;
+  qsort( res->keys, res->n, 2 * sizeof(uint64_t), mcpl_internal_sfcranges_cmp );
+  uint64_t nmerged = 1;
+  for ( uint64_t i = 1; i < res->n; ++i ) {
+    uint64_t * last = res->keys + 2 * ( nmerged - 1 );
+    if ( res->keys[2*i] <= last[1] + 1 ) {
+      if ( res->keys[2*i+1] > last[1] )
+        last[1] = res->keys[2*i+1];
+    } else {
+      res->keys[2*nmerged] = res->keys[2*i];
+      res->keys[2*nmerged+1] = res->keys[2*i+1];
+      ++nmerged;
+    }
+  }
+  res->n = nmerged;
+}
+
+//Check if any of the (sorted and merged) ranges overlap [k0,k1]:
+MCPL_LOCAL int mcpl_internal_sfcranges_overlap( const mcpl_internal_sfcranges_t * r,
+                                                uint64_t k0, uint64_t k1 )
+{
+  //Find first range with last key >= k0:
+  uint64_t a = 0, b = r->n;
+  while ( a < b ) {
+    uint64_t m = a + ( b - a ) / 2;
+    if ( r->keys[2*m+1] < k0 )
+      a = m + 1;
+    else
+      b = m;
+  }
+  return a < r->n && r->keys[2*a] <= k1;
+}
+
+uint64_t mcpl_query_box( mcpl_file_t ff, const double * boxmin,
+                         const double * boxmax,
+                         void (*callback)( const mcpl_particle_t *, void * ),
+                         void * userdata )
+{
+  MCPLIMP_FILEDECODE;
+  for ( int k = 0; k < 3; ++k )
+    if ( !( boxmin[k] <= boxmax[k] ) )
+      return 0;
+
+  //Without a (valid) spatial index, all particles are simply read as a single
+  //block:
+  mcpl_internal_sfc_t sfc;
+  unsigned blocksize;
+  uint64_t nblocks;
+  const char * blockkeys;
+  mcpl_internal_sfcranges_t ranges;
+  ranges.keys = NULL;
+  ranges.n = 0;
+  int has_index = mcpl_internal_sfc_decode( ff, &sfc, &blocksize, &nblocks, &blockkeys );
+  if ( !has_index ) {
+    uint32_t ldata;
+    const char * data;
+    if ( mcpl_hdr_blob( ff, MCPLIMP_SFC_BLOBKEY, &ldata, &data ) )
+      mcpl_print("MCPL WARNING: Ignoring outdated or invalid spatial index.\n");
+    blocksize = 0;
+    nblocks = ( f->nparticles ? 1 : 0 );
+  } else {
+    uint32_t cmin[3], cmax[3];
+    for ( int k = 0; k < 3; ++k ) {
+      cmin[k] = mcpl_internal_sfc_cell( boxmin[k], sfc.lo[k], sfc.scale[k] );
+      cmax[k] = mcpl_internal_sfc_cell( boxmax[k], sfc.lo[k], sfc.scale[k] );
+    }
+    mcpl_internal_sfc_boxranges( sfc.curve, cmin, cmax, &ranges );
+  }
+
+  mcpl_internal_selection_t * sel = (mcpl_internal_selection_t*)f->selection;
+  const uint64_t origpos = f->current_particle_idx;
+  uint64_t nfound = 0;
+  for ( uint64_t ib = 0; ib < nblocks; ++ib ) {
+    uint64_t first = ( has_index ? ib * blocksize : 0 );
+    uint64_t last = ( has_index ? first + blocksize : f->nparticles );
+    if ( last > f->nparticles )
+      last = f->nparticles;
+    if ( has_index ) {
+      uint64_t k[2];
+      memcpy( k, blockkeys + 16 * ib, 16 );
+      if ( !mcpl_internal_sfcranges_overlap( &ranges, k[0], k[1] ) )
+        continue;
+    }
+    mcpl_seek( ff, first );
+    for ( uint64_t i = first; i < last; ++i ) {
+      const mcpl_particle_t * p = mcpl_internal_read( f );
+      if ( !p )
+        break;
+      int inside = 1;
+      for ( int k = 0; k < 3; ++k )
+        if ( !( p->position[k] >= boxmin[k] && p->position[k] <= boxmax[k] ) )
+          inside = 0;
+      if ( !inside )
+        continue;
+      if ( sel ) {
+        mcpl_internal_filtereval_setparticle( &sel->feval, p );
+        if ( !mcpl_internal_filtereval_run( &sel->feval, &sel->filter, 1 ) )
+          continue;
+      }
+      ++nfound;
+      callback( p, userdata );
+    }
+  }
+  free( ranges.keys );
+  mcpl_seek( ff, origpos );
+  return nfound;
+}
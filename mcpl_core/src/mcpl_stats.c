@@ -0,0 +1,685 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Collection and printing of particle statistics.
+
+#include "mcpl_internal.h"
+
+//Statistics of the particle data in a file, collected in a single pass (with
+//output equivalent to that of "pymcpltool --stats"). Blocks of particles are
+//decoded and summarised concurrently, and the summaries are combined in order,
+//so results do not depend on the number of threads. Histogram ranges are not
+//known in advance, so histograms start out with very narrow bins (of width
+//2^k, aligned to multiples of the width) and the bins are merged pairwise
+//whenever values fall outside the range which can be covered:
+#define MCPLIMP_STATS_BLOCKSIZE 16384
+#define MCPLIMP_STATS_NBINS 256
+#define MCPLIMP_STATS_MAXUNIQUE 10000
+
+static const int mcpl_internal_stats_fieldids[MCPL_STATS_NFIELDS]
+  = { MCPLIMP_FLD_EKIN, MCPLIMP_FLD_X, MCPLIMP_FLD_Y, MCPLIMP_FLD_Z,
+      MCPLIMP_FLD_UX, MCPLIMP_FLD_UY, MCPLIMP_FLD_UZ, MCPLIMP_FLD_TIME,
+      MCPLIMP_FLD_WEIGHT, MCPLIMP_FLD_POLX, MCPLIMP_FLD_POLY, MCPLIMP_FLD_POLZ };
+static const char * mcpl_internal_stats_names[MCPL_STATS_NFIELDS]
+  = { "ekin", "x", "y", "z", "ux", "uy", "uz", "time", "weight",
+      "polx", "poly", "polz" };
+static const char * mcpl_internal_stats_units[MCPL_STATS_NFIELDS]
+  = { "MeV", "cm", "cm", "cm", NULL, NULL, NULL, "ms", NULL, NULL, NULL, NULL };
+
+typedef struct MCPL_LOCAL {
+  //Moments (T is the sum of w*(x-mean)^2, which is numerically stable to
+  //accumulate also when mean>>rms):
+  double sumw, sumwx, T;
+  double min, max;
+  int nvalues;//whether any values were seen
+  //Histogram, with bins[i] covering [(lo+i)*2^k,(lo+i+1)*2^k) for lo<=i<=hi:
+  int hempty;
+  int k;
+  int64_t lo, hi;
+  double bins[MCPLIMP_STATS_NBINS];
+} mcpl_internal_fieldacc_t;
+
+MCPL_LOCAL void mcpl_internal_fieldacc_reset( mcpl_internal_fieldacc_t * a )
+{
+  a->sumw = a->sumwx = a->T = 0.0;
+  a->min = a->max = 0.0;
+  a->nvalues = 0;
+  a->hempty = 1;
+  a->k = 0;
+  a->lo = a->hi = 0;
+}
+
+MCPL_LOCAL int64_t mcpl_internal_floordiv2( int64_t i )
+{
+  return ( i - ( i & 1 ) ) / 2;
+}
+
+//Double the histogram bin widths:
+MCPL_LOCAL void mcpl_internal_fieldacc_coarsen( mcpl_internal_fieldacc_t * a )
+{
+  double tmp[MCPLIMP_STATS_NBINS];
+  const int64_t newlo = mcpl_internal_floordiv2( a->lo );
+  const int64_t newhi = mcpl_internal_floordiv2( a->hi );
+  memset( tmp, 0, sizeof(double) * (size_t)( newhi - newlo + 1 ) );
+  for ( int64_t i = a->lo; i <= a->hi; ++i )
+    tmp[ mcpl_internal_floordiv2( i ) - newlo ] += a->bins[ i - a->lo ];
+  memcpy( a->bins, tmp, sizeof(double) * (size_t)( newhi - newlo + 1 ) );
+  a->lo = newlo;
+  a->hi = newhi;
+  ++a->k;
+}
+
+//Move bins so the histogram starts at newlo (<=lo, with the result still
+//fitting in the available bins):
+MCPL_LOCAL void mcpl_internal_fieldacc_extendlo( mcpl_internal_fieldacc_t * a,
+                                                 int64_t newlo )
+{
+  const size_t d = (size_t)( a->lo - newlo );
+  if ( !d )
+    return;
+  memmove( a->bins + d, a->bins, sizeof(double) * (size_t)( a->hi - a->lo + 1 ) );
+  memset( a->bins, 0, sizeof(double) * d );
+  a->lo = newlo;
+}
+
+MCPL_LOCAL void mcpl_internal_fieldacc_hfill( mcpl_internal_fieldacc_t * a,
+                                              double x, double w )
+{
+  if ( isinf( x ) )
+    return;
+  if ( a->hempty ) {
+    //Start with bins narrow enough to resolve x well:
+    int e = 0;
+    if ( x != 0.0 )
+      (void)frexp( x, &e );
+    a->k = e - 40;
+    a->lo = a->hi = (int64_t)floor( ldexp( x, -a->k ) );
+    a->bins[0] = w;
+    a->hempty = 0;
+    return;
+  }
+  for (;;) {
+    double t = floor( ldexp( x, -a->k ) );
+    if ( fabs( t ) < 4.0e18 ) {
+      int64_t i = (int64_t)t;
+      if ( i >= a->lo && i - a->lo < MCPLIMP_STATS_NBINS ) {
+        if ( i > a->hi ) {
+          memset( a->bins + ( a->hi - a->lo + 1 ), 0,
+                  sizeof(double) * (size_t)( i - a->hi ) );
+          a->hi = i;
+        }
+        a->bins[ i - a->lo ] += w;
+        return;
+      }
+      if ( i < a->lo && a->hi - i < MCPLIMP_STATS_NBINS ) {
+        mcpl_internal_fieldacc_extendlo( a, i );
+        a->bins[0] += w;
+        return;
+      }
+    }
+    mcpl_internal_fieldacc_coarsen( a );
+  }
+}
+
+//Add values x (and weights w, if not NULL) to a (assumed empty):
+MCPL_LOCAL void mcpl_internal_fieldacc_fill( mcpl_internal_fieldacc_t * a,
+                                             const double * x,
+                                             const double * w, unsigned n )
+{
+  //Histogram and range (NaN values are ignored):
+  double sumw = 0.0;
+  double sumwx = 0.0;
+  for ( unsigned i = 0; i < n; ++i ) {
+    const double xi = x[i];
+    if ( isnan( xi ) )
+      continue;
+    if ( !a->nvalues ) {
+      a->min = a->max = xi;
+      a->nvalues = 1;
+    } else {
+      if ( xi < a->min ) a->min = xi;
+      if ( xi > a->max ) a->max = xi;
+    }
+    const double wi = ( w ? w[i] : 1.0 );
+    sumw += wi;
+    sumwx += wi * xi;
+    mcpl_internal_fieldacc_hfill( a, xi, wi );
+  }
+  if ( !sumw )
+    return;
+  //Variance, from values shifted by the mean for numerical stability:
+  const double mean = sumwx / sumw;
+  double sumws = 0.0;
+  double sumwss = 0.0;
+  for ( unsigned i = 0; i < n; ++i ) {
+    if ( isnan( x[i] ) )
+      continue;
+    const double wi = ( w ? w[i] : 1.0 );
+    const double s = x[i] - mean;
+    sumws += wi * s;
+    sumwss += wi * s * s;
+  }
+  a->sumw = sumw;
+  a->sumwx = sumwx;
+  a->T = sumwss - sumws * sumws / sumw;
+}
+
+//Add the contents of b to a (b might be modified):
+MCPL_LOCAL void mcpl_internal_fieldacc_merge( mcpl_internal_fieldacc_t * a,
+                                              mcpl_internal_fieldacc_t * b )
+{
+  if ( !b->nvalues )
+    return;
+  if ( !a->nvalues ) {
+    *a = *b;
+    return;
+  }
+  if ( b->min < a->min ) a->min = b->min;
+  if ( b->max > a->max ) a->max = b->max;
+  if ( b->sumw ) {
+    if ( !a->sumw ) {
+      a->T = b->T;
+    } else {
+      const double w1 = a->sumw;
+      const double w2 = b->sumw;
+      const double d = w2 * a->sumwx - w1 * b->sumwx;
+      a->T += b->T + d * d / ( w1 * w2 * ( w1 + w2 ) );
+    }
+    a->sumw += b->sumw;
+    a->sumwx += b->sumwx;
+  }
+  if ( b->hempty )
+    return;
+  if ( a->hempty ) {
+    a->hempty = 0;
+    a->k = b->k;
+    a->lo = b->lo;
+    a->hi = b->hi;
+    memcpy( a->bins, b->bins, sizeof(double) * (size_t)( b->hi - b->lo + 1 ) );
+    return;
+  }
+  while ( a->k < b->k )
+    mcpl_internal_fieldacc_coarsen( a );
+  while ( b->k < a->k )
+    mcpl_internal_fieldacc_coarsen( b );
+  while ( ( a->hi > b->hi ? a->hi : b->hi )
+          - ( a->lo < b->lo ? a->lo : b->lo ) >= MCPLIMP_STATS_NBINS ) {
+    mcpl_internal_fieldacc_coarsen( a );
+    mcpl_internal_fieldacc_coarsen( b );
+  }
+  if ( b->lo < a->lo )
+    mcpl_internal_fieldacc_extendlo( a, b->lo );
+  if ( b->hi > a->hi ) {
+    memset( a->bins + ( a->hi - a->lo + 1 ), 0,
+            sizeof(double) * (size_t)( b->hi - a->hi ) );
+    a->hi = b->hi;
+  }
+  for ( int64_t i = b->lo; i <= b->hi; ++i )
+    a->bins[ i - a->lo ] += b->bins[ i - b->lo ];
+}
+
+//Weighted counts of unique values (in a hash table with open addressing):
+typedef struct MCPL_LOCAL {
+  int64_t * keys;
+  double * counts;
+  unsigned char * used;
+  size_t capacity;//power of 2
+  size_t n;
+  int overflow;//too many unique values
+} mcpl_internal_freqtable_t;
+
+MCPL_LOCAL void mcpl_internal_freqtable_init( mcpl_internal_freqtable_t * t )
+{
+  t->capacity = 64;
+  t->n = 0;
+  t->overflow = 0;
+  t->keys = (int64_t*)mcpl_internal_malloc( sizeof(int64_t) * t->capacity );
+  t->counts = (double*)mcpl_internal_malloc( sizeof(double) * t->capacity );
+  t->used = (unsigned char*)mcpl_internal_calloc( t->capacity, 1 );
+}
+
+MCPL_LOCAL void mcpl_internal_freqtable_dealloc( mcpl_internal_freqtable_t * t )
+{
+  free( t->keys );
+  free( t->counts );
+  free( t->used );
+}
+
+MCPL_LOCAL void mcpl_internal_freqtable_clear( mcpl_internal_freqtable_t * t )
+{
+  memset( t->used, 0, t->capacity );
+  t->n = 0;
+  t->overflow = 0;
+}
+
+MCPL_LOCAL size_t mcpl_internal_freqtable_slot( const mcpl_internal_freqtable_t * t,
+                                                int64_t key )
+{
+  size_t i = (size_t)( ( (uint64_t)key * UINT64_C(0x9e3779b97f4a7c15) ) >> 32 );
+  for ( i &= ( t->capacity - 1 ); t->used[i] && t->keys[i] != key;
+        i = ( i + 1 ) & ( t->capacity - 1 ) ) {}
+  return i;
+}
+
+MCPL_LOCAL void mcpl_internal_freqtable_add( mcpl_internal_freqtable_t * t,
+                                             int64_t key, double count )
+{
+  if ( t->overflow )
+    return;
+  size_t i = mcpl_internal_freqtable_slot( t, key );
+  if ( t->used[i] ) {
+    t->counts[i] += count;
+    return;
+  }
+  if ( t->n == MCPLIMP_STATS_MAXUNIQUE ) {
+    t->overflow = 1;
+    return;
+  }
+  if ( 2 * ( t->n + 1 ) > t->capacity ) {
+    mcpl_internal_freqtable_t old = *t;
+    t->capacity *= 2;
+    t->keys = (int64_t*)mcpl_internal_malloc( sizeof(int64_t) * t->capacity );
+    t->counts = (double*)mcpl_internal_malloc( sizeof(double) * t->capacity );
+    t->used = (unsigned char*)mcpl_internal_calloc( t->capacity, 1 );
+    for ( size_t j = 0; j < old.capacity; ++j ) {
+      if ( old.used[j] ) {
+        size_t s = mcpl_internal_freqtable_slot( t, old.keys[j] );
+        t->used[s] = 1;
+        t->keys[s] = old.keys[j];
+        t->counts[s] = old.counts[j];
+      }
+    }
+    mcpl_internal_freqtable_dealloc( &old );
+    i = mcpl_internal_freqtable_slot( t, key );
+  }
+  t->used[i] = 1;
+  t->keys[i] = key;
+  t->counts[i] = count;
+  ++t->n;
+}
+
+MCPL_LOCAL void mcpl_internal_freqtable_merge( mcpl_internal_freqtable_t * a,
+                                               const mcpl_internal_freqtable_t * b )
+{
+  if ( b->overflow )
+    a->overflow = 1;
+  for ( size_t j = 0; j < b->capacity && !a->overflow; ++j )
+    if ( b->used[j] )
+      mcpl_internal_freqtable_add( a, b->keys[j], b->counts[j] );
+}
+
+//Summary of one block of particles:
+typedef struct MCPL_LOCAL {
+  const mcpl_fileinternal_t * f;
+  const char * raw;
+  unsigned n;
+  mcpl_internal_filtereval_t feval;
+  mcpl_internal_fieldacc_t fields[MCPL_STATS_NFIELDS];
+  mcpl_internal_freqtable_t pdgcodes;
+  mcpl_internal_freqtable_t userflags;
+  double sumw;
+} mcpl_internal_statspart_t;
+
+MCPL_LOCAL void mcpl_internal_statspart_process( void * arg )
+{
+  mcpl_internal_statspart_t * p = (mcpl_internal_statspart_t*)arg;
+  mcpl_internal_filtereval_decode( &p->feval, p->f, p->raw, p->n );
+  double ** cols = p->feval.cols;
+  const double * w = cols[MCPLIMP_FLD_WEIGHT];
+  for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld ) {
+    const int id = mcpl_internal_stats_fieldids[ifld];
+    mcpl_internal_fieldacc_reset( &p->fields[ifld] );
+    mcpl_internal_fieldacc_fill( &p->fields[ifld], cols[id],
+                                 ( id == MCPLIMP_FLD_WEIGHT ? NULL : w ), p->n );
+  }
+  mcpl_internal_freqtable_clear( &p->pdgcodes );
+  mcpl_internal_freqtable_clear( &p->userflags );
+  p->sumw = 0.0;
+  for ( unsigned i = 0; i < p->n; ++i ) {
+    mcpl_internal_freqtable_add( &p->pdgcodes,
+                                 (int64_t)cols[MCPLIMP_FLD_PDGCODE][i], w[i] );
+    mcpl_internal_freqtable_add( &p->userflags,
+                                 (int64_t)cols[MCPLIMP_FLD_USERFLAGS][i], w[i] );
+    p->sumw += w[i];
+  }
+}
+
+MCPL_LOCAL void mcpl_internal_statsparts_process( mcpl_internal_statspart_t * parts,
+                                                  unsigned nparts )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nparts > 1 ) {
+    mcpl_internal_thread_t * threads
+      = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                       * nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_create( &threads[i], mcpl_internal_statspart_process,
+                                   parts + i );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_join( &threads[i] );
+    free( threads );
+    return;
+  }
+#endif
+  for ( unsigned i = 0; i < nparts; ++i )
+    mcpl_internal_statspart_process( parts + i );
+}
+
+typedef struct MCPL_LOCAL {
+  int64_t value;
+  double count;
+} mcpl_internal_freqentry_t;
+
+//Decreasing counts, and decreasing values for equal counts (as in Python):
+MCPL_LOCAL int mcpl_internal_freqentry_cmp( const void * va, const void * vb )
+{
+  const mcpl_internal_freqentry_t * a = (const mcpl_internal_freqentry_t *)va;
+  const mcpl_internal_freqentry_t * b = (const mcpl_internal_freqentry_t *)vb;
+  if ( a->count != b->count )
+    return ( a->count > b->count ? -1 : 1 );
+  return ( a->value == b->value ? 0 : ( a->value > b->value ? -1 : 1 ) );
+}
+
+MCPL_LOCAL unsigned mcpl_internal_freqtable_export( const mcpl_internal_freqtable_t * t,
+                                                    const char * name,
+                                                    int64_t ** values,
+                                                    double ** counts )
+{
+  *values = NULL;
+  *counts = NULL;
+  if ( t->overflow ) {
+    char buf[256];
+    snprintf( buf, sizeof(buf), "MCPL WARNING: Too many unique values in %s"
+              " field. Disabling %s statistics\n", name, name );
+    mcpl_print( buf );
+    return 0;
+  }
+  mcpl_internal_freqentry_t * e
+    = (mcpl_internal_freqentry_t*)mcpl_internal_malloc( sizeof(mcpl_internal_freqentry_t)
+                                                        * ( t->n ? t->n : 1 ) );
+  unsigned n = 0;
+  for ( size_t j = 0; j < t->capacity; ++j ) {
+    if ( t->used[j] ) {
+      e[n].value = t->keys[j];
+      e[n].count = t->counts[j];
+      ++n;
+    }
+  }
+  qsort( e, n, sizeof(mcpl_internal_freqentry_t), mcpl_internal_freqentry_cmp );
+  *values = (int64_t*)mcpl_internal_malloc( sizeof(int64_t) * ( n ? n : 1 ) );
+  *counts = (double*)mcpl_internal_malloc( sizeof(double) * ( n ? n : 1 ) );
+  for ( unsigned i = 0; i < n; ++i ) {
+    (*values)[i] = e[i].value;
+    (*counts)[i] = e[i].count;
+  }
+  free( e );
+  return n;
+}
+
+mcpl_stats_t mcpl_collect_stats( const char * filename, unsigned nthreads )
+{
+  nthreads = mcpl_internal_resolve_nthreads( nthreads );
+  mcpl_file_t fi = mcpl_open_file( filename );
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  const unsigned blocksize = MCPLIMP_STATS_BLOCKSIZE;
+  const unsigned psize = fs->particle_size;
+
+  mcpl_internal_filter_t flt;
+  memset( &flt, 0, sizeof(flt) );
+  flt.ncode = 0;
+  flt.stacksize = 0;
+  flt.fieldmask = ( 1u << MCPLIMP_NFIELDS ) - 1;
+  char * buf = mcpl_internal_malloc( (size_t)blocksize * nthreads * psize );
+  mcpl_internal_statspart_t * parts
+    = (mcpl_internal_statspart_t*)mcpl_internal_calloc( nthreads,
+                                                        sizeof(mcpl_internal_statspart_t) );
+  for ( unsigned i = 0; i < nthreads; ++i ) {
+    parts[i].f = fs;
+    parts[i].raw = buf + (size_t)blocksize * i * psize;
+    mcpl_internal_filtereval_init( &parts[i].feval, &flt, blocksize );
+    mcpl_internal_freqtable_init( &parts[i].pdgcodes );
+    mcpl_internal_freqtable_init( &parts[i].userflags );
+  }
+
+  mcpl_internal_fieldacc_t * fields
+    = (mcpl_internal_fieldacc_t*)mcpl_internal_malloc( sizeof(mcpl_internal_fieldacc_t)
+                                                       * MCPL_STATS_NFIELDS );
+  for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld )
+    mcpl_internal_fieldacc_reset( &fields[ifld] );
+  mcpl_internal_freqtable_t pdgcodes, userflags;
+  mcpl_internal_freqtable_init( &pdgcodes );
+  mcpl_internal_freqtable_init( &userflags );
+  double sumw = 0.0;
+  for (;;) {
+    unsigned nread = mcpl_internal_read_raw_particles( fs, buf, blocksize * nthreads );
+    if ( !nread )
+      break;
+    unsigned nparts = 0;
+    for ( unsigned offset = 0; offset < nread; offset += blocksize )
+      parts[nparts++].n = ( nread - offset < blocksize ? nread - offset : blocksize );
+    mcpl_internal_statsparts_process( parts, nparts );
+    for ( unsigned i = 0; i < nparts; ++i ) {
+      for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld )
+        mcpl_internal_fieldacc_merge( &fields[ifld], &parts[i].fields[ifld] );
+      mcpl_internal_freqtable_merge( &pdgcodes, &parts[i].pdgcodes );
+      mcpl_internal_freqtable_merge( &userflags, &parts[i].userflags );
+      sumw += parts[i].sumw;
+    }
+  }
+  for ( unsigned i = 0; i < nthreads; ++i ) {
+    mcpl_internal_filtereval_dealloc( &parts[i].feval );
+    mcpl_internal_freqtable_dealloc( &parts[i].pdgcodes );
+    mcpl_internal_freqtable_dealloc( &parts[i].userflags );
+  }
+  free( parts );
+  free( buf );
+
+  mcpl_stats_t res;
+  memset( &res, 0, sizeof(res) );
+  res.nparticles = fs->nparticles;
+  res.sum_weights = sumw;
+  for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld ) {
+    const mcpl_internal_fieldacc_t * a = &fields[ifld];
+    mcpl_fieldstats_t * fst = &res.fields[ifld];
+    fst->name = mcpl_internal_stats_names[ifld];
+    fst->unit = mcpl_internal_stats_units[ifld];
+    fst->integral = a->sumw;
+    fst->mean = ( a->sumw ? a->sumwx / a->sumw : NAN );
+    fst->rms = ( a->sumw ? sqrt( a->T / a->sumw ) : NAN );
+    fst->min = ( a->nvalues ? a->min : NAN );
+    fst->max = ( a->nvalues ? a->max : NAN );
+    if ( !a->hempty ) {
+      fst->hist_nbins = (unsigned)( a->hi - a->lo + 1 );
+      fst->hist_xmin = ldexp( (double)a->lo, a->k );
+      fst->hist_binwidth = ldexp( 1.0, a->k );
+      double * h = (double*)mcpl_internal_malloc( sizeof(double) * fst->hist_nbins );
+      memcpy( h, a->bins, sizeof(double) * fst->hist_nbins );
+      fst->hist = h;
+    }
+  }
+  free( fields );
+  int64_t * values;
+  double * counts;
+  res.n_pdgcodes = mcpl_internal_freqtable_export( &pdgcodes, "pdgcode",
+                                                   &values, &counts );
+  res.pdgcodes = values;
+  res.pdgcode_counts = counts;
+  res.n_userflags = mcpl_internal_freqtable_export( &userflags, "userflags",
+                                                    &values, &counts );
+  res.userflags = values;
+  res.userflags_counts = counts;
+  mcpl_internal_freqtable_dealloc( &pdgcodes );
+  mcpl_internal_freqtable_dealloc( &userflags );
+  mcpl_close_file( fi );
+  return res;
+}
+
+void mcpl_free_stats( mcpl_stats_t * stats )
+{
+  for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld )
+    free( (void*)stats->fields[ifld].hist );
+  free( (void*)stats->pdgcodes );
+  free( (void*)stats->pdgcode_counts );
+  free( (void*)stats->userflags );
+  free( (void*)stats->userflags_counts );
+  memset( stats, 0, sizeof(*stats) );
+}
+
+//Short name for pdgcode (empty if not known), as in the Python module:
+MCPL_LOCAL void mcpl_internal_pdgname( int32_t pdgcode, char * buf, size_t nbuf )
+{
+  static const int32_t codes[] = { 12, 14, 16, -12, -14, -16, 2112, 2212, -2112,
+                                   -2212, 22, 11, -11, 13, -13, 15, -15, 211,
+                                   -211, 111, 321, -321, 130, 310, -1000010020,
+                                   -1000010030, 1000010020, 1000010030,
+                                   1000020040, -1000020040 };
+  static const char * names[] = { "nu_e", "nu_mu", "nu_tau", "nu_e-bar",
+                                  "nu_mu-bar", "nu_tau-bar", "n", "p", "n-bar",
+                                  "p-bar", "gamma", "e-", "e+", "mu-", "mu+",
+                                  "tau-", "tau+", "pi+", "pi-", "pi0", "K+",
+                                  "K-", "Klong", "Kshort", "D-bar", "T-bar",
+                                  "D", "T", "alpha", "alpha-bar" };
+  static const char * elements[] = {
+    "H", "He", "Li", "Be", "B", "C", "N", "O", "F", "Ne", "Na", "Mg", "Al",
+    "Si", "P", "S", "Cl", "Ar", "K", "Ca", "Sc", "Ti", "V", "Cr", "Mn", "Fe",
+    "Co", "Ni", "Cu", "Zn", "Ga", "Ge", "As", "Se", "Br", "Kr", "Rb", "Sr",
+    "Y", "Zr", "Nb", "Mo", "Tc", "Ru", "Rh", "Pd", "Ag", "Cd", "In", "Sn",
+    "Sb", "Te", "I", "Xe", "Cs", "Ba", "La", "Ce", "Pr", "Nd", "Pm", "Sm",
+    "Eu", "Gd", "Tb", "Dy", "Ho", "Er", "Tm", "Yb", "Lu", "Hf", "Ta", "W",
+    "Re", "Os", "Ir", "Pt", "Au", "Hg", "Tl", "Pb", "Bi", "Po", "At", "Rn",
+    "Fr", "Ra", "Ac", "Th", "Pa", "U", "Np", "Pu", "Am", "Cm", "Bk", "Cf",
+    "Es", "Fm", "Md", "No", "Lr", "Rf", "Db", "Sg", "Bh", "Hs", "Mt", "Ds",
+    "Rg" };
+  const int nnames = (int)( sizeof(codes) / sizeof(codes[0]) );
+  const int nelements = (int)( sizeof(elements) / sizeof(elements[0]) );
+  buf[0] = 0;
+  for ( int i = 0; i < nnames; ++i ) {
+    if ( codes[i] == pdgcode ) {
+      snprintf( buf, nbuf, "%s", names[i] );
+      return;
+    }
+  }
+  if ( pdgcode / 100000000 != 10 )
+    return;
+  //Ions, 10LZZZAAAI:
+  int32_t c = pdgcode;
+  const int I = c % 10; c /= 10;
+  const int A = c % 1000; c /= 1000;
+  const int Z = c % 1000; c /= 1000;
+  const int L = c % 10; c /= 10;
+  if ( c != 10 || Z <= 0 || A <= 0 )
+    return;
+  if ( L == 0 && I == 0 && Z <= nelements ) {
+    snprintf( buf, nbuf, "%s%i", elements[Z-1], A );
+    return;
+  }
+  int n = snprintf( buf, nbuf, "ion(Z=%i,A=%i", Z, A );
+  if ( L && n >= 0 && (size_t)n < nbuf )
+    n += snprintf( buf + n, nbuf - (size_t)n, ",L=%i", L );
+  if ( I && n >= 0 && (size_t)n < nbuf )
+    n += snprintf( buf + n, nbuf - (size_t)n, ",I=%i", I );
+  if ( n >= 0 && (size_t)n < nbuf )
+    snprintf( buf + n, nbuf - (size_t)n, ")" );
+}
+
+MCPL_LOCAL void mcpl_internal_dump_freqstats( const char * name,
+                                              const int64_t * values,
+                                              const double * counts,
+                                              unsigned n )
+{
+  const char * sep = "------------------------------------------------------------------------------\n";
+  const unsigned showmax = 50;
+  char buf[256];
+  char descr[64];
+  char txt[32];
+  mcpl_print( sep );
+  double total = 0.0;
+  for ( unsigned i = 0; i < n; ++i )
+    total += counts[i];
+  const double scale = 100.0 / total;
+  snprintf( buf, sizeof(buf), "%-12s : ", name );
+  mcpl_print( buf );
+  for ( unsigned i = 0; i < n; ++i ) {
+    double c = counts[i];
+    double p = c * scale;
+    if ( i + 1 == showmax ) {
+      snprintf( txt, sizeof(txt), "other" );
+      descr[0] = 0;
+      c = p = 0.0;
+      for ( unsigned j = i; j < n; ++j ) {
+        c += counts[j];
+        p += counts[j] * scale;
+      }
+    } else {
+      snprintf( txt, sizeof(txt), "%" PRId64, values[i] );
+      char alt[48];
+      if ( name[0] == 'p' )
+        mcpl_internal_pdgname( (int32_t)values[i], alt, sizeof(alt) );
+      else
+        snprintf( alt, sizeof(alt), "0x%08x", (unsigned)values[i] );
+      if ( alt[0] )
+        snprintf( descr, sizeof(descr), "(%s)", alt );
+      else
+        descr[0] = 0;
+    }
+    snprintf( buf, sizeof(buf), "%*s %-12s %12g (%5.2f%%)\n",
+              ( i ? 26 : 11 ), txt, descr, c, p );
+    mcpl_print( buf );
+    if ( i + 1 == showmax )
+      break;
+  }
+  mcpl_print( "                     [ values ]             [ weighted counts ]\n" );
+}
+
+void mcpl_dump_stats( const mcpl_stats_t * stats )
+{
+  const char * sep = "------------------------------------------------------------------------------\n";
+  char buf[256];
+  mcpl_print( sep );
+  snprintf( buf, sizeof(buf), "nparticles   : %" PRIu64 "\n", stats->nparticles );
+  mcpl_print( buf );
+  snprintf( buf, sizeof(buf), "sum(weights) : %g\n", stats->sum_weights );
+  mcpl_print( buf );
+  mcpl_print( sep );
+  mcpl_print( "             :            mean             rms             min             max\n" );
+  mcpl_print( sep );
+  for ( int ifld = 0; ifld < MCPL_STATS_NFIELDS; ++ifld ) {
+    const mcpl_fieldstats_t * fst = &stats->fields[ifld];
+    char label[32];
+    if ( fst->unit ) {
+      char unit[16];
+      snprintf( unit, sizeof(unit), "[%s]", fst->unit );
+      snprintf( label, sizeof(label), "%-6s %5s", fst->name, unit );
+    } else {
+      snprintf( label, sizeof(label), "%s", fst->name );
+    }
+    snprintf( buf, sizeof(buf), "%-12s : %15g %15.5g %15g %15g\n",
+              label, fst->mean, fst->rms, fst->min, fst->max );
+    mcpl_print( buf );
+  }
+  if ( stats->n_pdgcodes )
+    mcpl_internal_dump_freqstats( "pdgcode", stats->pdgcodes,
+                                  stats->pdgcode_counts, stats->n_pdgcodes );
+  if ( stats->n_userflags )
+    mcpl_internal_dump_freqstats( "userflags", stats->userflags,
+                                  stats->userflags_counts, stats->n_userflags );
+  mcpl_print( sep );
+}
@@ -0,0 +1,1171 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Conversion of particle data to and from text (ASCII and JSON).
+
+#include "mcpl_internal.h"
+
+MCPL_LOCAL unsigned mcpl_internal_utf8_seqlen( const unsigned char * c )
+{
+  //Length of valid (non-overlong) UTF-8 multibyte sequence at c, or 0:
+  unsigned n;
+  if ( c[0] >= 0xC2 && c[0] <= 0xDF )
+    n = 2;
+  else if ( c[0] >= 0xE0 && c[0] <= 0xEF )
+    n = 3;
+  else if ( c[0] >= 0xF0 && c[0] <= 0xF4 )
+    n = 4;
+  else
+    return 0;
+  for ( unsigned i = 1; i < n; ++i )
+    if ( ( c[i] & 0xC0 ) != 0x80 )
+      return 0;
+  if ( ( c[0] == 0xE0 && c[1] < 0xA0 ) || ( c[0] == 0xED && c[1] > 0x9F )
+       || ( c[0] == 0xF0 && c[1] < 0x90 ) || ( c[0] == 0xF4 && c[1] > 0x8F ) )
+    return 0;
+  return n;
+}
+
+MCPL_LOCAL void mcpl_internal_print_json_str( const char * str )
+{
+  //Print as JSON string, escaping as needed. Bytes which are not valid UTF-8
+  //are replaced with U+FFFD to always produce valid JSON:
+  char buf[256];
+  size_t n = 0;
+  buf[n++] = '"';
+  for ( const unsigned char * c = (const unsigned char*)str; *c; ++c ) {
+    if ( n + 8 > sizeof(buf) ) {
+      buf[n] = '\0';
+      mcpl_print(buf);
+      n = 0;
+    }
+    if ( *c == '"' || *c == '\\' ) {
+      buf[n++] = '\\';
+      buf[n++] = (char)*c;
+    } else if ( *c < 0x20 ) {
+      snprintf( buf + n, 7, "\\u%04x", (unsigned)*c );
+      n += 6;
+    } else if ( *c < 0x80 ) {
+      buf[n++] = (char)*c;
+    } else {
+      unsigned nseq = mcpl_internal_utf8_seqlen( c );
+      if ( !nseq ) {
+        memcpy( buf + n, "\\ufffd", 6 );
+        n += 6;
+        continue;
+      }
+      for ( unsigned i = 0; i < nseq; ++i )
+        buf[n++] = (char)c[i];
+      c += nseq - 1;
+    }
+  }
+  buf[n++] = '"';
+  buf[n] = '\0';
+  mcpl_print(buf);
+}
+
+MCPL_LOCAL void mcpl_internal_print_json_double( double val )
+{
+  char buf[64];
+  if ( isnan(val) || isinf(val) )
+    memcpy( buf, "null", 5 );
+  else
+    snprintf( buf, sizeof(buf), "%.17g", val );
+  mcpl_print(buf);
+}
+
+MCPL_LOCAL void mcpl_internal_print_json_header( const char * filename )
+{
+  //Print header info as a single line of JSON:
+  mcpl_file_t f = mcpl_open_header_only(filename);
+  char buf[256];
+  mcpl_print("{\"file\":");
+  mcpl_internal_print_json_str( filename );
+  snprintf( buf, sizeof(buf),
+            ",\"version\":%u,\"nparticles\":%" PRIu64
+            ",\"header_size\":%" PRIu64 ",\"particle_size\":%i,\"srcname\":",
+            mcpl_hdr_version(f), mcpl_hdr_nparticles(f),
+            mcpl_hdr_header_size(f), mcpl_hdr_particle_size(f) );
+  mcpl_print(buf);
+  mcpl_internal_print_json_str( mcpl_hdr_srcname(f) );
+  mcpl_print(",\"comments\":[");
+  unsigned ncomments = mcpl_hdr_ncomments(f);
+  for ( unsigned i = 0; i < ncomments; ++i ) {
+    if ( i )
+      mcpl_print(",");
+    mcpl_internal_print_json_str( mcpl_hdr_comment(f,i) );
+  }
+  mcpl_print("],\"stat_sum\":{");
+  int first = 1;
+  for ( unsigned i = 0; i < ncomments; ++i ) {
+    const char * c = mcpl_hdr_comment(f,i);
+    if ( !MCPL_COMMENT_IS_STATSUM(c) )
+      continue;
+    mcpl_internal_statsum_t sc;
+    mcpl_internal_statsum_parse_or_emit_err( c, &sc );
+    if ( !first )
+      mcpl_print(",");
+    first = 0;
+    mcpl_internal_print_json_str( sc.key );
+    mcpl_print(":");
+    mcpl_internal_print_json_double( sc.value );
+  }
+  mcpl_print("},\"blobs\":{");
+  //Lengths are accessed directly to avoid loading the blobs:
+  const mcpl_fileinternal_t * fi = (const mcpl_fileinternal_t *)f.internal;
+  for ( uint32_t i = 0; i < fi->nblobs; ++i ) {
+    if ( i )
+      mcpl_print(",");
+    mcpl_internal_print_json_str( fi->blobkeys[i] );
+    snprintf( buf, sizeof(buf), ":%lu", (unsigned long)fi->bloblengths[i] );
+    mcpl_print(buf);
+  }
+  snprintf( buf, sizeof(buf),
+            "},\"has_userflags\":%s,\"has_polarisation\":%s"
+            ",\"has_doubleprec\":%s,\"universal_pdgcode\":%li"
+            ",\"universal_weight\":",
+            ( mcpl_hdr_has_userflags(f) ? "true" : "false" ),
+            ( mcpl_hdr_has_polarisation(f) ? "true" : "false" ),
+            ( mcpl_hdr_has_doubleprec(f) ? "true" : "false" ),
+            (long)mcpl_hdr_universal_pdgcode(f) );
+  mcpl_print(buf);
+  mcpl_internal_print_json_double( mcpl_hdr_universal_weight(f) );
+  mcpl_print( mcpl_hdr_little_endian(f)
+              ? ",\"little_endian\":true}\n"
+              : ",\"little_endian\":false}\n" );
+  mcpl_close_file(f);
+}
+
+//Fast ASCII output for mcpltool --text. Floating point values are written with
+//as few digits as needed to read back as exactly the same value, found with the
+//Grisu2 algorithm (F. Loitsch, "Printing Floating-Point Numbers Quickly and
+//Accurately with Integers", PLDI 2010). The digits produced by Grisu2 always
+//read back exactly, and are the shortest such digits for almost all values.
+//Blocks of particles are decoded and formatted concurrently, and written out
+//in order, so the output does not depend on the number of threads:
+#define MCPLIMP_TEXT_BLOCKSIZE 16384
+#define MCPLIMP_TEXT_MAXLINE 384
+
+typedef struct MCPL_LOCAL {
+  uint64_t f;
+  int e;
+} mcpl_internal_diyfp_t;
+
+typedef struct MCPL_LOCAL {
+  uint64_t f;
+  int e;
+  int k;
+} mcpl_internal_cachedpow_t;
+
+//Normalised approximations f*2^e of 10^k, for k=-300,-292,...,324:
+static const mcpl_internal_cachedpow_t mcpl_internal_cachedpowers[79] = {
+  { UINT64_C(0xAB70FE17C79AC6CA), -1060, -300 },
+  { UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292 },
+  { UINT64_C(0xBE5691EF416BD60C), -1007, -284 },
+  { UINT64_C(0x8DD01FAD907FFC3C),  -980, -276 },
+  { UINT64_C(0xD3515C2831559A83),  -954, -268 },
+  { UINT64_C(0x9D71AC8FADA6C9B5),  -927, -260 },
+  { UINT64_C(0xEA9C227723EE8BCB),  -901, -252 },
+  { UINT64_C(0xAECC49914078536D),  -874, -244 },
+  { UINT64_C(0x823C12795DB6CE57),  -847, -236 },
+  { UINT64_C(0xC21094364DFB5637),  -821, -228 },
+  { UINT64_C(0x9096EA6F3848984F),  -794, -220 },
+  { UINT64_C(0xD77485CB25823AC7),  -768, -212 },
+  { UINT64_C(0xA086CFCD97BF97F4),  -741, -204 },
+  { UINT64_C(0xEF340A98172AACE5),  -715, -196 },
+  { UINT64_C(0xB23867FB2A35B28E),  -688, -188 },
+  { UINT64_C(0x84C8D4DFD2C63F3B),  -661, -180 },
+  { UINT64_C(0xC5DD44271AD3CDBA),  -635, -172 },
+  { UINT64_C(0x936B9FCEBB25C996),  -608, -164 },
+  { UINT64_C(0xDBAC6C247D62A584),  -582, -156 },
+  { UINT64_C(0xA3AB66580D5FDAF6),  -555, -148 },
+  { UINT64_C(0xF3E2F893DEC3F126),  -529, -140 },
+  { UINT64_C(0xB5B5ADA8AAFF80B8),  -502, -132 },
+  { UINT64_C(0x87625F056C7C4A8B),  -475, -124 },
+  { UINT64_C(0xC9BCFF6034C13053),  -449, -116 },
+  { UINT64_C(0x964E858C91BA2655),  -422, -108 },
+  { UINT64_C(0xDFF9772470297EBD),  -396, -100 },
+  { UINT64_C(0xA6DFBD9FB8E5B88F),  -369,  -92 },
+  { UINT64_C(0xF8A95FCF88747D94),  -343,  -84 },
+  { UINT64_C(0xB94470938FA89BCF),  -316,  -76 },
+  { UINT64_C(0x8A08F0F8BF0F156B),  -289,  -68 },
+  { UINT64_C(0xCDB02555653131B6),  -263,  -60 },
+  { UINT64_C(0x993FE2C6D07B7FAC),  -236,  -52 },
+  { UINT64_C(0xE45C10C42A2B3B06),  -210,  -44 },
+  { UINT64_C(0xAA242499697392D3),  -183,  -36 },
+  { UINT64_C(0xFD87B5F28300CA0E),  -157,  -28 },
+  { UINT64_C(0xBCE5086492111AEB),  -130,  -20 },
+  { UINT64_C(0x8CBCCC096F5088CC),  -103,  -12 },
+  { UINT64_C(0xD1B71758E219652C),   -77,   -4 },
+  { UINT64_C(0x9C40000000000000),   -50,    4 },
+  { UINT64_C(0xE8D4A51000000000),   -24,   12 },
+  { UINT64_C(0xAD78EBC5AC620000),     3,   20 },
+  { UINT64_C(0x813F3978F8940984),    30,   28 },
+  { UINT64_C(0xC097CE7BC90715B3),    56,   36 },
+  { UINT64_C(0x8F7E32CE7BEA5C70),    83,   44 },
+  { UINT64_C(0xD5D238A4ABE98068),   109,   52 },
+  { UINT64_C(0x9F4F2726179A2245),   136,   60 },
+  { UINT64_C(0xED63A231D4C4FB27),   162,   68 },
+  { UINT64_C(0xB0DE65388CC8ADA8),   189,   76 },
+  { UINT64_C(0x83C7088E1AAB65DB),   216,   84 },
+  { UINT64_C(0xC45D1DF942711D9A),   242,   92 },
+  { UINT64_C(0x924D692CA61BE758),   269,  100 },
+  { UINT64_C(0xDA01EE641A708DEA),   295,  108 },
+  { UINT64_C(0xA26DA3999AEF774A),   322,  116 },
+  { UINT64_C(0xF209787BB47D6B85),   348,  124 },
+  { UINT64_C(0xB454E4A179DD1877),   375,  132 },
+  { UINT64_C(0x865B86925B9BC5C2),   402,  140 },
+  { UINT64_C(0xC83553C5C8965D3D),   428,  148 },
+  { UINT64_C(0x952AB45CFA97A0B3),   455,  156 },
+  { UINT64_C(0xDE469FBD99A05FE3),   481,  164 },
+  { UINT64_C(0xA59BC234DB398C25),   508,  172 },
+  { UINT64_C(0xF6C69A72A3989F5C),   534,  180 },
+  { UINT64_C(0xB7DCBF5354E9BECE),   561,  188 },
+  { UINT64_C(0x88FCF317F22241E2),   588,  196 },
+  { UINT64_C(0xCC20CE9BD35C78A5),   614,  204 },
+  { UINT64_C(0x98165AF37B2153DF),   641,  212 },
+  { UINT64_C(0xE2A0B5DC971F303A),   667,  220 },
+  { UINT64_C(0xA8D9D1535CE3B396),   694,  228 },
+  { UINT64_C(0xFB9B7CD9A4A7443C),   720,  236 },
+  { UINT64_C(0xBB764C4CA7A44410),   747,  244 },
+  { UINT64_C(0x8BAB8EEFB6409C1A),   774,  252 },
+  { UINT64_C(0xD01FEF10A657842C),   800,  260 },
+  { UINT64_C(0x9B10A4E5E9913129),   827,  268 },
+  { UINT64_C(0xE7109BFBA19C0C9D),   853,  276 },
+  { UINT64_C(0xAC2820D9623BF429),   880,  284 },
+  { UINT64_C(0x80444B5E7AA7CF85),   907,  292 },
+  { UINT64_C(0xBF21E44003ACDD2D),   933,  300 },
+  { UINT64_C(0x8E679C2F5E44FF8F),   960,  308 },
+  { UINT64_C(0xD433179D9C8CB841),   986,  316 },
+  { UINT64_C(0x9E19DB92B4E31BA9),  1013,  324 }
+};
+
+MCPL_LOCAL mcpl_internal_diyfp_t mcpl_internal_diyfp_mul( mcpl_internal_diyfp_t x,
+                                                          mcpl_internal_diyfp_t y )
+{
+  //Upper 64 bits of the 128 bit product of the significands (rounded):
+  const uint64_t m32 = UINT64_C(0xFFFFFFFF);
+  const uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = ( bd >> 32 ) + ( ad & m32 ) + ( bc & m32 );
+  tmp += UINT64_C(1) << 31;
+  mcpl_internal_diyfp_t r;
+  r.f = ac + ( ad >> 32 ) + ( bc >> 32 ) + ( tmp >> 32 );
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+MCPL_LOCAL mcpl_internal_diyfp_t mcpl_internal_diyfp_normalize( mcpl_internal_diyfp_t x )
+{
+  assert( x.f );
+  while ( !( x.f & ( UINT64_C(1) << 63 ) ) ) {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+//Writes the digits of v (which must be finite and positive) to digits, and
+//returns their number. The value is digits*10^(*decexp):
+MCPL_LOCAL int mcpl_internal_grisu2( double v, char * digits, int * decexp )
+{
+  uint64_t bits;
+  memcpy( &bits, &v, sizeof(bits) );
+  const uint64_t fbits = bits & ( ( UINT64_C(1) << 52 ) - 1 );
+  const int ebits = (int)( bits >> 52 );
+  mcpl_internal_diyfp_t w, mplus, mminus;
+  if ( ebits ) {
+    w.f = fbits | ( UINT64_C(1) << 52 );
+    w.e = ebits - 1075;
+  } else {
+    w.f = fbits;
+    w.e = 1 - 1075;
+  }
+
+  //Boundaries halfway to the neighbouring values (the lower one is closer
+  //when v is a power of two):
+  mplus.f = 2 * w.f + 1;
+  mplus.e = w.e - 1;
+  if ( fbits == 0 && ebits > 1 ) {
+    mminus.f = 4 * w.f - 1;
+    mminus.e = w.e - 2;
+  } else {
+    mminus.f = 2 * w.f - 1;
+    mminus.e = w.e - 1;
+  }
+  mplus = mcpl_internal_diyfp_normalize( mplus );
+  mminus.f <<= ( mminus.e - mplus.e );
+  mminus.e = mplus.e;
+  w = mcpl_internal_diyfp_normalize( w );
+
+  //Scale by cached power of ten, bringing the binary exponent into [-60,-32]:
+  const int fexp = -60 - mplus.e - 1;
+  const int kmin = ( fexp * 78913 ) / ( 1 << 18 ) + ( fexp > 0 );
+  const mcpl_internal_cachedpow_t * cp
+    = &mcpl_internal_cachedpowers[ ( 300 + kmin + 7 ) / 8 ];
+  mcpl_internal_diyfp_t c;
+  c.f = cp->f;
+  c.e = cp->e;
+  w = mcpl_internal_diyfp_mul( w, c );
+  mplus = mcpl_internal_diyfp_mul( mplus, c );
+  mminus = mcpl_internal_diyfp_mul( mminus, c );
+  mminus.f += 1;//stay safely inside the rounding interval
+  mplus.f -= 1;
+  *decexp = -cp->k;
+
+  //Generate digits of mplus until the result is inside the interval:
+  uint64_t delta = mplus.f - mminus.f;
+  uint64_t dist = mplus.f - w.f;
+  const int shift = -mplus.e;
+  const uint64_t one = UINT64_C(1) << shift;
+  uint32_t p1 = (uint32_t)( mplus.f >> shift );
+  uint64_t p2 = mplus.f & ( one - 1 );
+  uint32_t pow10 = 1;
+  int n = 1;
+  while ( n < 10 && p1 / pow10 >= 10 ) {
+    pow10 *= 10;
+    ++n;
+  }
+  int len = 0;
+  uint64_t rest = 0, tenk = 0;
+  while ( n > 0 ) {
+    digits[len++] = (char)( '0' + p1 / pow10 );
+    p1 %= pow10;
+    --n;
+    rest = ( (uint64_t)p1 << shift ) + p2;
+    if ( rest <= delta ) {
+      *decexp += n;
+      tenk = (uint64_t)pow10 << shift;
+      break;
+    }
+    pow10 /= 10;
+  }
+  if ( !tenk ) {
+    for (;;) {
+      p2 *= 10;
+      digits[len++] = (char)( '0' + ( p2 >> shift ) );
+      p2 &= one - 1;
+      --*decexp;
+      delta *= 10;
+      dist *= 10;
+      if ( p2 <= delta )
+        break;
+    }
+    rest = p2;
+    tenk = one;
+  }
+
+  //Round towards w:
+  while ( rest < dist && delta - rest >= tenk
+          && ( rest + tenk < dist || dist - rest > rest + tenk - dist ) ) {
+    --digits[len - 1];
+    rest += tenk;
+  }
+  return len;
+}
+
+//Writes v in the style of %.17g, but with the shortest digits (returns the
+//number of characters written, at most 24):
+MCPL_LOCAL int mcpl_internal_fmt_double( char * out, double v )
+{
+  char * o = out;
+  if ( isnan(v) ) {
+    memcpy( o, "nan", 3 );
+    return 3;
+  }
+  if ( signbit(v) ) {
+    *o++ = '-';
+    v = -v;
+  }
+  if ( isinf(v) ) {
+    memcpy( o, "inf", 3 );
+    return (int)( o - out ) + 3;
+  }
+  if ( v == 0.0 ) {
+    *o++ = '0';
+    return (int)( o - out );
+  }
+  char d[32];
+  int decexp;
+  const int nd = mcpl_internal_grisu2( v, d, &decexp );
+  const int x = nd + decexp;//value is 0.ddd * 10^x
+  if ( x >= -3 && x <= 17 ) {
+    if ( x >= nd ) {
+      memcpy( o, d, nd );
+      o += nd;
+      for ( int i = nd; i < x; ++i )
+        *o++ = '0';
+    } else if ( x > 0 ) {
+      memcpy( o, d, x );
+      o += x;
+      *o++ = '.';
+      memcpy( o, d + x, nd - x );
+      o += nd - x;
+    } else {
+      *o++ = '0';
+      *o++ = '.';
+      for ( int i = x; i < 0; ++i )
+        *o++ = '0';
+      memcpy( o, d, nd );
+      o += nd;
+    }
+    return (int)( o - out );
+  }
+  *o++ = d[0];
+  if ( nd > 1 ) {
+    *o++ = '.';
+    memcpy( o, d + 1, nd - 1 );
+    o += nd - 1;
+  }
+  int ex = x - 1;
+  *o++ = 'e';
+  *o++ = ( ex < 0 ? '-' : '+' );
+  if ( ex < 0 )
+    ex = -ex;
+  if ( ex >= 100 )
+    *o++ = (char)( '0' + ex / 100 );
+  *o++ = (char)( '0' + ( ex / 10 ) % 10 );
+  *o++ = (char)( '0' + ex % 10 );
+  return (int)( o - out );
+}
+
+MCPL_LOCAL char * mcpl_internal_fmt_rjust( char * o, const char * s, int n, int width )
+{
+  for ( int i = n; i < width; ++i )
+    *o++ = ' ';
+  memcpy( o, s, n );
+  return o + n;
+}
+
+MCPL_LOCAL int mcpl_internal_fmt_uint( char * out, uint64_t v )
+{
+  char tmp[20];
+  int n = 0;
+  do {
+    tmp[n++] = (char)( '0' + v % 10 );
+    v /= 10;
+  } while ( v );
+  for ( int i = 0; i < n; ++i )
+    out[i] = tmp[n - 1 - i];
+  return n;
+}
+
+typedef struct MCPL_LOCAL {
+  const mcpl_fileinternal_t * f;
+  const char * raw;
+  unsigned n;
+  uint64_t firstidx;
+  char * out;
+  size_t nout;
+} mcpl_internal_textpart_t;
+
+MCPL_LOCAL void mcpl_internal_textpart_process( void * arg )
+{
+  //Produces lines like fprintf with the format "%5llu %11i %23.18g ..
+  //%23.18g 0x%08x\n", except for the digits of the floating point values:
+  mcpl_internal_textpart_t * tp = (mcpl_internal_textpart_t*)arg;
+  static const char hexdigits[] = "0123456789abcdef";
+  const unsigned psize = tp->f->particle_size;
+  char * o = tp->out;
+  char tmp[32];
+  mcpl_particle_t p;
+  for ( unsigned i = 0; i < tp->n; ++i ) {
+    mcpl_internal_decode_particle( tp->f, tp->raw + (size_t)i * psize, &p );
+    o = mcpl_internal_fmt_rjust( o, tmp, mcpl_internal_fmt_uint( tmp, tp->firstidx + i ), 5 );
+    *o++ = ' ';
+    int n = 0;
+    if ( p.pdgcode < 0 )
+      tmp[n++] = '-';
+    n += mcpl_internal_fmt_uint( tmp + n, ( p.pdgcode < 0
+                                            ? (uint64_t)( -(int64_t)p.pdgcode )
+                                            : (uint64_t)p.pdgcode ) );
+    o = mcpl_internal_fmt_rjust( o, tmp, n, 11 );
+    const double vals[12] = { p.ekin, p.position[0], p.position[1], p.position[2],
+                              p.direction[0], p.direction[1], p.direction[2],
+                              p.time, p.weight, p.polarisation[0],
+                              p.polarisation[1], p.polarisation[2] };
+    for ( int j = 0; j < 12; ++j ) {
+      *o++ = ' ';
+      o = mcpl_internal_fmt_rjust( o, tmp, mcpl_internal_fmt_double( tmp, vals[j] ), 23 );
+    }
+    *o++ = ' ';
+    *o++ = '0';
+    *o++ = 'x';
+    for ( int j = 7; j >= 0; --j )
+      *o++ = hexdigits[ ( p.userflags >> ( 4 * j ) ) & 0xF ];
+    *o++ = '\n';
+  }
+  tp->nout = (size_t)( o - tp->out );
+}
+
+MCPL_LOCAL void mcpl_internal_textparts_process( mcpl_internal_textpart_t * parts,
+                                                 unsigned nparts )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nparts > 1 ) {
+    mcpl_internal_thread_t * threads
+      = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                       * nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_create( &threads[i], mcpl_internal_textpart_process,
+                                   parts + i );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_join( &threads[i] );
+    free( threads );
+    return;
+  }
+#endif
+  for ( unsigned i = 0; i < nparts; ++i )
+    mcpl_internal_textpart_process( parts + i );
+}
+
+MCPL_LOCAL void mcpl_internal_write_text( mcpl_file_t fi, FILE * fout,
+                                          unsigned nthreads )
+{
+  nthreads = mcpl_internal_resolve_nthreads( nthreads );
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  fprintf(fout,"#MCPL-ASCII\n#ASCII-FORMAT: v1\n#NPARTICLES: %" PRIu64 "\n#END-HEADER\n",mcpl_hdr_nparticles(fi));
+  fprintf(fout,"index     pdgcode               ekin[MeV]                   x[cm]          "
+          "         y[cm]                   z[cm]                      ux                  "
+          "    uy                      uz                time[ms]                  weight  "
+          "                 pol-x                   pol-y                   pol-z  userflags\n");
+  const unsigned blocksize = MCPLIMP_TEXT_BLOCKSIZE;
+  const unsigned psize = fs->particle_size;
+  char * buf = mcpl_internal_malloc( (size_t)blocksize * nthreads * psize );
+  mcpl_internal_textpart_t * parts
+    = (mcpl_internal_textpart_t*)mcpl_internal_calloc( nthreads,
+                                                       sizeof(mcpl_internal_textpart_t) );
+  for ( unsigned i = 0; i < nthreads; ++i ) {
+    parts[i].f = fs;
+    parts[i].raw = buf + (size_t)blocksize * i * psize;
+    parts[i].out = mcpl_internal_malloc( (size_t)blocksize * MCPLIMP_TEXT_MAXLINE );
+  }
+  uint64_t idx = 0;
+  for (;;) {
+    unsigned nread = mcpl_internal_read_raw_particles( fs, buf, blocksize * nthreads );
+    if ( !nread )
+      break;
+    unsigned nparts = 0;
+    for ( unsigned offset = 0; offset < nread; offset += blocksize ) {
+      mcpl_internal_textpart_t * tp = &parts[nparts++];
+      tp->n = ( nread - offset < blocksize ? nread - offset : blocksize );
+      tp->firstidx = idx;
+      idx += tp->n;
+    }
+    mcpl_internal_textparts_process( parts, nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      if ( fwrite( parts[i].out, 1, parts[i].nout, fout ) != parts[i].nout )
+        mcpl_error("Errors encountered while writing text output.");
+  }
+  for ( unsigned i = 0; i < nthreads; ++i )
+    free( parts[i].out );
+  free( parts );
+  free( buf );
+}
+
+//ASCII import for mcpltool --from-text, the inverse of --text. The input is
+//read in large chunks, which are split into line-aligned parts that are parsed
+//concurrently and handled in order. Numbers are parsed without allocations,
+//directly from their decimal digits: exactly with a single floating point
+//operation when the digits and the power of ten both fit in a double, and
+//otherwise with the cached powers of ten above and a bound on the error (as in
+//Grisu). Only values which are too close to call that way are passed on to
+//strtod. The input is read twice: the first pass validates it and finds the
+//most compact layout for the output file (universal pdgcode and weight, single
+//precision, polarisation and userflags only when needed), and the second pass
+//serialises the particles:
+#define MCPLIMP_FROMTEXT_CHUNKSIZE 4194304
+
+static const uint64_t mcpl_internal_pow10_u64[8] = {
+  UINT64_C(1), UINT64_C(10), UINT64_C(100), UINT64_C(1000), UINT64_C(10000),
+  UINT64_C(100000), UINT64_C(1000000), UINT64_C(10000000)
+};
+
+static const double mcpl_internal_pow10_exact[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+  1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+MCPL_LOCAL int mcpl_internal_parse_double_slow( const char * b, const char * e,
+                                                double * out )
+{
+  char tmp[64];
+  size_t n = (size_t)( e - b );
+  if ( n >= sizeof(tmp) )
+    return 0;
+  memcpy( tmp, b, n );
+  tmp[n] = '\0';
+  char * tmpend;
+  *out = strtod( tmp, &tmpend );
+  return n > 0 && tmpend == tmp + n;
+}
+
+//Parses the number in [b,e), returning 0 if it is not a valid number:
+MCPL_LOCAL int mcpl_internal_parse_double( const char * b, const char * e,
+                                           double * out )
+{
+  const char * s = b;
+  int neg = 0;
+  if ( s < e && ( *s == '-' || *s == '+' ) )
+    neg = ( *s++ == '-' );
+  //Up to 19 significant digits are collected in m, so the value is m*10^e10:
+  uint64_t m = 0;
+  int nsignificant = 0;
+  int e10 = 0;
+  int ndigits = 0;
+  int inexact = 0;
+  for ( ; s < e && *s >= '0' && *s <= '9'; ++s, ++ndigits ) {
+    if ( nsignificant < 19 ) {
+      m = m * 10 + (uint64_t)( *s - '0' );
+      if ( m )
+        ++nsignificant;
+    } else {
+      ++e10;
+      inexact |= ( *s != '0' );
+    }
+  }
+  if ( s < e && *s == '.' ) {
+    for ( ++s; s < e && *s >= '0' && *s <= '9'; ++s, ++ndigits ) {
+      if ( nsignificant < 19 ) {
+        m = m * 10 + (uint64_t)( *s - '0' );
+        if ( m )
+          ++nsignificant;
+        --e10;
+      } else {
+        inexact |= ( *s != '0' );
+      }
+    }
+  }
+  if ( ndigits && s < e && ( *s == 'e' || *s == 'E' ) ) {
+    ++s;
+    int eneg = 0;
+    if ( s < e && ( *s == '-' || *s == '+' ) )
+      eneg = ( *s++ == '-' );
+    if ( s == e )
+      return 0;
+    int x = 0;
+    for ( ; s < e && *s >= '0' && *s <= '9'; ++s )
+      if ( x < 100000 )
+        x = x * 10 + ( *s - '0' );
+    e10 += ( eneg ? -x : x );
+  }
+  if ( !ndigits || s != e || inexact )
+    return mcpl_internal_parse_double_slow( b, e, out );//nan, inf, etc.
+  if ( !m ) {
+    *out = ( neg ? -0.0 : 0.0 );
+    return 1;
+  }
+  if ( m <= ( UINT64_C(1) << 53 ) && e10 >= -22 && e10 <= 22 ) {
+    //Exact operands, so a single correctly rounded operation:
+    double v = (double)m;
+    v = ( e10 < 0 ? v / mcpl_internal_pow10_exact[-e10]
+          : v * mcpl_internal_pow10_exact[e10] );
+    *out = ( neg ? -v : v );
+    return 1;
+  }
+  if ( e10 < -300 || e10 > 331 )
+    return mcpl_internal_parse_double_slow( b, e, out );
+  //m*10^e10 = m*10^a*10^k, with 10^k from the table of cached powers. The
+  //error is tracked in units of 1/8 of the last bit of the significand:
+  const mcpl_internal_cachedpow_t * cp
+    = &mcpl_internal_cachedpowers[ ( e10 + 300 ) / 8 ];
+  const int a = e10 - cp->k;
+  mcpl_internal_diyfp_t x;
+  x.f = m;
+  x.e = 0;
+  x = mcpl_internal_diyfp_normalize( x );
+  int err8 = 0;
+  if ( a ) {
+    mcpl_internal_diyfp_t p;
+    p.f = mcpl_internal_pow10_u64[a];
+    p.e = 0;
+    x = mcpl_internal_diyfp_mul( x, mcpl_internal_diyfp_normalize( p ) );
+    err8 = 4;//rounding of product
+    if ( !( x.f & ( UINT64_C(1) << 63 ) ) ) {
+      x.f <<= 1;
+      --x.e;
+      err8 <<= 1;
+    }
+  }
+  mcpl_internal_diyfp_t c;
+  c.f = cp->f;
+  c.e = cp->e;
+  x = mcpl_internal_diyfp_mul( x, c );
+  err8 += 9;//rounding of product and cached power, plus a margin
+  if ( !( x.f & ( UINT64_C(1) << 63 ) ) ) {
+    x.f <<= 1;
+    --x.e;
+    err8 <<= 1;
+  }
+  //Round the 64 bit significand to 53 bits, unless the error interval includes
+  //the halfway point:
+  const int64_t low8 = (int64_t)( x.f & 0x7FF ) * 8;
+  const int64_t half8 = 0x400 * 8;
+  if ( low8 > half8 - err8 && low8 < half8 + err8 )
+    return mcpl_internal_parse_double_slow( b, e, out );
+  uint64_t mant = ( x.f >> 11 ) + ( low8 > half8 ? 1 : 0 );
+  int biasedexp = x.e + 11 + 52 + 1023;
+  if ( mant == ( UINT64_C(1) << 53 ) ) {
+    mant >>= 1;
+    ++biasedexp;
+  }
+  if ( biasedexp < 1 || biasedexp > 2046 )
+    return mcpl_internal_parse_double_slow( b, e, out );//subnormal or inf
+  uint64_t bits = ( (uint64_t)biasedexp << 52 )
+    | ( mant & ( ( UINT64_C(1) << 52 ) - 1 ) );
+  if ( neg )
+    bits |= ( UINT64_C(1) << 63 );
+  memcpy( out, &bits, sizeof(bits) );
+  return 1;
+}
+
+MCPL_LOCAL int mcpl_internal_parse_int32( const char * b, const char * e,
+                                          int32_t * out )
+{
+  int neg = 0;
+  if ( b < e && ( *b == '-' || *b == '+' ) )
+    neg = ( *b++ == '-' );
+  if ( b == e || e - b > 10 )
+    return 0;
+  int64_t v = 0;
+  for ( ; b < e; ++b ) {
+    if ( *b < '0' || *b > '9' )
+      return 0;
+    v = v * 10 + ( *b - '0' );
+  }
+  if ( neg )
+    v = -v;
+  if ( v < INT32_MIN || v > INT32_MAX )
+    return 0;
+  *out = (int32_t)v;
+  return 1;
+}
+
+MCPL_LOCAL int mcpl_internal_parse_hex32( const char * b, const char * e,
+                                          uint32_t * out )
+{
+  if ( e - b < 3 || e - b > 10 || b[0] != '0' || ( b[1] != 'x' && b[1] != 'X' ) )
+    return 0;
+  uint32_t v = 0;
+  for ( b += 2; b < e; ++b ) {
+    unsigned d;
+    if ( *b >= '0' && *b <= '9' )
+      d = (unsigned)( *b - '0' );
+    else if ( *b >= 'a' && *b <= 'f' )
+      d = (unsigned)( *b - 'a' ) + 10;
+    else if ( *b >= 'A' && *b <= 'F' )
+      d = (unsigned)( *b - 'A' ) + 10;
+    else
+      return 0;
+    v = ( v << 4 ) | d;
+  }
+  *out = v;
+  return 1;
+}
+
+MCPL_LOCAL const char * mcpl_internal_fromtext_token( const char ** pos,
+                                                      const char * end,
+                                                      const char ** tokend )
+{
+  const char * s = *pos;
+  while ( s < end && ( *s == ' ' || *s == '\t' || *s == '\r' ) )
+    ++s;
+  const char * t = s;
+  while ( t < end && *t != ' ' && *t != '\t' && *t != '\r' )
+    ++t;
+  *pos = t;
+  *tokend = t;
+  return s;
+}
+
+//Parses the particle on the line [b,e), returning an error message in case of
+//problems:
+MCPL_LOCAL const char * mcpl_internal_fromtext_parseline( const char * b,
+                                                          const char * e,
+                                                          mcpl_particle_t * p )
+{
+  const char * t, * te;
+  t = mcpl_internal_fromtext_token( &b, e, &te );
+  if ( t == te )
+    return "Invalid index";
+  for ( ; t < te; ++t )
+    if ( *t < '0' || *t > '9' )
+      return "Invalid index";
+  t = mcpl_internal_fromtext_token( &b, e, &te );
+  if ( !mcpl_internal_parse_int32( t, te, &p->pdgcode ) )
+    return "Invalid pdgcode";
+  double * dst[12] = { &p->ekin, &p->position[0], &p->position[1], &p->position[2],
+                       &p->direction[0], &p->direction[1], &p->direction[2],
+                       &p->time, &p->weight, &p->polarisation[0],
+                       &p->polarisation[1], &p->polarisation[2] };
+  for ( int i = 0; i < 12; ++i ) {
+    t = mcpl_internal_fromtext_token( &b, e, &te );
+    if ( t == te )
+      return "Too few fields";
+    if ( !mcpl_internal_parse_double( t, te, dst[i] ) )
+      return "Invalid number";
+  }
+  t = mcpl_internal_fromtext_token( &b, e, &te );
+  if ( !mcpl_internal_parse_hex32( t, te, &p->userflags ) )
+    return "Invalid userflags";
+  t = mcpl_internal_fromtext_token( &b, e, &te );
+  if ( t != te )
+    return "Too many fields";
+  //Same requirements as in mcpl_add_particle:
+  double dirsq = p->direction[0] * p->direction[0]
+    + p->direction[1] * p->direction[1]
+    + p->direction[2] * p->direction[2];
+  if ( fabs( dirsq - 1.0 ) > 1.0e-5 )
+    return "Non-unit direction vector";
+  if ( p->ekin < 0.0 )
+    return "Negative kinetic energy";
+  return NULL;
+}
+
+typedef struct MCPL_LOCAL {
+  uint64_t nparticles;
+  int32_t pdgcode;
+  int pdgcode_varies;
+  double weight;
+  int weight_varies;
+  int weight_needdp;
+  int any_polarisation;
+  int any_userflags;
+  int need_doubleprec;
+} mcpl_internal_fromtextsummary_t;
+
+MCPL_LOCAL int mcpl_internal_fromtext_needdp( double v )
+{
+  return !isnan(v) && (double)(float)v != v;
+}
+
+MCPL_LOCAL void mcpl_internal_fromtextsummary_add( mcpl_internal_fromtextsummary_t * s,
+                                                   const mcpl_particle_t * p )
+{
+  if ( !s->nparticles++ ) {
+    s->pdgcode = p->pdgcode;
+    s->weight = p->weight;
+  }
+  s->pdgcode_varies |= ( p->pdgcode != s->pdgcode );
+  s->weight_varies |= !( p->weight == s->weight );
+  s->any_polarisation |= ( p->polarisation[0] != 0.0 || p->polarisation[1] != 0.0
+                           || p->polarisation[2] != 0.0 );
+  s->any_userflags |= ( p->userflags != 0 );
+  s->weight_needdp |= mcpl_internal_fromtext_needdp( p->weight );
+  if ( s->need_doubleprec )
+    return;
+  const double vals[8] = { p->ekin, p->position[0], p->position[1], p->position[2],
+                           p->time, p->polarisation[0], p->polarisation[1],
+                           p->polarisation[2] };
+  for ( int i = 0; i < 8; ++i )
+    s->need_doubleprec |= mcpl_internal_fromtext_needdp( vals[i] );
+  //The direction must also survive packing in single precision (which it
+  //always does if it was unpacked from a single precision file originally).
+  //The rounding goes via volatile variables, since gcc 12 otherwise drops the
+  //rounding of the vectorised code:
+  double packed[3], dir[3];
+  mcpl_unitvect_pack_adaptproj( p->direction, packed );
+  volatile float sp[2];
+  sp[0] = (float)packed[0];
+  sp[1] = (float)packed[1];
+  packed[0] = sp[0];
+  packed[1] = sp[1];
+  mcpl_unitvect_unpack_adaptproj( packed, dir );
+  s->need_doubleprec |= ( dir[0] != p->direction[0] || dir[1] != p->direction[1]
+                          || dir[2] != p->direction[2] );
+}
+
+MCPL_LOCAL void mcpl_internal_fromtextsummary_merge( mcpl_internal_fromtextsummary_t * s,
+                                                     const mcpl_internal_fromtextsummary_t * o )
+{
+  if ( !o->nparticles )
+    return;
+  if ( !s->nparticles ) {
+    *s = *o;
+    return;
+  }
+  s->pdgcode_varies |= ( o->pdgcode_varies || o->pdgcode != s->pdgcode );
+  s->weight_varies |= ( o->weight_varies || !( o->weight == s->weight ) );
+  s->any_polarisation |= o->any_polarisation;
+  s->any_userflags |= o->any_userflags;
+  s->weight_needdp |= o->weight_needdp;
+  s->need_doubleprec |= o->need_doubleprec;
+  s->nparticles += o->nparticles;
+}
+
+typedef struct MCPL_LOCAL {
+  //Input:
+  const char * begin;
+  const char * end;
+  const mcpl_outfileinternal_t * fo;//serialise particles if set
+  //Output:
+  uint64_t nlines;
+  const char * errmsg;
+  mcpl_internal_fromtextsummary_t summary;
+  char * out;//buffer reused between chunks
+  uint64_t nout;
+  uint64_t outcapacity;
+} mcpl_internal_fromtextpart_t;
+
+MCPL_LOCAL void mcpl_internal_fromtextpart_process( void * arg )
+{
+  mcpl_internal_fromtextpart_t * tp = (mcpl_internal_fromtextpart_t*)arg;
+  memset( &tp->summary, 0, sizeof(tp->summary) );
+  tp->nlines = 0;
+  tp->nout = 0;
+  tp->errmsg = NULL;
+  const unsigned psize = ( tp->fo ? tp->fo->particle_size : 0 );
+  mcpl_particle_t p;
+  memset( &p, 0, sizeof(p) );
+  const char * b = tp->begin;
+  while ( b < tp->end ) {
+    const char * e = (const char*)memchr( b, '\n', (size_t)( tp->end - b ) );
+    if ( !e )
+      e = tp->end;
+    const char * t, * te, * pos = b;
+    t = mcpl_internal_fromtext_token( &pos, e, &te );
+    if ( t != te ) {
+      tp->errmsg = mcpl_internal_fromtext_parseline( b, e, &p );
+      if ( tp->errmsg )
+        return;
+      if ( tp->fo ) {
+        if ( tp->nout == tp->outcapacity ) {
+          tp->outcapacity = ( tp->outcapacity ? 2 * tp->outcapacity : 1024 );
+          tp->out = (char*)mcpl_internal_realloc( tp->out, (size_t)tp->outcapacity * psize );
+        }
+        mcpl_internal_serialise_particle( &p, tp->fo, tp->out + (size_t)psize * tp->nout++ );
+      } else {
+        mcpl_internal_fromtextsummary_add( &tp->summary, &p );
+      }
+    }
+    ++tp->nlines;
+    b = e + 1;
+  }
+}
+
+MCPL_LOCAL void mcpl_internal_fromtextparts_process( mcpl_internal_fromtextpart_t * parts,
+                                                     unsigned nparts )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nparts > 1 ) {
+    mcpl_internal_thread_t * threads
+      = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                       * nparts );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_create( &threads[i], mcpl_internal_fromtextpart_process,
+                                   parts + i );
+    for ( unsigned i = 0; i < nparts; ++i )
+      mcpl_internal_thread_join( &threads[i] );
+    free( threads );
+    return;
+  }
+#endif
+  for ( unsigned i = 0; i < nparts; ++i )
+    mcpl_internal_fromtextpart_process( parts + i );
+}
+
+MCPL_LOCAL void mcpl_internal_fromtext_error( const char * filename, uint64_t lineno,
+                                              const char * errmsg )
+{
+  char buf[256];
+  snprintf( buf, sizeof(buf), "%s in line %" PRIu64 " of ASCII file ",
+            errmsg, lineno );
+  size_t n = strlen( buf );
+  size_t nfn = strlen( filename );
+  char * msg = mcpl_internal_malloc( n + nfn + 1 );
+  memcpy( msg, buf, n );
+  memcpy( msg + n, filename, nfn + 1 );
+  mcpl_error( msg );
+  free( msg );
+}
+
+//Parses the header lines at the start of [b,e) (returning a pointer to the
+//first line after it, or NULL if the header is not complete or valid):
+MCPL_LOCAL const char * mcpl_internal_fromtext_header( const char * b, const char * e,
+                                                       uint64_t * nparticles,
+                                                       uint64_t * nlines )
+{
+  const char * expected[5] = { "#MCPL-ASCII", "#ASCII-FORMAT: v1", "#NPARTICLES: ",
+                               "#END-HEADER", "index " };
+  for ( int i = 0; i < 5; ++i ) {
+    const char * le = (const char*)memchr( b, '\n', (size_t)( e - b ) );
+    if ( !le )
+      return NULL;
+    size_t n = (size_t)( le - b );
+    if ( n && b[n-1] == '\r' )
+      --n;
+    size_t nexp = strlen( expected[i] );
+    if ( n < nexp || memcmp( b, expected[i], nexp ) != 0 )
+      return NULL;
+    if ( i == 0 || i == 1 || i == 3 ) {
+      if ( n != nexp )
+        return NULL;
+    } else if ( i == 2 ) {
+      const char * s = b + nexp;
+      if ( s == b + n )
+        return NULL;
+      *nparticles = 0;
+      for ( ; s < b + n; ++s ) {
+        if ( *s < '0' || *s > '9' || *nparticles > UINT64_MAX / 10 - 1 )
+          return NULL;
+        *nparticles = *nparticles * 10 + (uint64_t)( *s - '0' );
+      }
+    }
+    ++*nlines;
+    b = le + 1;
+  }
+  return b;
+}
+
+//Reads through the ASCII file, either just collecting the summary (when fo is
+//NULL) or also writing the particles to fo:
+MCPL_LOCAL void mcpl_internal_fromtext_pass( const char * filename, unsigned nthreads,
+                                             mcpl_outfileinternal_t * fo,
+                                             mcpl_internal_fromtextsummary_t * summary,
+                                             uint64_t * nparticles_hdr )
+{
+  mcpl_generic_filehandle_t fh = mcpl_generic_fopen( filename );
+  const size_t bufsize = (size_t)MCPLIMP_FROMTEXT_CHUNKSIZE * nthreads;
+  char * buf = mcpl_internal_malloc( bufsize );
+  mcpl_internal_fromtextpart_t * parts
+    = (mcpl_internal_fromtextpart_t*)mcpl_internal_calloc( nthreads,
+                                                           sizeof(mcpl_internal_fromtextpart_t) );
+  for ( unsigned i = 0; i < nthreads; ++i )
+    parts[i].fo = fo;
+  memset( summary, 0, sizeof(*summary) );
+  if ( fo )
+    mcpl_internal_write_raw_particles( fo, NULL, 0 );//ensure header is written
+  size_t nbuf = 0;
+  int eof = 0;
+  int in_header = 1;
+  uint64_t lineno = 0;
+  for (;;) {
+    while ( !eof && nbuf < bufsize ) {
+      size_t nwant = bufsize - nbuf;
+      if ( nwant > INT32_MAX )
+        nwant = INT32_MAX;
+      unsigned nb = mcpl_generic_fread_try( &fh, buf + nbuf, (unsigned)nwant );
+      if ( !nb )
+        eof = 1;
+      nbuf += nb;
+    }
+    if ( !nbuf )
+      break;
+    //Only handle complete lines (the last line is allowed to lack a newline):
+    size_t nuse = nbuf;
+    if ( !eof ) {
+      while ( nuse && buf[nuse-1] != '\n' )
+        --nuse;
+      if ( !nuse )
+        mcpl_internal_fromtext_error( filename, lineno + 1, "Line too long" );
+    }
+    const char * b = buf;
+    const char * e = buf + nuse;
+    if ( in_header ) {
+      b = mcpl_internal_fromtext_header( b, e, nparticles_hdr, &lineno );
+      if ( !b )
+        mcpl_internal_fromtext_error( filename, lineno + 1,
+                                      "Invalid header (expected MCPL-ASCII v1 format)" );
+      in_header = 0;
+    }
+    //Split into line-aligned parts of similar size:
+    unsigned nparts = 0;
+    const size_t target = (size_t)( e - b ) / nthreads + 1;
+    while ( b < e ) {
+      mcpl_internal_fromtextpart_t * tp = &parts[nparts++];
+      tp->begin = b;
+      if ( nparts == nthreads || (size_t)( e - b ) <= target ) {
+        b = e;
+      } else {
+        const char * le = (const char*)memchr( b + target, '\n',
+                                               (size_t)( e - b - target ) );
+        b = ( le ? le + 1 : e );
+      }
+      tp->end = b;
+    }
+    mcpl_internal_fromtextparts_process( parts, nparts );
+    for ( unsigned i = 0; i < nparts; ++i ) {
+      mcpl_internal_fromtextpart_t * tp = &parts[i];
+      if ( tp->errmsg )
+        mcpl_internal_fromtext_error( filename, lineno + tp->nlines + 1, tp->errmsg );
+      lineno += tp->nlines;
+      if ( fo ) {
+        mcpl_internal_write_raw_particles( fo, tp->out, (unsigned)tp->nout );
+        summary->nparticles += tp->nout;
+      } else {
+        mcpl_internal_fromtextsummary_merge( summary, &tp->summary );
+      }
+    }
+    memmove( buf, buf + nuse, nbuf - nuse );
+    nbuf -= nuse;
+  }
+  if ( in_header )
+    mcpl_internal_fromtext_error( filename, 1, "Missing header" );
+  for ( unsigned i = 0; i < nthreads; ++i )
+    free( parts[i].out );
+  free( parts );
+  free( buf );
+  mcpl_generic_fclose( &fh );
+}
+
+MCPL_LOCAL mcpl_outfile_t mcpl_internal_read_text( const char * infile,
+                                                   const char * outfile,
+                                                   unsigned nthreads )
+{
+  nthreads = mcpl_internal_resolve_nthreads( nthreads );
+  mcpl_internal_fromtextsummary_t s;
+  uint64_t nparticles_hdr = 0;
+  mcpl_internal_fromtext_pass( infile, nthreads, NULL, &s, &nparticles_hdr );
+  if ( s.nparticles != nparticles_hdr ) {
+    char buf[256];
+    snprintf( buf, sizeof(buf), "ASCII file has %" PRIu64 " particles, but"
+              " the header says %" PRIu64 " (file truncated?).",
+              s.nparticles, nparticles_hdr );
+    mcpl_error( buf );
+  }
+
+  const int universal_pdgcode = ( s.nparticles && !s.pdgcode_varies && s.pdgcode != 0 );
+  const int universal_weight = ( s.nparticles && !s.weight_varies
+                                 && s.weight > 0.0 && !isinf(s.weight) );
+  mcpl_outfile_t fo = mcpl_create_outfile( outfile );
+  if ( mcpl_internal_fakeconstantversion(0) )
+    mcpl_hdr_set_srcname( fo, "mcpltool --from-text (from MCPL v" "99.99.99" ")" );
+  else
+    mcpl_hdr_set_srcname( fo, "mcpltool --from-text (from MCPL v" MCPL_VERSION_STR ")" );
+  if ( s.any_userflags )
+    mcpl_enable_userflags( fo );
+  if ( s.any_polarisation )
+    mcpl_enable_polarisation( fo );
+  //A universal weight is stored in double precision in the header:
+  if ( s.need_doubleprec || ( s.weight_needdp && !universal_weight ) )
+    mcpl_enable_doubleprec( fo );
+  if ( universal_pdgcode )
+    mcpl_enable_universal_pdgcode( fo, s.pdgcode );
+  if ( universal_weight )
+    mcpl_enable_universal_weight( fo, s.weight );
+
+  mcpl_internal_fromtextsummary_t s2;
+  mcpl_internal_fromtext_pass( infile, nthreads, (mcpl_outfileinternal_t *)fo.internal,
+                               &s2, &nparticles_hdr );
+  if ( s2.nparticles != s.nparticles )
+    mcpl_error( "ASCII file changed while being converted." );
+  return fo;
+}
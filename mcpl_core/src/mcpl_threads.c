@@ -0,0 +1,450 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Portable threading wrappers, and extraction of (filtered) particles with an
+//optional multi-threaded pipeline.
+
+#include "mcpl_internal.h"
+
+#ifndef MCPL_NO_THREADS
+#  ifdef _WIN32
+MCPL_LOCAL DWORD WINAPI mcpl_internal_thread_trampoline( LPVOID arg )
+{
+  mcpl_internal_thread_t * t = (mcpl_internal_thread_t*)arg;
+  (*t->fct)(t->arg);
+  return 0;
+}
+#  else
+MCPL_LOCAL void * mcpl_internal_thread_trampoline( void * arg )
+{
+  mcpl_internal_thread_t * t = (mcpl_internal_thread_t*)arg;
+  (*t->fct)(t->arg);
+  return NULL;
+}
+#  endif
+
+//Start thread running fct(arg). The mcpl_internal_thread_t object must stay
+//alive until mcpl_internal_thread_join is called:
+MCPL_LOCAL void mcpl_internal_thread_create( mcpl_internal_thread_t * t,
+                                             void (*fct)(void*), void * arg )
+{
+  t->fct = fct;
+  t->arg = arg;
+#  ifdef _WIN32
+  t->handle = CreateThread( NULL, 0, mcpl_internal_thread_trampoline,
+                            t, 0, NULL );
+  if ( !t->handle )
+    mcpl_error("Failed to create thread");
+#  else
+  if ( pthread_create( &t->handle, NULL, mcpl_internal_thread_trampoline, t ) )
+    mcpl_error("Failed to create thread");
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_thread_join( mcpl_internal_thread_t * t )
+{
+#  ifdef _WIN32
+  WaitForSingleObject( t->handle, INFINITE );
+  CloseHandle( t->handle );
+#  else
+  pthread_join( t->handle, NULL );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_mutex_init( mcpl_internal_mutex_t * m )
+{
+#  ifdef _WIN32
+  InitializeCriticalSection( m );
+#  else
+  pthread_mutex_init( m, NULL );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_mutex_destroy( mcpl_internal_mutex_t * m )
+{
+#  ifdef _WIN32
+  DeleteCriticalSection( m );
+#  else
+  pthread_mutex_destroy( m );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_mutex_lock( mcpl_internal_mutex_t * m )
+{
+#  ifdef _WIN32
+  EnterCriticalSection( m );
+#  else
+  pthread_mutex_lock( m );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_mutex_unlock( mcpl_internal_mutex_t * m )
+{
+#  ifdef _WIN32
+  LeaveCriticalSection( m );
+#  else
+  pthread_mutex_unlock( m );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_cond_init( mcpl_internal_cond_t * c )
+{
+#  ifdef _WIN32
+  InitializeConditionVariable( c );
+#  else
+  pthread_cond_init( c, NULL );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_cond_destroy( mcpl_internal_cond_t * c )
+{
+#  ifdef _WIN32
+  (void)c;//nothing to do
+#  else
+  pthread_cond_destroy( c );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_cond_wait( mcpl_internal_cond_t * c,
+                                         mcpl_internal_mutex_t * m )
+{
+#  ifdef _WIN32
+  SleepConditionVariableCS( c, m, INFINITE );
+#  else
+  pthread_cond_wait( c, m );
+#  endif
+}
+
+MCPL_LOCAL void mcpl_internal_cond_broadcast( mcpl_internal_cond_t * c )
+{
+#  ifdef _WIN32
+  WakeAllConditionVariable( c );
+#  else
+  pthread_cond_broadcast( c );
+#  endif
+}
+#endif
+
+//Number of threads to actually use when nthreads were requested (0 means one
+//per available processor core). Always returns 1 without thread support:
+MCPL_LOCAL unsigned mcpl_internal_resolve_nthreads( unsigned nthreads )
+{
+#ifdef MCPL_NO_THREADS
+  (void)nthreads;
+  return 1;
+#else
+  if ( !nthreads ) {
+#  ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    nthreads = (unsigned)si.dwNumberOfProcessors;
+#  else
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    nthreads = ( ncpu > 0 ? (unsigned)ncpu : 1 );
+#  endif
+  }
+  if ( nthreads < 1 )
+    nthreads = 1;
+  if ( nthreads > MCPLIMP_MAX_NTHREADS )
+    nthreads = MCPLIMP_MAX_NTHREADS;
+  return nthreads;
+#endif
+}
+
+#ifndef MCPL_NO_THREADS
+//Multi-threaded pipeline for extracting particles, in which blocks of raw
+//particle data are read by one thread, filtered by a number of worker threads,
+//and written (in the original order) by the calling thread. Blocks are passed
+//around in a ring of slots, in which block number iblock always uses slot
+//number iblock%nslots:
+
+typedef enum { MCPLIMP_XSLOT_EMPTY, MCPLIMP_XSLOT_READ,
+               MCPLIMP_XSLOT_BUSY, MCPLIMP_XSLOT_DONE } mcpl_internal_xslotstate_t;
+
+typedef struct MCPL_LOCAL {
+  char * buf;
+  unsigned n;
+  mcpl_internal_xslotstate_t state;
+} mcpl_internal_xslot_t;
+
+typedef struct MCPL_LOCAL {
+  mcpl_fileinternal_t * fs;
+  const mcpl_internal_filter_t * filter;
+  const mcpl_internal_blockselection_t * blocksel;//null if no index available
+  unsigned blocksize;
+  unsigned nslots;
+  mcpl_internal_xslot_t * slots;
+  uint64_t nleft;//only accessed by reader thread
+  uint64_t nblocks_read;
+  uint64_t nblocks_taken;//blocks taken for processing by workers
+  int read_done;
+  mcpl_internal_mutex_t mutex;
+  mcpl_internal_cond_t cond;
+} mcpl_internal_xpipe_t;
+
+MCPL_LOCAL void mcpl_internal_xpipe_reader( void * arg )
+{
+  mcpl_internal_xpipe_t * xp = (mcpl_internal_xpipe_t*)arg;
+  for (;;) {
+    mcpl_internal_mutex_lock( &xp->mutex );
+    mcpl_internal_xslot_t * slot = xp->slots + ( xp->nblocks_read % xp->nslots );
+    while ( slot->state != MCPLIMP_XSLOT_EMPTY )
+      mcpl_internal_cond_wait( &xp->cond, &xp->mutex );
+    mcpl_internal_mutex_unlock( &xp->mutex );
+    //The slot is now owned by the reader:
+    unsigned np = 0;
+    while ( xp->nleft && !np ) {
+      unsigned nconsumed;
+      np = mcpl_internal_read_raw_candidates( xp->fs, xp->blocksel, slot->buf,
+                                              ( xp->nleft < xp->blocksize
+                                                ? (unsigned)xp->nleft
+                                                : xp->blocksize ),
+                                              &nconsumed );
+      xp->nleft = ( nconsumed ? xp->nleft - nconsumed : 0 );
+    }
+    mcpl_internal_mutex_lock( &xp->mutex );
+    if ( np ) {
+      slot->n = np;
+      slot->state = MCPLIMP_XSLOT_READ;
+      ++(xp->nblocks_read);
+    } else {
+      xp->read_done = 1;
+    }
+    mcpl_internal_cond_broadcast( &xp->cond );
+    mcpl_internal_mutex_unlock( &xp->mutex );
+    if ( !np )
+      return;
+  }
+}
+
+MCPL_LOCAL void mcpl_internal_xpipe_worker( void * arg )
+{
+  mcpl_internal_xpipe_t * xp = (mcpl_internal_xpipe_t*)arg;
+  mcpl_internal_filtereval_t feval;
+  mcpl_internal_filtereval_init( &feval, xp->filter, xp->blocksize );
+  const unsigned psize = xp->fs->particle_size;
+  for (;;) {
+    mcpl_internal_mutex_lock( &xp->mutex );
+    while ( xp->nblocks_taken == xp->nblocks_read && !xp->read_done )
+      mcpl_internal_cond_wait( &xp->cond, &xp->mutex );
+    if ( xp->nblocks_taken == xp->nblocks_read ) {
+      //nothing more to do:
+      mcpl_internal_mutex_unlock( &xp->mutex );
+      break;
+    }
+    mcpl_internal_xslot_t * slot = ( xp->slots
+                                     + ( xp->nblocks_taken++ % xp->nslots ) );
+    assert( slot->state == MCPLIMP_XSLOT_READ );
+    slot->state = MCPLIMP_XSLOT_BUSY;
+    mcpl_internal_mutex_unlock( &xp->mutex );
+    //The slot is now owned by this worker:
+    unsigned np = slot->n;
+    mcpl_internal_filtereval_decode( &feval, xp->fs, slot->buf, np );
+    if ( mcpl_internal_filtereval_run( &feval, xp->filter, np ) != np )
+      np = mcpl_internal_filtereval_compact( &feval, slot->buf, psize, np );
+    mcpl_internal_mutex_lock( &xp->mutex );
+    slot->n = np;
+    slot->state = MCPLIMP_XSLOT_DONE;
+    mcpl_internal_cond_broadcast( &xp->cond );
+    mcpl_internal_mutex_unlock( &xp->mutex );
+  }
+  mcpl_internal_filtereval_dealloc( &feval );
+}
+
+MCPL_LOCAL uint64_t mcpl_internal_extract_particles_mt( mcpl_fileinternal_t * fs,
+                                                        mcpl_outfileinternal_t * ft,
+                                                        uint64_t nmax,
+                                                        const mcpl_internal_filter_t * filter,
+                                                        const mcpl_internal_blockselection_t * blocksel,
+                                                        unsigned blocksize,
+                                                        unsigned nworkers )
+{
+  assert( filter && nworkers > 0 );
+  mcpl_internal_xpipe_t xp;
+  xp.fs = fs;
+  xp.filter = filter;
+  xp.blocksel = blocksel;
+  xp.blocksize = blocksize;
+  xp.nslots = nworkers + 4;//enough to keep everyone busy
+  xp.slots = (mcpl_internal_xslot_t*)mcpl_internal_calloc( xp.nslots,
+                                                           sizeof(mcpl_internal_xslot_t) );
+  for ( unsigned i = 0; i < xp.nslots; ++i ) {
+    xp.slots[i].buf = mcpl_internal_malloc( (size_t)blocksize * fs->particle_size );
+    xp.slots[i].n = 0;
+    xp.slots[i].state = MCPLIMP_XSLOT_EMPTY;
+  }
+  xp.nleft = nmax;
+  xp.nblocks_read = 0;
+  xp.nblocks_taken = 0;
+  xp.read_done = 0;
+  mcpl_internal_mutex_init( &xp.mutex );
+  mcpl_internal_cond_init( &xp.cond );
+
+  mcpl_internal_thread_t * threads
+    = (mcpl_internal_thread_t*)mcpl_internal_malloc( sizeof(mcpl_internal_thread_t)
+                                                     * ( nworkers + 1 ) );
+  mcpl_internal_thread_create( &threads[0], mcpl_internal_xpipe_reader, &xp );
+  for ( unsigned i = 1; i <= nworkers; ++i )
+    mcpl_internal_thread_create( &threads[i], mcpl_internal_xpipe_worker, &xp );
+
+  //Write out processed blocks in order:
+  uint64_t added = 0;
+  for ( uint64_t iblock = 0; ; ++iblock ) {
+    mcpl_internal_xslot_t * slot = xp.slots + ( iblock % xp.nslots );
+    mcpl_internal_mutex_lock( &xp.mutex );
+    while ( !( iblock < xp.nblocks_read && slot->state == MCPLIMP_XSLOT_DONE )
+            && !( xp.read_done && iblock == xp.nblocks_read ) )
+      mcpl_internal_cond_wait( &xp.cond, &xp.mutex );
+    int finished = ( iblock == xp.nblocks_read );
+    mcpl_internal_mutex_unlock( &xp.mutex );
+    if ( finished )
+      break;
+    mcpl_internal_write_raw_particles( ft, slot->buf, slot->n );
+    added += slot->n;
+    mcpl_internal_mutex_lock( &xp.mutex );
+    slot->state = MCPLIMP_XSLOT_EMPTY;
+    mcpl_internal_cond_broadcast( &xp.cond );
+    mcpl_internal_mutex_unlock( &xp.mutex );
+  }
+
+  for ( unsigned i = 0; i <= nworkers; ++i )
+    mcpl_internal_thread_join( &threads[i] );
+  free( threads );
+  mcpl_internal_cond_destroy( &xp.cond );
+  mcpl_internal_mutex_destroy( &xp.mutex );
+  for ( unsigned i = 0; i < xp.nslots; ++i )
+    free( xp.slots[i].buf );
+  free( xp.slots );
+  return added;
+}
+#endif
+
+//Transfer up to nmax particles from fi to fo, skipping any particles not
+//selected by the filter (if not null). When the particle data is encoded in
+//the same manner in both files, this is done with blocks of raw particle data
+//(filtered by nthreads worker threads if nthreads>1), otherwise it falls back to
+//reading and transferring one particle at a time. If an index file is available
+//for fi, blocks which can not contain selected particles are skipped. Returns
+//number of particles added to fo:
+MCPL_LOCAL uint64_t mcpl_internal_extract_particles( mcpl_file_t fi,
+                                                     mcpl_outfile_t fo,
+                                                     uint64_t nmax,
+                                                     const mcpl_internal_filter_t * filter,
+                                                     unsigned nthreads )
+{
+  mcpl_fileinternal_t * fs = (mcpl_fileinternal_t *)fi.internal;
+  mcpl_outfileinternal_t * ft = (mcpl_outfileinternal_t *)fo.internal;
+  assert(fs);
+  assert(ft);
+  uint64_t added = 0;
+  int blockwise = ( fs->format_version == MCPL_FORMATVERSION
+                    && ft->opt_signature == fs->opt_signature
+                    && ft->particle_size == fs->particle_size
+                    && ft->opt_universalpdgcode == fs->opt_universalpdgcode
+                    && ft->opt_universalweight == fs->opt_universalweight );
+  const unsigned blocksize = ( blockwise ? 16384 : 1 );
+
+  mcpl_internal_blockselection_t blocksel_data;
+  const mcpl_internal_blockselection_t * blocksel = NULL;
+  if ( filter ) {
+    uint64_t pos = fs->current_particle_idx;
+    if ( mcpl_internal_blockselection_init( &blocksel_data, fs, filter ) ) {
+      blocksel = &blocksel_data;
+      char buf[128];
+      snprintf( buf, sizeof(buf),
+                "MCPL: Using index file to skip %llu of %llu particle blocks.\n",
+                (unsigned long long)( blocksel->nblocks - blocksel->ncandidates ),
+                (unsigned long long)blocksel->nblocks );
+      mcpl_print( buf );
+    }
+    mcpl_seek( fi, pos );
+  }
+
+#ifndef MCPL_NO_THREADS
+  if ( blockwise && filter && nthreads > 1 ) {
+    mcpl_internal_write_raw_particles( ft, NULL, 0 );//ensure header is written
+    added = mcpl_internal_extract_particles_mt( fs, ft, nmax, filter, blocksel,
+                                                blocksize, nthreads );
+    if ( blocksel )
+      free( blocksel_data.candidate );
+    return added;
+  }
+#else
+  (void)nthreads;
+#endif
+  mcpl_internal_filtereval_t feval;
+  if ( filter )
+    mcpl_internal_filtereval_init( &feval, filter, blocksize );
+
+  if ( blockwise ) {
+    char * buf = mcpl_internal_malloc( (size_t)blocksize * fs->particle_size );
+    mcpl_internal_write_raw_particles( ft, buf, 0 );//ensure header is written
+    while ( nmax ) {
+      unsigned nconsumed;
+      unsigned np = mcpl_internal_read_raw_candidates( fs, blocksel, buf,
+                                                       ( nmax < blocksize
+                                                         ? (unsigned)nmax
+                                                         : blocksize ),
+                                                       &nconsumed );
+      if (!nconsumed)
+        break;
+      nmax -= nconsumed;
+      if (!np)
+        continue;
+      if ( filter ) {
+        mcpl_internal_filtereval_decode( &feval, fs, buf, np );
+        if ( mcpl_internal_filtereval_run( &feval, filter, np ) != np )
+          np = mcpl_internal_filtereval_compact( &feval, buf,
+                                                 fs->particle_size, np );
+      }
+      mcpl_internal_write_raw_particles( ft, buf, np );
+      added += np;
+    }
+    free(buf);
+  } else {
+    for ( ; nmax; --nmax ) {
+      if ( blocksel && fs->current_particle_idx < fs->nparticles
+           && !blocksel->candidate[fs->current_particle_idx / MCPLIMP_INDEX_BLOCKSIZE] ) {
+        unsigned nconsumed;
+        mcpl_internal_read_raw_candidates( fs, blocksel, NULL,
+                                           ( nmax < UINT_MAX ? (unsigned)nmax : UINT_MAX ),
+                                           &nconsumed );
+        nmax -= nconsumed - 1;//compensate for --nmax
+        continue;
+      }
+      const mcpl_particle_t* p = mcpl_read(fi);
+      if (!p)
+        break;
+      if ( filter ) {
+        mcpl_internal_filtereval_setparticle( &feval, p );
+        if ( !mcpl_internal_filtereval_run( &feval, filter, 1 ) )
+          continue;
+      }
+      mcpl_transfer_last_read_particle(fi, fo);
+      ++added;
+    }
+  }
+  if ( filter )
+    mcpl_internal_filtereval_dealloc( &feval );
+  if ( blocksel )
+    free( blocksel_data.candidate );
+  return added;
+}
@@ -0,0 +1,322 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "mcplpipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef MCPL_NO_THREADS
+#  ifdef _WIN32
+#    ifndef WIN32_LEAN_AND_MEAN
+#      define WIN32_LEAN_AND_MEAN
+#    endif
+#    ifndef NOMINMAX
+#      define NOMINMAX
+#    endif
+#    include <windows.h>
+#  else
+#    include <pthread.h>
+#    include <unistd.h>
+#  endif
+#endif
+
+void mcplpipeline_run_serial( const mcplpipeline_def_t * def )
+{
+  void * b = def->create_block( def->ctx );
+  while ( def->load( def->ctx, b ) ) {
+    def->convert( def->ctx, b );
+    if ( !def->write( def->ctx, b ) )
+      break;
+  }
+  def->destroy_block( b );
+}
+
+#ifndef MCPL_NO_THREADS
+
+//Blocks are kept in a ring buffer, and the state of the pipeline is protected
+//by a single mutex:
+
+#  ifdef _WIN32
+typedef CRITICAL_SECTION mcplpipeline_mutex_t;
+typedef CONDITION_VARIABLE mcplpipeline_cond_t;
+typedef HANDLE mcplpipeline_thread_t;
+#  else
+typedef pthread_mutex_t mcplpipeline_mutex_t;
+typedef pthread_cond_t mcplpipeline_cond_t;
+typedef pthread_t mcplpipeline_thread_t;
+#  endif
+
+typedef struct {
+  const mcplpipeline_def_t * def;
+  void ** blocks;
+  int * converted;
+  uint64_t nblocks;
+  uint64_t nloaded;//blocks loaded by the reader
+  uint64_t ntaken;//blocks taken by converters
+  uint64_t nwritten;//blocks written (and thus free to be reused)
+  int eof;
+  int stop;
+  mcplpipeline_mutex_t mutex;
+  mcplpipeline_cond_t cond;
+} mcplpipeline_state_t;
+
+void mcplpipeline_lock( mcplpipeline_state_t * pl )
+{
+#  ifdef _WIN32
+  EnterCriticalSection( &pl->mutex );
+#  else
+  pthread_mutex_lock( &pl->mutex );
+#  endif
+}
+
+void mcplpipeline_unlock_and_notify( mcplpipeline_state_t * pl )
+{
+#  ifdef _WIN32
+  WakeAllConditionVariable( &pl->cond );
+  LeaveCriticalSection( &pl->mutex );
+#  else
+  pthread_cond_broadcast( &pl->cond );
+  pthread_mutex_unlock( &pl->mutex );
+#  endif
+}
+
+void mcplpipeline_wait( mcplpipeline_state_t * pl )
+{
+#  ifdef _WIN32
+  SleepConditionVariableCS( &pl->cond, &pl->mutex, INFINITE );
+#  else
+  pthread_cond_wait( &pl->cond, &pl->mutex );
+#  endif
+}
+
+void mcplpipeline_reader( mcplpipeline_state_t * pl )
+{
+  while ( 1 ) {
+    mcplpipeline_lock( pl );
+    while ( pl->nloaded - pl->nwritten >= pl->nblocks && !pl->stop )
+      mcplpipeline_wait( pl );
+    if ( pl->stop ) {
+      mcplpipeline_unlock_and_notify( pl );
+      return;
+    }
+    uint64_t ib = pl->nloaded % pl->nblocks;
+    mcplpipeline_unlock_and_notify( pl );
+
+    unsigned long n = pl->def->load( pl->def->ctx, pl->blocks[ib] );
+
+    mcplpipeline_lock( pl );
+    if ( n ) {
+      pl->converted[ib] = 0;
+      ++pl->nloaded;
+    } else {
+      pl->eof = 1;
+    }
+    mcplpipeline_unlock_and_notify( pl );
+    if ( !n )
+      return;
+  }
+}
+
+void mcplpipeline_converter( mcplpipeline_state_t * pl )
+{
+  while ( 1 ) {
+    mcplpipeline_lock( pl );
+    while ( pl->ntaken == pl->nloaded && !pl->eof && !pl->stop )
+      mcplpipeline_wait( pl );
+    if ( pl->ntaken == pl->nloaded || pl->stop ) {
+      //Nothing more to do:
+      mcplpipeline_unlock_and_notify( pl );
+      return;
+    }
+    uint64_t ib = pl->ntaken++ % pl->nblocks;
+    mcplpipeline_unlock_and_notify( pl );
+
+    pl->def->convert( pl->def->ctx, pl->blocks[ib] );
+
+    mcplpipeline_lock( pl );
+    pl->converted[ib] = 1;
+    mcplpipeline_unlock_and_notify( pl );
+  }
+}
+
+#  ifdef _WIN32
+DWORD WINAPI mcplpipeline_reader_thread( LPVOID arg )
+{
+  mcplpipeline_reader( (mcplpipeline_state_t*)arg );
+  return 0;
+}
+DWORD WINAPI mcplpipeline_converter_thread( LPVOID arg )
+{
+  mcplpipeline_converter( (mcplpipeline_state_t*)arg );
+  return 0;
+}
+#  else
+void * mcplpipeline_reader_thread( void * arg )
+{
+  mcplpipeline_reader( (mcplpipeline_state_t*)arg );
+  return NULL;
+}
+void * mcplpipeline_converter_thread( void * arg )
+{
+  mcplpipeline_converter( (mcplpipeline_state_t*)arg );
+  return NULL;
+}
+#  endif
+
+void mcplpipeline_thread_create( mcplpipeline_thread_t * t, int reader,
+                                mcplpipeline_state_t * pl )
+{
+#  ifdef _WIN32
+  *t = CreateThread( NULL, 0, ( reader ? mcplpipeline_reader_thread
+                                : mcplpipeline_converter_thread ), pl, 0, NULL );
+  if ( !*t )
+    pl->def->error("Failed to create thread");
+#  else
+  if ( pthread_create( t, NULL, ( reader ? mcplpipeline_reader_thread
+                                  : mcplpipeline_converter_thread ), pl ) )
+    pl->def->error("Failed to create thread");
+#  endif
+}
+
+void mcplpipeline_thread_join( mcplpipeline_thread_t * t )
+{
+#  ifdef _WIN32
+  WaitForSingleObject( *t, INFINITE );
+  CloseHandle( *t );
+#  else
+  pthread_join( *t, NULL );
+#  endif
+}
+
+void mcplpipeline_run_pipeline( const mcplpipeline_def_t * def,
+                                unsigned nthreads )
+{
+  mcplpipeline_state_t pl;
+  memset(&pl,0,sizeof(pl));
+  pl.def = def;
+  //Enough blocks to keep all converters busy while the writer is working:
+  pl.nblocks = 2 * nthreads + 2;
+  pl.blocks = malloc( pl.nblocks * sizeof(void*) );
+  pl.converted = calloc( pl.nblocks, sizeof(int) );
+  if ( !pl.blocks || !pl.converted )
+    def->error("memory allocation failure");
+  uint64_t i;
+  for ( i = 0; i < pl.nblocks; ++i )
+    pl.blocks[i] = def->create_block( def->ctx );
+#  ifdef _WIN32
+  InitializeCriticalSection( &pl.mutex );
+  InitializeConditionVariable( &pl.cond );
+#  else
+  pthread_mutex_init( &pl.mutex, NULL );
+  pthread_cond_init( &pl.cond, NULL );
+#  endif
+
+  mcplpipeline_thread_t * threads = malloc( ( nthreads + 1 ) * sizeof(mcplpipeline_thread_t) );
+  if (!threads)
+    def->error("memory allocation failure");
+  mcplpipeline_thread_create( &threads[0], 1, &pl );
+  for ( i = 1; i <= nthreads; ++i )
+    mcplpipeline_thread_create( &threads[i], 0, &pl );
+
+  //Write blocks in order as they become ready:
+  while ( 1 ) {
+    mcplpipeline_lock( &pl );
+    uint64_t ib = pl.nwritten % pl.nblocks;
+    while ( !( pl.nwritten < pl.nloaded && pl.converted[ib] )
+            && !( pl.eof && pl.nwritten == pl.nloaded ) )
+      mcplpipeline_wait( &pl );
+    int done = ( pl.nwritten == pl.nloaded );
+    mcplpipeline_unlock_and_notify( &pl );
+    if ( done )
+      break;
+
+    int more = def->write( def->ctx, pl.blocks[ib] );
+
+    mcplpipeline_lock( &pl );
+    pl.converted[ib] = 0;
+    ++pl.nwritten;
+    if ( !more )
+      pl.stop = 1;
+    mcplpipeline_unlock_and_notify( &pl );
+    if ( !more )
+      break;
+  }
+
+  for ( i = 0; i <= nthreads; ++i )
+    mcplpipeline_thread_join( &threads[i] );
+  free(threads);
+#  ifdef _WIN32
+  DeleteCriticalSection( &pl.mutex );
+#  else
+  pthread_mutex_destroy( &pl.mutex );
+  pthread_cond_destroy( &pl.cond );
+#  endif
+  for ( i = 0; i < pl.nblocks; ++i )
+    def->destroy_block( pl.blocks[i] );
+  free( pl.blocks );
+  free( pl.converted );
+}
+
+#endif
+
+unsigned mcplpipeline_resolve_nthreads( unsigned nthreads )
+{
+#ifdef MCPL_NO_THREADS
+  (void)nthreads;
+  return 1;
+#else
+  if ( !nthreads ) {
+#  ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo( &si );
+    nthreads = (unsigned)si.dwNumberOfProcessors;
+#  else
+    long ncpu = sysconf( _SC_NPROCESSORS_ONLN );
+    nthreads = ( ncpu > 0 ? (unsigned)ncpu : 1 );
+#  endif
+  }
+  if ( nthreads < 1 )
+    nthreads = 1;
+  if ( nthreads > MCPLPIPELINE_MAX_NTHREADS )
+    nthreads = MCPLPIPELINE_MAX_NTHREADS;
+  return nthreads;
+#endif
+}
+
+void mcplpipeline_run( const mcplpipeline_def_t * def, unsigned nthreads )
+{
+#ifndef MCPL_NO_THREADS
+  if ( nthreads != 1 ) {
+    mcplpipeline_run_pipeline( def, mcplpipeline_resolve_nthreads( nthreads ) );
+    return;
+  }
+#else
+  (void)nthreads;
+#endif
+  mcplpipeline_run_serial( def );
+}
+
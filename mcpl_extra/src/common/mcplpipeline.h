@@ -0,0 +1,62 @@
+
+/******************************************************************************/
+/*                                                                            */
+/*  This file is part of MCPL (see https://mctools.github.io/mcpl/)           */
+/*                                                                            */
+/*  Copyright 2015-2026 MCPL developers.                                      */
+/*                                                                            */
+/*  Licensed under the Apache License, Version 2.0 (the "License");           */
+/*  you may not use this file except in compliance with the License.          */
+/*  You may obtain a copy of the License at                                   */
+/*                                                                            */
+/*      http://www.apache.org/licenses/LICENSE-2.0                            */
+/*                                                                            */
+/*  Unless required by applicable law or agreed to in writing, software       */
+/*  distributed under the License is distributed on an "AS IS" BASIS,         */
+/*  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  */
+/*  See the License for the specific language governing permissions and       */
+/*  limitations under the License.                                            */
+/*                                                                            */
+/******************************************************************************/
+
+#ifndef mcplpipeline_h
+#define mcplpipeline_h
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+// Block-wise conversion of particles, shared by the converters in            //
+// mcpl_extra. Particles are read, converted and written in blocks, possibly  //
+// in a pipeline where one thread reads blocks, a number of threads convert   //
+// them, and the calling thread writes the converted blocks in their original //
+// order. The output is thus independent of the number of threads used.       //
+//                                                                            //
+// Define MCPL_NO_THREADS to build without thread support, in which case all  //
+// conversions are done serially.                                             //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#define MCPLPIPELINE_BLOCKSIZE 4096
+#define MCPLPIPELINE_MAX_NTHREADS 64
+
+typedef struct {
+  void * ctx;
+  void * (*create_block)( void * ctx );
+  void (*destroy_block)( void * block );
+  //Fill block, returning the number of particles in it (0 at EOF):
+  unsigned long (*load)( void * ctx, void * block );
+  //Convert block (can be called concurrently for different blocks):
+  void (*convert)( void * ctx, void * block );
+  //Write block, returning 0 if no further blocks are needed:
+  int (*write)( void * ctx, void * block );
+  //Report fatal error (must not return):
+  void (*error)( const char * msg );
+} mcplpipeline_def_t;
+
+//Number of converter threads to use when nthreads were requested (0 means one
+//per available processor core). Always returns 1 without thread support:
+unsigned mcplpipeline_resolve_nthreads( unsigned nthreads );
+
+//Run serially when nthreads is 1, otherwise as a pipeline:
+void mcplpipeline_run( const mcplpipeline_def_t * def, unsigned nthreads );
+
+#endif
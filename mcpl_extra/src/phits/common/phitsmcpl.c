@@ -37,6 +37,7 @@
 #include "phitsmcpl.h"
 #include "phitsread.h"
 #include "mcpl.h"
+#include "mcplpipeline.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -116,32 +117,54 @@ int phits2mcpl2( const char * phitsdumpfile, const char * mcplfile,
 
   mcpl_particle_t* mcpl_particle = mcpl_get_empty_particle(mcplfh);
 
-  while ( 1 ) {
-    const phits_particle_t * p = phits_load_particle(f);
-    if (!p)
-      break;
+  //Read particles in batches, which is much faster than one at a time:
+  const unsigned long nbatch = 4096;
+  phits_particle_t * batch = malloc( nbatch * sizeof(phits_particle_t) );
+  if (!batch) {
+    printf("Error: Memory allocation error\n");
+    return 0;
+  }
 
-    if (!p->pdgcode) {
-      printf("Warning: ignored particle with no PDG code set (raw phits kt"
-             " code was %li).\n",p->rawtype);
-      continue;
+  uint64_t skipped_nopdg = 0;
+  unsigned long nloaded;
+  while ( ( nloaded = phits_load_particles(f, nbatch, batch) ) ) {
+    unsigned long i;
+    for ( i = 0; i < nloaded; ++i )
+      batch[i].time *= 1.0e-6;//nanoseconds (PHITS) to milliseconds (MCPL)
+    for ( i = 0; i < nloaded; ++i ) {
+      const phits_particle_t * p = batch + i;
+      if (!p->pdgcode) {
+        ++skipped_nopdg;
+        if (skipped_nopdg<=100) {
+          printf("Warning: ignored particle with no PDG code set (raw phits kt"
+                 " code was %li).\n",p->rawtype);
+          if (skipped_nopdg==100)
+            printf("Warning: Suppressing future warnings regarding particles"
+                   " with no PDG code set.\n");
+        }
+        continue;
+      }
+      mcpl_particle->pdgcode = p->pdgcode;
+      mcpl_particle->position[0] = p->x;//already in cm
+      mcpl_particle->position[1] = p->y;//already in cm
+      mcpl_particle->position[2] = p->z;//already in cm
+      mcpl_particle->direction[0] = p->dirx;
+      mcpl_particle->direction[1] = p->diry;
+      mcpl_particle->direction[2] = p->dirz;
+      mcpl_particle->polarisation[0] = p->polx;
+      mcpl_particle->polarisation[1] = p->poly;
+      mcpl_particle->polarisation[2] = p->polz;
+      mcpl_particle->time = p->time;
+      mcpl_particle->weight = p->weight;
+      mcpl_particle->ekin = p->ekin;//already in MeV
+      mcpl_add_particle(mcplfh,mcpl_particle);
     }
-    mcpl_particle->pdgcode = p->pdgcode;
-    mcpl_particle->position[0] = p->x;//already in cm
-    mcpl_particle->position[1] = p->y;//already in cm
-    mcpl_particle->position[2] = p->z;//already in cm
-    mcpl_particle->direction[0] = p->dirx;
-    mcpl_particle->direction[1] = p->diry;
-    mcpl_particle->direction[2] = p->dirz;
-    mcpl_particle->polarisation[0] = p->polx;
-    mcpl_particle->polarisation[1] = p->poly;
-    mcpl_particle->polarisation[2] = p->polz;
-    mcpl_particle->time = p->time * 1.0e-6;//nanoseconds (PHITS) to milliseconds
-                                           //(MCPL)
-    mcpl_particle->weight = p->weight;
-    mcpl_particle->ekin = p->ekin;//already in MeV
-    mcpl_add_particle(mcplfh,mcpl_particle);
   }
+  free(batch);
+
+  if (skipped_nopdg>100)
+    printf("Warning: ignored %llu particles in total with no PDG code set.\n",
+           (unsigned long long)skipped_nopdg);
 
   const char * tmp = mcpl_outfile_filename(mcplfh);
   size_t laf = strlen(tmp);
@@ -274,70 +297,84 @@ int phits2mcpl_app(int argc,char** argv)
   return ok ? 0 : 1;
 }
 
-void phits_writerecord( mcpl_generic_wfilehandle_t* fh,
-                        int reclen, size_t lbuf, char* buf )
+//Blocks used when converting from MCPL to PHITS. Particles are encoded into
+//complete Fortran records by the converter threads, while decisions involving
+//counts and limits are made in the writer as particles are written in order:
+typedef struct {
+  mcpl_particle_t * parts;
+  unsigned long n;
+  unsigned char * encoded;//1 if particle was encoded, 0 if it was skipped
+  int32_t * rawtypes;
+  char * recs;//encoded records
+} mcpl2phits_block_t;
+
+typedef struct {
+  mcpl_file_t fmcpl;
+  mcpl_generic_wfilehandle_t * fout;
+  int use_polarisation;
+  int reclen;
+  size_t lrec;
+  uint64_t nparticles_limit;
+  uint64_t used;
+  uint64_t skipped_nophitstype;
+} mcpl2phits_ctx_t;
+
+void * mcpl2phits_create_block( void * ctx )
 {
-  if (reclen==4) {
-    if ( lbuf > UINT32_MAX )
-      phits_error("output record size too large for 32bit records");
-    uint32_t rl = (uint32_t)lbuf;
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-    mcpl_generic_fwrite( fh, buf, lbuf );
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-  } else {
-    assert(reclen==8);
-    uint64_t rl = lbuf;
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-    mcpl_generic_fwrite( fh, buf, lbuf );
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-  }
+  mcpl2phits_ctx_t * c = (mcpl2phits_ctx_t*)ctx;
+  mcpl2phits_block_t * b = malloc( sizeof(mcpl2phits_block_t) );
+  if (!b)
+    phits_error("memory allocation failure");
+  b->parts = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(mcpl_particle_t) );
+  b->encoded = malloc( MCPLPIPELINE_BLOCKSIZE );
+  b->rawtypes = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(int32_t) );
+  b->recs = malloc( MCPLPIPELINE_BLOCKSIZE * c->lrec );
+  b->n = 0;
+  if ( !b->parts || !b->encoded || !b->rawtypes || !b->recs )
+    phits_error("memory allocation failure");
+  return b;
 }
 
-int mcpl2phits( const char * inmcplfile, const char * outphitsdumpfile,
-                int use_polarisation, uint64_t nparticles_limit, int reclen )
+void mcpl2phits_destroy_block( void * block )
 {
-  if ( reclen != 4 && reclen != 8 )
-    phits_error("Reclen parameter should be 4 (32bit Fortran record markers,"
-                " recommended) or 8 (64bit Fortran record markers)");
-
-  mcpl_file_t fmcpl = mcpl_open_file(inmcplfile);
-
-  printf( "Opened MCPL file produced with \"%s\" (contains %llu particles)\n",
-          mcpl_hdr_srcname(fmcpl),
-          (unsigned long long)mcpl_hdr_nparticles(fmcpl) );
-
-  printf("Creating (or overwriting) output PHITS file.\n");
-
-  //Open new phits file:
-  mcpl_generic_wfilehandle_t fout = mcpl_generic_wfopen(outphitsdumpfile);
-
-  if (!fout.internal)
-    phits_error("Problems opening new PHITS file");
-
-  uint64_t used = 0;
-  uint64_t skipped_nophitstype = 0;
-
-  printf("Initiating particle conversion loop.\n");
+  mcpl2phits_block_t * b = (mcpl2phits_block_t*)block;
+  free( b->parts );
+  free( b->encoded );
+  free( b->rawtypes );
+  free( b->recs );
+  free( b );
+}
 
-  double dumpdata[13] = {0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.,0.};//explicit since gcc 4.1-4.6 might warn on ={0}; syntax
+unsigned long mcpl2phits_load( void * ctx, void * block )
+{
+  mcpl2phits_ctx_t * c = (mcpl2phits_ctx_t*)ctx;
+  mcpl2phits_block_t * b = (mcpl2phits_block_t*)block;
+  b->n = (unsigned long)mcpl_read_particles( c->fmcpl, b->parts,
+                                             MCPLPIPELINE_BLOCKSIZE );
+  return b->n;
+}
 
-  while ( 1 ) {
-    const mcpl_particle_t* mcpl_p = mcpl_read(fmcpl);
-    if ( !mcpl_p )
-      break;
-    int32_t rawtype =  conv_code_pdg2phits( mcpl_p->pdgcode );
-    if (!rawtype) {
-      ++skipped_nophitstype;
-      if (skipped_nophitstype<=100) {
-        printf("WARNING: Found PDG code (%li) in the MCPL file which can not be converted to a PHITS particle code\n",
-               (long)mcpl_p->pdgcode);
-        if (skipped_nophitstype==100)
-          printf("WARNING: Suppressing future warnings regarding non-convertible PDG codes.\n");
-      }
+void mcpl2phits_convert( void * ctx, void * block )
+{
+  const mcpl2phits_ctx_t * c = (const mcpl2phits_ctx_t*)ctx;
+  mcpl2phits_block_t * b = (mcpl2phits_block_t*)block;
+  const size_t ldata = sizeof(double)*(c->use_polarisation?13:10);
+  char * out = b->recs;
+  double dumpdata[13];
+  unsigned long i;
+
+  //Convert all PDG codes in the block at once:
+  int32_t * rawtypes = b->rawtypes;
+  for ( i = 0; i < b->n; ++i )
+    rawtypes[i] = b->parts[i].pdgcode;
+  conv_code_pdg2phits_array( rawtypes, rawtypes, b->n );
+
+  for ( i = 0; i < b->n; ++i ) {
+    const mcpl_particle_t* mcpl_p = b->parts + i;
+    int32_t rawtype = rawtypes[i];
+    b->encoded[i] = ( rawtype ? 1 : 0 );
+    if (!rawtype)
       continue;
-    }
-
-    assert(rawtype!=0);
 
     dumpdata[0] = rawtype;
     dumpdata[1] = mcpl_p->position[0];//Already in cm
@@ -353,24 +390,114 @@ int mcpl2phits( const char * inmcplfile, const char * outphitsdumpfile,
     dumpdata[11] = mcpl_p->polarisation[1];
     dumpdata[12] = mcpl_p->polarisation[2];
 
-    if (used==INT32_MAX) {
+    //Encode as a Fortran record:
+    if ( c->reclen == 4 ) {
+      uint32_t rl = (uint32_t)ldata;
+      memcpy( out, &rl, 4 );
+      memcpy( out + 4, dumpdata, ldata );
+      memcpy( out + 4 + ldata, &rl, 4 );
+    } else {
+      uint64_t rl = ldata;
+      memcpy( out, &rl, 8 );
+      memcpy( out + 8, dumpdata, ldata );
+      memcpy( out + 8 + ldata, &rl, 8 );
+    }
+    out += c->lrec;
+  }
+}
+
+int mcpl2phits_write( void * ctx, void * block )
+{
+  mcpl2phits_ctx_t * c = (mcpl2phits_ctx_t*)ctx;
+  mcpl2phits_block_t * b = (mcpl2phits_block_t*)block;
+  size_t nbytes = 0;
+  int more = 1;
+  unsigned long i;
+  for ( i = 0; i < b->n; ++i ) {
+    if (!b->encoded[i]) {
+      ++c->skipped_nophitstype;
+      if (c->skipped_nophitstype<=100) {
+        printf("WARNING: Found PDG code (%li) in the MCPL file which can not be converted to a PHITS particle code\n",
+               (long)b->parts[i].pdgcode);
+        if (c->skipped_nophitstype==100)
+          printf("WARNING: Suppressing future warnings regarding non-convertible PDG codes.\n");
+      }
+      continue;
+    }
+
+    if (c->used==INT32_MAX) {
       printf("WARNING: Writing more than 2147483647 (maximum value of 32 bit integers) particles in the PHITS dump "
              "file - it is not known whether PHITS will be able to deal with such files correctly.\n");
     }
-    phits_writerecord(&fout,reclen,sizeof(double)*(use_polarisation?13:10),(char*)&dumpdata[0]);
+    nbytes += c->lrec;
 
-    if (++used==nparticles_limit) {
-      uint64_t remaining = mcpl_hdr_nparticles(fmcpl) - skipped_nophitstype - used;
+    if (++c->used==c->nparticles_limit) {
+      uint64_t remaining = mcpl_hdr_nparticles(c->fmcpl) - c->skipped_nophitstype - c->used;
       if (remaining)
         printf("Output limit of %llu particles reached. Ignoring"
                " remaining %llu particles in the MCPL file.\n",
-               (unsigned long long)nparticles_limit,
+               (unsigned long long)c->nparticles_limit,
                (unsigned long long)remaining );
+      more = 0;
       break;
     }
+  }
+  mcpl_generic_fwrite( c->fout, b->recs, nbytes );
+  return more;
+}
 
+int mcpl2phits( const char * inmcplfile, const char * outphitsdumpfile,
+                int use_polarisation, uint64_t nparticles_limit, int reclen )
+{
+  return mcpl2phits2( inmcplfile, outphitsdumpfile, use_polarisation,
+                      nparticles_limit, reclen, 0, 1 );
+}
 
-  }
+int mcpl2phits2( const char * inmcplfile, const char * outphitsdumpfile,
+                 int use_polarisation, uint64_t nparticles_limit, int reclen,
+                 int opt_gzip, unsigned nthreads )
+{
+  if ( reclen != 4 && reclen != 8 )
+    phits_error("Reclen parameter should be 4 (32bit Fortran record markers,"
+                " recommended) or 8 (64bit Fortran record markers)");
+
+  mcpl_file_t fmcpl = mcpl_open_file(inmcplfile);
+
+  printf( "Opened MCPL file produced with \"%s\" (contains %llu particles)\n",
+          mcpl_hdr_srcname(fmcpl),
+          (unsigned long long)mcpl_hdr_nparticles(fmcpl) );
+
+  printf("Creating (or overwriting) output PHITS file.\n");
+
+  //Open new phits file:
+  mcpl_generic_wfilehandle_t fout = mcpl_generic_wfopen(outphitsdumpfile);
+
+  if (!fout.internal)
+    phits_error("Problems opening new PHITS file");
+
+  mcpl2phits_ctx_t ctx;
+  memset(&ctx,0,sizeof(ctx));
+  ctx.fmcpl = fmcpl;
+  ctx.fout = &fout;
+  ctx.use_polarisation = use_polarisation;
+  ctx.reclen = reclen;
+  ctx.lrec = sizeof(double)*(use_polarisation?13:10) + 2 * (size_t)reclen;
+  ctx.nparticles_limit = nparticles_limit;
+
+  printf("Initiating particle conversion loop.\n");
+
+  mcplpipeline_def_t def;
+  def.ctx = &ctx;
+  def.create_block = mcpl2phits_create_block;
+  def.destroy_block = mcpl2phits_destroy_block;
+  def.load = mcpl2phits_load;
+  def.convert = mcpl2phits_convert;
+  def.write = mcpl2phits_write;
+  def.error = phits_error;
+  mcplpipeline_run( &def, nthreads );
+
+  uint64_t used = ctx.used;
+  uint64_t skipped_nophitstype = ctx.skipped_nophitstype;
 
   printf("Ending particle conversion loop.\n");
 
@@ -381,11 +508,13 @@ int mcpl2phits( const char * inmcplfile, const char * outphitsdumpfile,
   mcpl_close_file(fmcpl);
   mcpl_generic_fwclose(&fout);
 
-  printf("Created %s with %lli particles.\n",outphitsdumpfile,(long long)used);
-
-  return 1;
+  int did_gzip = 0;
+  if (opt_gzip)
+    did_gzip = mcpl_gzip_file(outphitsdumpfile);
 
+  printf("Created %s%s with %lli particles.\n",outphitsdumpfile,(did_gzip?".gz":""),(long long)used);
 
+  return 1;
 }
 
 
@@ -419,6 +548,10 @@ int mcpl2phits_app_usage( const char** argv, const char * errmsg ) {
          "                 the default (32 bit) is almost always the correct choice.\n"
          "  -l<LIMIT>    : Limit the number of particles transferred to the PHITS file\n"
          "                 (defaults to 0, meaning no limit).\n"
+         "  -z           : Gzip the resulting PHITS file.\n"
+         "  -jN          : Encode PHITS records with N threads, while a separate thread\n"
+         "                 reads the MCPL file (-j0 means one thread per processor\n"
+         "                 core). The output does not depend on N.\n"
          );
   free(progname);
   return 0;
@@ -426,15 +559,19 @@ int mcpl2phits_app_usage( const char** argv, const char * errmsg ) {
 
 int mcpl2phits_parse_args( int argc,const char **argv, const char** inmcplfile,
                            const char **outphitsfile, uint64_t* nparticles_limit,
-                           int* use64bitreclen, int* nopolarisation ) {
+                           int* use64bitreclen, int* nopolarisation,
+                           int* do_gzip, unsigned* nthreads ) {
   //returns: 0 all ok, 1: error, -1: all ok but do nothing (-h/--help mode)
   *inmcplfile = 0;
   *outphitsfile = 0;
   *nparticles_limit = UINT64_MAX;
   *use64bitreclen = 0;
   *nopolarisation = 0;
+  *do_gzip = 0;
+  *nthreads = 1;
 
   int64_t opt_num_limit = -1;
+  int64_t opt_nthreads = -1;
   int i;
   for (i = 1; i<argc; ++i) {
     const char * a = argv[i];
@@ -458,6 +595,8 @@ int mcpl2phits_parse_args( int argc,const char **argv, const char** inmcplfile,
         case 'l': consume_digit = &opt_num_limit; break;
         case 'f': *use64bitreclen = 1; break;
         case 'n': *nopolarisation = 1; break;
+        case 'j': consume_digit = &opt_nthreads; break;
+        case 'z': *do_gzip = 1; break;
         default:
           return mcpl2phits_app_usage(argv,"Unrecognised option");
         }
@@ -493,6 +632,11 @@ int mcpl2phits_parse_args( int argc,const char **argv, const char** inmcplfile,
   //mcpl2phits method emit a WARNING if exceeding INT32_MAX particles.
   *nparticles_limit = opt_num_limit;
 
+  if (opt_nthreads>9999)
+    return mcpl2phits_app_usage(argv,"Parameter out of range : Too many threads requested.");
+  if (opt_nthreads>=0)
+    *nthreads = (unsigned)opt_nthreads;
+
   return 0;
 }
 
@@ -501,11 +645,13 @@ int mcpl2phits_app( int argc, char** argv ) {
   const char * inmcplfile;
   const char * outphitsfile;
   uint64_t nparticles_limit;
-  int use64bitreclen, nopolarisation;
+  int use64bitreclen, nopolarisation, do_gzip;
+  unsigned nthreads;
 
   int parse = mcpl2phits_parse_args( argc, (const char**)argv, &inmcplfile,
                                      &outphitsfile, &nparticles_limit,
-                                     &use64bitreclen, &nopolarisation);
+                                     &use64bitreclen, &nopolarisation,
+                                     &do_gzip, &nthreads );
 
   if (parse==-1)// --help
     return 0;
@@ -515,8 +661,8 @@ int mcpl2phits_app( int argc, char** argv ) {
 
   int reclen = (use64bitreclen?8:4);
 
-  if ( mcpl2phits( inmcplfile, outphitsfile, (nopolarisation?0:1),
-                   nparticles_limit, reclen) )
+  if ( mcpl2phits2( inmcplfile, outphitsfile, (nopolarisation?0:1),
+                    nparticles_limit, reclen, do_gzip, nthreads ) )
     return 0;
 
   return 1;
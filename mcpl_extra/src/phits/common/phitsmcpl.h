@@ -91,6 +91,20 @@ int phits2mcpl2( const char * phitsdumpfile, const char * mcplfile,
 int mcpl2phits( const char * mcplfile, const char * phitsdumpfile,
                 int usepol, uint64_t limit, int reclen );
 
+//////////////////////////////////////////////////////////////////////////////////////
+// Advanced version of the above with more options:
+//
+//  opt_gzip: Set to 1 to gzip the resulting PHITS file. Set to 0 to leave the
+//            resulting file uncompressed.
+//  nthreads: Set to 1 to convert particles serially. Otherwise one thread reads
+//            the MCPL file, nthreads threads encode the PHITS records, and the
+//            calling thread writes them (0 means one encoding thread per
+//            processor core). The resulting file does not depend on nthreads.
+//
+int mcpl2phits2( const char * mcplfile, const char * phitsdumpfile,
+                 int usepol, uint64_t limit, int reclen,
+                 int opt_gzip, unsigned nthreads );
+
 //////////////////////////////////////////////////////////////////////////////////////
 // For easily creating standard phits2mcpl and mcpl2phits cmdline applications:
 int phits2mcpl_app(int argc,char** argv);
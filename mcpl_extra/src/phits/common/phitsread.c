@@ -74,13 +74,25 @@ static int phits_known_nonion_codes[] = { 11, 12, 13, 14, 22, 111, 211, 221,
                                           311, 321, 331, 2112, 2212, 3112,
                                           3122, 3212, 3222, 3312, 3322, 3334 };
 
-int phits_cmp_codes( void const *va, void const *vb )
-{
-  //Standard integer comparison function for bsearch
-  const int * a = (const int *)va;
-  const int * b = (const int *)vb;
-  return  *a < *b ? -1 : ( *a > *b ? 1 : 0 );
-}
+//The codes above (and their antiparticles) are found via a perfect hash table:
+//slot number ((uint32_t)pdgcode*K)>>(32-nbits) holds the index in the table
+//above, with the 0x80 bit set for antiparticles (unused slots hold 255). The
+//antiparticles of 22, 111 and 331 are not included, since these particles are
+//their own antiparticles. The multiplier K was found by trying random odd
+//numbers until one gave no collisions, so the hash table must be regenerated
+//with devel/misc/gen_pdghash.py if the table above is ever modified:
+#define PHITS_PDGHASH_K 0xd8f16adfu
+#define PHITS_PDGHASH_NBITS 7
+static const unsigned char phits_known_nonion_hash[128] = {
+  255, 255,   2,   9, 255, 143, 255, 255,   5, 255, 255, 255, 255, 255, 255, 255,
+  255, 131, 255, 255, 255,   1,  18, 255, 134, 255, 255,  13, 139, 255, 255, 255,
+  255, 255, 255, 255,   7, 255, 145, 142, 255,   0, 255, 255,  19, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255,  16, 255, 136, 255, 255, 255, 140, 255, 255,
+   10, 255,  12, 255, 255, 255,   8, 255, 144, 255, 255, 255, 255, 255, 255, 255,
+  255, 255,   4, 147, 255, 255, 128, 255,  14,  17, 255, 135, 255, 255, 255, 255,
+  255, 255, 255,  11, 141, 255, 255,   6, 255, 146, 129, 255, 255, 255,   3, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  15, 255, 137, 130, 255, 255
+};
 
 int32_t conv_code_phits2pdg( int32_t c )
 {
@@ -115,12 +127,12 @@ int32_t conv_code_pdg2phits( int32_t c )
     //room for 6 digits. And in fact, only those in the phits_known_nonion_codes
     //are supported - and for 22, 111, 331 only if not negative (these particles
     //are their own antiparticles):
-    int key = absc;
-    void * res = bsearch(&key, phits_known_nonion_codes, sizeof(phits_known_nonion_codes) / sizeof(phits_known_nonion_codes[0]),
-                         sizeof(phits_known_nonion_codes[0]), phits_cmp_codes);
-    if ( !res || ( c < 0 && (c==-22||c==-111||c==-331) ) )
+    unsigned e = phits_known_nonion_hash[ ( (uint32_t)c * PHITS_PDGHASH_K )
+                                          >> ( 32 - PHITS_PDGHASH_NBITS ) ];
+    if ( e == 255 )
       return 0;
-    return c;
+    int known = phits_known_nonion_codes[ e & 0x7f ];
+    return ( ( e & 0x80 ) ? -known : known ) == c ? c : 0;
   }
   if (absc<=1009999990) {
     //Ions. PDG format for ions is 10LZZZAAAI, where L!=0 indicates strangeness
@@ -145,10 +157,25 @@ int32_t conv_code_pdg2phits( int32_t c )
   return 0;
 }
 
+unsigned long conv_code_pdg2phits_array( const int32_t * in, int32_t * out,
+                                         unsigned long n )
+{
+  unsigned long i, nfailed = 0;
+  for ( i = 0; i < n; ++i ) {
+    out[i] = conv_code_pdg2phits( in[i] );
+    nfailed += ( out[i] ? 0 : 1 );
+  }
+  return nfailed;
+}
+
 //Should be more than large enough to hold all records in all supported PHITS
 //dump files, including two 64bit record markers:
 #define PHITSREAD_MAXBUFSIZE (15*sizeof(double))
 
+//Size of buffer used for reading many particle records at once in
+//phits_load_particles:
+#define PHITSREAD_BULKBUFSIZE 1048576
+
 typedef struct {
   mcpl_generic_filehandle_t filehandle;
   phits_particle_t part;
@@ -157,6 +184,7 @@ typedef struct {
   char buf[PHITSREAD_MAXBUFSIZE];//for holding last record of raw data read (including record markers of reclen bytes)
   unsigned lbuf;//number of bytes currently read into buf
   int haspolarisation;
+  char * bulkbuf;//for phits_load_particles (allocated on demand)
 } phits_fileinternal_t;
 
 int phits_ensure_load(phits_fileinternal_t* f, int nbytes)
@@ -279,6 +307,36 @@ phits_file_t phits_open_file( const char * filename )
   out.internal = f;
   return out;
 }
+//Decode the particle data of a record (which does not need to be aligned):
+void phits_decode_particle( const char * data, int haspol,
+                            phits_particle_t * pp )
+{
+  double pdata[13];
+  memcpy( pdata, data, ( haspol ? 13 : 10 ) * sizeof(double) );
+  pp->rawtype = (long)pdata[0];
+  //NB: PHITS units, not MCPL units here (only difference is time unit which is ns in PHITS and ms in MCPL):
+  pp->x = pdata[1];//cm
+  pp->y = pdata[2];//cm
+  pp->z = pdata[3];//cm
+  pp->dirx = pdata[4];
+  pp->diry = pdata[5];
+  pp->dirz = pdata[6];
+  pp->ekin = pdata[7];//MeV
+  pp->weight = pdata[8];
+  pp->time = pdata[9];//ns
+  if (haspol) {
+    pp->polx = pdata[10];
+    pp->poly = pdata[11];
+    pp->polz = pdata[12];
+  } else {
+    pp->polx = 0.0;
+    pp->poly = 0.0;
+    pp->polz = 0.0;
+  }
+
+  pp->pdgcode = conv_code_phits2pdg(pp->rawtype);
+}
+
 const phits_particle_t * phits_load_particle(phits_file_t ff)
 {
   phits_fileinternal_t * f = (phits_fileinternal_t *)ff.internal;
@@ -315,35 +373,123 @@ const phits_particle_t * phits_load_particle(phits_file_t ff)
   }
 
   assert( f->lbuf == f->particlesize + f->reclen * 2 );
-  double * pdata = (double*)(f->buf+f->reclen);
-  phits_particle_t * pp =  & (f->part);
-  pp->rawtype = (long)pdata[0];
-  //NB: PHITS units, not MCPL units here (only difference is time unit which is ns in PHITS and ms in MCPL):
-  pp->x = pdata[1];//cm
-  pp->y = pdata[2];//cm
-  pp->z = pdata[3];//cm
-  pp->dirx = pdata[4];
-  pp->diry = pdata[5];
-  pp->dirz = pdata[6];
-  pp->ekin = pdata[7];//MeV
-  pp->weight = pdata[8];
-  pp->time = pdata[9];//ns
-  if (f->particlesize == 13*sizeof(double)) {
-    pp->polx = pdata[10];
-    pp->poly = pdata[11];
-    pp->polz = pdata[12];
+  phits_decode_particle( f->buf + f->reclen,
+                         f->particlesize == 13*sizeof(double),
+                         &(f->part) );
+
+  //Mark as used:
+  f->lbuf = 0;
+
+  return &(f->part);
+}
+
+uint64_t phits_read_marker( const char * data, size_t reclen )
+{
+  if ( reclen == 4 ) {
+    uint32_t m;
+    memcpy( &m, data, 4 );
+    return m;
   } else {
-    pp->polx = 0.0;
-    pp->poly = 0.0;
-    pp->polz = 0.0;
+    uint64_t m;
+    memcpy( &m, data, 8 );
+    return m;
   }
+}
 
-  pp->pdgcode = conv_code_phits2pdg(pp->rawtype);
+void phits_bulk_error( const char * b, size_t nbytes, size_t reclen,
+                       unsigned psize )
+{
+  //Find the first bad record in a buffer of records, and emit the same error
+  //as phits_load_particle would have done upon reaching it:
+  const size_t lrec = psize + 2 * reclen;
+  while ( nbytes >= lrec ) {
+    uint64_t m0 = phits_read_marker( b, reclen );
+    if ( m0 != psize ) {
+      if ( m0 <= nbytes - 2 * reclen
+           && phits_read_marker( b + reclen + m0, reclen ) == m0 )
+        phits_error("Problems loading particle data record - particle"
+                    " data length changed mid-file (perhaps it is not"
+                    " actually a binary PHITS dump file after all?)!");
+      break;
+    }
+    if ( phits_read_marker( b + reclen + psize, reclen ) != m0 )
+      break;
+    b += lrec;
+    nbytes -= lrec;
+  }
+  phits_error("Problems loading particle data record!");
+}
 
-  //Mark as used:
-  f->lbuf = 0;
+unsigned long phits_load_particles(phits_file_t ff, unsigned long n,
+                                   phits_particle_t * out)
+{
+  phits_fileinternal_t * f = (phits_fileinternal_t *)ff.internal;
+  assert(f);
+  unsigned long nloaded = 0;
+  if ( !n || !f->particlesize )
+    return 0;
 
-  return pp;
+  //The first record might have been loaded already during initialisation:
+  if ( f->lbuf ) {
+    const phits_particle_t * p = phits_load_particle(ff);
+    assert(p);
+    out[nloaded++] = *p;
+  }
+
+  //Read as many records as fit in the bulk buffer at a time. The record size is
+  //fixed for a given file, so all record markers can be checked at once before
+  //the particles are decoded:
+  const unsigned psize = f->particlesize;
+  const int haspol = ( psize == 13*sizeof(double) );
+  const size_t reclen = (size_t)f->reclen;
+  const size_t lrec = psize + 2 * reclen;
+  const unsigned long nrecmax = PHITSREAD_BULKBUFSIZE / lrec;
+  if ( nloaded < n && !f->bulkbuf ) {
+    f->bulkbuf = malloc( nrecmax * lrec );
+    if (!f->bulkbuf)
+      phits_error("memory allocation failure");
+  }
+  while ( nloaded < n ) {
+    unsigned long nrec = n - nloaded;
+    if ( nrec > nrecmax )
+      nrec = nrecmax;
+    char * b = f->bulkbuf;
+    unsigned nbytes = (unsigned)( nrec * lrec );
+    unsigned actual = mcpl_generic_fread_try( &f->filehandle, b, nbytes );
+    int eof = ( actual < nbytes );
+    if ( actual % lrec )
+      phits_bulk_error( b, (size_t)actual, reclen, psize );
+    nrec = actual / lrec;
+    unsigned long i;
+    int bad = 0;
+    if ( reclen == 4 ) {
+      const uint32_t expected = psize;
+      for ( i = 0; i < nrec; ++i ) {
+        uint32_t m0, m1;
+        memcpy( &m0, b + i * lrec, 4 );
+        memcpy( &m1, b + i * lrec + 4 + psize, 4 );
+        bad |= ( m0 != expected ) | ( m1 != expected );
+      }
+    } else {
+      const uint64_t expected = psize;
+      for ( i = 0; i < nrec; ++i ) {
+        uint64_t m0, m1;
+        memcpy( &m0, b + i * lrec, 8 );
+        memcpy( &m1, b + i * lrec + 8 + psize, 8 );
+        bad |= ( m0 != expected ) | ( m1 != expected );
+      }
+    }
+    if ( bad )
+      phits_bulk_error( b, (size_t)actual, reclen, psize );
+    for ( i = 0; i < nrec; ++i )
+      phits_decode_particle( b + i * lrec + reclen, haspol, out + nloaded + i );
+    nloaded += nrec;
+    if ( eof ) {
+      f->particlesize = 0;
+      break;
+    }
+  }
+  return nloaded;
 }
 
 int phits_has_polarisation(phits_file_t ff)
@@ -363,6 +509,7 @@ void phits_close_file(phits_file_t ff)
     mcpl_generic_fclose( &f->filehandle );
     f->filehandle.internal = NULL;
   }
+  free(f->bulkbuf);
   free(f);
   ff.internal = 0;
 }
@@ -412,4 +559,18 @@ void phits_dump( const char * filename, const char * outfile )
   phits_set_stdout(NULL);
 
 }
+
+//Plain linear search through phits_known_nonion_codes, for unit tests verifying
+//the hash table used by conv_code_pdg2phits (returns 0 when the code is not
+//supported):
+int32_t conv_code_pdg2phits_linear( int32_t c )
+{
+  if ( c == -22 || c == -111 || c == -331 )
+    return 0;
+  size_t i;
+  for ( i = 0; i < sizeof(phits_known_nonion_codes)/sizeof(int); ++i )
+    if ( phits_known_nonion_codes[i] == c || phits_known_nonion_codes[i] == -c )
+      return c;
+  return 0;
+}
 #endif
@@ -82,6 +82,13 @@ extern "C" {
   //load next particle (null indicates EOF):
   const phits_particle_t * phits_load_particle(phits_file_t);
 
+  //load up to n next particles into out, returning the number loaded (0
+  //indicates EOF). Particle records are read and checked in large chunks, which
+  //is much faster than calling phits_load_particle for each particle. The two
+  //functions can be used interchangeably on a file:
+  unsigned long phits_load_particles(phits_file_t, unsigned long n,
+                                     phits_particle_t * out);
+
   //close file and release resources:
   void phits_close_file(phits_file_t);
 
@@ -103,6 +110,11 @@ extern "C" {
   int32_t conv_code_phits2pdg(int32_t);
   int32_t conv_code_pdg2phits(int32_t);
 
+  //Version of conv_code_pdg2phits converting n codes at once, putting the
+  //results in out (which may be the same array as in). The number of codes
+  //which could not be converted (i.e. which were converted to 0) is returned:
+  unsigned long conv_code_pdg2phits_array(const int32_t * in, int32_t * out, unsigned long n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,7 @@
 #include "sswmcpl.h"
 #include "sswread.h"
 #include "mcpl.h"
+#include "mcplpipeline.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -52,6 +53,14 @@ int ssw2mcpl(const char * sswfile, const char * mcplfile)
   return ssw2mcpl2(sswfile, mcplfile, 0, 0, 1, 0);
 }
 
+int ssw2mcpl2(const char * sswfile, const char * mcplfile,
+              int opt_dp, int opt_surf, int opt_gzip,
+              const char * inputdeckfile)
+{
+  return ssw2mcpl3(sswfile, mcplfile, opt_dp, opt_surf, opt_gzip,
+                   inputdeckfile, 1);
+}
+
 size_t ssw_strlen( const char * str, size_t maxsize )
 {
   const char * nullchr = (const char *) memchr( str, '\0', maxsize );
@@ -72,9 +81,102 @@ void ssw_strcat( char * dest, const char * src, size_t destbuflen )
   memcpy( dest + nd, src, ns+1 );
 }
 
-int ssw2mcpl2(const char * sswfile, const char * mcplfile,
+//Blocks used when converting from SSW to MCPL. The reader thread only reads
+//the raw particle records, which are then decoded (including the conversion of
+//particle types to PDG codes) in the converter threads:
+typedef struct {
+  char * raw;
+  ssw_particle_t * in;
+  mcpl_particle_t * out;
+  unsigned long n;
+} ssw2mcpl_block_t;
+
+typedef struct {
+  ssw_file_t f;
+  mcpl_outfile_t mcplfh;
+  uint64_t skipped_nopdg;
+} ssw2mcpl_ctx_t;
+
+void * ssw2mcpl_create_block( void * ctx )
+{
+  ssw2mcpl_block_t * b = malloc( sizeof(ssw2mcpl_block_t) );
+  if (!b)
+    ssw_error("memory allocation failure");
+  b->raw = malloc( MCPLPIPELINE_BLOCKSIZE
+                   * ssw_particle_record_size(((ssw2mcpl_ctx_t*)ctx)->f) );
+  b->in = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(ssw_particle_t) );
+  b->out = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(mcpl_particle_t) );
+  b->n = 0;
+  if ( !b->raw || !b->in || !b->out )
+    ssw_error("memory allocation failure");
+  return b;
+}
+
+void ssw2mcpl_destroy_block( void * block )
+{
+  ssw2mcpl_block_t * b = (ssw2mcpl_block_t*)block;
+  free( b->raw );
+  free( b->in );
+  free( b->out );
+  free( b );
+}
+
+unsigned long ssw2mcpl_load( void * ctx, void * block )
+{
+  ssw2mcpl_block_t * b = (ssw2mcpl_block_t*)block;
+  b->n = ssw_read_particle_records( ((ssw2mcpl_ctx_t*)ctx)->f,
+                                    MCPLPIPELINE_BLOCKSIZE, b->raw );
+  return b->n;
+}
+
+void ssw2mcpl_convert( void * ctx, void * block )
+{
+  ssw2mcpl_block_t * b = (ssw2mcpl_block_t*)block;
+  ssw_decode_particle_records( ((ssw2mcpl_ctx_t*)ctx)->f, b->n, b->raw, b->in );
+  const ssw_particle_t * p = b->in;
+  mcpl_particle_t * mp = b->out;
+  unsigned long i;
+  for ( i = 0; i < b->n; ++i, ++p, ++mp ) {
+    memset(mp,0,sizeof(*mp));
+    mp->pdgcode = p->pdgcode;
+    mp->position[0] = p->x;//already in cm
+    mp->position[1] = p->y;//already in cm
+    mp->position[2] = p->z;//already in cm
+    mp->direction[0] = p->dirx;
+    mp->direction[1] = p->diry;
+    mp->direction[2] = p->dirz;
+    mp->time = p->time * 1.0e-5;//"shakes" to milliseconds
+    mp->weight = p->weight;
+    mp->ekin = p->ekin;//already in MeV
+    mp->userflags = p->isurf;
+  }
+}
+
+int ssw2mcpl_write( void * ctx, void * block )
+{
+  ssw2mcpl_ctx_t * c = (ssw2mcpl_ctx_t*)ctx;
+  ssw2mcpl_block_t * b = (ssw2mcpl_block_t*)block;
+  mcpl_outfile_t mcplfh = c->mcplfh;
+  ssw_warn_unconverted( c->f, b->n, b->in );
+  unsigned long i;
+  for ( i = 0; i < b->n; ++i ) {
+    if (!b->out[i].pdgcode) {
+      ++c->skipped_nopdg;
+      if (c->skipped_nopdg<=100) {
+        printf("Warning: ignored particle with no PDG code set (raw ssw type was %li).\n",b->in[i].rawtype);
+        if (c->skipped_nopdg==100)
+          printf("Warning: Suppressing future warnings regarding particles with no PDG code set.\n");
+      }
+      continue;
+    }
+    mcpl_add_particle(mcplfh,&b->out[i]);
+  }
+  return 1;
+}
+
+int ssw2mcpl3(const char * sswfile, const char * mcplfile,
               int opt_dp, int opt_surf, int opt_gzip,
-              const char * inputdeckfile)
+              const char * inputdeckfile, unsigned nthreads)
 {
   ssw_file_t f = ssw_open_file(sswfile);
   mcpl_outfile_t mcplfh = mcpl_create_outfile(mcplfile);
@@ -140,33 +242,23 @@ int ssw2mcpl2(const char * sswfile, const char * mcplfile,
     free(cfgfile_buf);
   }
 
-  mcpl_particle_t mcpl_particle;
-  memset(&mcpl_particle,0,sizeof(mcpl_particle));
-
-  while ( 1 ) {
-    const ssw_particle_t * p = ssw_load_particle(f);
-    if (!p)
-      break;
-    mcpl_particle.pdgcode = p->pdgcode;
-    if (!mcpl_particle.pdgcode) {
-      printf("Warning: ignored particle with no PDG code set (raw ssw type was %li).\n",p->rawtype);
-      continue;
-    }
-
-    mcpl_particle.position[0] = p->x;//already in cm
-    mcpl_particle.position[1] = p->y;//already in cm
-    mcpl_particle.position[2] = p->z;//already in cm
-    mcpl_particle.direction[0] = p->dirx;
-    mcpl_particle.direction[1] = p->diry;
-    mcpl_particle.direction[2] = p->dirz;
-    mcpl_particle.time = p->time * 1.0e-5;//"shakes" to milliseconds
-    mcpl_particle.weight = p->weight;
-    mcpl_particle.ekin = p->ekin;//already in MeV
-    mcpl_particle.userflags = p->isurf;
-
-    mcpl_add_particle(mcplfh,&mcpl_particle);
-
-  }
+  ssw2mcpl_ctx_t ctx;
+  ctx.f = f;
+  ctx.mcplfh = mcplfh;
+  ctx.skipped_nopdg = 0;
+  mcplpipeline_def_t def;
+  def.ctx = &ctx;
+  def.create_block = ssw2mcpl_create_block;
+  def.destroy_block = ssw2mcpl_destroy_block;
+  def.load = ssw2mcpl_load;
+  def.convert = ssw2mcpl_convert;
+  def.write = ssw2mcpl_write;
+  def.error = ssw_error;
+  mcplpipeline_run( &def, nthreads );
+
+  if (ctx.skipped_nopdg>100)
+    printf("Warning: ignored %llu particles in total with no PDG code set.\n",
+           (unsigned long long)ctx.skipped_nopdg);
 
   const char * tmp = mcpl_outfile_filename(mcplfh);
   size_t laf = strlen(tmp);
@@ -193,13 +285,15 @@ int ssw2mcpl2(const char * sswfile, const char * mcplfile,
 
 void ssw2mcpl_parse_args(int argc,char **argv, const char** infile,
                          const char **outfile, const char **cfgfile,
-                         int* double_prec, int* surface_info, int* do_gzip) {
+                         int* double_prec, int* surface_info, int* do_gzip,
+                         unsigned* nthreads) {
   *cfgfile = 0;
   *infile = 0;
   *outfile = 0;
   *surface_info = 0;
   *double_prec = 0;
   *do_gzip = 1;
+  *nthreads = 1;
   int i;
   for (i=1; i < argc; ++i) {
     if (argv[i][0]=='\0')
@@ -220,6 +314,9 @@ void ssw2mcpl_parse_args(int argc,char **argv, const char** infile,
              "  -n, --nogzip : Do not attempt to gzip output file.\n"
              "  -c FILE      : Embed entire configuration FILE (the input deck)\n"
              "                 used to produce input.ssw in the MCPL header.\n"
+             "  -jN          : Convert particles with N threads, while separate threads\n"
+             "                 read and write the files (-j0 means one thread per\n"
+             "                 processor core). The output does not depend on N.\n"
              );
       free(progname);
       exit(0);
@@ -250,6 +347,23 @@ void ssw2mcpl_parse_args(int argc,char **argv, const char** infile,
       *do_gzip = 0;
       continue;
     }
+    if (argv[i][0]=='-'&&argv[i][1]=='j') {
+      const char * c = argv[i] + 2;
+      unsigned long nt = 0;
+      if (!*c) {
+        printf("Error: Missing number for -j\n");
+        exit(1);
+      }
+      for ( ; *c; ++c ) {
+        if ( *c < '0' || *c > '9' || nt > 9999 ) {
+          printf("Error: Bad number of threads: %s\n",argv[i]);
+          exit(1);
+        }
+        nt = nt * 10 + (unsigned long)( *c - '0' );
+      }
+      *nthreads = (unsigned)nt;
+      continue;
+    }
     if (argv[i][0]=='-') {
       printf("Error: Unknown argument: %s\n",argv[i]);
       exit(1);
@@ -284,8 +398,9 @@ int ssw2mcpl_app(int argc,char** argv)
   const char * outfile;
   const char * cfgfile;
   int double_prec, surface_info, do_gzip;
-  ssw2mcpl_parse_args(argc,argv,&infile,&outfile,&cfgfile,&double_prec,&surface_info,&do_gzip);
-  int ok = ssw2mcpl2(infile, outfile,double_prec, surface_info, do_gzip,cfgfile);
+  unsigned nthreads;
+  ssw2mcpl_parse_args(argc,argv,&infile,&outfile,&cfgfile,&double_prec,&surface_info,&do_gzip,&nthreads);
+  int ok = ssw2mcpl3(infile, outfile,double_prec, surface_info, do_gzip,cfgfile,nthreads);
   return ok ? 0 : 1;
 }
 
@@ -302,28 +417,236 @@ void ssw_update_nparticles( mcpl_generic_wfilehandle_t* fh,
   mcpl_generic_fwseek( fh, savedpos );
 }
 
-void ssw_writerecord( mcpl_generic_wfilehandle_t* fh,
-                      int reclen, size_t lbuf, char* buf )
+#define SSW_MCNP6 1
+#define SSW_MCNPX 2
+#define SSW_MCNP5 3
+
+//Blocks used when converting from MCPL to SSW. Particles are encoded into
+//complete Fortran records by the converter threads, while decisions involving
+//counts, limits and error reporting are made in the writer as particles are
+//written in order:
+#define MCPL2SSW_ENCODED 0
+#define MCPL2SSW_SKIPPED 1
+#define MCPL2SSW_NOSURFACE 2
+#define MCPL2SSW_BADSURFACE 3
+
+typedef struct {
+  mcpl_particle_t * parts;
+  unsigned long n;
+  uint64_t ifirst;//index in input file of first particle
+  unsigned char * status;
+  int32_t * rawtypes;
+  char * recs;//encoded records (for particles with status MCPL2SSW_ENCODED)
+} mcpl2ssw_block_t;
+
+typedef struct {
+  mcpl_file_t fmcpl;
+  mcpl_generic_wfilehandle_t * fout;
+  int mcnp_type;
+  int reclen;
+  int ssblen;
+  size_t lrec;
+  long surface_id;
+  long nparticles_limit;
+  const char * mcnpflavour;
+  uint64_t nread;
+  long used;
+  long long skipped_nosswtype;
+} mcpl2ssw_ctx_t;
+
+void * mcpl2ssw_create_block( void * ctx )
 {
-  if (reclen==4) {
-    if ( lbuf > UINT32_MAX )
-      ssw_error("output record size too large for 32bit records");
-    uint32_t rl = (uint32_t)lbuf;
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-    mcpl_generic_fwrite( fh, buf, lbuf );
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
+  mcpl2ssw_ctx_t * c = (mcpl2ssw_ctx_t*)ctx;
+  mcpl2ssw_block_t * b = malloc( sizeof(mcpl2ssw_block_t) );
+  if (!b)
+    ssw_error("memory allocation failure");
+  b->parts = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(mcpl_particle_t) );
+  b->status = malloc( MCPLPIPELINE_BLOCKSIZE );
+  b->rawtypes = malloc( MCPLPIPELINE_BLOCKSIZE * sizeof(int32_t) );
+  b->recs = malloc( MCPLPIPELINE_BLOCKSIZE * c->lrec );
+  b->n = 0;
+  b->ifirst = 0;
+  if ( !b->parts || !b->status || !b->rawtypes || !b->recs )
+    ssw_error("memory allocation failure");
+  return b;
+}
+
+void mcpl2ssw_destroy_block( void * block )
+{
+  mcpl2ssw_block_t * b = (mcpl2ssw_block_t*)block;
+  free( b->parts );
+  free( b->status );
+  free( b->rawtypes );
+  free( b->recs );
+  free( b );
+}
+
+unsigned long mcpl2ssw_load( void * ctx, void * block )
+{
+  mcpl2ssw_ctx_t * c = (mcpl2ssw_ctx_t*)ctx;
+  mcpl2ssw_block_t * b = (mcpl2ssw_block_t*)block;
+  b->n = (unsigned long)mcpl_read_particles( c->fmcpl, b->parts,
+                                             MCPLPIPELINE_BLOCKSIZE );
+  b->ifirst = c->nread;
+  c->nread += b->n;
+  return b->n;
+}
+
+void mcpl2ssw_convert( void * ctx, void * block )
+{
+  const mcpl2ssw_ctx_t * c = (const mcpl2ssw_ctx_t*)ctx;
+  mcpl2ssw_block_t * b = (mcpl2ssw_block_t*)block;
+  const int ssw_mcnp_type = c->mcnp_type;
+  const int ssw_ssblen = c->ssblen;
+  const long surface_id = c->surface_id;
+  char * out = b->recs;
+  double ssb[11];
+  ssb[10] = 0.0;
+  unsigned long i;
+
+  //Convert all PDG codes in the block at once:
+  int32_t * rawtypes = b->rawtypes;
+  for ( i = 0; i < b->n; ++i )
+    rawtypes[i] = b->parts[i].pdgcode;
+  if (ssw_mcnp_type == SSW_MCNP6) {
+    conv_mcnp6_pdg2ssw_array( rawtypes, rawtypes, b->n );
+  } else if (ssw_mcnp_type == SSW_MCNPX) {
+    conv_mcnpx_pdg2ssw_array( rawtypes, rawtypes, b->n );
   } else {
-    assert(reclen==8);
-    uint64_t rl = lbuf;
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
-    mcpl_generic_fwrite( fh, buf, lbuf );
-    mcpl_generic_fwrite( fh, (char*)&rl, sizeof(rl) );
+    assert(ssw_mcnp_type == SSW_MCNP5);
+    for ( i = 0; i < b->n; ++i )
+      rawtypes[i] = (rawtypes[i]==2112?1:(rawtypes[i]==22?2:0));
+  }
+
+  for ( i = 0; i < b->n; ++i ) {
+    const mcpl_particle_t* mcpl_p = b->parts + i;
+    //ssb[0] should be history number (starting from 1), but in our case we
+    //always put nhistories=nparticles, so it is simply the position in the
+    //input file:
+    ssb[0] = (double)( b->ifirst + i + 1 );
+    ssb[2] = mcpl_p->weight;
+    ssb[3] = mcpl_p->ekin;//already in MeV
+    ssb[4] = mcpl_p->time * 1.0e5;//milliseconds to "shakes"
+    ssb[5] = mcpl_p->position[0];//already in cm
+    ssb[6] = mcpl_p->position[1];//already in cm
+    ssb[7] = mcpl_p->position[2];//already in cm
+    ssb[8] = mcpl_p->direction[0];
+    ssb[9] = mcpl_p->direction[1];
+
+    int32_t isurf = surface_id;
+    if (!isurf)
+      isurf = (int32_t)mcpl_p->userflags;
+
+    if (isurf<=0||isurf>1000000) {
+      b->status[i] = ( (isurf==0&&surface_id==0)
+                       ? MCPL2SSW_NOSURFACE : MCPL2SSW_BADSURFACE );
+      continue;
+    }
+
+    int64_t rawtype = rawtypes[i];
+    if (!rawtype) {
+      b->status[i] = MCPL2SSW_SKIPPED;
+      continue;
+    }
+
+    if ( !(rawtype>0 ) )
+      ssw_error("Logic error in PDG code conversions.");
+    assert(rawtype>0);
+
+    if (ssw_mcnp_type == SSW_MCNP6) {
+      assert(ssw_ssblen==11);
+      ssb[10] = isurf;//Should we set the sign of ssb[10] to mean something (we take abs(ssb[10]) in sswread.c)?
+      ssb[1] = (double)(((int64_t)rawtype)*4);//Shift 2 bits (thus we only create files with those two bits zero!)
+    } else if (ssw_mcnp_type == SSW_MCNPX) {
+      ssb[1] = (double)(isurf + 1000000*((int64_t)rawtype));
+      if (ssw_ssblen==11)
+        ssb[10] = 1.0;//Cosine of angle at surface? Can't calculate it, so we simply set
+                      //it to 1 (seems to be not used anyway?)
+    } else {
+      assert(ssw_mcnp_type == SSW_MCNP5);
+      //NOTE: We had for MCPL <=1.6.x: ssb[1] = (isurf + 1000000*rawtype)*8; But
+      //now we try instead:
+      ssb[1] = (double)((isurf + 100000000*((int64_t)rawtype))*8);
+      if (ssw_ssblen==11)
+        ssb[10] = 1.0;//Cosine of angle at surface? Can't calculate it, so we simply set
+                      //it to 1 (seems to be not used anyway?)
+    }
+
+    //Sign of ssb[1] is used to store the sign of dirz:
+    assert(ssb[1] >= 1.0);
+    if (mcpl_p->direction[2]<0.0)
+      ssb[1] = - ssb[1];
+
+    //Encode as a Fortran record:
+    const size_t lssb = sizeof(double)*ssw_ssblen;
+    if ( c->reclen == 4 ) {
+      uint32_t rl = (uint32_t)lssb;
+      memcpy( out, &rl, 4 );
+      memcpy( out + 4, ssb, lssb );
+      memcpy( out + 4 + lssb, &rl, 4 );
+    } else {
+      uint64_t rl = lssb;
+      memcpy( out, &rl, 8 );
+      memcpy( out + 8, ssb, lssb );
+      memcpy( out + 8 + lssb, &rl, 8 );
+    }
+    out += c->lrec;
+    b->status[i] = MCPL2SSW_ENCODED;
+  }
+}
+
+int mcpl2ssw_write( void * ctx, void * block )
+{
+  mcpl2ssw_ctx_t * c = (mcpl2ssw_ctx_t*)ctx;
+  mcpl2ssw_block_t * b = (mcpl2ssw_block_t*)block;
+  size_t nbytes = 0;
+  int more = 1;
+  unsigned long i;
+  for ( i = 0; i < b->n; ++i ) {
+    const unsigned char st = b->status[i];
+    if ( st == MCPL2SSW_NOSURFACE || st == MCPL2SSW_BADSURFACE ) {
+      mcpl_generic_fwrite( c->fout, b->recs, nbytes );
+      if ( st == MCPL2SSW_NOSURFACE )
+        ssw_error("Could not determine surface ID: no global surface id specified and particle had no (or empty) userflags");
+      else
+        ssw_error("Surface id must be in range 1..999999");
+    }
+    if ( st == MCPL2SSW_SKIPPED ) {
+      ++c->skipped_nosswtype;
+      if (c->skipped_nosswtype<=100) {
+        printf("WARNING: Found PDG code (%li) in the MCPL file which can not be converted to an %s particle type\n",
+               (long)b->parts[i].pdgcode,c->mcnpflavour);
+        if (c->skipped_nosswtype==100)
+          printf("WARNING: Suppressing future warnings regarding non-convertible PDG codes.\n");
+      }
+      continue;
+    }
+    assert( st == MCPL2SSW_ENCODED );
+    nbytes += c->lrec;
+    if (++c->used==c->nparticles_limit) {
+      long long remaining = mcpl_hdr_nparticles(c->fmcpl) - c->skipped_nosswtype - c->used;
+      if (remaining)
+        printf("Output limit of %li particles reached. Ignoring remaining %lli particles in the MCPL file.\n",
+               c->nparticles_limit,remaining);
+      more = 0;
+      break;
+    }
   }
+  mcpl_generic_fwrite( c->fout, b->recs, nbytes );
+  return more;
 }
 
 int mcpl2ssw(const char * inmcplfile, const char * outsswfile, const char * refsswfile,
              long surface_id, long nparticles_limit)
 {
+  return mcpl2ssw2( inmcplfile, outsswfile, refsswfile, surface_id,
+                    nparticles_limit, 0, 1 );
+}
+
+int mcpl2ssw2(const char * inmcplfile, const char * outsswfile, const char * refsswfile,
+              long surface_id, long nparticles_limit, int opt_gzip,
+              unsigned nthreads)
+{
 
   mcpl_file_t fmcpl = mcpl_open_file(inmcplfile);
 
@@ -349,9 +672,6 @@ int mcpl2ssw(const char * inmcplfile, const char * outsswfile, const char * refs
   assert(ssw_np1pos<ssw_hdrlen);
   assert(ssw_nrsspos<ssw_hdrlen);
 
-#define SSW_MCNP6 1
-#define SSW_MCNPX 2
-#define SSW_MCNP5 3
   int ssw_mcnp_type = 0;
   if (ssw_is_mcnp6(fsswref)) {
     ssw_mcnp_type = SSW_MCNP6;
@@ -400,109 +720,39 @@ int mcpl2ssw(const char * inmcplfile, const char * outsswfile, const char * refs
   free(hdrbuf);
   hdrbuf = NULL;
 
-  double ssb[11];
-
   if ( ssw_ssblen != 10 && ssw_ssblen != 11)
     ssw_error("Unexpected length of ssb record in reference SSW file");
   if ( (ssw_mcnp_type == SSW_MCNP6) && ssw_ssblen != 11 )
     ssw_error("Unexpected length of ssb record in reference SSW file (expected 11 for MCNP6 files)");
 
-  //ssb[0] should be history number (starting from 1), but in our case we always
-  //put nhistories=nparticles, so it is simply incrementing by 1 for each particle.
-  ssb[0] = 0.0;
-
-
   assert(surface_id>=0&&surface_id<1000000);
 
-
-  long used = 0;
-  long long skipped_nosswtype = 0;
+  mcpl2ssw_ctx_t ctx;
+  memset(&ctx,0,sizeof(ctx));
+  ctx.fmcpl = fmcpl;
+  ctx.fout = &fout;
+  ctx.mcnp_type = ssw_mcnp_type;
+  ctx.reclen = ssw_reclen;
+  ctx.ssblen = ssw_ssblen;
+  ctx.lrec = sizeof(double)*ssw_ssblen + 2 * (size_t)ssw_reclen;
+  ctx.surface_id = surface_id;
+  ctx.nparticles_limit = nparticles_limit;
+  ctx.mcnpflavour = ref_mcnpflavour_str;
 
   printf("Initiating particle conversion loop.\n");
 
-  while ( 1 ) {
-    const mcpl_particle_t* mcpl_p = mcpl_read(fmcpl);
-    if (!mcpl_p)
-      break;
-    ++ssb[0];
-    ssb[2] = mcpl_p->weight;
-    ssb[3] = mcpl_p->ekin;//already in MeV
-    ssb[4] = mcpl_p->time * 1.0e5;//milliseconds to "shakes"
-    ssb[5] = mcpl_p->position[0];//already in cm
-    ssb[6] = mcpl_p->position[1];//already in cm
-    ssb[7] = mcpl_p->position[2];//already in cm
-    ssb[8] = mcpl_p->direction[0];
-    ssb[9] = mcpl_p->direction[1];
+  mcplpipeline_def_t def;
+  def.ctx = &ctx;
+  def.create_block = mcpl2ssw_create_block;
+  def.destroy_block = mcpl2ssw_destroy_block;
+  def.load = mcpl2ssw_load;
+  def.convert = mcpl2ssw_convert;
+  def.write = mcpl2ssw_write;
+  def.error = ssw_error;
+  mcplpipeline_run( &def, nthreads );
 
-    int32_t isurf = surface_id;
-    if (!isurf)
-      isurf = (int32_t)mcpl_p->userflags;
-
-    if (isurf<=0||isurf>1000000) {
-      if (isurf==0&&surface_id==0)
-        ssw_error("Could not determine surface ID: no global surface id specified and particle had no (or empty) userflags");
-      else
-        ssw_error("Surface id must be in range 1..999999");
-    }
-
-    int64_t rawtype;
-    if (ssw_mcnp_type == SSW_MCNP6) {
-      rawtype = conv_mcnp6_pdg2ssw(mcpl_p->pdgcode);
-    } else if (ssw_mcnp_type == SSW_MCNPX) {
-      rawtype = conv_mcnpx_pdg2ssw(mcpl_p->pdgcode);
-    } else {
-      assert(ssw_mcnp_type == SSW_MCNP5);
-      rawtype = (mcpl_p->pdgcode==2112?1:(mcpl_p->pdgcode==22?2:0));
-    }
-
-    if (!rawtype) {
-      ++skipped_nosswtype;
-      if (skipped_nosswtype<=100) {
-        printf("WARNING: Found PDG code (%li) in the MCPL file which can not be converted to an %s particle type\n",
-               (long)mcpl_p->pdgcode,ref_mcnpflavour_str);
-        if (skipped_nosswtype==100)
-          printf("WARNING: Suppressing future warnings regarding non-convertible PDG codes.\n");
-      }
-      continue;
-    }
-
-    if ( !(rawtype>0 ) )
-      ssw_error("Logic error in PDG code conversions.");
-    assert(rawtype>0);
-
-    if (ssw_mcnp_type == SSW_MCNP6) {
-      assert(ssw_ssblen==11);
-      ssb[10] = isurf;//Should we set the sign of ssb[10] to mean something (we take abs(ssb[10]) in sswread.c)?
-      ssb[1] = (double)(((int64_t)rawtype)*4);//Shift 2 bits (thus we only create files with those two bits zero!)
-    } else if (ssw_mcnp_type == SSW_MCNPX) {
-      ssb[1] = (double)(isurf + 1000000*((int64_t)rawtype));
-      if (ssw_ssblen==11)
-        ssb[10] = 1.0;//Cosine of angle at surface? Can't calculate it, so we simply set
-                      //it to 1 (seems to be not used anyway?)
-    } else {
-      assert(ssw_mcnp_type == SSW_MCNP5);
-      //NOTE: We had for MCPL <=1.6.x: ssb[1] = (isurf + 1000000*rawtype)*8; But
-      //now we try instead:
-      ssb[1] = (double)((isurf + 100000000*((int64_t)rawtype))*8);
-      if (ssw_ssblen==11)
-        ssb[10] = 1.0;//Cosine of angle at surface? Can't calculate it, so we simply set
-                      //it to 1 (seems to be not used anyway?)
-    }
-
-    //Sign of ssb[1] is used to store the sign of dirz:
-    assert(ssb[1] >= 1.0);
-    if (mcpl_p->direction[2]<0.0)
-      ssb[1] = - ssb[1];
-
-    ssw_writerecord(&fout,ssw_reclen,sizeof(double)*ssw_ssblen,(char*)&ssb[0]);
-    if (++used==nparticles_limit) {
-      long long remaining = mcpl_hdr_nparticles(fmcpl) - skipped_nosswtype - used;
-      if (remaining)
-        printf("Output limit of %li particles reached. Ignoring remaining %lli particles in the MCPL file.\n",
-               nparticles_limit,remaining);
-      break;
-    }
-  }
+  long used = ctx.used;
+  long long skipped_nosswtype = ctx.skipped_nosswtype;
 
   printf("Ending particle conversion loop.\n");
 
@@ -528,7 +778,11 @@ int mcpl2ssw(const char * inmcplfile, const char * outsswfile, const char * refs
   mcpl_close_file(fmcpl);
   mcpl_generic_fwclose(&fout);
 
-  printf("Created %s with %lli particles (nrss) and %lli histories (np1).\n",outsswfile,(long long)new_nrss,(long long)labs(new_np1));
+  int did_gzip = 0;
+  if (opt_gzip)
+    did_gzip = mcpl_gzip_file(outsswfile);
+
+  printf("Created %s%s with %lli particles (nrss) and %lli histories (np1).\n",outsswfile,(did_gzip?".gz":""),(long long)new_nrss,(long long)labs(new_np1));
   return 1;
 
 
@@ -569,6 +823,10 @@ int mcpl2ssw_app_usage( const char** argv, const char * errmsg ) {
          "  -s<ID>       : All particles in the SSW file will get this surface ID.\n"
          "  -l<LIMIT>    : Limit the number of particles transferred to the SSW file\n"
          "                 (defaults to 2147483647, the maximal SSW capacity).\n"
+         "  -z           : Gzip the resulting SSW file.\n"
+         "  -jN          : Encode SSW records with N threads, while a separate thread\n"
+         "                 reads the MCPL file (-j0 means one thread per processor\n"
+         "                 core). The output does not depend on N.\n"
          );
   free(progname);
   return 0;
@@ -576,16 +834,20 @@ int mcpl2ssw_app_usage( const char** argv, const char * errmsg ) {
 
 int mcpl2ssw_parse_args(int argc,const char **argv, const char** inmcplfile,
                         const char **refsswfile, const char **outsswfile,
-                        long* nparticles_limit, long* surface_id) {
+                        long* nparticles_limit, long* surface_id,
+                        int* do_gzip, unsigned* nthreads) {
   //returns: 0 all ok, 1: error, -1: all ok but do nothing (-h/--help mode)
   *inmcplfile = 0;
   *refsswfile = 0;
   *outsswfile = 0;
   *nparticles_limit = INT32_MAX;
   *surface_id = 0;
+  *do_gzip = 0;
+  *nthreads = 1;
 
   int64_t opt_num_limit = -1;
   int64_t opt_num_isurf = -1;
+  int64_t opt_nthreads = -1;
   int i;
   for (i = 1; i<argc; ++i) {
     const char * a = argv[i];
@@ -608,6 +870,8 @@ int mcpl2ssw_parse_args(int argc,const char **argv, const char** inmcplfile,
         case 'h': mcpl2ssw_app_usage(argv,0); return -1;
         case 'l': consume_digit = &opt_num_limit; break;
         case 's': consume_digit = &opt_num_isurf; break;
+        case 'j': consume_digit = &opt_nthreads; break;
+        case 'z': *do_gzip = 1; break;
         default:
           return mcpl2ssw_app_usage(argv,"Unrecognised option");
         }
@@ -652,6 +916,11 @@ int mcpl2ssw_parse_args(int argc,const char **argv, const char** inmcplfile,
 
   *surface_id = (long)opt_num_isurf;
 
+  if (opt_nthreads>9999)
+    return mcpl2ssw_app_usage(argv,"Parameter out of range : Too many threads requested.");
+  if (opt_nthreads>=0)
+    *nthreads = (unsigned)opt_nthreads;
+
   return 0;
 }
 
@@ -662,10 +931,13 @@ int mcpl2ssw_app( int argc, char** argv ) {
   const char * outsswfile;
   long nparticles_limit;
   long surface_id;
+  int do_gzip;
+  unsigned nthreads;
 
   int parse = mcpl2ssw_parse_args( argc, (const char**)argv,
                                    &inmcplfile, &refsswfile, &outsswfile,
-                                   &nparticles_limit, &surface_id );
+                                   &nparticles_limit, &surface_id,
+                                   &do_gzip, &nthreads );
 
   if (parse==-1)// --help
     return 0;
@@ -673,7 +945,8 @@ int mcpl2ssw_app( int argc, char** argv ) {
   if (parse)// parse error
     return parse;
 
-  if (mcpl2ssw(inmcplfile, outsswfile, refsswfile,surface_id, nparticles_limit))
+  if (mcpl2ssw2(inmcplfile, outsswfile, refsswfile,surface_id, nparticles_limit,
+                do_gzip, nthreads))
     return 0;
 
   return 1;
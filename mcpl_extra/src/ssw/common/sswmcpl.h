@@ -61,6 +61,15 @@ int ssw2mcpl2(const char * sswfile, const char * mcplfile,
               int opt_dp, int opt_surf, int opt_gzip,
               const char * inputdeckfile);
 
+//////////////////////////////////////////////////////////////////////////////////////
+// Like ssw2mcpl2, but with nthreads!=1 the conversion is done in a pipeline
+// where one thread reads the SSW file, nthreads threads convert the particles,
+// and the calling thread writes them to the MCPL file (0 means one converter
+// thread per processor core). The resulting file does not depend on nthreads:
+int ssw2mcpl3(const char * sswfile, const char * mcplfile,
+              int opt_dp, int opt_surf, int opt_gzip,
+              const char * inputdeckfile, unsigned nthreads);
+
 //////////////////////////////////////////////////////////////////////////////////////
 // Create sswfile based on content in mcplfile. This also needs a reference
 // sswfile from the same approximate setup (MCNP version, input deck...) where
@@ -72,6 +81,19 @@ int ssw2mcpl2(const char * sswfile, const char * mcplfile,
 int mcpl2ssw(const char * mcplfile, const char * sswfile, const char * refsswfile,
              long surface_id, long limit);
 
+//////////////////////////////////////////////////////////////////////////////////////
+// Advanced version of the above with more options:
+//
+//  opt_gzip: Set to 1 to gzip the resulting SSW file. Set to 0 to leave the
+//            resulting file uncompressed.
+//  nthreads: Set to 1 to convert particles serially. Otherwise one thread reads
+//            the MCPL file, nthreads threads encode the SSW records, and the
+//            calling thread writes them (0 means one encoding thread per
+//            processor core). The resulting file does not depend on nthreads.
+//
+int mcpl2ssw2(const char * mcplfile, const char * sswfile, const char * refsswfile,
+              long surface_id, long limit, int opt_gzip, unsigned nthreads);
+
 //////////////////////////////////////////////////////////////////////////////////////
 // For easily creating standard ssw2mcpl and mcpl2ssw cmdline applications:
 int ssw2mcpl_app(int argc,char** argv);
@@ -50,6 +50,11 @@
 //Should be large enough to hold first record in all supported files:
 #define SSWREAD_STDBUFSIZE 1024
 
+//Size of buffer used for reading many particle records at once in
+//ssw_load_particles, and of the tables used for decoding particle types:
+#define SSWREAD_BULKBUFSIZE 1048576
+#define SSWREAD_PDGTABLESIZE 1024
+
 #define SSW_MCNP_NOTFOUND 0
 #define SSW_MCNP6 1
 #define SSW_MCNPX 2
@@ -107,6 +112,9 @@ typedef struct {
   uint64_t lbuf;
   uint64_t lbufmax;
   char * buf;
+  char * bulkbuf;
+  int32_t pdgtable[SSWREAD_PDGTABLESIZE];
+  uint64_t nbadtypes;
   size_t np1pos;
   size_t nrsspos;
   size_t headlen;
@@ -191,6 +199,7 @@ void ssw_close_file(ssw_file_t ff) {
   if ( f->filehandle.internal )
     mcpl_generic_fclose( &f->filehandle );
   free(f->buf);
+  free(f->bulkbuf);
   free(f);
   ff.internal = 0;
 }
@@ -213,6 +222,8 @@ void ssw_strip(char **str) {
   }
 }
 
+void ssw_init_pdgtable( ssw_fileinternal_t * );
+
 void ssw_openerror(ssw_fileinternal_t * f, const char* msg) {
   if (f) {
     if ( f->filehandle.internal )
@@ -580,6 +591,8 @@ ssw_file_t ssw_open_file( const char * filename )
     }
   }
 
+  ssw_init_pdgtable(f);
+
   //Return handle:
   out.internal = f;
   return out;
@@ -650,30 +663,57 @@ void ssw_layout(ssw_file_t ff, int* reclen, int* ssblen, int64_t* hdrlen, int64_
 }
 
 
-//load next particle (null indicates eof):
-const ssw_particle_t * ssw_load_particle(ssw_file_t ff)
+//Raw particle types are converted to PDG codes through a table for the most
+//common values:
+void ssw_init_pdgtable( ssw_fileinternal_t * f )
 {
-  SSW_FILEDECODE;
-  if (f->pos >= f->nrss)
-    return 0;
-
-  ++f->pos;
-
-  //The record of the first particle in the file is always pre-loaded during
-  //initialisation, for the others we must consume another record:
-  if ( f->pos > 1 && !ssw_loadrecord(f) ) {
-    ssw_error("ssw_load error: problems loading particle record (E)\n");
-    //return 0;
+  int32_t i;
+  for ( i = 0; i < SSWREAD_PDGTABLESIZE; ++i ) {
+    if ( f->mcnp_type == SSW_MCNP6 )
+      f->pdgtable[i] = conv_mcnp6_ssw2pdg(i);
+    else if ( f->mcnp_type == SSW_MCNPX )
+      f->pdgtable[i] = conv_mcnpx_ssw2pdg(i);
+    else
+      f->pdgtable[i] = (i==1?2112:(i==2?22:0));//only neutrons and gammas in MCNP5
   }
+}
 
-  if ( f->lbuf != (unsigned)(8*f->nrcd) ) {
-    ssw_error("ssw_load error: unexpected particle data length");
-    //return 0;
-  }
+int32_t ssw_rawtype2pdg( const ssw_fileinternal_t * f, long rawtype )
+{
+  if ( rawtype >= 0 && rawtype < SSWREAD_PDGTABLESIZE )
+    return f->pdgtable[rawtype];
+  if ( f->mcnp_type == SSW_MCNP6 )
+    return conv_mcnp6_ssw2pdg((int32_t)rawtype);
+  if ( f->mcnp_type == SSW_MCNPX )
+    return conv_mcnpx_ssw2pdg((int32_t)rawtype);
+  return 0;
+}
+
+//Particle types which can not be converted to PDG codes are counted, but only
+//the first of them are mentioned in warnings:
+#define SSWREAD_MAXTYPEWARNINGS 100
 
-  double * ssb = (double*)f->buf;
+void ssw_warn_badtype( ssw_fileinternal_t * f, const ssw_particle_t * p )
+{
+  if ( p->pdgcode || ++f->nbadtypes > SSWREAD_MAXTYPEWARNINGS )
+    return;
+  const char * flavour = ( f->mcnp_type == SSW_MCNP6
+                           ? "MCNP6"
+                           : ( f->mcnp_type == SSW_MCNPX ? "MCNPX" : "MCNP5" ) );
+  fprintf(ssw_stdout(),"ssw_load_particle WARNING: Could not convert raw %s SSW type (%li) to pdg code\n",flavour,p->rawtype);
+  if ( f->nbadtypes == SSWREAD_MAXTYPEWARNINGS )
+    fprintf(ssw_stdout(),"ssw_load_particle WARNING: Suppressing future warnings regarding non-convertible SSW types.\n");
+}
 
-  ssw_particle_t* p = &(f->part);
+//Decode the payload of a particle record (which does not need to be
+//aligned). This does not modify the file object, and warnings about particle
+//types which could not be converted are left for ssw_warn_badtype:
+void ssw_decode_particle( const ssw_fileinternal_t * f, const char * data,
+                          ssw_particle_t * p )
+{
+  double ssb[11];
+  assert( f->nrcd >= 10 && f->nrcd <= 11 );
+  memcpy( ssb, data, 8 * (size_t)f->nrcd );
 
   p->weight = ssb[2];
   p->ekin = ssb[3];//MeV
@@ -696,9 +736,6 @@ const ssw_particle_t * ssw_load_particle(ssw_file_t ff)
     } else {
       p->rawtype = (long)(rawtype0);
     }
-    p->pdgcode = conv_mcnp6_ssw2pdg((int32_t)p->rawtype);
-    if (!p->pdgcode)
-      fprintf(ssw_stdout(),"ssw_load_particle WARNING: Could not convert raw MCNP6 SSW type (%li) to pdg code\n",(long)(p->rawtype));
   } else if ( f->mcnp_type == SSW_MCNPX ) {
     p->isurf = nx % 1000000;
     int64_t rawtype0 = nx / 1000000;
@@ -707,9 +744,6 @@ const ssw_particle_t * ssw_load_particle(ssw_file_t ff)
     } else {
       p->rawtype = (long)(rawtype0);
     }
-    p->pdgcode = conv_mcnpx_ssw2pdg((int32_t)p->rawtype);
-    if (!p->pdgcode)
-      fprintf(ssw_stdout(),"ssw_load_particle WARNING: Could not convert raw MCNPX SSW type (%li) to pdg code\n",(long)(p->rawtype));
   } else {
     assert( f->mcnp_type == SSW_MCNP5 );
     nx /= 8;//Guess: Get rid of some bits that might be used for something else
@@ -721,16 +755,146 @@ const ssw_particle_t * ssw_load_particle(ssw_file_t ff)
     } else {
       p->rawtype = (long)(rawtype0);
     }
-    p->pdgcode = (p->rawtype==1?2112:(p->rawtype==2?22:0));//only neutrons and gammas in MCNP5
-    if (!p->pdgcode)
-      fprintf(ssw_stdout(),"ssw_load_particle WARNING: Could not convert raw MCNP5 SSW type (%li) to pdg code\n",(long)(p->rawtype));
   }
+  p->pdgcode = ssw_rawtype2pdg(f,p->rawtype);
   p->dirz = sqrt(fmax(0.0, 1. - p->dirx*p->dirx-p->diry*p->diry));
   if (ssb[1]<0.0)
     p->dirz = - p->dirz;
+}
+
+//load next particle (null indicates eof):
+const ssw_particle_t * ssw_load_particle(ssw_file_t ff)
+{
+  SSW_FILEDECODE;
+  if (f->pos >= f->nrss)
+    return 0;
+
+  ++f->pos;
+
+  //The record of the first particle in the file is always pre-loaded during
+  //initialisation, for the others we must consume another record:
+  if ( f->pos > 1 && !ssw_loadrecord(f) ) {
+    ssw_error("ssw_load error: problems loading particle record (E)\n");
+    //return 0;
+  }
+
+  if ( f->lbuf != (unsigned)(8*f->nrcd) ) {
+    ssw_error("ssw_load error: unexpected particle data length");
+    //return 0;
+  }
 
-  return p;
+  ssw_decode_particle(f,f->buf,&(f->part));
+  ssw_warn_badtype(f,&(f->part));
+  return &(f->part);
+}
 
+unsigned long ssw_particle_record_size(ssw_file_t ff)
+{
+  SSW_FILEDECODE;
+  return (unsigned long)( 8 * (size_t)f->nrcd + 2 * (size_t)f->reclen );
+}
+
+unsigned long ssw_read_particle_records(ssw_file_t ff, unsigned long n, char * buf)
+{
+  SSW_FILEDECODE;
+  if ( f->pos >= f->nrss )
+    return 0;
+  unsigned long nleft = (unsigned long)( f->nrss - f->pos );
+  if ( n > nleft )
+    n = nleft;
+  const size_t lpayload = 8 * (size_t)f->nrcd;
+  const size_t lrec = lpayload + 2 * (size_t)f->reclen;
+  unsigned long nread = 0;
+
+  //The record of the first particle is pre-loaded during initialisation (only
+  //its payload is needed, since the record markers were already checked):
+  if ( n && f->pos == 0 ) {
+    if ( f->lbuf != lpayload )
+      ssw_error("ssw_load error: unexpected particle data length");
+    memcpy( buf + f->reclen, f->buf, lpayload );
+    ++f->pos;
+    ++nread;
+  }
+
+  //Read the remaining records in one go, and check all their record markers:
+  while ( nread < n ) {
+    unsigned long nrec = n - nread;
+    if ( nrec > INT_MAX / lrec )
+      nrec = (unsigned long)( INT_MAX / lrec );
+    char * b = buf + nread * lrec;
+    if (!ssw_try_readbytes(f, b, (int)( nrec * lrec )))
+      ssw_error("ssw_load error: problems loading particle record (E)\n");
+    unsigned long i;
+    int bad = 0;
+    if ( f->reclen == 4 ) {
+      const uint32_t expected = (uint32_t)lpayload;
+      for ( i = 0; i < nrec; ++i ) {
+        uint32_t m0, m1;
+        memcpy( &m0, b + i * lrec, 4 );
+        memcpy( &m1, b + i * lrec + 4 + lpayload, 4 );
+        bad |= ( m0 != expected ) | ( m1 != expected );
+      }
+    } else {
+      const uint64_t expected = (uint64_t)lpayload;
+      for ( i = 0; i < nrec; ++i ) {
+        uint64_t m0, m1;
+        memcpy( &m0, b + i * lrec, 8 );
+        memcpy( &m1, b + i * lrec + 8 + lpayload, 8 );
+        bad |= ( m0 != expected ) | ( m1 != expected );
+      }
+    }
+    if ( bad )
+      ssw_error("ssw_load error: unexpected particle data length");
+    nread += nrec;
+    f->pos += (int32_t)nrec;
+  }
+  return nread;
+}
+
+void ssw_decode_particle_records(ssw_file_t ff, unsigned long n,
+                                 const char * buf, ssw_particle_t * out)
+{
+  SSW_FILEDECODE;
+  const size_t lrec = 8 * (size_t)f->nrcd + 2 * (size_t)f->reclen;
+  unsigned long i;
+  for ( i = 0; i < n; ++i )
+    ssw_decode_particle( f, buf + i * lrec + f->reclen, out + i );
+}
+
+void ssw_warn_unconverted(ssw_file_t ff, unsigned long n,
+                          const ssw_particle_t * particles)
+{
+  SSW_FILEDECODE;
+  unsigned long i;
+  for ( i = 0; i < n; ++i )
+    ssw_warn_badtype( f, particles + i );
+}
+
+unsigned long ssw_load_particles(ssw_file_t ff, unsigned long n, ssw_particle_t * out)
+{
+  SSW_FILEDECODE;
+  //Read as many consecutive particle records as fit in the bulk buffer at a
+  //time, and decode them:
+  const unsigned long lrec = ssw_particle_record_size(ff);
+  const unsigned long nrecmax = SSWREAD_BULKBUFSIZE / lrec;
+  unsigned long nloaded = 0;
+  while ( nloaded < n ) {
+    if (!f->bulkbuf) {
+      f->bulkbuf = malloc( nrecmax * lrec );
+      if (!f->bulkbuf)
+        ssw_error("memory allocation failure");
+    }
+    unsigned long nrec = n - nloaded;
+    if ( nrec > nrecmax )
+      nrec = nrecmax;
+    nrec = ssw_read_particle_records( ff, nrec, f->bulkbuf );
+    if (!nrec)
+      break;
+    ssw_decode_particle_records( ff, nrec, f->bulkbuf, out + nloaded );
+    ssw_warn_unconverted( ff, nrec, out + nloaded );
+    nloaded += nrec;
+  }
+  return nloaded;
 }
 
 static int32_t conv_mcnpx_to_pdg_0to34[] = { 0, 2112, 22, 11, 13, 15, 12, 14, 16, 2212, 3122, 3222,
@@ -743,6 +907,46 @@ static int32_t conv_mcnp6_to_pdg_0to36[] = { 0, 2112, 22, 11, 13, -2112, 12, 14,
                                              111, 321, 310, 130, -3122, -3222, -3112, -3322, -3312, -3334,
                                              1000010020, 1000010030, 1000020030, 1000020040, -211, -321 };
 
+//The PDG codes in the tables above (and their antiparticles) are found via
+//perfect hash tables: slot number ((uint32_t)pdgcode*K)>>(32-nbits) holds the
+//index in the table above, with the 0x80 bit set for antiparticles (unused
+//slots hold 255). The multipliers K were found by trying random odd numbers
+//until one gave no collisions, so the hash tables must be regenerated with
+//devel/misc/gen_pdghash.py if the tables above are ever modified:
+#define SSW_MCNPX_PDGHASH_K 0x63ca828du
+#define SSW_MCNPX_PDGHASH_NBITS 8
+static const unsigned char conv_pdg_to_mcnpx_hash[256] = {
+    0,  27, 158, 255, 138, 255, 255, 255, 255, 139, 255,  14, 255, 255, 141, 255,
+  255,   4, 255, 255, 255,  12, 255,  28, 255, 255, 255, 255,  26, 255, 255, 255,
+   22, 255, 255, 255, 255, 255, 255, 133, 151, 255, 255, 255, 255, 255, 255, 255,
+  255,  29, 255, 255, 255, 144,  25, 255, 255, 255, 255, 255,   8, 255, 255,  20,
+  255,   9, 255, 255,  21, 255,   1, 255, 255,   3, 159, 255, 255, 255, 161, 146,
+  255, 255, 134, 152, 145, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  143, 255, 255, 255, 160, 255, 147, 255, 162, 255, 255, 255, 130, 255, 255, 255,
+  255, 255, 255, 255, 255,   7, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 135, 255, 255, 255, 255, 255,
+  255, 255, 255,   2, 255, 255, 255,  34, 255,  19, 255,  32, 255, 255, 255,  15,
+  255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  17,  24,   6, 255, 255,
+   18,  33, 255, 255, 255,  31, 131, 255, 255, 129, 255, 149, 255, 255, 137, 255,
+  148, 255, 255, 136, 255, 255, 255, 255, 255, 153,  16, 255, 255, 255, 157, 255,
+  255, 255, 255, 255, 255, 255, 255,  23,   5, 255, 255, 255, 255, 255, 255, 150,
+  255, 255, 255, 154, 255, 255, 255, 255, 156, 255, 140, 255, 255, 255, 132, 255,
+  255,  13, 255, 255, 142, 255,  11, 255, 255, 255, 255,  10, 255,  30, 155, 255
+};
+
+#define SSW_MCNP6_PDGHASH_K 0x1ba16215u
+#define SSW_MCNP6_PDGHASH_NBITS 7
+static const unsigned char conv_pdg_to_mcnp6_hash[128] = {
+    0, 255, 149,  24,  25,  33,   5, 255, 255, 255, 255, 255, 255, 255, 255,  27,
+   34, 255, 255, 255,  30, 255, 255,   3, 255, 255, 255, 255,  35, 255, 255,  26,
+   19, 255, 160, 255, 255,   6, 255, 255, 255, 255, 255, 255, 159,  36, 255,   2,
+  255, 255, 255,   4, 255, 255, 255, 255, 255,  28,  23,  14, 255, 255,  18, 255,
+  255,   7, 255, 255,  29, 151,  13, 255, 255, 255, 255, 255,  16, 255, 255, 255,
+  130, 255,  22,  31, 255, 255, 255, 255, 255, 255,  17, 255, 255,  32, 255,   9,
+   11, 255, 255,  20, 255, 255, 255, 255,   8, 255, 255,  15, 255, 255, 255, 162,
+   12, 255, 255, 255, 255, 255, 255, 255, 255,   1, 161,  10, 152,  21, 255, 255
+};
+
 int32_t conv_mcnpx_ssw2pdg( int32_t c )
 {
   if (c<0)
@@ -803,15 +1007,15 @@ int32_t conv_mcnp6_ssw2pdg( int32_t c )
 int32_t conv_mcnpx_pdg2ssw( int32_t c )
 {
   int32_t absc = c < 0 ? -c : c;
-  if (absc <= 1000020040) {
-    int i;
-    for (i = 0; i<35; ++i) {
-      if (conv_mcnpx_to_pdg_0to34[i]==c)
-        return i;
-    }
-    for (i = 0; i<35; ++i) {
-      if (conv_mcnpx_to_pdg_0to34[i] == -c)
+  unsigned e = conv_pdg_to_mcnpx_hash[ ( (uint32_t)c * SSW_MCNPX_PDGHASH_K )
+                                       >> ( 32 - SSW_MCNPX_PDGHASH_NBITS ) ];
+  if ( e != 255 ) {
+    int32_t i = (int32_t)( e & 0x7f );
+    if ( e & 0x80 ) {
+      if ( conv_mcnpx_to_pdg_0to34[i] == -c )
         return 400+i;
+    } else if ( conv_mcnpx_to_pdg_0to34[i] == c ) {
+      return i;
     }
   }
   if (absc>1000000000&&absc<=1009999990) {
@@ -833,17 +1037,17 @@ int32_t conv_mcnpx_pdg2ssw( int32_t c )
 int32_t conv_mcnp6_pdg2ssw( int32_t c )
 {
   int32_t absc = c < 0 ? -c : c;
-  if (absc <= 1000020040) {
-    if (c==-11)
-      return 7;//e+ is special case, pick 7 (anti e-) rather than 16 (straight e+)
-    int i;
-    for (i = 0; i<37; ++i) {
-      if (conv_mcnp6_to_pdg_0to36[i]==c)
-        return 2*i;
-    }
-    for (i = 0; i<37; ++i) {
-      if (conv_mcnp6_to_pdg_0to36[i] == -c)
+  if (c==-11)
+    return 7;//e+ is special case, pick 7 (anti e-) rather than 16 (straight e+)
+  unsigned e = conv_pdg_to_mcnp6_hash[ ( (uint32_t)c * SSW_MCNP6_PDGHASH_K )
+                                       >> ( 32 - SSW_MCNP6_PDGHASH_NBITS ) ];
+  if ( e != 255 ) {
+    int32_t i = (int32_t)( e & 0x7f );
+    if ( e & 0x80 ) {
+      if ( conv_mcnp6_to_pdg_0to36[i] == -c )
         return 1 + 2*i;
+    } else if ( conv_mcnp6_to_pdg_0to36[i] == c ) {
+      return 2*i;
     }
   }
   if (absc>1000000000&&absc<=1009999990) {
@@ -867,6 +1071,28 @@ int32_t conv_mcnp6_pdg2ssw( int32_t c )
   return 0;
 }
 
+unsigned long conv_mcnpx_pdg2ssw_array( const int32_t * in, int32_t * out,
+                                        unsigned long n )
+{
+  unsigned long i, nfailed = 0;
+  for ( i = 0; i < n; ++i ) {
+    out[i] = conv_mcnpx_pdg2ssw( in[i] );
+    nfailed += ( out[i] ? 0 : 1 );
+  }
+  return nfailed;
+}
+
+unsigned long conv_mcnp6_pdg2ssw_array( const int32_t * in, int32_t * out,
+                                        unsigned long n )
+{
+  unsigned long i, nfailed = 0;
+  for ( i = 0; i < n; ++i ) {
+    out[i] = conv_mcnp6_pdg2ssw( in[i] );
+    nfailed += ( out[i] ? 0 : 1 );
+  }
+  return nfailed;
+}
+
 #ifdef MCPLSSW_IS_TEST_LIB
 //Function needed for unit tests, outfile must be ascii characters only (for
 //now):
@@ -915,4 +1141,33 @@ void ssw_dump( const char * filename, const char * outfile )
   ssw_set_stdout(NULL);
 
 }
+
+//Plain linear searches through the type tables, for unit tests verifying the
+//hash tables used by conv_mcnpx_pdg2ssw and conv_mcnp6_pdg2ssw (returns 0 when
+//the code is not in the table):
+int32_t conv_mcnpx_pdg2ssw_linear( int32_t c )
+{
+  int i;
+  for ( i = 0; i < 35; ++i )
+    if ( conv_mcnpx_to_pdg_0to34[i] == c )
+      return i;
+  for ( i = 0; i < 35; ++i )
+    if ( conv_mcnpx_to_pdg_0to34[i] == -c )
+      return 400+i;
+  return 0;
+}
+
+int32_t conv_mcnp6_pdg2ssw_linear( int32_t c )
+{
+  if ( c == -11 )
+    return 7;
+  int i;
+  for ( i = 0; i < 37; ++i )
+    if ( conv_mcnp6_to_pdg_0to36[i] == c )
+      return 2*i;
+  for ( i = 0; i < 37; ++i )
+    if ( conv_mcnp6_to_pdg_0to36[i] == -c )
+      return 1 + 2*i;
+  return 0;
+}
 #endif
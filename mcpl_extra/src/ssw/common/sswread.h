@@ -86,6 +86,25 @@ extern "C" {
   //load next particle (null indicates eof):
   const ssw_particle_t * ssw_load_particle(ssw_file_t);
 
+  //load up to n next particles into out, returning the number loaded (0
+  //indicates eof). Consecutive particle records are read and checked in large
+  //chunks, which is much faster than calling ssw_load_particle for each
+  //particle. The two functions can be used interchangeably on a file:
+  unsigned long ssw_load_particles(ssw_file_t, unsigned long n, ssw_particle_t * out);
+
+  //The steps of ssw_load_particles are also available separately, so the
+  //decoding can be done elsewhere (e.g. in other threads) than the reading:
+  //ssw_read_particle_records reads up to n raw particle records into buf (which
+  //must have room for n*ssw_particle_record_size bytes) and returns the number
+  //read. ssw_decode_particle_records decodes such records and is safe to call
+  //concurrently, but leaves it to ssw_warn_unconverted (to be called on the
+  //decoded particles in file order) to warn about unknown particle types:
+  unsigned long ssw_particle_record_size(ssw_file_t);
+  unsigned long ssw_read_particle_records(ssw_file_t, unsigned long n, char * buf);
+  void ssw_decode_particle_records(ssw_file_t, unsigned long n, const char * buf,
+                                   ssw_particle_t * out);
+  void ssw_warn_unconverted(ssw_file_t, unsigned long n, const ssw_particle_t * particles);
+
   //close file and release resources:
   void ssw_close_file(ssw_file_t);
 
@@ -115,6 +134,12 @@ extern "C" {
   int32_t conv_mcnpx_pdg2ssw(int32_t);
   int32_t conv_mcnp6_pdg2ssw(int32_t);
 
+  //Versions of the pdg2ssw functions converting n codes at once, putting the
+  //results in out (which may be the same array as in). The number of codes
+  //which could not be converted (i.e. which were converted to 0) is returned:
+  unsigned long conv_mcnpx_pdg2ssw_array(const int32_t * in, int32_t * out, unsigned long n);
+  unsigned long conv_mcnp6_pdg2ssw_array(const int32_t * in, int32_t * out, unsigned long n);
+
 #ifdef __cplusplus
 }
 #endif
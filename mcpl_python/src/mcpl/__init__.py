@@ -47,6 +47,8 @@ agreement No 676548 (the BrightnESS project)
 """
 
 __all__ = [ 'MCPLFile',
+            'MCPLWriter',
+            'MCPLDataset',
             'MCPLParticle',
             'MCPLParticleBlock',
             'MCPLError',
@@ -63,6 +65,8 @@ __all__ = [ 'MCPLFile',
 __version__ = '2.2.8'
 
 from .mcpl import ( MCPLFile,
+                    MCPLWriter,
+                    MCPLDataset,
                     MCPLParticle,
                     MCPLParticleBlock,
                     MCPLError,
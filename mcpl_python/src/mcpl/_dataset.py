@@ -0,0 +1,293 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+#Reading of a collection of compatible MCPL files as a single dataset
+#(MCPLDataset).
+
+import os
+import math
+from .mcpl import MCPLFile, MCPLError, np, _parse_statsum_comment
+
+def _can_merge(f1,f2):
+    #Python equivalent of mcpl_can_merge for two opened files, requiring
+    #identical headers except for nparticles, the format version and the values
+    #of stat:sum: entries.
+    def raw(f,key):
+        return f._hdr.get(key+'_raw',f._hdr[key])
+    for a in ('headersize','opt_userflags','opt_polarisation','opt_singleprec',
+              'opt_universalpdgcode','opt_universalweight','endianness','particlesize'):
+        if getattr(f1,a) != getattr(f2,a):
+            return False
+    if raw(f1,'sourcename') != raw(f2,'sourcename'):
+        return False
+    c1,c2 = raw(f1,'comments'),raw(f2,'comments')
+    if len(c1) != len(c2):
+        return False
+    for a,b in zip(c1,c2):
+        if a != b:
+            #incompatible, unless it represents the same stat:sum: entry:
+            ok1,(k1,_) = _parse_statsum_comment(a)
+            ok2,(k2,_) = _parse_statsum_comment(b)
+            if not ( ok1 and ok2 and k1 == k2 ):
+                return False
+    return ( raw(f1,'blobkeys') == raw(f2,'blobkeys')
+             and raw(f1,'blobs') == raw(f2,'blobs') )
+
+def _dataset_part(filename,offset,iblock_begin,iblock_end,openkw,partfn):
+    #Apply partfn to an iterator over a range of blocks in one of the files in an
+    #MCPLDataset (at module level so it can also be used in worker processes):
+    with MCPLFile(filename,**openkw) as f:
+        return partfn(f._blocks(iblock_begin,iblock_end,offset))
+
+def _map_blocks_part(fn,blocks):
+    return [fn(b) for b in blocks]
+
+class MCPLDataset:
+    """Python-only class for reading a collection of MCPL files as a single
+    dataset, for instance the files produced by the individual processes of a
+    parallel simulation. The files must be compatible in the sense that they
+    could be merged with mcpltool --merge (i.e. their headers must be identical
+    except for the number of particles and the values of stat:sum: entries).
+    Particles are indexed globally, in the order of the files. The files are
+    only kept open while particles are read from them, and blocks of particles
+    can be processed in parallel with the map_blocks() method. Example:
+
+      ds = MCPLDataset(glob.glob('output_rank*.mcpl.gz'))
+      print(ds.nparticles,ds.stat_sum)
+      sumw = sum(ds.map_blocks(lambda pb : pb.weight.sum()))
+    """
+
+    def __init__(self,paths,blocklength = 10000, raw_strings = False, memmap = False,
+                 native = False, prefetch = False):
+        """Load the headers of the indicated MCPL files and check that they are
+        compatible. The remaining parameters have the same meaning as for the
+        MCPLFile class, and are used whenever particles are read from the
+        files (memmap mode is only used for the uncompressed files)."""
+        self._filenames = [ os.fspath(p) if hasattr(p,'__fspath__') else p for p in paths ]
+        if not self._filenames:
+            raise MCPLError('MCPLDataset requires at least one file')
+        self._openkw = dict( blocklength = blocklength, raw_strings = raw_strings,
+                             memmap = memmap, native = native, prefetch = prefetch )
+        #Headers are loaded once, after which the files are closed again:
+        self._hdrs = []
+        for fn in self._filenames:
+            f = MCPLFile(fn,blocklength=blocklength,raw_strings=raw_strings)
+            f._fileclose()
+            f._fileclose = lambda : None
+            if self._hdrs and not _can_merge(self._hdrs[0],f):
+                raise MCPLError('Files %s and %s have incompatible headers'
+                                %(self._filenames[0],fn))
+            self._hdrs.append(f)
+        self._offsets = np.cumsum([0]+[f.nparticles for f in self._hdrs],dtype=np.int64)
+        self._stat_sum = None
+        self._current = None#(ifile,MCPLFile) used for access via __getitem__
+
+    @property
+    def filenames(self):
+        """Names of the files in the dataset"""
+        return list(self._filenames)
+
+    @property
+    def nfiles(self):
+        """Number of files in the dataset"""
+        return len(self._filenames)
+
+    @property
+    def nparticles(self):
+        """Total number of particles in all files"""
+        return int(self._offsets[-1])
+
+    @property
+    def file_nparticles(self):
+        """Number of particles in each of the files"""
+        return [f.nparticles for f in self._hdrs]
+
+    @property
+    def blocklength(self):
+        """Maximum number of particles in each block"""
+        return self._openkw['blocklength']
+
+    def __len__(self):
+        return self.nparticles
+
+    @property
+    def particlesize(self):
+        """Number of bytes used to store each particle"""
+        return self._hdrs[0].particlesize
+
+    @property
+    def endianness(self):
+        """Endianness of numbers in the files ('little' or 'big')"""
+        return self._hdrs[0].endianness
+
+    @property
+    def opt_userflags(self):
+        """Whether userflags are stored for each particle"""
+        return self._hdrs[0].opt_userflags
+
+    @property
+    def opt_universalpdgcode(self):
+        """Global pdgcode value for all particles (0 if not enabled)"""
+        return self._hdrs[0].opt_universalpdgcode
+
+    @property
+    def opt_polarisation(self):
+        """Whether polarisation vectors are stored for each particle"""
+        return self._hdrs[0].opt_polarisation
+
+    @property
+    def opt_singleprec(self):
+        """Whether particle data is stored in single precision"""
+        return self._hdrs[0].opt_singleprec
+
+    @property
+    def opt_universalweight(self):
+        """Global weight value for all particles (0.0 if not enabled)"""
+        return self._hdrs[0].opt_universalweight
+
+    @property
+    def sourcename(self):
+        """Name of the program which created the files"""
+        return self._hdrs[0].sourcename
+
+    @property
+    def comments(self):
+        """Comments in the header of the first file (see stat_sum for the
+        combined values of any stat:sum: entries)"""
+        return self._hdrs[0].comments
+
+    @property
+    def blobs(self):
+        """Binary blobs (identical in all files) as a key->value dictionary"""
+        return self._hdrs[0].blobs
+
+    @property
+    def stat_sum(self):
+        """The "stat:sum:..." values of all files added together, as a
+        key->value dictionary. As when merging files, the value is None if it is
+        not available (-1) in any of the files."""
+        if self._stat_sum is None:
+            from types import MappingProxyType # read-only view of dict
+            d = {}
+            for key in self._hdrs[0].stat_sum:
+                vals = [ f.stat_sum[key] for f in self._hdrs ]
+                d[key] = None if None in vals else math.fsum(vals)
+            self._stat_sum = MappingProxyType(d)
+        return self._stat_sum
+
+    def locate(self,ipos):
+        """Returns (filename,index) with the file containing the particle at
+        global position ipos in the dataset, and its position in that file"""
+        ifile,ipos = self._locate(ipos)
+        return self._filenames[ifile],ipos-int(self._offsets[ifile])
+
+    def _locate(self,ipos):
+        ipos = int(ipos)
+        if ipos < 0:
+            ipos += self.nparticles
+        if not ( 0 <= ipos < self.nparticles ):
+            raise IndexError('particle position out of range')
+        return int(np.searchsorted(self._offsets,ipos,side='right'))-1,ipos
+
+    def __getitem__(self,ipos):
+        """Access single particle by its global position in the dataset. Like the
+        particles returned by MCPLFile.read(), the returned object is only valid
+        until the next particle is accessed."""
+        ifile,ipos = self._locate(ipos)
+        if self._current is None or self._current[0] != ifile:
+            self._current = (ifile,MCPLFile(self._filenames[ifile],**self._file_openkw(ifile)))
+        f = self._current[1]
+        p = f._currentblock.get_by_global(ipos)
+        if p is None:
+            offset = int(self._offsets[ifile])
+            f._use_gzip_checkpoints()
+            ib = (ipos-offset)//f.blocklength
+            for b in f._blocks(ib,ib+1,offset):
+                p = b.get_by_global(ipos)
+        return p
+
+    @property
+    def particles(self):
+        """Use to iterate over all particles in all files"""
+        for pb in self.particle_blocks:
+            for p in pb.particles:
+                yield p
+
+    @property
+    def particle_blocks(self):
+        """Use to iterate over all particles in all files, returning a block of
+        particles each time for efficiency. The file_offset of each block is
+        the global position of its first particle in the dataset. Blocks never
+        span more than one file."""
+        for i,fn in enumerate(self._filenames):
+            if self._hdrs[i].nparticles:
+                with MCPLFile(fn,**self._file_openkw(i)) as f:
+                    for pb in f._blocks(0,f._nblocks,int(self._offsets[i])):
+                        yield pb
+
+    def map_blocks(self,fn,workers=None,processes=False):
+        """Returns [fn(pb) for pb in self.particle_blocks], but with the blocks
+        distributed over the indicated number of worker threads (default is
+        os.cpu_count()). Use processes=True to use worker processes instead,
+        which is more efficient when fn is not dominated by numpy operations,
+        but requires fn and its return values to be picklable. In either case,
+        fn should not keep references to the block objects it is given."""
+        import functools
+        parts = self._map_parts(functools.partial(_map_blocks_part,fn),workers,processes)
+        return [ r for part in parts for r in part ]
+
+    def collect_stats(self,stats='all',bin_data=True,workers=None):
+        """Collect statistics from all files in the dataset, in parallel using
+        the indicated number of worker threads (see the collect_stats function
+        for details)."""
+        from ._stats import collect_stats
+        return collect_stats(self,stats=stats,bin_data=bin_data,workers=workers)
+
+    def _file_openkw(self,ifile):
+        if self._openkw['memmap'] and self._hdrs[ifile]._is_gz:
+            return dict(self._openkw,memmap=False)
+        return self._openkw
+
+    def _map_parts(self,partfn,workers,processes=False):
+        #Splits the dataset into parts (whole files, or ranges of blocks in
+        #uncompressed files, where seeking is cheap), and returns the results of
+        #calling partfn with an iterator over the blocks in each part:
+        workers = ( os.cpu_count() or 1 ) if workers is None else int(workers)
+        if workers < 1:
+            raise MCPLError('Number of workers must be at least 1')
+        if workers == 1:
+            return [ partfn(self.particle_blocks) ]
+        bl = self.blocklength
+        nblocks = [ -(-f.nparticles//bl) for f in self._hdrs ]
+        maxblocks = max(1,-(-sum(nblocks)//workers))
+        tasks = []
+        for i,f in enumerate(self._hdrs):
+            step = nblocks[i] if f._is_gz else maxblocks
+            for ib in range(0,nblocks[i],step):
+                tasks.append( ( self._filenames[i], int(self._offsets[i]),
+                                ib, min(nblocks[i],ib+step), self._file_openkw(i), partfn ) )
+        if len(tasks) <= 1:
+            return [ _dataset_part(*t) for t in tasks ] or [ partfn(iter([])) ]
+        import concurrent.futures
+        pooltype = ( concurrent.futures.ProcessPoolExecutor if processes
+                     else concurrent.futures.ThreadPoolExecutor )
+        with pooltype(max_workers = min(workers,len(tasks))) as pool:
+            return list(pool.map(_dataset_part,*zip(*tasks)))
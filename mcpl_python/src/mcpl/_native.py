@@ -0,0 +1,154 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+#Optional usage of the compiled MCPL library via ctypes (see the native
+#parameter of MCPLFile). The library is located via the MCPL_LIB environment
+#variable, the mcpl-config command, or the standard library search path.
+
+import os
+import threading
+from .mcpl import MCPLError, np_dtype
+
+_libmcpl_cache = []
+_libmcpl_keepalive = []
+_libmcpl_quiet = []
+_libmcpl_thread = threading.local()
+def _libmcpl():
+    if not _libmcpl_cache:
+        _libmcpl_cache.append(_load_libmcpl())
+    return _libmcpl_cache[0]
+
+def _find_libmcpl():
+    if os.environ.get('MCPL_LIB'):
+        return os.environ['MCPL_LIB']
+    import shutil
+    cfgcmd = shutil.which('mcpl-config')
+    if cfgcmd:
+        import subprocess
+        try:
+            p = subprocess.run([cfgcmd,'--show','shlibpath'],check=True,
+                               capture_output=True).stdout.decode().strip()
+        except (OSError,subprocess.CalledProcessError,UnicodeDecodeError):
+            p = None
+        if p and os.path.isfile(p):
+            return p
+    import ctypes.util
+    return ctypes.util.find_library('mcpl')
+
+def _load_libmcpl():
+    import ctypes
+    path = _find_libmcpl()
+    if not path:
+        return None
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+    if not hasattr(lib,'mcpl_read_particles'):
+        return None#too old
+    class mcpl_file_t(ctypes.Structure):
+        _fields_ = [('internal',ctypes.c_void_p)]
+    lib.mcpl_open_file.argtypes = [ctypes.c_char_p]
+    lib.mcpl_open_file.restype = mcpl_file_t
+    lib.mcpl_close_file.argtypes = [mcpl_file_t]
+    lib.mcpl_close_file.restype = None
+    lib.mcpl_seek.argtypes = [mcpl_file_t,ctypes.c_uint64]
+    lib.mcpl_seek.restype = ctypes.c_int
+    lib.mcpl_read_particles.argtypes = [mcpl_file_t,ctypes.c_void_p,ctypes.c_uint64]
+    lib.mcpl_read_particles.restype = ctypes.c_uint64
+    #Route printouts via sys.stdout (to keep ordering with Python printouts), but
+    #allow them to be suppressed (to avoid repeating header warnings already
+    #emitted when the Python code loaded the header):
+    def print_handler(msg):
+        if not _libmcpl_quiet:
+            print(msg.decode('utf-8','replace'),end='',flush=True)
+    print_handler_t = ctypes.CFUNCTYPE(None,ctypes.c_char_p)
+    _libmcpl_keepalive.append(print_handler_t(print_handler))
+    lib.mcpl_set_print_handler.argtypes = [print_handler_t]
+    lib.mcpl_set_print_handler.restype = None
+    lib.mcpl_set_print_handler(_libmcpl_keepalive[-1])
+    #Errors must not end the process, but an error handler is not allowed to
+    #return to libmcpl. Calls are therefore done via _LibMCPLCaller, and errors
+    #reported back to the calling thread:
+    def error_handler(msg):
+        msg = msg.decode('utf-8','replace')
+        caller = getattr(_libmcpl_thread,'caller',None)
+        if caller is None:
+            #libmcpl used outside of this module, mimic default handler:
+            print('MCPL ERROR: %s'%msg,flush=True)
+            os._exit(1)
+        caller._on_error(msg)
+    _libmcpl_keepalive.append(print_handler_t(error_handler))
+    lib.mcpl_set_error_handler.argtypes = [print_handler_t]
+    lib.mcpl_set_error_handler.restype = None
+    lib.mcpl_set_error_handler(_libmcpl_keepalive[-1])
+    return lib
+
+class _LibMCPLCaller:
+    """Calls functions in libmcpl from a dedicated thread. In case of errors,
+    an MCPLError is raised in the calling thread, while the dedicated thread is
+    left waiting forever in the error handler (since it must not return to
+    libmcpl). All subsequent calls will then also raise an MCPLError."""
+
+    def __init__(self):
+        import queue
+        self._requests = queue.Queue()
+        self._done = threading.Event()
+        self._result = None
+        self._error = None
+        threading.Thread(target=self._run,daemon=True).start()
+
+    def _run(self):
+        _libmcpl_thread.caller = self
+        while True:
+            fct = self._requests.get()
+            if fct is None:
+                return
+            self._result = fct()
+            self._done.set()
+
+    def _on_error(self,msg):
+        self._error = msg
+        self._done.set()
+        threading.Event().wait()
+
+    def __call__(self,fct):
+        if self._error is not None:
+            raise MCPLError(self._error)
+        self._done.clear()
+        self._requests.put(fct)
+        self._done.wait()
+        if self._error is not None:
+            raise MCPLError(self._error)
+        res, self._result = self._result, None
+        return res
+
+    def stop(self):
+        if self._error is None:
+            self._requests.put(None)
+
+#Memory layout of mcpl_particle_t (packed), with field names matching those of
+#the raw particle data where possible:
+_native_pdt = np_dtype({'names':['ekin','polx','poly','polz','x','y','z',
+                                 'ux','uy','uz','t','w','pdg','uf'],
+                        'formats':['f8']*12+['i4','u4'],
+                        'offsets':[8*i for i in range(12)]+[96,100],
+                        'itemsize':104})
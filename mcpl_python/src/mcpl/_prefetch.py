@@ -0,0 +1,239 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+#Alternative readers of gzipped files used by MCPLFile, for inflating in a
+#background thread (prefetch mode) and for seeking efficiently in both
+#directions.
+
+from .mcpl import np, np_dtype
+
+class _GzipPrefetcher:
+    """Inflates a gzipped file in a background thread (zlib releases the GIL
+    while inflating, so this overlaps with the work done in the main thread). The
+    inflated data is kept in large chunks, and reads contained in a single chunk
+    are served as views without copying. Chunks are never reused: although
+    MCPLFile reuses the same MCPLParticleBlock object, the arrays previously
+    obtained from it (as well as blocks in the seek cache) are views of the data
+    returned here, and must not change when more data is read."""
+
+    rawchunksize = 1<<20#compressed bytes read at a time
+    chunksize = 1<<22#max size of inflated chunks
+    maxqueued = 4
+
+    def __init__(self,fh):
+        self._fh = fh
+        self._thread = None
+        self._start()
+
+    def _start(self):
+        import threading
+        import queue
+        self.close()
+        self._fh.seek(0)
+        self._queue = queue.Queue(self.maxqueued)
+        self._stopflag = threading.Event()
+        self._chunk, self._chunkpos, self._pos, self._eof = b'', 0, 0, False
+        self._thread = threading.Thread(target=self._inflate,
+                                        args=(self._queue,self._stopflag),
+                                        daemon=True)
+        self._thread.start()
+
+    def _inflate(self,q,stopflag):
+        import zlib
+        import queue
+        def put(x):
+            while not stopflag.is_set():
+                try:
+                    q.put(x,timeout=0.1)
+                    return True
+                except queue.Full:
+                    pass
+            return False
+        newdecomp = lambda : zlib.decompressobj(16+zlib.MAX_WBITS)
+        d = newdecomp()
+        try:
+            while not stopflag.is_set():
+                buf = self._fh.read(self.rawchunksize)
+                if not buf:
+                    break#EOF (incomplete data is detected by the reader)
+                while buf:
+                    if not put(d.decompress(buf,self.chunksize)):
+                        return
+                    if d.eof:
+                        #end of gzip member (files can contain several):
+                        buf = d.unused_data
+                        d = newdecomp()
+                    else:
+                        buf = d.unconsumed_tail
+        except (IOError, OSError, EOFError, zlib.error):
+            pass#corrupt data, treat like EOF
+        put(None)
+
+    def _nextchunk(self):
+        if self._eof:
+            return False
+        c = self._queue.get()
+        if c is None:
+            self._eof = True
+            self._chunk, self._chunkpos = b'', 0
+            return False
+        self._chunk, self._chunkpos = c, 0
+        return True
+
+    def _take(self,n,keep=True):
+        #Consume next n bytes (or less at EOF), returning them if keep is set:
+        if self._chunkpos + n <= len(self._chunk):
+            i0 = self._chunkpos
+            self._chunkpos += n
+            self._pos += n
+            return memoryview(self._chunk)[i0:i0+n] if keep else None
+        parts, nmissing = [], n
+        while True:
+            nused = min(nmissing,len(self._chunk)-self._chunkpos)
+            if keep:
+                parts.append(memoryview(self._chunk)[self._chunkpos:self._chunkpos+nused])
+            self._chunkpos += nused
+            nmissing -= nused
+            if not nmissing or not self._nextchunk():
+                break
+        self._pos += n - nmissing
+        return b''.join(parts) if keep else None
+
+    def read(self,dtype,count):
+        dtype,count=np_dtype(dtype),int(np.squeeze(count))
+        assert count>0
+        n = dtype.itemsize * count
+        x = self._take(n)
+        if len(x)==n:
+            return np.frombuffer(x,dtype=dtype,count=count)
+        else:
+            return np.ndarray(dtype=dtype,shape=0)#incomplete read => return empty array
+
+    def seek(self,pos):
+        if pos < self._pos:
+            self._start()#backwards, must start over
+        while self._pos < pos:
+            n = self._pos
+            self._take(min(pos-self._pos,1<<26),keep=False)
+            if self._pos == n:
+                break#EOF
+
+    def close(self):
+        if self._thread is not None:
+            self._stopflag.set()
+            self._thread.join()
+            self._thread = None
+
+class _GzipCheckpoints:
+    """Reads a gzipped file while saving copies of the decompressor state at
+    regular intervals of the inflated data (as in zran.c from the zlib
+    examples). Seeking to any position, in either direction, can then resume
+    from the nearest preceding checkpoint rather than from the start of the
+    file. Each checkpoint holds a copy of the 32kb inflate window, so their
+    number is capped by doubling the spacing and dropping every other
+    checkpoint whenever the cap is reached."""
+
+    rawchunksize = 1<<18#compressed bytes read at a time
+    chunksize = 1<<18#max size of inflated chunks
+    spacing = 1<<20#initial min distance between checkpoints
+    maxcheckpoints = 256
+
+    def __init__(self,fh):
+        self._fh = fh
+        self._spacing = self.spacing
+        self._checkpoints = []#(pos,rawpos,decompressor) sorted by pos
+        self._checkpoint_pos = []
+        self._resume(0,0,None)
+
+    def _resume(self,pos,rawpos,d):
+        import zlib
+        self._fh.seek(rawpos)
+        self._rawpos = rawpos#position in compressed file after data in _tail
+        self._d = d.copy() if d is not None else zlib.decompressobj(16+zlib.MAX_WBITS)
+        self._tail = b''#compressed data not yet consumed by _d
+        self._chunk, self._chunkpos, self._pos = b'', 0, pos
+
+    def _nextchunk(self):
+        import zlib
+        d = self._d
+        self._pos += len(self._chunk)
+        self._chunk, self._chunkpos = b'', 0
+        try:
+            while not self._chunk:
+                if not self._tail:
+                    self._tail = self._fh.read(self.rawchunksize)
+                    self._rawpos += len(self._tail)
+                    if not self._tail:
+                        return False#EOF (incomplete data is detected by the reader)
+                if d.eof:
+                    #end of gzip member (files can contain several):
+                    self._d = d = zlib.decompressobj(16+zlib.MAX_WBITS)
+                self._chunk = d.decompress(self._tail,self.chunksize)
+                self._tail = d.unused_data if d.eof else d.unconsumed_tail
+        except (IOError, OSError, EOFError, zlib.error):
+            self._chunk = b''
+            return False#corrupt data, treat like EOF
+        endpos = self._pos + len(self._chunk)
+        lastcp = self._checkpoint_pos[-1] if self._checkpoints else 0
+        if not d.eof and endpos >= lastcp + self._spacing:
+            if len(self._checkpoints) >= self.maxcheckpoints:
+                self._spacing *= 2
+                self._checkpoints = self._checkpoints[1::2]
+                self._checkpoint_pos = self._checkpoint_pos[1::2]
+                if endpos < self._checkpoint_pos[-1] + self._spacing:
+                    return True
+            self._checkpoints.append( ( endpos, self._rawpos - len(self._tail), d.copy() ) )
+            self._checkpoint_pos.append( endpos )
+        return True
+
+    def read(self,dtype,count):
+        dtype,count=np_dtype(dtype),int(np.squeeze(count))
+        assert count>0
+        n = dtype.itemsize * count
+        if self._chunkpos + n <= len(self._chunk):
+            x = memoryview(self._chunk)[self._chunkpos:self._chunkpos+n]
+            self._chunkpos += n
+        else:
+            parts, nmissing = [], n
+            while True:
+                nused = min(nmissing,len(self._chunk)-self._chunkpos)
+                parts.append(memoryview(self._chunk)[self._chunkpos:self._chunkpos+nused])
+                self._chunkpos += nused
+                nmissing -= nused
+                if not nmissing or not self._nextchunk():
+                    break
+            x = b''.join(parts)
+        if len(x)==n:
+            return np.frombuffer(x,dtype=dtype,count=count)
+        else:
+            return np.ndarray(dtype=dtype,shape=0)#incomplete read => return empty array
+
+    def seek(self,pos):
+        if not ( self._pos <= pos <= self._pos + len(self._chunk) ):
+            import bisect
+            i = bisect.bisect_right(self._checkpoint_pos,pos)
+            cp = self._checkpoints[i-1] if i else (0,0,None)
+            if pos < self._pos or cp[0] > self._pos + len(self._chunk):
+                self._resume(*cp)
+            while pos > self._pos + len(self._chunk):
+                if not self._nextchunk():
+                    return#EOF
+        self._chunkpos = pos - self._pos
@@ -0,0 +1,746 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+#Collection, printing and plotting of statistics (collect_stats, dump_stats and
+#plot_stats).
+
+import os
+from .mcpl import ( MCPLFile, MCPLError, np, np_dtype, np_unique, _np_add_at,
+                    _determine_version )
+from ._dataset import MCPLDataset
+
+_db_pdg = None
+_db_elem = None
+def _pdg_database(pdgcode):
+    global _db_pdg, _db_elem
+    if _db_pdg is None:
+        _db_pdg = { 12:'nu_e',14:'nu_mu',16:'nu_tau',-12:'nu_e-bar',-14:'nu_mu-bar',
+                    -16:'nu_tau-bar',2112:'n',2212:'p',-2112:'n-bar',-2212:'p-bar',
+                    22:'gamma',11:'e-',-11:'e+',13:'mu-',-13:'mu+',15:'tau-',-15:'tau+',
+                    211:'pi+',-211:'pi-',111:'pi0',321:'K+',-321:'K-',130:'Klong',
+                    310:'Kshort',-1000010020:'D-bar',-1000010030:'T-bar',1000010020:'D',
+                    1000010030:'T',1000020040:'alpha',-1000020040:'alpha-bar' }
+    r=_db_pdg.get(pdgcode,None)
+    if r is not None:
+        return r
+    if _db_elem is None:
+        _db_elem = ['H',  'He', 'Li', 'Be', 'B',  'C',  'N',  'O',  'F',  'Ne',
+                    'Na', 'Mg', 'Al', 'Si', 'P' , 'S',  'Cl', 'Ar', 'K',  'Ca', 'Sc',
+                    'Ti', 'V',  'Cr', 'Mn', 'Fe', 'Co', 'Ni', 'Cu', 'Zn', 'Ga', 'Ge',
+                    'As', 'Se', 'Br', 'Kr', 'Rb', 'Sr', 'Y',  'Zr', 'Nb', 'Mo', 'Tc',
+                    'Ru', 'Rh', 'Pd', 'Ag', 'Cd', 'In', 'Sn', 'Sb', 'Te', 'I',  'Xe',
+                    'Cs', 'Ba', 'La', 'Ce', 'Pr', 'Nd', 'Pm', 'Sm', 'Eu', 'Gd', 'Tb',
+                    'Dy', 'Ho', 'Er', 'Tm', 'Yb', 'Lu', 'Hf', 'Ta', 'W',  'Re', 'Os',
+                    'Ir', 'Pt', 'Au', 'Hg', 'Tl', 'Pb', 'Bi', 'Po', 'At', 'Rn', 'Fr',
+                    'Ra', 'Ac', 'Th', 'Pa', 'U',  'Np', 'Pu', 'Am', 'Cm', 'Bk', 'Cf',
+                    'Es', 'Fm', 'Md', 'No', 'Lr', 'Rf', 'Db', 'Sg', 'Bh', 'Hs', 'Mt',
+                    'Ds', 'Rg']
+    if pdgcode>0 and pdgcode//100000000==10:
+        III = pdgcode % 10
+        pdgcode //= 10
+        AAA = pdgcode%1000
+        pdgcode //= 1000
+        ZZZ = pdgcode%1000
+        pdgcode //= 1000
+        L = pdgcode % 10
+        pdgcode //= 10
+        if pdgcode==10 and ZZZ>0 and AAA>0:
+            if L==0 and III==0 and ZZZ < len(_db_elem)+1:
+                return '%s%i'%(_db_elem[ZZZ-1],AAA)
+            s = 'ion(Z=%i,A=%i'%(ZZZ,AAA)
+            if L:
+                s += ',L=%i'%L
+            if III:
+                s += ',I=%i'%III
+            s += ')'
+            return s
+    return None
+
+def _unique_count(a,weights=None):
+    """returns (unique,count) where unique is an array of sorted unique values in a, and count is the corresponding frequency counts"""
+    unique, inverse = np_unique(a, return_inverse=True)
+    count = np.zeros(len(unique), int if weights is None else np_dtype(type(weights[0])))
+    _np_add_at(count, inverse, 1 if weights is None else weights)
+    return (unique, count)
+
+def _merge_unique_count(uc1,uc2):
+    """merges the results of calling _unique_count on two separate data sets"""
+    u = np.append(uc1[0],uc2[0])
+    c = np.append(uc1[1],uc2[1])
+    restype=(uc1[1][0] if len(uc1[1]) else 0) +(uc2[1][0] if len(uc2[1]) else 0)
+    unique, inverse = np_unique(u, return_inverse=True)
+    count = np.zeros(len(unique), np_dtype(type(restype)))
+    _np_add_at(count, inverse, c)
+    return (unique,count)
+
+class _StatCollector:
+    def __init__(self):
+        #For numerical stability also when mean>>rms, rms state is calculated by
+        #accumulation in T variable (as in "SimpleHists" by T. Kittelmann, 2014).
+        #Here the variable T is stored in self.__rmsstate.
+        self.clear()
+        self.__dumporder = ['min','max','mean','rms','integral']
+        self.__statcalc = { 'rms'      : (lambda : np.sqrt(self.__rmsstate/self.__sumw) if self.__sumw else None ),
+                            'mean'     : (lambda : (self.__sumwx/self.__sumw) if self.__sumw else None ),
+                            'min'      : (lambda : self.__min ),
+                            'max'      : (lambda : self.__max ),
+                            'integral' : (lambda : self.__sumw )
+        }
+        assert sorted(self.__dumporder)==sorted(self.__statcalc.keys())
+
+    def clear(self):
+        self.__sumw,self.__sumwx,self.__rmsstate = 0.0,0.0,0.0
+        self.__min,self.__max = None,None
+
+    def add_data(self,a,w = None):
+        amin,amax = a.min(),a.max()
+        assert w is None or len(w)==len(a)
+        assert not np.isnan(amin),"input array has NaN's!"
+        self.__min = min(amin,amin if self.__min is None else self.__min)
+        self.__max = max(amax,amax if self.__max is None else self.__max)
+        new_sumw = float(len(a)) if w is None else w.sum()
+        if not new_sumw:
+            return
+        new_sumwx = a.sum() if w is None else (a*w).sum()
+        a_shifted = a - new_sumwx/new_sumw#shift to mean for numerical stability
+        sumwx_shifted = a_shifted.sum() if w is None else (a_shifted*w).sum()
+        sumwxx_shifted = (a_shifted**2).sum() if w is None else ((a_shifted**2)*w).sum()
+        new_T = sumwxx_shifted - sumwx_shifted**2/new_sumw
+        self.__add(new_sumw,new_sumwx,new_T)
+
+    def merge(self,o):
+        """Add state of another collector (which collected separate data)"""
+        for v in (o.__min,o.__max):
+            if v is not None:
+                self.__min = min(v,v if self.__min is None else self.__min)
+                self.__max = max(v,v if self.__max is None else self.__max)
+        if o.__sumw:
+            self.__add(o.__sumw,o.__sumwx,o.__rmsstate)
+
+    def __add(self,new_sumw,new_sumwx,new_T):
+        if not self.__sumw:
+            self.__rmsstate = new_T
+        else:
+            w1,w2 = self.__sumw,new_sumw
+            self.__rmsstate += new_T + (w2*self.__sumwx-w1*new_sumwx)**2/(w1*w2*(w1+w2))
+        self.__sumw  += new_sumw
+        self.__sumwx += new_sumwx
+
+    def dump(self):
+        for k in self.__dumporder:
+            print("%s : %s"%(k.ljust(8),'%g'%self.__statcalc[k]() if self.__sumw>0.0 or k=='integral' else 'n/a'))
+
+    def summarise(self):
+        return ', '.join("%s=%s"%(k,'%g'%self.__statcalc[k]() if self.__sumw>0.0 or k=='integral' else 'n/a') for k in self.__dumporder)
+
+    def __getitem__(self,a):
+        return self.__statcalc[a]()
+
+    def as_dict(self):
+        return dict((k,self.__statcalc[k]()) for k in self.__statcalc.keys())
+
+#Histogram ranges depend on the final statistics, so in collect_stats they are
+#only known at the end of the single pass through the data. Up to this number
+#of particles, copies of the data are kept in memory and histogrammed exactly at
+#the end. For more particles, the data is instead filled into _StatsFineHist
+#objects, which are rebinned at the end:
+_stats_sample_max = 250000
+_stats_finebins = 1<<16
+
+def _stats_hist_add(hists,std_stats,ranges,nbins,get_vals,vals_weight):
+    #Histogram the kept data block by block, once the ranges are known:
+    for s in std_stats:
+        vals = get_vals(s) if s!='weight' else vals_weight
+        h,bins = np.histogram(vals, bins=nbins, range=ranges[s],
+                              weights=(None if s=='weight' else vals_weight))
+        if s in hists:
+            hists[s][0] += h
+        else:
+            hists[s] = [ h, bins ]
+
+class _StatsFineHist:
+    """Histogram of finite values with _stats_finebins bins of width 2**k,
+    aligned to multiples of the width. When values outside the covered range
+    are added, k is increased (merging neighbouring bins). Besides the
+    (weighted) contents, each bin keeps the number and sum of its values, one
+    of the values, and whether it has seen different values. When rebinning at
+    the end, the contents of each fine bin go into the final bin holding the
+    mean of its values (or its value, if all values in the fine bin are
+    identical). Thus only contents of fine bins straddling an edge of a final
+    bin can end up in a neighbouring final bin, and only if the fine bin holds
+    more than one distinct value. The fine bins are narrower than
+    2*(max-min)/(_stats_finebins-2), where min and max are over all values, so
+    a value can only end up in a neighbouring final bin if it is closer to the
+    edge than that. With the usual 201 final bins spanning mean +- 2 rms, this
+    is normally a small fraction of a final bin."""
+
+    def __init__(self):
+        self.k = None#no values yet
+        self.o = 0#bin i covers [(o+i)*2**k,(o+i+1)*2**k)
+        self.lo, self.hi = None, None
+        self.dtype = None#dtype of histogram contents made by np.histogram
+        self.vdtype = None#dtype of values
+
+    def __required_k(self,lo,hi,k):
+        import math
+        #No need for bins much narrower than the floating point resolution
+        #(this also keeps all bin indices well within the range of int64):
+        k = max( k, math.frexp(max(abs(lo),abs(hi)))[1] - 60 )
+        if hi > lo:
+            k = max( k, math.frexp( (hi-lo) / (_stats_finebins-2) )[1] - 1 )
+        while ( math.floor(math.ldexp(hi,-k))
+                - math.floor(math.ldexp(lo,-k)) ) >= _stats_finebins:
+            k += 1
+        return k
+
+    def __remap(self,k,o):
+        """Change to bins of width 2**k starting at index o"""
+        nb = _stats_finebins
+        d, g = k - self.k, self.o
+        while d:
+            #Merge groups of 2**step neighbouring bins:
+            step = min(d,32)
+            idx = ( ( g & ((1<<step)-1) ) + np.arange(nb,dtype=np.int64) ) >> step
+            starts = np.flatnonzero(np.r_[True,idx[1:]!=idx[:-1]])
+            ib = idx[starts]
+            filled = self.n > 0
+            repmin = np.minimum.reduceat(np.where(filled,self.rep,np.inf),starts)
+            repmax = np.maximum.reduceat(np.where(filled,self.rep,-np.inf),starts)
+            multi = np.logical_or.reduceat(self.multi,starts)
+            w, n, sx = ( np.add.reduceat(x,starts) for x in (self.w,self.n,self.sx) )
+            self.__alloc()
+            self.w[ib], self.n[ib], self.sx[ib] = w, n, sx
+            self.rep[ib] = np.where( n > 0, repmin, 0.0 )
+            self.multi[ib] = multi | ( ( n > 0 ) & ( repmin != repmax ) )
+            g >>= step
+            d -= step
+        shift = g - o
+        assert 0 <= shift < nb
+        if shift:
+            assert not self.n[nb-shift:].any()
+            for x in (self.w,self.n,self.sx,self.rep,self.multi):
+                x[shift:] = x[:nb-shift].copy()
+                x[:shift] = 0
+        self.k, self.o = k, o
+
+    def __alloc(self):
+        nb = _stats_finebins
+        self.w = np.zeros(nb,dtype=float)#sum of weights
+        self.n = np.zeros(nb,dtype=np.int64)#number of values
+        self.sx = np.zeros(nb,dtype=float)#sum of values
+        self.rep = np.zeros(nb,dtype=float)#one of the values
+        self.multi = np.zeros(nb,dtype=bool)#whether values differ
+
+    def __extend(self,lo,hi,k=None):
+        import math
+        if self.k is not None:
+            lo, hi = min(lo,self.lo), max(hi,self.hi)
+        k = self.__required_k(lo,hi,max(k if k is not None else -2000,
+                                        self.k if self.k is not None else -2000))
+        o = math.floor(math.ldexp(lo,-k))
+        if self.k is None:
+            self.__alloc()
+            self.k, self.o = k, o
+        self.lo, self.hi = lo, hi
+        if ( k, o ) != ( self.k, self.o ):
+            self.__remap(k,o)
+
+    def add_data(self,a,w=None):
+        if self.dtype is None:
+            self.dtype = np.dtype(np.intp) if w is None else w.dtype
+            self.vdtype = a.dtype
+        a = np.asarray(a,dtype=float)
+        finite = np.isfinite(a)
+        if not finite.all():
+            a = a[finite]
+            w = w[finite] if w is not None else None
+        if not len(a):
+            return
+        self.__extend(float(a.min()),float(a.max()))
+        nb = _stats_finebins
+        idx = np.floor(np.ldexp(a,-self.k)).astype(np.int64) - self.o
+        new = self.n[idx] == 0
+        self.rep[idx[new]] = a[new]
+        self.multi[idx[a!=self.rep[idx]]] = True
+        self.n += np.bincount(idx,minlength=nb)
+        if w is not None:
+            self.w += np.bincount(idx,weights=w,minlength=nb)
+        self.sx += np.bincount(idx,weights=a,minlength=nb)
+
+    def merge(self,o):
+        """Add contents of another _StatsFineHist (which collected separate data)"""
+        if self.dtype is None:
+            self.dtype, self.vdtype = o.dtype, o.vdtype
+        if o.k is None:
+            return
+        import copy
+        o = copy.deepcopy(o)
+        self.__extend(o.lo,o.hi,o.k)
+        o.__extend(self.lo,self.hi,self.k)#same extent, so same bins
+        assert ( o.k, o.o ) == ( self.k, self.o )
+        both = ( self.n > 0 ) & ( o.n > 0 )
+        self.multi |= o.multi | ( both & ( self.rep != o.rep ) )
+        self.rep = np.where( self.n > 0, self.rep, o.rep )
+        self.w += o.w
+        self.n += o.n
+        self.sx += o.sx
+
+    def histogram(self,nbins,hrange):
+        """Rebin into nbins bins over hrange, returning (contents,bins) like
+        np.histogram"""
+        if self.k is None:
+            h,bins = np.histogram(np.zeros(0,dtype=self.vdtype),bins=nbins,range=hrange)
+            return h.astype(self.dtype or h.dtype), bins
+        m = self.n > 0
+        n = self.n[m]
+        x = np.where( self.multi[m], self.sx[m]/n, self.rep[m] )
+        x = x.astype(self.vdtype)#exact for single values, which came from vdtype
+        weighted = ( self.dtype.kind == 'f' )
+        h,bins = np.histogram(x, bins=nbins, range=hrange,
+                              weights=( self.w[m] if weighted else n ))
+        return h.astype(self.dtype), bins
+
+class _StatsPass:
+    """State of the pass through the particle data in collect_stats. Parts of
+    the data can be processed separately (e.g. in different threads), and the
+    results merged afterwards."""
+
+    def __init__(self,std_stats,freq_stats,bin_data):
+        self.collected_stats = dict((s,_StatCollector()) for s in std_stats)
+        self.freq_uc = dict((s,(np.asarray([],dtype=int),np.asarray([],dtype=float))) for s in freq_stats)
+        self.disabled = []#freq stats with too many unique values
+        self.sumw = 0.0
+        #Copies of the data in each block, for histogramming at the end (None
+        #if there is too much data, in which case finehists are used instead):
+        self.samples = [] if ( bin_data and std_stats ) else None
+        self.nsampled = 0
+        self.finehists = None
+
+    def add_block(self,pb):
+        vals_weight = pb.weight
+        for s,sc in self.collected_stats.items():
+            vals = getattr(pb,s) if s!='weight' else vals_weight
+            sc.add_data(vals,None if s=='weight' else vals_weight)
+        for s,uc in self.freq_uc.items():
+            self.freq_uc[s] = _merge_unique_count(uc,_unique_count(getattr(pb,s),vals_weight))
+        self.__check_freq()
+        self.sumw += vals_weight.sum()
+        if self.samples is not None:
+            self.nsampled += len(pb)
+            #(copies needed since block arrays might be reused)
+            self.samples.append( ( np.array(vals_weight),
+                                   dict( (s,np.array(getattr(pb,s)))
+                                         for s in self.collected_stats
+                                         if s!='weight' ) ) )
+            if self.nsampled > _stats_sample_max:
+                self.__samples_to_finehists()
+        elif self.finehists is not None:
+            self.__fill_finehists(lambda s : getattr(pb,s),vals_weight)
+
+    def __fill_finehists(self,get_vals,vals_weight):
+        for s,fh in self.finehists.items():
+            if s=='weight':
+                fh.add_data(vals_weight)
+            else:
+                fh.add_data(get_vals(s),vals_weight)
+
+    def __samples_to_finehists(self):
+        self.finehists = dict( (s,_StatsFineHist()) for s in self.collected_stats )
+        for vals_weight,vals in self.samples:
+            self.__fill_finehists(vals.get,vals_weight)
+        self.samples = None
+
+    def merge(self,o):
+        for s,sc in self.collected_stats.items():
+            sc.merge(o.collected_stats[s])
+        for s in o.disabled:
+            if s not in self.disabled:
+                self.disabled.append(s)
+                del self.freq_uc[s]
+        for s,uc in self.freq_uc.items():
+            self.freq_uc[s] = _merge_unique_count(uc,o.freq_uc[s])
+        self.__check_freq()
+        self.sumw += o.sumw
+        self.nsampled += o.nsampled
+        if self.samples is not None and o.samples is not None:
+            self.samples += o.samples
+            if self.nsampled > _stats_sample_max:
+                self.__samples_to_finehists()
+        elif self.samples is not None or o.samples is not None:
+            if self.samples is not None:
+                self.__samples_to_finehists()
+            if o.samples is not None:
+                o.__samples_to_finehists()
+        if o.finehists is not None:
+            for s,fh in self.finehists.items():
+                fh.merge(o.finehists[s])
+
+    def __check_freq(self):
+        for s in sorted(self.freq_uc):
+            if len(self.freq_uc[s][0])>10000:
+                self.disabled.append(s)
+                del self.freq_uc[s]
+
+def _stats_pass_part(std_stats,freq_stats,bin_data,blocks):
+    sp = _StatsPass(std_stats,freq_stats,bin_data)
+    for pb in blocks:
+        sp.add_block(pb)
+    return sp
+
+_possible_std_stats = ['ekin','x','y','z','ux','uy','uz','time','weight','polx','poly','polz']
+_possible_freq_stats = ['pdgcode','userflags']
+
+def collect_stats(mcplfile,stats='all',bin_data=True,workers=None):
+    """Efficiently collect statistics from an entire file (or part of file, if limit
+    or skip parameters are set). Returns dictionary with stat names as key and
+    the collected statistics as values. The mcplfile argument can also be an
+    MCPLDataset, in which case the files are processed by the indicated number
+    of worker threads (default is os.cpu_count()) and the results merged.
+
+    The data is read just once. For more than 250000 particles, histograms are
+    therefore approximate: A particle might be counted in a bin next to the
+    right one, but only if its value is within 2*(max-min)/65534 of the edge
+    between the bins (where min and max are the extreme values of the field).
+    All other statistics are exact."""
+
+    #Normal stats (will be used weighted, except for stats about the weight field itself):
+    possible_std_stats = set(_possible_std_stats)
+    #Stats for which distributions are less likely to be relevant, so unique
+    #values and their frequency will be returned instead:
+    possible_freq_stats = set(_possible_freq_stats)
+
+    if stats=='all':
+        stats = possible_std_stats.union(possible_freq_stats)
+
+    if not isinstance(stats,set):
+        stats = set(stats)
+
+    if not isinstance(mcplfile,MCPLFile) and not isinstance(mcplfile,MCPLDataset):
+        mcplfile = MCPLFile(mcplfile)
+    if mcplfile.nparticles==0:
+        print("MCPL WARNING: Can not calculate stats on an empty file")
+        return {}
+
+    unknown = stats.difference(possible_std_stats.union(possible_freq_stats))
+    if unknown:
+        raise MCPLError('Unknown stat names requested: "%s"'%('","'.join(unknown)))
+
+    #Some stats might be constant for all particles in the file:
+    constant_stats_available = set()
+    if mcplfile.opt_universalpdgcode:
+        constant_stats_available.add('pdgcode')
+    if not mcplfile.opt_userflags:
+        constant_stats_available.add('userflags')
+    if mcplfile.opt_universalweight:
+        constant_stats_available.add('weight')
+    if not mcplfile.opt_polarisation:
+        constant_stats_available |= set(['polx','poly','polz'])
+    cnst_stats = constant_stats_available.intersection(stats)
+    stats = stats.difference(cnst_stats)
+
+    std_stats = sorted(list(stats.difference(constant_stats_available).intersection(possible_std_stats)))
+    freq_stats = sorted(list(stats.difference(constant_stats_available).intersection(possible_freq_stats)))
+
+    if not std_stats and not freq_stats and not cnst_stats:
+        raise MCPLError('No stats requested')
+
+    weight_sum = mcplfile.nparticles * mcplfile.opt_universalweight if mcplfile.opt_universalweight else None
+
+    nbins = 100 if mcplfile.nparticles < 1000 else 200
+
+    if nbins%2==0:
+        nbins += 1#ensure nbins is odd (makes some stuff below easier)
+
+    #Single pass through the data. Histogram ranges depend on the final
+    #statistics, so histograms are filled afterwards from copies of the data
+    #(or rebinned from fine histograms for large files):
+    sp = _StatsPass(std_stats,freq_stats,bin_data)
+    if std_stats or freq_stats or weight_sum is None:
+        if isinstance(mcplfile,MCPLDataset):
+            import functools
+            parts = mcplfile._map_parts(functools.partial(_stats_pass_part,std_stats,
+                                                          freq_stats,bin_data),workers)
+            for part in parts:
+                sp.merge(part)
+        else:
+            for pb in mcplfile.particle_blocks:
+                sp.add_block(pb)
+        for s in sp.disabled:
+            print("MCPL WARNING: Too many unique values in %s field. Disabling %s statistics"%(s,s))
+        if weight_sum is None:
+            weight_sum = sp.sumw
+    collected_stats, freq_uc = sp.collected_stats, sp.freq_uc
+
+    hists={}
+    if bin_data and std_stats:
+        ranges={}
+        for s,sc in collected_stats.items():
+            ranges[s] = [max(sc['min'],sc['mean']-2*sc['rms']),
+                         min(sc['max'],sc['mean']+2*sc['rms'])]
+            if not ranges[s][0]<ranges[s][1]:
+                ranges[s] = (ranges[s][0]-1.0,ranges[s][1]+1.0)
+        if sp.samples is not None:
+            for vals_weight,vals in sp.samples:
+                _stats_hist_add(hists,std_stats,ranges,nbins,vals.get,vals_weight)
+        else:
+            for s,fh in sp.finehists.items():
+                hists[s] = list(fh.histogram(nbins,ranges[s]))
+
+    assert weight_sum is not None
+
+    if cnst_stats:
+        if 'pdgcode' in cnst_stats:
+            assert mcplfile.opt_universalpdgcode
+            cnst_stats.remove('pdgcode')
+            freq_uc['pdgcode'] = (np.asarray([mcplfile.opt_universalpdgcode]),np.asarray([weight_sum]))
+        if 'userflags' in cnst_stats:
+            assert not mcplfile.opt_userflags
+            cnst_stats.remove('userflags')
+            freq_uc['userflags'] = (np.asarray([0]),np.asarray([weight_sum]))
+        if 'weight' in cnst_stats:
+            uw=mcplfile.opt_universalweight
+            assert uw
+            cnst_stats.remove('weight')
+            sc=_StatCollector()
+            sc.add_data(np.asarray([uw],float),np.asarray([mcplfile.nparticles],float))
+            collected_stats['weight']=sc
+            if bin_data:
+                bins = np.linspace(0.0,2.0*uw,nbins+1)
+                h = np.zeros(nbins)
+                assert nbins % 2 != 0#nbins is odd, value falls at bin center below:
+                h[nbins//2] = uw * mcplfile.nparticles#unweighted!
+                hists['weight'] = [ h, bins ]
+        for spol in ('polx','poly','polz'):
+            if spol in cnst_stats:
+                cnst_stats.remove(spol)
+                sc=_StatCollector()
+                sc.add_data(np.asarray([0.0],float),np.asarray([weight_sum],float))
+                collected_stats[spol] = sc
+                if bin_data:
+                    bins = np.linspace(-1.0,1.0,nbins+1)
+                    h = np.zeros(nbins)
+                    assert nbins % 2 != 0#nbins is odd, value 0.0 falls at bin center:
+                    h[nbins//2] = weight_sum
+                    hists[spol] = [ h, bins ]
+
+    for s in list(k for k in freq_uc.keys()):
+        #sort by frequency:
+        u,c=freq_uc[s]
+        sortidx=np.argsort(u,kind='mergesort')#the indices that would sort u
+        u,c=u[sortidx],c[sortidx]
+        sortidx=np.argsort(c,kind='mergesort')[::-1]#the indices that would sort c, viewed in reverse order
+        freq_uc[s] = u[sortidx],c[sortidx]
+
+    results = { 'file':{'type':'fileinfo','integral':weight_sum,'nparticles':mcplfile.nparticles} }
+    for s,uc in freq_uc.items():
+        results[s] = { 'unique_values': uc[0], 'unique_values_counts' : uc[1], 'weighted' : True, 'type':'freq' }
+
+    units=dict(ekin='MeV',x='cm',y='cm',z='cm',time='ms')
+
+    for s,sc in collected_stats.items():
+        d=sc.as_dict()
+        d.update({'summary':sc.summarise(),
+                  'name':s,
+                  'unit':units.get(s,None),
+                  'weighted': s!='weight',
+                  'type' : 'hist'})
+        if bin_data:
+            h,bins = hists[s]
+            d.update({'hist_bins' : bins,
+                      'hist' : h})
+        results[s] = d
+
+    return results
+
+_freq_alt_descr =  {'pdgcode': _pdg_database,
+                    'userflags':lambda x : '0x%08x'%x}
+
+def dump_stats(stats):
+    """Format and print provided statistics object to stdout. The stats object is
+    assumed to have been created by a call to collect_stats()"""
+
+    if not isinstance(stats,dict):
+        stats = collect_stats(stats,bin_data=False)
+    print('------------------------------------------------------------------------------')
+    print('nparticles   : %i'%stats['file']['nparticles'])
+    print('sum(weights) : %g'%stats['file']['integral'])
+    if set(stats).intersection(_possible_std_stats):
+        print('------------------------------------------------------------------------------')
+        print('             :            mean             rms             min             max')
+        print('------------------------------------------------------------------------------')
+
+    for statname in _possible_std_stats:
+        if statname not in stats:
+            continue
+        s=stats[statname]
+        assert s['type']=='hist'
+        su = '%s %s'%(statname.ljust(6),('[%s]'%s['unit']).rjust(5)) if s['unit'] else statname
+        print('%s : %15g %15.5g %15g %15g'%(su.ljust(12),s['mean'],s['rms'],s['min'],s['max']))
+    for statname in _possible_freq_stats:
+        if statname not in stats:
+            continue
+        print('------------------------------------------------------------------------------')
+        s=stats[statname]
+        assert s['type']=='freq'
+        fct_alt_descr = _freq_alt_descr.get(statname,lambda x: '')
+        #fmt_fct = freq_formats_fcts[statname]
+        uv,uvc=s['unique_values'],s['unique_values_counts'].copy()
+        percents=uvc*(100.0/uvc.sum())
+        showmax=50
+        print ('%s : '%(statname.ljust(12)),end='')
+        for i,(u,p,c) in enumerate(zip(uv,percents,uvc)):
+            txt='%i'%u
+            if i+1==showmax:
+                txt='other'
+                alttxt=''
+                p=percents[i:].sum()
+                c=uvc[i:].sum()
+            else:
+                alttxt=fct_alt_descr(u)
+            print('%s %s %12g (%5.2f%%)'%(txt.rjust(26 if i else 11),
+                                       ('(%s)'%alttxt if alttxt else '').ljust(12),
+                                       c,p))
+            if i+1==showmax:
+                break
+        print ('                     [ values ]             [ weighted counts ]')
+    print('------------------------------------------------------------------------------')
+
+def plot_stats(stats,pdf=False,set_backend=None):
+    """Produce plots of provided statistics object with matplotlib. The pdf
+    parameter can be set to a filename and if so, the plots will be produced in
+    that newly created PDF file, rather than being shown interactively. The
+    set_backend parameter can be used to select a matplotlib backend. The stats
+    object is assumed to have been created by a call to collect_stats()."""
+
+    if pdf is True:
+        raise MCPLError('If set, the pdf parameter should be a string'
+                        +' containing the desired filename of the PDF file to be created')
+
+    if pdf and os.path.exists(pdf):
+        raise MCPLError('PDF file %s already exists'%(pdf))
+
+    try:
+        import matplotlib
+    except ImportError:
+        print()
+        print("ERROR: For plotting, this MCPL python module requires matplotlib (matplotlib.org) to be")
+        print("ERROR: installed. You can perhaps install it using using your software manager and searching")
+        print("ERROR: for \"matplotlib\" or \"python-matplotlib\", or it might come bundled with software")
+        print("ERROR: such as scientific python or anaconda, depending on your platform. Alternatively, if")
+        print("ERROR: you are using the pip package manager, you might be able to install it with the")
+        print("ERROR: command \"pip install matplotlib\".")
+        print()
+        raise
+
+    if set_backend:
+        matplotlib.use(set_backend)
+
+    if pdf:
+        try:
+            from matplotlib.backends.backend_pdf import PdfPages
+        except ImportError:
+            print()
+            print("ERROR: matplotlib installation does not have required support for PDF output.")
+            print()
+            raise
+        pdf_file = pdf # noqa F841 (not really sure if this variable was needed
+                       # for object lifetime reasons).
+        pdf = PdfPages(pdf)
+
+    try:
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print()
+        print("ERROR: importing matplotlib succeeded, but importing matplotlib.pyplot failed.")
+        print("ERROR: This is rather unusual, an is perhaps related to issues with your chosen")
+        print("ERROR: matplotlib backend, which you might have set globally in a matplotlib")
+        print("ERROR: configuration file.")
+        print()
+        raise
+
+    if not isinstance(stats,dict):
+        stats = collect_stats(stats,bin_data=True)
+
+    showmax=10
+    for s in _possible_freq_stats:
+        if s not in stats:
+            continue
+        freq=stats[s]
+        u,c=freq['unique_values'],freq['unique_values_counts']
+        fct_alt_descr = _freq_alt_descr.get(s,lambda x: None)
+        def fmt_fct_raw(x):
+            alttxt = fct_alt_descr(x)
+            return '%s\n(%s)'%(str(x),alttxt) if alttxt is not None else str(x)
+        #fmt_fct_raw = freq_formats_fcts[s]
+        def fmt_fct( i, x ):
+            return fmt_fct_raw(x)
+        if len(c)>showmax:
+            sum_other = c[showmax-1:].sum()
+            u,c = u[0:showmax].copy(), c[0:showmax].copy()
+            c[showmax-1] = sum_other
+            def fmt_fct( i, x ):
+                return 'other' if i==showmax-1 else fmt_fct_raw(x)
+        percents = c.astype(float)*100.0/sum(c)
+        labels = ['%s\n%.2f%%'%(fmt_fct(i,e),percents[i]) for i,e in enumerate(u)]
+        barcenters=list(range(len(c)))
+        plt.bar(barcenters, c, width=0.7,align='center',linewidth=0)
+        ax=plt.gca()
+        ax.set_xticks(barcenters)
+        percents=c.astype(float)*100.0/sum(c)
+        ax.set_xticklabels(labels,fontsize='small')
+        ax.yaxis.grid(True,color='white',linestyle='-')
+        ax.set_xlim(-0.5,len(c)-0.5)
+        plt.title(s)
+        plt.subplots_adjust(left=0.1, right=0.94, top=0.93, bottom=0.13)
+        if pdf:
+            pdf.savefig(plt.gcf())
+            plt.close()
+        else:
+            plt.show()
+
+    for s in _possible_std_stats:
+        if s not in stats:
+            continue
+        h=stats[s]
+        hist,bins = h['hist'],h['hist_bins']
+        plt.bar(0.5*(bins[:-1] + bins[1:]), hist, align='center', width=(bins[1] - bins[0]),linewidth=0)
+        plt.grid()
+        plt.title('%s%s (%s)'%(s,
+                               ' [%s]'%h['unit'] if h['unit'] is not None else '',
+                               'weighted' if h['weighted'] else 'unweighted'))
+        plt.xlabel(h['summary'],fontsize='small')
+        plt.xlim(bins[0],bins[-1])
+        plt.subplots_adjust(left=0.1, right=0.94, top=0.93, bottom=0.13)
+        if pdf:
+            pdf.savefig(plt.gcf())
+            plt.close()
+        else:
+            plt.show()
+
+    if pdf:
+        if hasattr(pdf,'infodict'):
+            d = pdf.infodict()
+            d['Title'] = ( 'Plots made with mcpl.py version %s'
+                           % _determine_version() )
+            d['Author'] = 'mcpl.py v%s' % _determine_version()
+            d['Subject'] = 'mcpl plots'
+            d['Keywords'] = 'mcpl'
+        pdf.close()
@@ -0,0 +1,327 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+#Writing of MCPL files from numpy arrays (MCPLWriter).
+
+import sys
+import os
+import math
+from .mcpl import ( MCPLError, np, _particle_dtype, encode_stat_sum,
+                    _parse_statsum_comment )
+
+class MCPLWriter:
+    """Python-only class for writing MCPL files from numpy arrays. The files
+    written are identical to those written by particle-by-particle calls to
+    mcpl_add_particle in the C API. Header information must be provided before
+    the first particles are added, with the exception of stat:sum: values for
+    keys which were already added (possibly with a value of -1). Example:
+
+      with MCPLWriter('out.mcpl') as w:
+          w.set_srcname('MyGenerator')
+          w.add_stat_sum('nsource',-1)
+          w.add_particles(pdgcode=2112,ekin=ekin,x=x,y=y,z=z,
+                          ux=ux,uy=uy,uz=uz,weight=w)
+          w.add_stat_sum('nsource',1e6)
+    """
+
+    def __init__(self,filename):
+        """Create new MCPL file with the given name (".mcpl" is appended if not
+        already present)."""
+        if hasattr(filename,'__fspath__'):
+            filename = os.fspath(filename)
+        if isinstance(filename,bytes):
+            filename = os.fsdecode(filename)
+        if not isinstance(filename,str) or not filename or filename=='.mcpl':
+            raise MCPLError('Invalid filename for MCPL output file')
+        if not filename.endswith('.mcpl'):
+            filename += '.mcpl'
+        self._filename = filename
+        self._srcname = b'unknown'
+        self._comments = []
+        self._blobs = {}
+        self._userflags = False
+        self._polarisation = False
+        self._singleprec = True
+        self._universalpdgcode = 0
+        self._universalweight = 0.0
+        self._statsumpos = None#positions in file, when header is written
+        self._np = 0
+        self._fh = open(filename,'wb')
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, ttype, value, traceback):
+        if self._fh is not None:
+            self.close()
+
+    def __del__(self):
+        if getattr(self,'_fh',None) is not None:
+            self.close()
+
+    @property
+    def filename(self):
+        """Name of file being written"""
+        return self._filename
+
+    @property
+    def nparticles(self):
+        """Number of particles added so far"""
+        return self._np
+
+    def _check_hdr_open(self,fctname):
+        if self._fh is None:
+            raise MCPLError('%s called after file was closed.'%fctname)
+        if self._statsumpos is not None:
+            raise MCPLError('%s called too late.'%fctname)
+
+    @staticmethod
+    def _to_bytes(s):
+        return s if isinstance(s,bytes) else str(s).encode('utf-8')
+
+    def set_srcname(self,srcname):
+        """Name of the generating application"""
+        self._check_hdr_open('set_srcname')
+        self._srcname = self._to_bytes(srcname)
+
+    def add_comment(self,comment):
+        """Add human-readable comment (or "stat:sum:..." entry) to the header"""
+        self._check_hdr_open('add_comment')
+        comment = self._to_bytes(comment)
+        if comment.startswith(b'stat:sum:'):
+            ok, (key,_) = _parse_statsum_comment(comment)
+            if not ok:
+                raise MCPLError('Syntax error: could not properly decode comment'
+                                ' starting with "stat:sum:"')
+            if key in self._statsum_keys():
+                raise MCPLError('Duplicate stat:sum: key "%s"'%key)
+        elif comment.startswith(b'stat:'):
+            raise MCPLError('Refusing to create file with comments starting with'
+                            ' "stat:" unless starting with "stat:sum:", as such'
+                            ' syntax is reserved for future usage.')
+        self._comments.append(comment)
+
+    def add_data(self,key,data):
+        """Add binary data blob to the header"""
+        self._check_hdr_open('add_data')
+        key = self._to_bytes(key)
+        if key in self._blobs:
+            raise MCPLError('add_data got duplicate key')
+        self._blobs[key] = bytes(data)
+
+    def _statsum_keys(self):
+        return [ _parse_statsum_comment(c)[1][0]
+                 for c in self._comments if c.startswith(b'stat:sum:') ]
+
+    def add_stat_sum(self,key,value):
+        """Add or update "stat:sum:" entry. After particles were added, only
+        values of already added keys can be updated. A value of None or -1
+        indicates that the value is not (yet) available."""
+        if self._fh is None:
+            raise MCPLError('add_stat_sum called after file was closed.')
+        comment = encode_stat_sum(key,value).encode('ascii')
+        if hasattr(key,'decode'):
+            key = key.decode('ascii')
+        if self._statsumpos is None:
+            for i,c in enumerate(self._comments):
+                if c.startswith(b'stat:sum:') and _parse_statsum_comment(c)[1][0]==key:
+                    self._comments[i] = comment
+                    return
+            self._comments.append(comment)
+            return
+        if key not in self._statsumpos:
+            raise MCPLError('add_stat_sum called after first particle was added to'
+                            ' file, but without first registering a value for the'
+                            ' same key earlier (the special value -1 can be used'
+                            ' for this)')
+        pos = self._fh.tell()
+        self._fh.seek(self._statsumpos[key])
+        self._fh.write(comment)
+        self._fh.seek(pos)
+
+    def enable_userflags(self):
+        """Store the userflags field"""
+        if not self._userflags:
+            self._check_hdr_open('enable_userflags')
+            self._userflags = True
+
+    def enable_polarisation(self):
+        """Store the polarisation vector"""
+        if not self._polarisation:
+            self._check_hdr_open('enable_polarisation')
+            self._polarisation = True
+
+    def enable_doubleprec(self):
+        """Use double precision floating point numbers in storage"""
+        if self._singleprec:
+            self._check_hdr_open('enable_doubleprec')
+            self._singleprec = False
+
+    def enable_universal_pdgcode(self,pdgcode):
+        """All particles have the same pdgcode (which is then not stored per particle)"""
+        pdgcode = int(pdgcode)
+        if pdgcode==0:
+            raise MCPLError('enable_universal_pdgcode must be called with non-zero pdgcode.')
+        if self._universalpdgcode:
+            if self._universalpdgcode!=pdgcode:
+                raise MCPLError('enable_universal_pdgcode called multiple times')
+            return
+        self._check_hdr_open('enable_universal_pdgcode')
+        self._universalpdgcode = pdgcode
+
+    def enable_universal_weight(self,weight):
+        """All particles have the same weight (which is then not stored per particle)"""
+        weight = float(weight)
+        if not ( weight>0.0 and not math.isinf(weight) ):
+            raise MCPLError('enable_universal_weight must be called with positive but finite weight.')
+        if self._universalweight:
+            if self._universalweight!=weight:
+                raise MCPLError('enable_universal_weight called multiple times')
+            return
+        self._check_hdr_open('enable_universal_weight')
+        self._universalweight = weight
+
+    def _write_header(self):
+        import struct
+        dt = _particle_dtype(self._singleprec,self._polarisation,self._universalweight,
+                             self._universalpdgcode,self._userflags,'=')
+        e = '<' if sys.byteorder=='little' else '>'
+        fh = self._fh
+        fh.write(b'MCPL003'+(b'L' if e=='<' else b'B'))
+        fh.write(struct.pack(e+'Q8I',0,len(self._comments),len(self._blobs),
+                             int(self._userflags),int(self._polarisation),
+                             int(self._singleprec),self._universalpdgcode&0xffffffff,
+                             dt.itemsize,1 if self._universalweight else 0))
+        if self._universalweight:
+            fh.write(struct.pack(e+'d',self._universalweight))
+        def write_buffer(b):
+            fh.write(struct.pack(e+'I',len(b)))
+            fh.write(b)
+        write_buffer(self._srcname)
+        self._statsumpos = {}
+        for c in self._comments:
+            if c.startswith(b'stat:sum:'):
+                self._statsumpos[_parse_statsum_comment(c)[1][0]] = fh.tell() + 4
+            write_buffer(c)
+        for k in self._blobs:
+            write_buffer(k)
+        for v in self._blobs.values():
+            write_buffer(v)
+        self._pdt = dt
+
+    def add_particles(self,**columns):
+        """Add particles, with the values of each field provided as arrays (of
+        the same length) or scalars, using the keyword arguments x, y, z, ux,
+        uy, uz, ekin, time, weight, pdgcode, polx, poly, polz and userflags.
+        Alternatively, (N,3) arrays can be provided via position, direction
+        or polarisation. The directions and ekin must always be provided,
+        while other fields default to 0 (or 1 for the weight)."""
+        if self._fh is None:
+            raise MCPLError('add_particles called after file was closed.')
+        for name,comps in (('position',('x','y','z')),('direction',('ux','uy','uz')),
+                           ('polarisation',('polx','poly','polz'))):
+            if name in columns:
+                v = np.asarray(columns.pop(name),dtype=float)
+                if v.ndim<1 or v.shape[-1]!=3:
+                    raise MCPLError('%s must have shape (N,3)'%name)
+                for i,c in enumerate(comps):
+                    if c in columns:
+                        raise MCPLError('both %s and %s provided'%(name,c))
+                    columns[c] = v[...,i]
+        known = ('x','y','z','ux','uy','uz','ekin','time','weight','pdgcode',
+                 'polx','poly','polz','userflags')
+        for k in columns:
+            if k not in known:
+                raise MCPLError('Unknown particle field: %s'%k)
+        for k in ('ux','uy','uz','ekin'):
+            if k not in columns:
+                raise MCPLError('add_particles needs values for %s'%k)
+        n = max([np.size(v) for v in columns.values()])
+        def col(k,dtype=float,default=0):
+            v = np.asarray(columns.get(k,default),dtype=dtype)
+            if v.ndim==0:
+                return np.full(n,v,dtype=dtype)
+            if v.shape!=(n,):
+                raise MCPLError('Inconsistent array lengths in add_particles')
+            return v
+        ux,uy,uz,ekin = col('ux'),col('uy'),col('uz'),col('ekin')
+        if not n:
+            return
+
+        #Sanity checks as in mcpl_add_particle:
+        if np.any(np.abs(ux*ux+uy*uy+uz*uz-1.0)>1.0e-5):
+            raise MCPLError('attempting to add particle with non-unit direction vector')
+        if np.any(ekin<0.0):
+            raise MCPLError('attempting to add particle with negative kinetic energy')
+
+        if self._statsumpos is None:
+            self._write_header()
+
+        #Pack direction and ekin ("Adaptive Projection Packing", see
+        #mcpl_unitvect_pack_adaptproj in mcpl.c):
+        absx,absy = np.abs(ux),np.abs(uy)
+        proj = np.abs(uz) < np.maximum(absx,absy)
+        with np.errstate(divide='ignore'):
+            invz = 1.0 / uz
+        invz[uz==0.0] = np.inf
+        xbig = absx >= absy
+        data = np.empty(n,dtype=self._pdt)
+        data['uve1'] = np.where(proj & xbig, invz, ux)
+        data['uve2'] = np.where(proj & ~xbig, invz, uy)
+        data['uve3'] = np.copysign(ekin,np.where(proj,np.where(xbig,ux,uy),uz))
+        for k,f in (('x','x'),('y','y'),('z','z'),('time','t')):
+            data[f] = col(k)
+        if self._polarisation:
+            for k in ('polx','poly','polz'):
+                data[k] = col(k)
+        if not self._universalweight:
+            data['w'] = col('weight',default=1.0)
+        if not self._universalpdgcode:
+            data['pdg'] = col('pdgcode',dtype=np.int32)
+        if self._userflags:
+            data['uf'] = col('userflags',dtype=np.uint32)
+        self._fh.write(data.tobytes())
+        self._np += n
+
+    def close(self):
+        """Finish writing the file"""
+        if self._fh is None:
+            return
+        if self._statsumpos is None:
+            self._write_header()
+        if self._np:
+            import struct
+            self._fh.seek(8)
+            self._fh.write(struct.pack('=Q',self._np))
+        self._fh.close()
+        self._fh = None
+
+    def closeandgzip(self):
+        """Finish writing the file, and compress it (replacing the file with a
+        .mcpl.gz file). Returns the name of the resulting file."""
+        import gzip
+        import shutil
+        self.close()
+        with open(self._filename,'rb') as fin:
+            with gzip.open(self._filename+'.gz','wb') as fout:
+                shutil.copyfileobj(fin,fout)
+        os.remove(self._filename)
+        return self._filename+'.gz'
@@ -55,6 +55,8 @@ __author__ = 'Thomas Kittelmann'
 __maintainer__ = 'Thomas Kittelmann'
 __email__ = 'thomas.kittelmann@ess.eu'
 __all__ = ['MCPLFile',
+           'MCPLWriter',
+           'MCPLDataset',
            'MCPLParticle',
            'MCPLParticleBlock',
            'MCPLError',
@@ -284,6 +286,7 @@ class MCPLParticleBlock:
         self._view_pol = None
         self._view_dir = None
         self._pos_cache,self._pol_cache = None,None#extra ndarrays for numpy 1.14 issue
+        self._decoded = False#data already unpacked by libmcpl (native mode)
 
     def _set_data(self,data,file_offset):
         #always present, but must unpack:
@@ -456,13 +459,19 @@ class MCPLParticleBlock:
     @property
     def ekin(self):
         if self._ekin is None:
-           self._ekin = abs(self._data['uve3']).astype(float)
+            if self._decoded:
+                self._ekin = self._data['ekin']
+            else:
+                self._ekin = abs(self._data['uve3']).astype(float)
         return self._ekin
 
     def _unpack(self):
         #On demand unpacking of unit vector. We have to make a version of
         #mcpl.c's mcpl_unitvect_unpack_adaptproj which can be efficiently
         #delegated to the compiled numpy library:
+        if self._decoded:
+            self._ux,self._uy,self._uz = self._data['ux'],self._data['uy'],self._data['uz']
+            return
         if self._fmtversion==2:
             return self._unpack_legacy()#old packing scheme
         in0 = self._data['uve1'].astype(float)
@@ -505,26 +514,70 @@ class MCPLParticleBlock:
         self._uz *= n
         self._uz = np.where(np.signbit(self._data['uve3']),0.0,self._uz)
 
+def _particle_dtype(singleprec,polarisation,universalweight,universalpdgcode,
+                    userflags,endianness):
+    #dtype of a single particle as stored in files:
+    fp = 'f4' if singleprec else 'f8'
+    fields = []
+    if polarisation:
+        fields += [('polx',fp),('poly',fp),('polz',fp)]
+    fields += [('x',fp),('y',fp),('z',fp),
+               ('uve1',fp),('uve2',fp),('uve3',fp),#packed unit vector and ekin
+               ('t',fp)]
+    if not universalweight:
+        fields += [('w',fp)]
+    if not universalpdgcode:
+        fields += [('pdg','i4')]
+    if userflags:
+        fields += [('uf','u4')]
+    fields = [(str(f[0]),str(f[1])) for f in fields]#workaround for https://github.com/numpy/numpy/issues/2407
+    return np_dtype(fields).newbyteorder(endianness)
+
 class MCPLFile:
     """Python-only class for reading MCPL files, using numpy and internal caches to
-    ensure good efficiency. File access is read-only, and the particles can only
-    be read in consecutive and forward order, providing either single particles or
-    blocks of particles as requested."""
+    ensure good efficiency. File access is read-only, and the particles are read
+    in consecutive order, providing either single particles or blocks of
+    particles as requested. Arbitrary positions in the file can be accessed with
+    seek() and read_indices(). Uncompressed files can also be opened in memmap
+    mode, which additionally allows access to arbitrary ranges of particles
+    without reading them into memory first."""
+
+    blockcachesize = 8#max number of blocks cached for seek() and read_indices()
 
     def __del__(self):
         self._fileclose()
         self._fileclose = lambda : None
 
-    def __init__(self,filename,blocklength = 10000, raw_strings = False):
+    def __init__(self,filename,blocklength = 10000, raw_strings = False, memmap = False,
+                 native = False, prefetch = False):
         """Open indicated mcpl file, which can either be uncompressed (.mcpl) or
         compressed (.mcpl.gz). The blocklength parameter can be used to control
         the number of particles read by each call to read_block(). The parameter
         raw_strings will prevent UTF-8 decoding of string data loaded from the
         file.
+
+        If memmap is True, the particle data of the (uncompressed) file is mapped
+        into memory with numpy.memmap rather than read block by block. Blocks
+        returned by read_block() are then views into the mapped data, and the
+        particle_data property and the view() method give access to any range
+        of particles without copying.
+
+        If native is True, particles are read and unpacked by the compiled MCPL
+        library (libmcpl) via ctypes, which is faster in particular for
+        compressed files. With native=None this is done only if the library is
+        available, falling back to the pure Python implementation otherwise.
+        Errors reported by libmcpl (e.g. for truncated files) are raised as
+        MCPLError exceptions.
+
+        If prefetch is True, compressed files are inflated in large chunks by a
+        background thread, overlapping with any processing of the particles
+        already read.
         """
 
         self._fileclose = lambda : None
+        self._prefetch = prefetch
         self._str_decode = (not raw_strings)
+        self._mmdata = None
 
         if hasattr(filename,'__fspath__'):
             #work with all pathlike objects:
@@ -535,10 +588,12 @@ class MCPLFile:
                                 ' (should be path-like, a string or similar)')
 
         #prepare file i/o (opens file):
+        self._filename = filename
         self._open_file(filename)
         #load info from mcpl header:
         self._loadhdr()
         #Check if empty files are actually broken (like in mcpl.c):
+        recovered = False
         if self.nparticles==0:
             if filename.endswith('.gz'):
                 #compressed - can only detect and raise error
@@ -553,6 +608,7 @@ class MCPLFile:
                 #not compressed - can use file size to recover file
                 np_rec = (int(os.stat(filename).st_size)-self.headersize) // self.particlesize
                 if np_rec:
+                    recovered = True
                     self._np = np_rec
                     self._hdr['nparticles'] = np_rec
                     print ("MCPL WARNING: Input file appears to not have been closed"
@@ -588,24 +644,36 @@ class MCPLFile:
                         del self._hdr['stat_sum']
 
         #prepare dtype for reading 1 particle:
-        fp = 'f4' if self.opt_singleprec else 'f8'
-        fields = []
-        if self.opt_polarisation:
-            fields += [('polx',fp),('poly',fp),('polz',fp)]
-        fields += [('x',fp),('y',fp),('z',fp),
-                   ('uve1',fp),('uve2',fp),('uve3',fp),#packed unit vector and ekin
-
-        ('t',fp)]
-        if not self.opt_universalweight:
-            fields += [('w',fp)]
-        if not self.opt_universalpdgcode:
-            fields += [('pdg','i4')]
-        if self.opt_userflags:
-            fields += [('uf','u4')]
-        fields = [(str(f[0]),str(f[1])) for f in fields]#workaround for https://github.com/numpy/numpy/issues/2407
-        self._pdt = np_dtype(fields).newbyteorder(self.endianness)
+        self._pdt = _particle_dtype(self.opt_singleprec,self.opt_polarisation,
+                                    self.opt_universalweight,self.opt_universalpdgcode,
+                                    self.opt_userflags,self.endianness)
+
+        if memmap:
+            if self._is_gz:
+                raise MCPLError('memmap mode is not available for compressed files')
+            if self.nparticles:
+                try:
+                    self._mmdata = np.memmap(filename,dtype=self._pdt,mode='r',
+                                             offset=self.headersize,shape=(self.nparticles,))
+                except ValueError:
+                    raise MCPLError('Errors encountered while attempting to map particle data.')
+            else:
+                self._mmdata = np.ndarray(dtype=self._pdt,shape=0)
+
+        self._nativeread = None
+        if native or ( native is None and not memmap ):
+            if memmap:
+                raise MCPLError('memmap and native modes can not be combined')
+            lib = _libmcpl()
+            if lib is None and native:
+                raise MCPLError('native mode requires the compiled MCPL library which was not found')
+            if lib is not None and not recovered:
+                #(recovered files are left to the Python code, to avoid duplicate warnings)
+                self._open_native(lib,filename)
 
         #Init position and caches (don't read first block yet):
+        import collections
+        self._blockcache = collections.OrderedDict()
         self._ipos = 0
         self._blocklength = int(blocklength)
         assert(self._blocklength>0)
@@ -614,6 +682,35 @@ class MCPLFile:
         #reuse same block object for whole file (to reuse fixed columns and internal caches)
         self._currentblock = MCPLParticleBlock(self.opt_polarisation,self.opt_userflags,
                                                self.opt_universalweight,self.opt_universalpdgcode,self.version)
+        self._currentblock._decoded = self.native
+
+    def _open_native(self,lib,filename):
+        #Header was already loaded and checked, so only need to switch reading
+        #of particles to libmcpl (which releases the GIL while reading):
+        self._fileclose()
+        call = _LibMCPLCaller()
+        _libmcpl_quiet.append(True)
+        try:
+            fh = call(lambda : lib.mcpl_open_file(os.fsencode(filename)))
+        except MCPLError:
+            call.stop()
+            raise
+        finally:
+            _libmcpl_quiet.pop()
+        def fileclose():
+            #(closing can not fail, so no need for the dedicated thread, which
+            #might no longer run if we are called during interpreter shutdown)
+            if call._error is None:
+                lib.mcpl_close_file(fh)
+            call.stop()
+        self._fileclose = fileclose
+        self._fileread = None
+        self._fileseek = lambda pos : call(lambda : lib.mcpl_seek(fh,(pos-self.headersize)//self.particlesize))
+        def nativeread(count):
+            x = np.empty(count,dtype=_native_pdt)
+            n = call(lambda : lib.mcpl_read_particles(fh,x.ctypes.data,count))
+            return x if n==count else x[0:n]
+        self._nativeread = nativeread
 
     @property
     def blocklength(self):
@@ -661,6 +758,14 @@ class MCPLFile:
             fh.seek(0)
 
         can_use_np_fromfile = not _numpy_oldfromfile
+        self._is_gz = is_gz
+        self._rawfh, self._prefetcher = fh, None
+        if is_gz and self._prefetch:
+            pf = self._prefetcher = _GzipPrefetcher(fh)
+            self._fileclose = lambda : ( pf.close(), fh.close() )
+            self._fileread = pf.read
+            self._fileseek = pf.seek
+            return
         if is_gz:
             can_use_np_fromfile = False
             fh = gzip.GzipFile(fileobj=fh)
@@ -696,6 +801,38 @@ class MCPLFile:
             self._fileread = fread_via_buffer
         self._fileseek = lambda pos : fh.seek(pos)
 
+    def _use_gzip_checkpoints(self):
+        #Switch reading of compressed files to _GzipCheckpoints, for efficient
+        #seeking in both directions. Since libmcpl can only seek backwards by
+        #inflating from the start of the file, this also ends native mode.
+        if ( not self._is_gz
+             or isinstance(getattr(self._fileread,'__self__',None),_GzipCheckpoints) ):
+            return
+        if self._prefetcher is not None:
+            self._prefetcher.close()
+            self._prefetcher = None
+        native_block = None
+        if self._nativeread is not None:
+            self._fileclose()
+            self._rawfh = open(self._filename,'rb')
+            self._nativeread = None
+            self._blockcache.clear()
+            self._currentblock._decoded = False
+            if len(self._currentblock):
+                native_block = self._currentblock.file_offset
+        fh = self._rawfh
+        gc = _GzipCheckpoints(fh)
+        self._fileclose = lambda : fh.close()
+        self._fileread = gc.read
+        self._fileseek = gc.seek
+        blocksize = self._blocklength*self.particlesize
+        if native_block is not None:
+            #reload current block in the format used without libmcpl:
+            gc.seek(self.headersize+(self._iblock-1)*blocksize)
+            x = gc.read(dtype=self._pdt,count=len(self._currentblock))
+            self._currentblock._set_data(x,native_block)
+        gc.seek(self.headersize+self._iblock*blocksize)
+
     #two methods needed for usage in with-statements:
 
     def __enter__(self):
@@ -718,7 +855,13 @@ class MCPLFile:
         to_read = self._blocklength
         if self._iblock+1==self._nblocks and self._np%self._blocklength:
             to_read = self.nparticles%self._blocklength#last block is shorter
-        x = self._fileread(dtype=self._pdt,count=to_read)
+        if self._mmdata is not None:
+            i0 = self._iblock*self._blocklength
+            x = self._mmdata[i0:i0+to_read]
+        elif self._nativeread is not None:
+            x = self._nativeread(to_read)
+        else:
+            x = self._fileread(dtype=self._pdt,count=to_read)
         if len(x)!=to_read:
             raise MCPLError('Errors encountered while attempting to read particle data.')
         self._currentblock._set_data(x,self._iblock*self._blocklength)
@@ -778,6 +921,146 @@ class MCPLFile:
             raise MCPLError('Unexpected failure to load particle block')
         return True
 
+    def seek(self,ipos):
+        """Move to position ipos in the file (counting from 0), in either direction,
+        so the next call to read() returns the particle at that position (returns
+        False when there is no particle at the new position, otherwise True). As
+        with skip_forward(), the block containing the position is loaded, and
+        read_block() continues with the following block.
+
+        Compressed files are inflated from the start the first time a position
+        is requested, but the state of the decompression is saved at regular
+        intervals, so later seeks only need to inflate the data following the
+        nearest of those checkpoints. Since libmcpl can only seek backwards in
+        compressed files by inflating from the start, native mode ends for
+        such files at the first call to seek() or read_indices()."""
+        ipos = int(ipos)
+        if ipos < 0:
+            raise MCPLError("Requested position is negative")
+        if self._currentblock.contains_ipos(ipos):
+            self._ipos = ipos
+            return True
+        if ipos >= self._np:
+            self._ipos = self._np
+            self._iblock = self._nblocks
+            self._currentblock._set_data(None,None)
+            return False#EOF
+        iblock = ipos // self._blocklength
+        if self._mmdata is not None:
+            self._seek_block(iblock)
+            self.read_block()
+        else:
+            self._use_gzip_checkpoints()
+            x = self._cached_block(iblock)
+            self._fileseek(self.headersize+(iblock+1)*self._blocklength*self.particlesize)
+            self._currentblock._set_data(x,iblock*self._blocklength)
+            self._iblock = iblock + 1
+        self._ipos = ipos
+        return True
+
+    def read_indices(self,indices):
+        """Read the particles at the given positions in the file, and return them as
+        a new block object, in which the i'th particle is the one at position
+        indices[i]. The indices can be in any order and can be repeated, which
+        for instance makes it efficient to draw bootstrap samples:
+
+          b = f.read_indices(np.random.randint(f.nparticles,size=f.nparticles))
+
+        The indices are sorted internally, so each block of particles needed is
+        read just once, and the most recently used blocks are kept in a small
+        cache (of blockcachesize blocks) for subsequent calls. Compressed files
+        are handled as described for seek(). The position used by read() and
+        read_block() is not affected. The file_offset of the returned block is
+        always 0."""
+        idx = np.asarray(indices).reshape(-1)
+        if not len(idx):
+            idx = idx.astype(np.int64)
+        if not np.issubdtype(idx.dtype,np.integer):
+            raise MCPLError("Particle indices must be integers")
+        if len(idx) and ( idx.min() < 0 or idx.max() >= self._np ):
+            raise MCPLError("Particle indices out of range")
+        if self._mmdata is not None:
+            data = self._mmdata[idx]
+        else:
+            self._use_gzip_checkpoints()
+            data = np.empty(len(idx),dtype=(_native_pdt if self.native else self._pdt))
+            bl = self._blocklength
+            order = np.argsort(idx,kind='stable')
+            sidx = idx[order]
+            iblocks = sidx // bl
+            #ranges of sorted indices in the same block:
+            bounds = (np.flatnonzero(np.diff(iblocks))+1).tolist()
+            bounds = [0] + bounds + [len(sidx)] if len(sidx) else []
+            moved = False
+            for i0,i1 in zip(bounds[:-1],bounds[1:]):
+                iblock = int(iblocks[i0])
+                moved = moved or iblock not in self._blockcache
+                x = self._cached_block(iblock)
+                data[order[i0:i1]] = x[sidx[i0:i1]-iblock*bl]
+            if moved:
+                #restore file position for read_block():
+                self._fileseek(self.headersize+self._iblock*bl*self.particlesize)
+        b = MCPLParticleBlock(self.opt_polarisation,self.opt_userflags,
+                              self.opt_universalweight,self.opt_universalpdgcode,self.version)
+        b._decoded = self.native
+        b._set_data(data,0)
+        return b
+
+    def _cached_block(self,iblock):
+        #Data of block (via a small LRU cache), moving the file position to the
+        #end of the block if it must be read:
+        x = self._blockcache.get(iblock)
+        if x is not None:
+            self._blockcache.move_to_end(iblock)
+            return x
+        self._fileseek(self.headersize+iblock*self._blocklength*self.particlesize)
+        n = min(self._blocklength,self._np-iblock*self._blocklength)
+        if self._nativeread is not None:
+            x = self._nativeread(n)
+        else:
+            x = self._fileread(dtype=self._pdt,count=n)
+        if len(x)!=n:
+            raise MCPLError('Errors encountered while attempting to read particle data.')
+        self._blockcache[iblock] = x
+        while len(self._blockcache) > self.blockcachesize:
+            self._blockcache.popitem(last=False)
+        return x
+
+    @property
+    def memmap(self):
+        """Whether the file was opened in memmap mode"""
+        return self._mmdata is not None
+
+    @property
+    def native(self):
+        """Whether particles are read via the compiled MCPL library"""
+        return self._nativeread is not None
+
+    @property
+    def particle_data(self):
+        """Raw particle data of the whole file as a numpy structured array
+        (memmap mode only). The fields are as stored in the file, with the unit
+        vector and kinetic energy still packed into uve1, uve2 and uve3. Use
+        view() for the unpacked quantities."""
+        if self._mmdata is None:
+            raise MCPLError('particle_data is only available in memmap mode')
+        return self._mmdata
+
+    def view(self,start=0,stop=None):
+        """Return a new block object for the particles at positions start to
+        stop-1 in the file (memmap mode only). Nothing is copied until a field
+        is requested, and fields like ux and ekin are only unpacked for the
+        particles in the range. Thus view().ekin gives the kinetic energies of
+        all particles in the file. Unlike blocks returned by read_block(), the
+        returned object remains valid when reading further."""
+        if self._mmdata is None:
+            raise MCPLError('view() is only available in memmap mode')
+        start,stop,_ = slice(start,stop).indices(self.nparticles)
+        b = MCPLParticleBlock(self.opt_polarisation,self.opt_userflags,
+                              self.opt_universalweight,self.opt_universalpdgcode,self.version)
+        b._set_data(self._mmdata[start:max(start,stop)],start)
+        return b
+
     @property
     def particles(self):
         """Use to iterate over all particles in file:
@@ -810,11 +1093,24 @@ class MCPLFile:
     def rewind(self):
         """Rewind file, causing next calls to read() and read_blocks() to start again at
         the beginning of the file."""
-        self._fileseek(self.headersize)
-        self._ipos = 0
-        self._iblock = 0
+        self._seek_block(0)
+
+    def _seek_block(self,iblock):
+        #Position file so the next call to read_block() reads the indicated block:
+        self._fileseek(self.headersize+iblock*self._blocklength*self.particlesize)
+        self._ipos = min(iblock*self._blocklength,self._np)
+        self._iblock = iblock
         self._currentblock._set_data(None,None)
 
+    def _blocks(self,iblock_begin,iblock_end,offset=0):
+        #Iterate over a range of blocks, with file_offset values shifted by
+        #offset (used by MCPLDataset to provide global particle positions):
+        self._seek_block(iblock_begin)
+        for _ in range(iblock_begin,min(iblock_end,self._nblocks)):
+            b = self.read_block()
+            b._offset += offset
+            yield b
+
     @property
     def version(self):
         """MCPL format version of the file"""
@@ -1339,481 +1635,6 @@ def app_pymcpltool(argv=None):
     dump_file(filelist[0],header=not opt_nohead,particles=not opt_justhead,limit=opt_limit,skip=opt_skip)
     sys.exit(0)
 
-_db_pdg = None
-_db_elem = None
-def _pdg_database(pdgcode):
-    global _db_pdg, _db_elem
-    if _db_pdg is None:
-        _db_pdg = { 12:'nu_e',14:'nu_mu',16:'nu_tau',-12:'nu_e-bar',-14:'nu_mu-bar',
-                    -16:'nu_tau-bar',2112:'n',2212:'p',-2112:'n-bar',-2212:'p-bar',
-                    22:'gamma',11:'e-',-11:'e+',13:'mu-',-13:'mu+',15:'tau-',-15:'tau+',
-                    211:'pi+',-211:'pi-',111:'pi0',321:'K+',-321:'K-',130:'Klong',
-                    310:'Kshort',-1000010020:'D-bar',-1000010030:'T-bar',1000010020:'D',
-                    1000010030:'T',1000020040:'alpha',-1000020040:'alpha-bar' }
-    r=_db_pdg.get(pdgcode,None)
-    if r is not None:
-        return r
-    if _db_elem is None:
-        _db_elem = ['H',  'He', 'Li', 'Be', 'B',  'C',  'N',  'O',  'F',  'Ne',
-                    'Na', 'Mg', 'Al', 'Si', 'P' , 'S',  'Cl', 'Ar', 'K',  'Ca', 'Sc',
-                    'Ti', 'V',  'Cr', 'Mn', 'Fe', 'Co', 'Ni', 'Cu', 'Zn', 'Ga', 'Ge',
-                    'As', 'Se', 'Br', 'Kr', 'Rb', 'Sr', 'Y',  'Zr', 'Nb', 'Mo', 'Tc',
-                    'Ru', 'Rh', 'Pd', 'Ag', 'Cd', 'In', 'Sn', 'Sb', 'Te', 'I',  'Xe',
-                    'Cs', 'Ba', 'La', 'Ce', 'Pr', 'Nd', 'Pm', 'Sm', 'Eu', 'Gd', 'Tb',
-                    'Dy', 'Ho', 'Er', 'Tm', 'Yb', 'Lu', 'Hf', 'Ta', 'W',  'Re', 'Os',
-                    'Ir', 'Pt', 'Au', 'Hg', 'Tl', 'Pb', 'Bi', 'Po', 'At', 'Rn', 'Fr',
-                    'Ra', 'Ac', 'Th', 'Pa', 'U',  'Np', 'Pu', 'Am', 'Cm', 'Bk', 'Cf',
-                    'Es', 'Fm', 'Md', 'No', 'Lr', 'Rf', 'Db', 'Sg', 'Bh', 'Hs', 'Mt',
-                    'Ds', 'Rg']
-    if pdgcode>0 and pdgcode//100000000==10:
-        III = pdgcode % 10
-        pdgcode //= 10
-        AAA = pdgcode%1000
-        pdgcode //= 1000
-        ZZZ = pdgcode%1000
-        pdgcode //= 1000
-        L = pdgcode % 10
-        pdgcode //= 10
-        if pdgcode==10 and ZZZ>0 and AAA>0:
-            if L==0 and III==0 and ZZZ < len(_db_elem)+1:
-                return '%s%i'%(_db_elem[ZZZ-1],AAA)
-            s = 'ion(Z=%i,A=%i'%(ZZZ,AAA)
-            if L:
-                s += ',L=%i'%L
-            if III:
-                s += ',I=%i'%III
-            s += ')'
-            return s
-    return None
-
-def _unique_count(a,weights=None):
-    """returns (unique,count) where unique is an array of sorted unique values in a, and count is the corresponding frequency counts"""
-    unique, inverse = np_unique(a, return_inverse=True)
-    count = np.zeros(len(unique), int if weights is None else np_dtype(type(weights[0])))
-    _np_add_at(count, inverse, 1 if weights is None else weights)
-    return (unique, count)
-
-def _merge_unique_count(uc1,uc2):
-    """merges the results of calling _unique_count on two separate data sets"""
-    u = np.append(uc1[0],uc2[0])
-    c = np.append(uc1[1],uc2[1])
-    restype=(uc1[1][0] if len(uc1[1]) else 0) +(uc2[1][0] if len(uc2[1]) else 0)
-    unique, inverse = np_unique(u, return_inverse=True)
-    count = np.zeros(len(unique), np_dtype(type(restype)))
-    _np_add_at(count, inverse, c)
-    return (unique,count)
-
-class _StatCollector:
-    def __init__(self):
-        #For numerical stability also when mean>>rms, rms state is calculated by
-        #accumulation in T variable (as in "SimpleHists" by T. Kittelmann, 2014).
-        #Here the variable T is stored in self.__rmsstate.
-        self.clear()
-        self.__dumporder = ['min','max','mean','rms','integral']
-        self.__statcalc = { 'rms'      : (lambda : np.sqrt(self.__rmsstate/self.__sumw) if self.__sumw else None ),
-                            'mean'     : (lambda : (self.__sumwx/self.__sumw) if self.__sumw else None ),
-                            'min'      : (lambda : self.__min ),
-                            'max'      : (lambda : self.__max ),
-                            'integral' : (lambda : self.__sumw )
-        }
-        assert sorted(self.__dumporder)==sorted(self.__statcalc.keys())
-
-    def clear(self):
-        self.__sumw,self.__sumwx,self.__rmsstate = 0.0,0.0,0.0
-        self.__min,self.__max = None,None
-
-    def add_data(self,a,w = None):
-        amin,amax = a.min(),a.max()
-        assert w is None or len(w)==len(a)
-        assert not np.isnan(amin),"input array has NaN's!"
-        self.__min = min(amin,amin if self.__min is None else self.__min)
-        self.__max = max(amax,amax if self.__max is None else self.__max)
-        new_sumw = float(len(a)) if w is None else w.sum()
-        if not new_sumw:
-            return
-        new_sumwx = a.sum() if w is None else (a*w).sum()
-        a_shifted = a - new_sumwx/new_sumw#shift to mean for numerical stability
-        sumwx_shifted = a_shifted.sum() if w is None else (a_shifted*w).sum()
-        sumwxx_shifted = (a_shifted**2).sum() if w is None else ((a_shifted**2)*w).sum()
-        new_T = sumwxx_shifted - sumwx_shifted**2/new_sumw
-        if not self.__sumw:
-            self.__rmsstate = new_T
-        else:
-            w1,w2 = self.__sumw,new_sumw
-            self.__rmsstate += new_T + (w2*self.__sumwx-w1*new_sumwx)**2/(w1*w2*(w1+w2))
-        self.__sumw  += new_sumw
-        self.__sumwx += new_sumwx
-
-    def dump(self):
-        for k in self.__dumporder:
-            print("%s : %s"%(k.ljust(8),'%g'%self.__statcalc[k]() if self.__sumw>0.0 or k=='integral' else 'n/a'))
-
-    def summarise(self):
-        return ', '.join("%s=%s"%(k,'%g'%self.__statcalc[k]() if self.__sumw>0.0 or k=='integral' else 'n/a') for k in self.__dumporder)
-
-    def __getitem__(self,a):
-        return self.__statcalc[a]()
-
-    def as_dict(self):
-        return dict((k,self.__statcalc[k]()) for k in self.__statcalc.keys())
-
-_possible_std_stats = ['ekin','x','y','z','ux','uy','uz','time','weight','polx','poly','polz']
-_possible_freq_stats = ['pdgcode','userflags']
-
-def collect_stats(mcplfile,stats='all',bin_data=True):
-    """Efficiently collect statistics from an entire file (or part of file, if limit
-    or skip parameters are set). Returns dictionary with stat names as key and
-    the collected statistics as values."""
-
-    #Normal stats (will be used weighted, except for stats about the weight field itself):
-    possible_std_stats = set(_possible_std_stats)
-    #Stats for which distributions are less likely to be relevant, so unique
-    #values and their frequency will be returned instead:
-    possible_freq_stats = set(_possible_freq_stats)
-
-    if stats=='all':
-        stats = possible_std_stats.union(possible_freq_stats)
-
-    if not isinstance(stats,set):
-        stats = set(stats)
-
-    if not isinstance(mcplfile,MCPLFile):
-        mcplfile = MCPLFile(mcplfile)
-    if mcplfile.nparticles==0:
-        print("MCPL WARNING: Can not calculate stats on an empty file")
-        return {}
-
-    unknown = stats.difference(possible_std_stats.union(possible_freq_stats))
-    if unknown:
-        raise MCPLError('Unknown stat names requested: "%s"'%('","'.join(unknown)))
-
-    #Some stats might be constant for all particles in the file:
-    constant_stats_available = set()
-    if mcplfile.opt_universalpdgcode:
-        constant_stats_available.add('pdgcode')
-    if not mcplfile.opt_userflags:
-        constant_stats_available.add('userflags')
-    if mcplfile.opt_universalweight:
-        constant_stats_available.add('weight')
-    if not mcplfile.opt_polarisation:
-        constant_stats_available |= set(['polx','poly','polz'])
-    cnst_stats = constant_stats_available.intersection(stats)
-    stats = stats.difference(cnst_stats)
-
-    std_stats = sorted(list(stats.difference(constant_stats_available).intersection(possible_std_stats)))
-    freq_stats = sorted(list(stats.difference(constant_stats_available).intersection(possible_freq_stats)))
-
-    if not std_stats and not freq_stats and not cnst_stats:
-        raise MCPLError('No stats requested')
-
-    weight_sum = mcplfile.nparticles * mcplfile.opt_universalweight if mcplfile.opt_universalweight else None
-
-    nbins = 100 if mcplfile.nparticles < 1000 else 200
-
-    if nbins%2==0:
-        nbins += 1#ensure nbins is odd (makes some stuff below easier)
-
-    collected_stats={}
-    if std_stats:
-        #Unfortunately we need a pass-through in order to collect
-        #statistics for histogram ranges:
-        for s in std_stats:
-            collected_stats[s] = _StatCollector()
-        for pb in mcplfile.particle_blocks:
-            vals_weight=pb.weight
-            for s,sc in collected_stats.items():
-                if s=='weight':
-                    sc.add_data(vals_weight)
-                else:
-                    sc.add_data(getattr(pb,s),vals_weight)
-    ranges={}
-    for s,sc in collected_stats.items():
-        if weight_sum is None and s!='weight':
-            weight_sum = sc['integral']
-        ranges[s] = [max(sc['min'],sc['mean']-2*sc['rms']),
-                     min(sc['max'],sc['mean']+2*sc['rms'])]
-        if not ranges[s][0]<ranges[s][1]:
-            ranges[s] = (ranges[s][0]-1.0,ranges[s][1]+1.0)
-
-    hists={}
-    freq_uc=dict((s,(np.asarray([],dtype=int),np.asarray([],dtype=float))) for s in freq_stats)
-    if (std_stats and bin_data) or freq_stats:
-        #pass through and collect data:
-        if weight_sum is None:
-            sumw = 0.0
-        for pb in mcplfile.particle_blocks:
-            vals_weight = pb.weight
-            disable=[]
-            for s in freq_stats:
-                uc_block = _unique_count(getattr(pb,s),vals_weight)
-                freq_uc[s] = _merge_unique_count(freq_uc[s],uc_block)
-                if len(freq_uc[s][0])>10000:
-                    print("MCPL WARNING: Too many unique values in %s field. Disabling %s statistics"%(s,s))
-                    disable+=[s]
-            for s in disable:
-                del freq_uc[s]
-                freq_stats.remove(s)
-            for s in (std_stats if bin_data else []):
-                vals = getattr(pb,s) if s!='weight' else vals_weight
-                h,bins = np.histogram(vals, bins=nbins, range=ranges[s],
-                                      weights=(None if s=='weight' else vals_weight))
-                if s in hists:
-                    hists[s][0] += h
-                else:
-                    hists[s] = [ h, bins ]
-            if weight_sum is None:
-                sumw += pb.weight.sum()
-        if weight_sum is None:
-            weight_sum = sumw
-
-    if weight_sum is None:
-        #apparently we need a run-through for the sole purpose of calculating this...
-        assert not std_stats and not freq_stats
-        weight_sum = 0.0
-        for pb in mcplfile.particle_blocks:
-            weight_sum += pb.weight.sum()
-
-    assert weight_sum is not None
-
-    if cnst_stats:
-        if 'pdgcode' in cnst_stats:
-            assert mcplfile.opt_universalpdgcode
-            cnst_stats.remove('pdgcode')
-            freq_uc['pdgcode'] = (np.asarray([mcplfile.opt_universalpdgcode]),np.asarray([weight_sum]))
-        if 'userflags' in cnst_stats:
-            assert not mcplfile.opt_userflags
-            cnst_stats.remove('userflags')
-            freq_uc['userflags'] = (np.asarray([0]),np.asarray([weight_sum]))
-        if 'weight' in cnst_stats:
-            uw=mcplfile.opt_universalweight
-            assert uw
-            cnst_stats.remove('weight')
-            sc=_StatCollector()
-            sc.add_data(np.asarray([uw],float),np.asarray([mcplfile.nparticles],float))
-            collected_stats['weight']=sc
-            if bin_data:
-                bins = np.linspace(0.0,2.0*uw,nbins+1)
-                h = np.zeros(nbins)
-                assert nbins % 2 != 0#nbins is odd, value falls at bin center below:
-                h[nbins//2] = uw * mcplfile.nparticles#unweighted!
-                hists['weight'] = [ h, bins ]
-        for spol in ('polx','poly','polz'):
-            if spol in cnst_stats:
-                cnst_stats.remove(spol)
-                sc=_StatCollector()
-                sc.add_data(np.asarray([0.0],float),np.asarray([weight_sum],float))
-                collected_stats[spol] = sc
-                if bin_data:
-                    bins = np.linspace(-1.0,1.0,nbins+1)
-                    h = np.zeros(nbins)
-                    assert nbins % 2 != 0#nbins is odd, value 0.0 falls at bin center:
-                    h[nbins//2] = weight_sum
-                    hists[spol] = [ h, bins ]
-
-    for s in list(k for k in freq_uc.keys()):
-        #sort by frequency:
-        u,c=freq_uc[s]
-        sortidx=np.argsort(u,kind='mergesort')#the indices that would sort u
-        u,c=u[sortidx],c[sortidx]
-        sortidx=np.argsort(c,kind='mergesort')[::-1]#the indices that would sort c, viewed in reverse order
-        freq_uc[s] = u[sortidx],c[sortidx]
-
-    results = { 'file':{'type':'fileinfo','integral':weight_sum,'nparticles':mcplfile.nparticles} }
-    for s,uc in freq_uc.items():
-        results[s] = { 'unique_values': uc[0], 'unique_values_counts' : uc[1], 'weighted' : True, 'type':'freq' }
-
-    units=dict(ekin='MeV',x='cm',y='cm',z='cm',time='ms')
-
-    for s,sc in collected_stats.items():
-        d=sc.as_dict()
-        d.update({'summary':sc.summarise(),
-                  'name':s,
-                  'unit':units.get(s,None),
-                  'weighted': s!='weight',
-                  'type' : 'hist'})
-        if bin_data:
-            h,bins = hists[s]
-            d.update({'hist_bins' : bins,
-                      'hist' : h})
-        results[s] = d
-
-    return results
-
-_freq_alt_descr =  {'pdgcode': _pdg_database,
-                    'userflags':lambda x : '0x%08x'%x}
-
-def dump_stats(stats):
-    """Format and print provided statistics object to stdout. The stats object is
-    assumed to have been created by a call to collect_stats()"""
-
-    if not isinstance(stats,dict):
-        stats = collect_stats(stats,bin_data=False)
-    print('------------------------------------------------------------------------------')
-    print('nparticles   : %i'%stats['file']['nparticles'])
-    print('sum(weights) : %g'%stats['file']['integral'])
-    if set(stats).intersection(_possible_std_stats):
-        print('------------------------------------------------------------------------------')
-        print('             :            mean             rms             min             max')
-        print('------------------------------------------------------------------------------')
-
-    for statname in _possible_std_stats:
-        if statname not in stats:
-            continue
-        s=stats[statname]
-        assert s['type']=='hist'
-        su = '%s %s'%(statname.ljust(6),('[%s]'%s['unit']).rjust(5)) if s['unit'] else statname
-        print('%s : %15g %15.5g %15g %15g'%(su.ljust(12),s['mean'],s['rms'],s['min'],s['max']))
-    for statname in _possible_freq_stats:
-        if statname not in stats:
-            continue
-        print('------------------------------------------------------------------------------')
-        s=stats[statname]
-        assert s['type']=='freq'
-        fct_alt_descr = _freq_alt_descr.get(statname,lambda x: '')
-        #fmt_fct = freq_formats_fcts[statname]
-        uv,uvc=s['unique_values'],s['unique_values_counts'].copy()
-        percents=uvc*(100.0/uvc.sum())
-        showmax=50
-        print ('%s : '%(statname.ljust(12)),end='')
-        for i,(u,p,c) in enumerate(zip(uv,percents,uvc)):
-            txt='%i'%u
-            if i+1==showmax:
-                txt='other'
-                alttxt=''
-                p=percents[i:].sum()
-                c=uvc[i:].sum()
-            else:
-                alttxt=fct_alt_descr(u)
-            print('%s %s %12g (%5.2f%%)'%(txt.rjust(26 if i else 11),
-                                       ('(%s)'%alttxt if alttxt else '').ljust(12),
-                                       c,p))
-            if i+1==showmax:
-                break
-        print ('                     [ values ]             [ weighted counts ]')
-    print('------------------------------------------------------------------------------')
-
-def plot_stats(stats,pdf=False,set_backend=None):
-    """Produce plots of provided statistics object with matplotlib. The pdf
-    parameter can be set to a filename and if so, the plots will be produced in
-    that newly created PDF file, rather than being shown interactively. The
-    set_backend parameter can be used to select a matplotlib backend. The stats
-    object is assumed to have been created by a call to collect_stats()."""
-
-    if pdf is True:
-        raise MCPLError('If set, the pdf parameter should be a string'
-                        +' containing the desired filename of the PDF file to be created')
-
-    if pdf and os.path.exists(pdf):
-        raise MCPLError('PDF file %s already exists'%(pdf))
-
-    try:
-        import matplotlib
-    except ImportError:
-        print()
-        print("ERROR: For plotting, this MCPL python module requires matplotlib (matplotlib.org) to be")
-        print("ERROR: installed. You can perhaps install it using using your software manager and searching")
-        print("ERROR: for \"matplotlib\" or \"python-matplotlib\", or it might come bundled with software")
-        print("ERROR: such as scientific python or anaconda, depending on your platform. Alternatively, if")
-        print("ERROR: you are using the pip package manager, you might be able to install it with the")
-        print("ERROR: command \"pip install matplotlib\".")
-        print()
-        raise
-
-    if set_backend:
-        matplotlib.use(set_backend)
-
-    if pdf:
-        try:
-            from matplotlib.backends.backend_pdf import PdfPages
-        except ImportError:
-            print()
-            print("ERROR: matplotlib installation does not have required support for PDF output.")
-            print()
-            raise
-        pdf_file = pdf # noqa F841 (not really sure if this variable was needed
-                       # for object lifetime reasons).
-        pdf = PdfPages(pdf)
-
-    try:
-        import matplotlib.pyplot as plt
-    except ImportError:
-        print()
-        print("ERROR: importing matplotlib succeeded, but importing matplotlib.pyplot failed.")
-        print("ERROR: This is rather unusual, an is perhaps related to issues with your chosen")
-        print("ERROR: matplotlib backend, which you might have set globally in a matplotlib")
-        print("ERROR: configuration file.")
-        print()
-        raise
-
-    if not isinstance(stats,dict):
-        stats = collect_stats(stats,bin_data=True)
-
-    showmax=10
-    for s in _possible_freq_stats:
-        if s not in stats:
-            continue
-        freq=stats[s]
-        u,c=freq['unique_values'],freq['unique_values_counts']
-        fct_alt_descr = _freq_alt_descr.get(s,lambda x: None)
-        def fmt_fct_raw(x):
-            alttxt = fct_alt_descr(x)
-            return '%s\n(%s)'%(str(x),alttxt) if alttxt is not None else str(x)
-        #fmt_fct_raw = freq_formats_fcts[s]
-        def fmt_fct( i, x ):
-            return fmt_fct_raw(x)
-        if len(c)>showmax:
-            sum_other = c[showmax-1:].sum()
-            u,c = u[0:showmax].copy(), c[0:showmax].copy()
-            c[showmax-1] = sum_other
-            def fmt_fct( i, x ):
-                return 'other' if i==showmax-1 else fmt_fct_raw(x)
-        percents = c.astype(float)*100.0/sum(c)
-        labels = ['%s\n%.2f%%'%(fmt_fct(i,e),percents[i]) for i,e in enumerate(u)]
-        barcenters=list(range(len(c)))
-        plt.bar(barcenters, c, width=0.7,align='center',linewidth=0)
-        ax=plt.gca()
-        ax.set_xticks(barcenters)
-        percents=c.astype(float)*100.0/sum(c)
-        ax.set_xticklabels(labels,fontsize='small')
-        ax.yaxis.grid(True,color='white',linestyle='-')
-        ax.set_xlim(-0.5,len(c)-0.5)
-        plt.title(s)
-        plt.subplots_adjust(left=0.1, right=0.94, top=0.93, bottom=0.13)
-        if pdf:
-            pdf.savefig(plt.gcf())
-            plt.close()
-        else:
-            plt.show()
-
-    for s in _possible_std_stats:
-        if s not in stats:
-            continue
-        h=stats[s]
-        hist,bins = h['hist'],h['hist_bins']
-        plt.bar(0.5*(bins[:-1] + bins[1:]), hist, align='center', width=(bins[1] - bins[0]),linewidth=0)
-        plt.grid()
-        plt.title('%s%s (%s)'%(s,
-                               ' [%s]'%h['unit'] if h['unit'] is not None else '',
-                               'weighted' if h['weighted'] else 'unweighted'))
-        plt.xlabel(h['summary'],fontsize='small')
-        plt.xlim(bins[0],bins[-1])
-        plt.subplots_adjust(left=0.1, right=0.94, top=0.93, bottom=0.13)
-        if pdf:
-            pdf.savefig(plt.gcf())
-            plt.close()
-        else:
-            plt.show()
-
-    if pdf:
-        if hasattr(pdf,'infodict'):
-            d = pdf.infodict()
-            d['Title'] = ( 'Plots made with mcpl.py version %s'
-                           % _determine_version() )
-            d['Author'] = 'mcpl.py v%s' % _determine_version()
-            d['Subject'] = 'mcpl plots'
-            d['Keywords'] = 'mcpl'
-        pdf.close()
-
 def _determine_version():
     if os.environ.get('PYMCPLTOOL_FAKE_PYVERSION','').strip():
         return '99.99.99'
@@ -1904,6 +1725,14 @@ def _parse_statsum( comments ):
                         f' following the specification: "{example}"')
     return d
 
+#Parts of the implementation are kept in separate modules (imported here at the
+#end, since they depend on the definitions above):
+from ._native import _libmcpl, _libmcpl_quiet, _LibMCPLCaller, _native_pdt # noqa: E402
+from ._prefetch import _GzipPrefetcher, _GzipCheckpoints # noqa: E402
+from ._writer import MCPLWriter # noqa: E402
+from ._dataset import MCPLDataset # noqa: E402
+from ._stats import collect_stats, dump_stats, plot_stats # noqa: E402
+
 def main():
     """This function simply calls app_pymcpltool(), but any raised MCPLError
     exception will be caught and transformed into a corresponding error message
@@ -0,0 +1,114 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# Utilities for writing small synthetic SSW and PHITS files, with contents
+# generated from a seed in a reproducible manner.
+
+import math
+import struct
+
+class _Rand:
+    #Simple LCG, to not depend on the details of the random module:
+    def __init__( self, seed ):
+        self.__s = ( 12345 + 1000003 * seed ) % 2**64
+    def next( self ):
+        self.__s = ( 6364136223846793005 * self.__s
+                     + 1442695040888963407 ) % 2**64
+        return ( self.__s >> 11 ) / 2**53
+    def uniform( self, a, b ):
+        return a + ( b - a ) * self.next()
+    def choice( self, seq ):
+        return seq[ min( len(seq) - 1, int( self.next() * len(seq) ) ) ]
+
+def _fortran_record( data, reclen ):
+    m = struct.pack( '<I' if reclen == 4 else '<Q', len(data) )
+    return m + data + m
+
+def write_ssw_file( path, flavour, nparticles, reclen = 4, seed = 1 ):
+    """Write SSW file in MCNP6 (flavour='mcnp6') or MCNPX (flavour='mcnpx')
+    layout. A few particles get a raw type which can not be converted to a PDG
+    code."""
+    assert flavour in ('mcnp6','mcnpx')
+    assert reclen in (4,8)
+    rng = _Rand( seed )
+    recs = []
+    if flavour == 'mcnp6':
+        recs.append( b'SF_00001' )
+        recs.append( b'mcnp    ' + b'6    '
+                     + b'01/01/20 12:00:00'.ljust(28)
+                     + b'machine'.ljust(18)
+                     + b'Synthetic SSW file'.ljust(128) + b'    ' )
+        recs.append( struct.pack( '<8i', 1000, 0, nparticles, 0,
+                                  11, 2, nparticles, 0 ) )
+        rawtypes = [ 2, 4, 6, 8, 18, 40, 62, 68 ]
+    else:
+        recs.append( ( b'mcnpx   ' + b'2.7.0'
+                       + b'01/01/20 12:00:00'.ljust(28)
+                       + b'machine'.ljust(19)
+                       + b'probid'.ljust(19)
+                       + b'Synthetic SSW file'.ljust(80) ).ljust(163) )
+        recs.append( struct.pack( '<5i', 1000, nparticles, 10,
+                                  2, nparticles ) )
+        rawtypes = [ 1, 2, 3, 9, 20, 21, 31, 33, 34 ]
+    for _ in range(3):
+        recs.append( b'\0' * 16 )
+    for i in range(nparticles):
+        rawtype = rng.choice( rawtypes ) if rng.next() > 0.01 else 2000
+        isurf = 1 + int( rng.next() * 999 )
+        sign = rng.choice( [ 1.0, -1.0 ] )
+        if flavour == 'mcnp6':
+            nx = rawtype * 4 + int( rng.next() * 4 )
+        else:
+            nx = rawtype * 1000000 + isurf
+        vals = [ float(i), sign * nx,
+                 rng.uniform(0.0,2.0), rng.uniform(0.0,10.0),
+                 rng.uniform(0.0,1e3),
+                 rng.uniform(-50.,50.), rng.uniform(-50.,50.),
+                 rng.uniform(-50.,50.),
+                 rng.uniform(-0.7,0.7), rng.uniform(-0.7,0.7) ]
+        if flavour == 'mcnp6':
+            vals.append( rng.choice( [ 1.0, -1.0 ] ) * isurf )
+        recs.append( struct.pack( '<%id'%len(vals), *vals ) )
+    with open( path, 'wb' ) as fh:
+        for r in recs:
+            fh.write( _fortran_record( r, reclen ) )
+
+def write_phits_file( path, nparticles, polarisation = True,
+                      reclen = 4, seed = 1 ):
+    """Write PHITS dump file, with or without polarisation fields."""
+    assert reclen in (4,8)
+    rng = _Rand( seed )
+    kts = [ 2112, 22, 11, -11, 2212, 1000001, 2000004, 6000012 ]
+    with open( path, 'wb' ) as fh:
+        for _ in range(nparticles):
+            u = [ rng.uniform(0.1,1.0) * rng.choice([-1.0,1.0])
+                  for _ in range(3) ]
+            ulen = math.sqrt( sum( e*e for e in u ) )
+            vals = [ float( rng.choice( kts ) ),
+                     rng.uniform(-5.,5.), rng.uniform(-5.,5.),
+                     rng.uniform(-5.,5.),
+                     u[0] / ulen, u[1] / ulen, u[2] / ulen,
+                     rng.uniform(0.0,10.0), rng.next(),
+                     rng.uniform(0.0,1e4) ]
+            if polarisation:
+                vals += [ rng.uniform(-1.,1.), 0.0, rng.next() ]
+            fh.write( _fortran_record( struct.pack( '<%id'%len(vals), *vals ),
+                                       reclen ) )
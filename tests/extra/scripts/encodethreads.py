@@ -0,0 +1,96 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# Check that mcpl2ssw and mcpl2phits give identical output no matter how many
+# threads are used for encoding the records, and that the output written with
+# -z decompresses to the same bytes as the output written without it.
+
+from MCPLExtraTestUtils.dirs import ( mcpl2ssw_cmd,
+                                      ssw2mcpl_cmd,
+                                      mcpl2phits_cmd,
+                                      phits2mcpl_cmd )
+from MCPLExtraTestUtils.synthfiles import write_ssw_file, write_phits_file
+import gzip
+import pathlib
+import subprocess
+import sys
+
+def run( cmd, *args, cwd = None ):
+    rv = subprocess.run( [ cmd ] + [ str(a) for a in args ],
+                         capture_output = True, cwd = cwd )
+    if rv.stderr or rv.returncode:
+        sys.stdout.buffer.write(rv.stdout)
+        sys.stdout.buffer.write(rv.stderr)
+        raise SystemExit(1)
+    return rv.stdout
+
+def check_converter( name, cmd, inputs, outname ):
+    results = {}
+    for nthreads in ( 1, 4, 0 ):
+        for gzip_output in ( False, True ):
+            d = pathlib.Path( f'{name}_j{nthreads}{"_z" if gzip_output else ""}' )
+            d.mkdir()
+            args = [ f'-j{nthreads}' ] + ( ['-z'] if gzip_output else [] )
+            stdout = run( cmd, *args, *inputs, outname, cwd = d )
+            if gzip_output:
+                assert not d.joinpath(outname).exists()
+                with gzip.open( d.joinpath(outname+'.gz'), 'rb' ) as fh:
+                    data = fh.read()
+            else:
+                data = d.joinpath(outname).read_bytes()
+            results[(nthreads,gzip_output)] = ( data, stdout )
+    ref_data, ref_stdout = results[(1,False)]
+    ref_stdout_z = results[(1,True)][1]
+    for (nthreads,gzip_output), (data,stdout) in sorted(results.items()):
+        same_stdout = stdout == ( ref_stdout_z if gzip_output else ref_stdout )
+        print( f'{name} -j{nthreads}{" -z" if gzip_output else ""}:',
+               f'{len(data)} bytes,',
+               'same output' if data == ref_data else 'DIFFERENT OUTPUT',
+               'and stdout' if same_stdout else 'but DIFFERENT STDOUT' )
+        if data != ref_data or not same_stdout:
+            raise SystemExit(1)
+
+def main():
+    #Enough particles for several blocks (of 4096 particles), and a partial
+    #final block:
+    nparticles = 3 * 4096 + 123
+
+    sswfile = pathlib.Path('ref.ssw').absolute()
+    write_ssw_file( sswfile, 'mcnp6', nparticles )
+    run( ssw2mcpl_cmd, '-s', '-n', sswfile, 'fromssw.mcpl' )
+    check_converter( 'mcpl2ssw', mcpl2ssw_cmd,
+                     [ pathlib.Path('fromssw.mcpl').absolute(), sswfile ],
+                     'out.ssw' )
+
+    for polarisation in ( True, False ):
+        dumpfile = pathlib.Path(f'ref{"_pol" if polarisation else ""}.dmp')
+        write_phits_file( dumpfile, nparticles, polarisation = polarisation )
+        mcplfile = pathlib.Path(f'fromphits{"_pol" if polarisation else ""}.mcpl')
+        run( phits2mcpl_cmd, '-n', dumpfile, mcplfile )
+        check_converter( 'mcpl2phits' if polarisation else 'mcpl2phits_nopol',
+                         mcpl2phits_cmd,
+                         [ mcplfile.absolute() ] + ( [] if polarisation
+                                                     else [ '-n' ] ),
+                         'out.dmp' )
+    print("All ok",flush=True)
+
+if __name__ == '__main__':
+    main()
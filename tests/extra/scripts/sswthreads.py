@@ -0,0 +1,68 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# Check that ssw2mcpl gives identical output (both files and stdout) no matter
+# how many threads are used for decoding the particles.
+
+from MCPLExtraTestUtils.dirs import ssw2mcpl_cmd
+from MCPLExtraTestUtils.synthfiles import write_ssw_file
+import pathlib
+import subprocess
+import sys
+
+def run_ssw2mcpl( cwd, *args ):
+    rv = subprocess.run( [ ssw2mcpl_cmd ] + [ str(a) for a in args ],
+                         capture_output = True, cwd = cwd )
+    if rv.stderr or rv.returncode:
+        sys.stdout.buffer.write(rv.stdout)
+        sys.stdout.buffer.write(rv.stderr)
+        raise SystemExit(1)
+    return rv.stdout
+
+def main():
+    #Particle counts chosen to give both empty, partial and full blocks of
+    #particles (the converter uses blocks of 4096 particles):
+    for flavour, reclen, nparticles in [ ( 'mcnp6', 4, 0 ),
+                                         ( 'mcnp6', 4, 1 ),
+                                         ( 'mcnp6', 8, 4096 ),
+                                         ( 'mcnp6', 4, 3 * 4096 + 123 ),
+                                         ( 'mcnpx', 4, 2 * 4096 + 1 ),
+                                         ( 'mcnpx', 8, 5000 ) ]:
+        sswfile = pathlib.Path( f'{flavour}_{reclen}_{nparticles}.ssw' ).absolute()
+        write_ssw_file( sswfile, flavour, nparticles, reclen = reclen )
+        outputs = []
+        for nthreads in ( 1, 4 ):
+            d = pathlib.Path( f'j{nthreads}' )
+            d.mkdir( exist_ok = True )
+            stdout = run_ssw2mcpl( d, '-n', f'-j{nthreads}',
+                                   sswfile, 'out.mcpl' )
+            outputs.append( ( d.joinpath('out.mcpl').read_bytes(), stdout ) )
+        ( data1, stdout1 ), ( data4, stdout4 ) = outputs
+        nwarn = stdout1.count(b'WARNING: Could not convert')
+        print( f'{sswfile.name}: {len(data1)} bytes, {nwarn} bad types,',
+               'same output' if data1 == data4 else 'DIFFERENT OUTPUT',
+               'and stdout' if stdout1 == stdout4 else 'but DIFFERENT STDOUT' )
+        if data1 != data4 or stdout1 != stdout4:
+            raise SystemExit(1)
+    print("All ok",flush=True)
+
+if __name__ == '__main__':
+    main()
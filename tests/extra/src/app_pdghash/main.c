@@ -0,0 +1,89 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "sswread.h"
+#include "phitsread.h"
+#include <stdint.h>
+#include <stdio.h>
+
+//Verifies that the perfect hash tables used when converting PDG codes to SSW
+//and PHITS codes give the same results as plain linear searches through the
+//tables of codes, for all codes of up to 7 digits and all ion codes with Z<10
+//(ions are otherwise converted arithmetically, so are only compared when they
+//are in the tables).
+
+//Functions only available in the test libraries:
+int32_t conv_mcnpx_pdg2ssw_linear( int32_t );
+int32_t conv_mcnp6_pdg2ssw_linear( int32_t );
+int32_t conv_code_pdg2phits_linear( int32_t );
+
+typedef int32_t (*convfct_t)( int32_t );
+
+static int check_range( const char * name, convfct_t fhashed,
+                        convfct_t flinear, int32_t cmin, int32_t cmax,
+                        unsigned long * nfound )
+{
+  int32_t c = cmin;
+  while ( 1 ) {
+    int32_t expected = flinear( c );
+    int32_t actual = fhashed( c );
+    int is_ion_range = ( c > 1000000000 || c < -1000000000 );
+    if ( expected )
+      ++(*nfound);
+    if ( expected ? actual != expected : ( actual && !is_ion_range ) ) {
+      printf("%s(%li) gave %li but linear search gave %li\n",name,
+             (long)c,(long)actual,(long)expected);
+      return 0;
+    }
+    if ( c == cmax )
+      break;
+    ++c;
+  }
+  return 1;
+}
+
+static int check( const char * name, convfct_t fhashed, convfct_t flinear )
+{
+  unsigned long nfound = 0;
+  if ( !check_range( name, fhashed, flinear, -9999999, 9999999, &nfound )
+       || !check_range( name, fhashed, flinear,
+                        1000000000, 1000099999, &nfound )
+       || !check_range( name, fhashed, flinear,
+                        -1000099999, -1000000000, &nfound ) )
+    return 0;
+  printf("%s: hashed and linear lookups agree (%lu codes found in tables)\n",
+         name, nfound);
+  return 1;
+}
+
+int main(void)
+{
+  if ( !check( "conv_mcnpx_pdg2ssw", conv_mcnpx_pdg2ssw,
+               conv_mcnpx_pdg2ssw_linear ) )
+    return 1;
+  if ( !check( "conv_mcnp6_pdg2ssw", conv_mcnp6_pdg2ssw,
+               conv_mcnp6_pdg2ssw_linear ) )
+    return 1;
+  if ( !check( "conv_code_pdg2phits", conv_code_pdg2phits,
+               conv_code_pdg2phits_linear ) )
+    return 1;
+  return 0;
+}
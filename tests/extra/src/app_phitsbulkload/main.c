@@ -0,0 +1,163 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "phitsread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Writes small synthetic PHITS dump files and checks that loading them with
+//phits_load_particles (in batches of various sizes) gives exactly the same
+//particles as loading them one at a time with phits_load_particle.
+
+static uint64_t rngstate = 12345;
+static double rng(void)
+{
+  rngstate = rngstate * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (double)( rngstate >> 11 ) / 9007199254740992.0;
+}
+
+static void write_phits( const char * filename, int haspol, int reclen,
+                         long nparticles )
+{
+  FILE * fh = fopen( filename, "wb" );
+  if (!fh) {
+    printf("Could not create %s\n",filename);
+    exit(1);
+  }
+  const long kts[] = { 2112, 22, 11, -11, 2212, 1000001, 2000004,
+                       6000012, 999999999 };
+  const size_t n = ( haspol ? 13 : 10 ) * sizeof(double);
+  uint32_t m32 = (uint32_t)n;
+  uint64_t m64 = (uint64_t)n;
+  const void * m = ( reclen == 4 ? (const void*)&m32 : (const void*)&m64 );
+  for ( long i = 0; i < nparticles; ++i ) {
+    double v[13];
+    v[0] = (double)kts[(int)(rng()*9)];
+    for ( int j = 1; j < 4; ++j )
+      v[j] = ( rng() - 0.5 ) * 10.0;
+    v[4] = ( rng() - 0.5 ) * 1.4;
+    v[5] = ( rng() - 0.5 ) * 1.4;
+    v[6] = ( rng() - 0.5 ) * 1.4;
+    v[7] = rng() * 10.0;
+    v[8] = rng();
+    v[9] = rng() * 1e4;
+    v[10] = rng() - 0.5;
+    v[11] = 0.0;
+    v[12] = rng();
+    fwrite( m, (size_t)reclen, 1, fh );
+    fwrite( v, 1, n, fh );
+    fwrite( m, (size_t)reclen, 1, fh );
+  }
+  fclose( fh );
+}
+
+static int same_particle( const phits_particle_t * a,
+                          const phits_particle_t * b )
+{
+  return ( a->x == b->x && a->y == b->y && a->z == b->z
+           && a->dirx == b->dirx && a->diry == b->diry && a->dirz == b->dirz
+           && a->polx == b->polx && a->poly == b->poly && a->polz == b->polz
+           && a->weight == b->weight && a->ekin == b->ekin
+           && a->time == b->time && a->rawtype == b->rawtype
+           && a->pdgcode == b->pdgcode );
+}
+
+//Load all particles, with phits_load_particles if batchsize is non-zero
+//(alternating with phits_load_particle if mixed is set):
+static phits_particle_t * load_all( const char * filename, long nexpected,
+                                    unsigned long batchsize, int mixed )
+{
+  phits_file_t f = phits_open_file( filename );
+  phits_particle_t * parts = malloc( ( (size_t)nexpected + 1 )
+                                     * sizeof(phits_particle_t) );
+  if (!parts) {
+    printf("Memory allocation failure\n");
+    exit(1);
+  }
+  unsigned long nloaded = 0;
+  while ( nloaded <= (unsigned long)nexpected ) {
+    if ( !batchsize || ( mixed && nloaded % 2 == 0 ) ) {
+      const phits_particle_t * p = phits_load_particle( f );
+      if (!p)
+        break;
+      parts[nloaded++] = *p;
+    } else {
+      unsigned long nmax = (unsigned long)nexpected + 1 - nloaded;
+      unsigned long nb = phits_load_particles( f, ( batchsize < nmax
+                                                    ? batchsize : nmax ),
+                                               parts + nloaded );
+      if (!nb)
+        break;
+      nloaded += nb;
+    }
+  }
+  if ( nloaded != (unsigned long)nexpected
+       || phits_load_particles( f, 1, parts ) ) {
+    printf("Unexpected number of particles loaded\n");
+    exit(1);
+  }
+  phits_close_file( f );
+  return parts;
+}
+
+int main(void)
+{
+  const struct { int haspol; int reclen; long n; } files[] = {
+    { 0, 4, 0 },
+    { 1, 4, 1 },
+    { 0, 4, 25003 },
+    { 0, 8, 4096 },
+    { 1, 8, 12345 },
+  };
+  const struct { unsigned long batchsize; int mixed; } modes[] = {
+    { 1000, 0 },
+    { 4097, 1 },
+    { 100000, 0 },
+  };
+  for ( unsigned i = 0; i < sizeof(files)/sizeof(files[0]); ++i ) {
+    char filename[64];
+    snprintf( filename, sizeof(filename), "synth_%s_%i_%li.dmp",
+              ( files[i].haspol ? "pol" : "nopol" ), files[i].reclen,
+              files[i].n );
+    write_phits( filename, files[i].haspol, files[i].reclen, files[i].n );
+    phits_particle_t * ref = load_all( filename, files[i].n, 0, 0 );
+    for ( unsigned j = 0; j < sizeof(modes)/sizeof(modes[0]); ++j ) {
+      phits_particle_t * parts = load_all( filename, files[i].n,
+                                           modes[j].batchsize,
+                                           modes[j].mixed );
+      for ( long k = 0; k < files[i].n; ++k ) {
+        if ( !same_particle( ref + k, parts + k ) ) {
+          printf("Particle %li differs when loading in batches of %lu\n",
+                 k, modes[j].batchsize);
+          return 1;
+        }
+      }
+      printf("%s: %li particles identical when loading in batches of %lu%s\n",
+             filename, files[i].n, modes[j].batchsize,
+             ( modes[j].mixed ? " (mixed with single loads)" : "" ) );
+      free( parts );
+    }
+    free( ref );
+  }
+  return 0;
+}
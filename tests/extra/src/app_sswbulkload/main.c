@@ -0,0 +1,201 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+#include "sswread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Writes small synthetic SSW files and checks that loading them with
+//ssw_load_particles (in batches of various sizes) gives exactly the same
+//particles as loading them one at a time with ssw_load_particle.
+
+static uint64_t rngstate = 12345;
+static double rng(void)
+{
+  rngstate = rngstate * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (double)( rngstate >> 11 ) / 9007199254740992.0;
+}
+
+static void write_record( FILE * fh, int reclen, const void * data, size_t n )
+{
+  uint32_t m32 = (uint32_t)n;
+  uint64_t m64 = (uint64_t)n;
+  const void * m = ( reclen == 4 ? (const void*)&m32 : (const void*)&m64 );
+  fwrite( m, (size_t)reclen, 1, fh );
+  fwrite( data, 1, n, fh );
+  fwrite( m, (size_t)reclen, 1, fh );
+}
+
+static void write_padded( char * dest, const char * src, size_t n )
+{
+  memset( dest, ' ', n );
+  memcpy( dest, src, strlen(src) );
+}
+
+static void write_ssw( const char * filename, int mcnp6, int reclen,
+                       int32_t nparticles )
+{
+  FILE * fh = fopen( filename, "wb" );
+  if (!fh) {
+    printf("Could not create %s\n",filename);
+    exit(1);
+  }
+  char hdr[191];
+  if ( mcnp6 ) {
+    write_record( fh, reclen, "SF_00001", 8 );
+    write_padded( hdr, "mcnp", 8 );
+    write_padded( hdr + 8, "6", 5 );
+    write_padded( hdr + 13, "01/01/20 12:00:00", 28 );
+    write_padded( hdr + 41, "machine", 18 );
+    write_padded( hdr + 59, "Synthetic SSW file", 132 );
+    write_record( fh, reclen, hdr, 191 );
+    int32_t rec[8] = { 1000, 0, nparticles, 0, 11, 2, nparticles, 0 };
+    write_record( fh, reclen, rec, sizeof(rec) );
+  } else {
+    write_padded( hdr, "mcnpx", 8 );
+    write_padded( hdr + 8, "2.7.0", 5 );
+    write_padded( hdr + 13, "01/01/20 12:00:00", 28 );
+    write_padded( hdr + 41, "machine", 19 );
+    write_padded( hdr + 60, "probid", 19 );
+    write_padded( hdr + 79, "Synthetic SSW file", 84 );
+    write_record( fh, reclen, hdr, 163 );
+    int32_t rec[5] = { 1000, nparticles, 10, 2, nparticles };
+    write_record( fh, reclen, rec, sizeof(rec) );
+  }
+  char zeroes[16] = { 0 };
+  for ( int i = 0; i < 3; ++i )
+    write_record( fh, reclen, zeroes, sizeof(zeroes) );
+  const long mcnp6_types[] = { 2, 4, 6, 8, 18, 40, 62, 68 };
+  const long mcnpx_types[] = { 1, 2, 3, 9, 20, 21, 31, 33, 34 };
+  for ( int32_t i = 0; i < nparticles; ++i ) {
+    long rawtype = ( mcnp6
+                     ? mcnp6_types[(int)(rng()*8)]
+                     : mcnpx_types[(int)(rng()*9)] );
+    if ( i % 5000 == 4999 )
+      rawtype = 2000;//not convertible to a PDG code
+    long isurf = 1 + (long)( rng() * 999 );
+    double sign = ( rng() < 0.5 ? -1.0 : 1.0 );
+    double ssb[11];
+    ssb[0] = (double)i;
+    ssb[1] = sign * (double)( mcnp6
+                              ? rawtype * 4 + (long)( rng() * 4 )
+                              : rawtype * 1000000 + isurf );
+    ssb[2] = rng() * 2.0;
+    ssb[3] = rng() * 10.0;
+    ssb[4] = rng() * 1e3;
+    for ( int j = 5; j < 8; ++j )
+      ssb[j] = ( rng() - 0.5 ) * 100.0;
+    ssb[8] = ( rng() - 0.5 ) * 1.4;
+    ssb[9] = ( rng() - 0.5 ) * 1.4;
+    ssb[10] = ( rng() < 0.5 ? -1.0 : 1.0 ) * (double)isurf;
+    write_record( fh, reclen, ssb, ( mcnp6 ? 11 : 10 ) * sizeof(double) );
+  }
+  fclose( fh );
+}
+
+static int same_particle( const ssw_particle_t * a, const ssw_particle_t * b )
+{
+  return ( a->x == b->x && a->y == b->y && a->z == b->z
+           && a->dirx == b->dirx && a->diry == b->diry && a->dirz == b->dirz
+           && a->weight == b->weight && a->ekin == b->ekin
+           && a->time == b->time && a->rawtype == b->rawtype
+           && a->pdgcode == b->pdgcode && a->isurf == b->isurf );
+}
+
+//Load all particles, with ssw_load_particles if batchsize is non-zero
+//(alternating with ssw_load_particle if mixed is set):
+static ssw_particle_t * load_all( const char * filename,
+                                  unsigned long batchsize, int mixed,
+                                  unsigned long * nloaded )
+{
+  ssw_file_t f = ssw_open_file( filename );
+  unsigned long n = ssw_nparticles( f );
+  ssw_particle_t * parts = malloc( ( n + 1 ) * sizeof(ssw_particle_t) );
+  if (!parts) {
+    printf("Memory allocation failure\n");
+    exit(1);
+  }
+  *nloaded = 0;
+  while ( 1 ) {
+    if ( !batchsize || ( mixed && *nloaded % 2 == 0 ) ) {
+      const ssw_particle_t * p = ssw_load_particle( f );
+      if (!p)
+        break;
+      parts[(*nloaded)++] = *p;
+    } else {
+      unsigned long nb = ssw_load_particles( f, batchsize, parts + *nloaded );
+      if (!nb)
+        break;
+      *nloaded += nb;
+    }
+  }
+  if ( *nloaded != n || ssw_load_particles( f, batchsize + 1, parts ) ) {
+    printf("Unexpected number of particles loaded\n");
+    exit(1);
+  }
+  ssw_close_file( f );
+  return parts;
+}
+
+int main(void)
+{
+  const struct { int mcnp6; int reclen; int32_t n; } files[] = {
+    { 1, 4, 0 },
+    { 1, 8, 1 },
+    { 1, 4, 25003 },
+    { 0, 4, 4096 },
+    { 0, 8, 12345 },
+  };
+  const struct { unsigned long batchsize; int mixed; } modes[] = {
+    { 1000, 0 },
+    { 4097, 1 },
+    { 100000, 0 },
+  };
+  for ( unsigned i = 0; i < sizeof(files)/sizeof(files[0]); ++i ) {
+    char filename[64];
+    snprintf( filename, sizeof(filename), "synth_%s_%i_%li.ssw",
+              ( files[i].mcnp6 ? "mcnp6" : "mcnpx" ), files[i].reclen,
+              (long)files[i].n );
+    write_ssw( filename, files[i].mcnp6, files[i].reclen, files[i].n );
+    unsigned long nref;
+    ssw_particle_t * ref = load_all( filename, 0, 0, &nref );
+    for ( unsigned j = 0; j < sizeof(modes)/sizeof(modes[0]); ++j ) {
+      unsigned long n;
+      ssw_particle_t * parts = load_all( filename, modes[j].batchsize,
+                                         modes[j].mixed, &n );
+      for ( unsigned long k = 0; k < n; ++k ) {
+        if ( !same_particle( ref + k, parts + k ) ) {
+          printf("Particle %lu differs when loading in batches of %lu\n",
+                 k, modes[j].batchsize);
+          return 1;
+        }
+      }
+      printf("%s: %lu particles identical when loading in batches of %lu%s\n",
+             filename, n, modes[j].batchsize,
+             ( modes[j].mixed ? " (mixed with single loads)" : "" ) );
+      free( parts );
+    }
+    free( ref );
+  }
+  return 0;
+}
@@ -0,0 +1,129 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Test MCPLDataset with files written by MCPLWriter, comparing with a single file
+#containing all the particles.
+
+def blocksum(pb):
+    return (pb.file_offset,len(pb),float(pb.ekin.sum()))
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+
+    rng = np.random.default_rng(1234)
+    nparts = [1000,0,2345,17,600]
+    def genparts(n):
+        d = rng.normal(size=(n,3))
+        d /= np.linalg.norm(d,axis=1)[:,None]
+        return dict( position = rng.normal(size=(n,3)), direction = d,
+                     ekin = rng.exponential(size=n), time = rng.random(n),
+                     weight = rng.random(n),
+                     pdgcode = rng.choice([22,2112,11,-11],n),
+                     userflags = rng.integers(0,5,n) )
+    def create(fn,cols,nsrc,srcname='gen'):
+        w = mcpl.MCPLWriter(fn)
+        w.set_srcname(srcname)
+        w.add_comment('some comment')
+        w.add_stat_sum('nsrc',nsrc)
+        w.add_data('blob',b'data')
+        w.enable_userflags()
+        w.add_particles(**cols)
+        if fn.endswith('_gz.mcpl'):
+            return w.closeandgzip()
+        w.close()
+        return w.filename
+
+    parts = [ genparts(n) for n in nparts ]
+    files = [ create('f%i%s.mcpl'%(i,'_gz' if i==2 else ''),p,100.0*(i+1))
+              for i,p in enumerate(parts) ]
+    allparts = dict( (k,np.concatenate([p[k] for p in parts])) for k in parts[0] )
+    fall = mcpl.MCPLFile(create('all.mcpl',allparts,1500.0))
+
+    ds = mcpl.MCPLDataset(files,blocklength=300)
+    print('Files:',ds.filenames)
+    print('nfiles=%i nparticles=%i len=%i'%(ds.nfiles,ds.nparticles,len(ds)))
+    print('file_nparticles:',ds.file_nparticles)
+    print('stat_sum:',dict(ds.stat_sum))
+    print('sourcename=%s comments=%s blobs=%s'%(ds.sourcename,ds.comments,ds.blobs))
+    print('userflags=%s singleprec=%s'%(ds.opt_userflags,ds.opt_singleprec))
+
+    #Global indexing:
+    fref = mcpl.MCPLFile('all.mcpl',memmap=True)
+    for i in (0,999,1000,3344,3345,3361,3362,3961,-1,5,2000,1999):
+        p = ds[i]
+        fn,idx = ds.locate(i)
+        j = i % ds.nparticles
+        ref = fref.view(j,j+1)
+        assert p.ekin == ref.ekin[0] and p.x == ref.x[0] and p.userflags == ref.userflags[0]
+        print('ds[%i] is particle %i in %s with file_index %i'%(i,idx,fn,p.file_index))
+    for i in (3962,-3963):
+        try:
+            ds[i]
+        except IndexError as e:
+            print('IndexError:',e)
+
+    #Iteration over blocks:
+    blocks = [ blocksum(pb) for pb in ds.particle_blocks ]
+    print('Blocks:',[b[0:2] for b in blocks])
+    x = np.concatenate([ pb.x.copy() for pb in ds.particle_blocks ])
+    assert np.array_equal(x,fref.view().x)
+    assert [p.ekin for p in ds.particles] == [p.ekin for p in fall.particles]
+
+    #Parallel processing of blocks gives the same results:
+    for kw in (dict(workers=1),dict(workers=3),dict(workers=3,processes=True)):
+        assert ds.map_blocks(blocksum,**kw) == blocks
+    for kw in ( dict(memmap=True), dict(prefetch=True) ):
+        ds2 = mcpl.MCPLDataset(files,blocklength=300,**kw)
+        assert ds2.map_blocks(blocksum,workers=2) == blocks
+    print('map_blocks OK')
+
+    #Stats of dataset and merged file:
+    for workers in (1,4):
+        stats = ds.collect_stats(workers=workers)
+        ref = mcpl.collect_stats(fall)
+        for s in sorted(ref):
+            for k,v in sorted(ref[s].items()):
+                v2 = stats[s][k]
+                if isinstance(v,float) or isinstance(v,np.ndarray):
+                    assert np.allclose(v,v2,rtol=1e-12,atol=1e-9),(s,k)
+                elif k!='summary':
+                    assert np.all(v==v2),(s,k)
+        print('collect_stats (workers=%i) OK'%workers)
+    mcpl.dump_stats(ds.collect_stats(workers=2,bin_data=False))
+
+    #Incompatible files:
+    create('bad.mcpl',genparts(3),1.0,srcname='othergen')
+    try:
+        mcpl.MCPLDataset(files+['bad.mcpl'])
+    except mcpl.MCPLError as e:
+        print('MCPLError:',e)
+    else:
+        raise RuntimeError('Expected error')
+
+    #stat:sum: not available in one of the files:
+    create('na.mcpl',genparts(3),-1.0)
+    print('stat_sum:',dict(mcpl.MCPLDataset(files+['na.mcpl']).stat_sum))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,75 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that MCPLFile(..,memmap=True) provides the same particles as the
+#default mode, and test the view() and particle_data access.
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+    from MCPLTestUtils.dirs import test_data_dir as tdir
+    fields = ('x','y','z','ux','uy','uz','polx','poly','polz',
+              'ekin','time','weight','pdgcode','userflags')
+    for d,fn in (('ref','reffile_12.mcpl'),('ref','reffile_skip123.mcpl'),
+                 ('ref','reffile_empty.mcpl'),('ref','reffile_crash.mcpl'),
+                 ('reffmt2','reffile_5.mcpl')):
+        path = tdir.joinpath(d,fn)
+        f = mcpl.MCPLFile(path,blocklength=10)
+        fm = mcpl.MCPLFile(path,blocklength=10,memmap=True)
+        assert not f.memmap and fm.memmap
+        nblocks = 0
+        for b,bm in zip(f.particle_blocks,fm.particle_blocks):
+            assert b.file_offset == bm.file_offset and len(b) == len(bm)
+            for s in fields:
+                assert np.array_equal(getattr(b,s),getattr(bm,s))
+            nblocks += 1
+        #Whole file and subranges:
+        vals = dict( (s,np.concatenate([getattr(b,s) for b in f.particle_blocks]
+                                       or [np.zeros(0)])) for s in fields )
+        for start,stop in ((0,None),(3,17),(-5,None),(50,40)):
+            v = fm.view(start,stop)
+            for s in fields:
+                assert np.array_equal(getattr(v,s),vals[s][start:stop])
+            p = v[0]
+            if p is not None:
+                assert p.file_index == v.file_offset and p.ekin == v.ekin[0]
+        assert len(fm.particle_data) == fm.nparticles
+        #Reading continues correctly after a view and a skip:
+        fm.rewind()
+        fm.skip_forward(min(13,fm.nparticles))
+        p = fm.read()
+        print('%s: %i particles in %i blocks, particle 13: %s'
+              %(fn,fm.nparticles,nblocks,
+                'none' if p is None else 'ekin=%g uz=%g'%(p.ekin,p.uz)))
+
+    #Not possible for gzipped files or in the default mode:
+    path = tdir.joinpath('ref','miscphys.mcpl.gz')
+    for kwargs in ({'memmap':True},{}):
+        try:
+            f = mcpl.MCPLFile(path,**kwargs)
+            f.view()
+        except mcpl.MCPLError as e:
+            print('MCPLError: %s'%e)
+
+if __name__ == '__main__':
+    main()
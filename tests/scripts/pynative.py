@@ -0,0 +1,80 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that MCPLFile(..,native=True), reading particles via libmcpl, provides
+#the same particles as the pure Python implementation.
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+    from MCPLTestUtils.dirs import test_data_dir as tdir
+    fields = ('x','y','z','ux','uy','uz','polx','poly','polz',
+              'ekin','time','weight','pdgcode','userflags')
+    for d,fn in (('ref','miscphys.mcpl.gz'),('ref','reffile_12.mcpl'),
+                 ('ref','reffile_skip123.mcpl.gz'),('ref','reffile_uw.mcpl.gz'),
+                 ('ref','reffile_userflags_is_pos.mcpl.gz'),
+                 ('ref','difficult_unitvector.mcpl.gz'),
+                 ('ref','reffile_empty.mcpl'),('ref','reffile_crash.mcpl'),
+                 ('reffmt2','miscphys.mcpl.gz'),('reffmt2','reffile_12.mcpl')):
+        path = tdir.joinpath(d,fn)
+        f = mcpl.MCPLFile(path,blocklength=10)
+        fn_ = mcpl.MCPLFile(path,blocklength=10,native=True)
+        nblocks = 0
+        for b,bn in zip(f.particle_blocks,fn_.particle_blocks):
+            assert b.file_offset == bn.file_offset and len(b) == len(bn)
+            for s in fields:
+                assert np.array_equal(getattr(b,s),getattr(bn,s))
+            nblocks += 1
+        #Skipping and single particle access:
+        f.rewind()
+        fn_.rewind()
+        for n in (0,3,20,1):
+            assert f.skip_forward(n) == fn_.skip_forward(n)
+            p,pn = f.read(), fn_.read()
+            assert (p is None) == (pn is None)
+            if p is not None:
+                assert p.file_index == pn.file_index
+                assert p.ekin == pn.ekin and p.direction.tolist() == pn.direction.tolist()
+        print('%s/%s: %i particles in %i blocks, native=%s'
+              %(d,fn,fn_.nparticles,nblocks,fn_.native))
+
+    #Errors in libmcpl must be raised as exceptions rather than ending the
+    #process:
+    import gzip
+    data = gzip.open(tdir.joinpath('ref','miscphys.mcpl.gz')).read()[:-100]
+    with open('truncated.mcpl','wb') as fh:
+        fh.write(data)
+    with gzip.open('truncated.mcpl.gz','wb') as fh:
+        fh.write(data)
+    for fn in ('truncated.mcpl','truncated.mcpl.gz'):
+        f = mcpl.MCPLFile(fn,blocklength=10,native=True)
+        assert f.native
+        for i in range(2):
+            try:
+                for b in f.particle_blocks:
+                    pass
+            except mcpl.MCPLError as e:
+                print('%s: MCPLError raised: %s'%(fn,e))
+
+if __name__ == '__main__':
+    main()
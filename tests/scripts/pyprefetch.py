@@ -0,0 +1,81 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that MCPLFile(..,prefetch=True), inflating gzipped files in a background
+#thread, provides the same particles and errors as the default mode. Tiny chunk
+#sizes are also used, to exercise reads crossing chunk boundaries.
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+    from MCPLTestUtils.dirs import test_data_dir as tdir
+    fields = ('x','y','z','ux','uy','uz','polx','poly','polz',
+              'ekin','time','weight','pdgcode','userflags')
+
+    def load(path,prefetch):
+        try:
+            f = mcpl.MCPLFile(path,blocklength=7,prefetch=prefetch)
+            res = [ f.comments ]
+            res += [ np.concatenate([getattr(b,s) for b in f.particle_blocks]
+                                    or [np.zeros(0)]) for s in fields ]
+            #Skipping forward and backwards (rewind):
+            f.rewind()
+            for n in (3,0,20):
+                f.skip_forward(n)
+                p = f.read()
+                res.append( None if p is None else (p.file_index,p.ekin) )
+            return res,'%i particles'%f.nparticles
+        except mcpl.MCPLError as e:
+            return None,'MCPLError: %s'%e
+
+    chunksizes = ( ( mcpl._prefetch._GzipPrefetcher.rawchunksize,
+                     mcpl._prefetch._GzipPrefetcher.chunksize ), (7,13) )
+
+    with open(tdir.joinpath('ref','miscphys.mcpl.gz'),'rb') as fh:
+        data = fh.read()
+    with open('truncated.mcpl.gz','wb') as fh:
+        fh.write(data[0:len(data)*2//3])
+
+    for d,fn in (('ref','miscphys.mcpl.gz'),('ref','reffile_skip123.mcpl.gz'),
+                 ('ref','reffile_uw.mcpl.gz'),('ref','reffile_encodings.mcpl.gz'),
+                 ('ref','reffile_empty.mcpl.gz'),('ref','reffile_notreallygz.mcpl.gz'),
+                 ('ref','reffile_truncated.mcpl.gz'),('ref','reffile_bad1.mcpl.gz'),
+                 ('reffmt2','miscphys.mcpl.gz'),(None,'truncated.mcpl.gz')):
+        path = tdir.joinpath(d,fn) if d else fn
+        ref,refmsg = load(path,False)
+        for rawchunksize,chunksize in chunksizes:
+            mcpl._prefetch._GzipPrefetcher.rawchunksize = rawchunksize
+            mcpl._prefetch._GzipPrefetcher.chunksize = chunksize
+            res,msg = load(path,True)
+            assert msg == refmsg
+            assert (res is None) == (ref is None)
+            if res is not None:
+                assert res[0] == ref[0] and res[-3:] == ref[-3:]
+                for a,b in zip(res[1:-3],ref[1:-3]):
+                    assert np.array_equal(a,b)
+        mcpl._prefetch._GzipPrefetcher.rawchunksize = chunksizes[0][0]
+        mcpl._prefetch._GzipPrefetcher.chunksize = chunksizes[0][1]
+        print('%s: %s'%(fn,msg))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Test MCPLFile.seek() and MCPLFile.read_indices() in the different reading
+#modes, including the use of checkpoints when seeking in compressed files.
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+    from MCPLTestUtils.dirs import test_data_dir as tdir
+
+    #Make checkpoints more frequent than normal, to get several in a small file,
+    #and allow only a few of them so the spacing is doubled along the way:
+    mcpl._prefetch._GzipCheckpoints.chunksize = 1000
+    mcpl._prefetch._GzipCheckpoints.spacing = 5000
+    mcpl._prefetch._GzipCheckpoints.maxcheckpoints = 8
+
+    rng = np.random.default_rng(42)
+    n = 20000
+    d = rng.normal(size=(n,3))
+    d /= np.linalg.norm(d,axis=1)[:,None]
+    w = mcpl.MCPLWriter('f.mcpl')
+    w.enable_userflags()
+    w.add_particles( position = rng.normal(size=(n,3)), direction = d,
+                     ekin = rng.random(n), userflags = np.arange(n) )
+    w.close()
+    w = mcpl.MCPLWriter('fgz.mcpl')
+    w.enable_userflags()
+    w.add_particles( position = rng.normal(size=(n,3)), direction = d,
+                     ekin = rng.random(n), userflags = np.arange(n) )
+    fngz = w.closeandgzip()
+
+    fields = ('x','y','z','ux','uy','uz','ekin','weight','pdgcode','userflags')
+    errors = set()
+    modes = ( dict(), dict(memmap=True), dict(native=None), dict(prefetch=True) )
+    for fn in ('f.mcpl',fngz,'ref/reffile_12.mcpl','ref/miscphys.mcpl.gz',
+               'reffmt2/miscphys.mcpl.gz'):
+        if fn.startswith('ref'):
+            fn = tdir.joinpath(*fn.split('/'))
+        ref = mcpl.MCPLFile(fn,blocklength=1000000).read_block()
+        for mode in modes:
+            if 'memmap' in mode and str(fn).endswith('.gz'):
+                continue
+            bl = max(2,len(ref)//60)
+            f = mcpl.MCPLFile(fn,blocklength=bl,**mode)
+            np_ = f.nparticles
+            #Random access to particles, with sequential reads in between:
+            for i in list(rng.integers(0,np_,20))+[np_-1,0,np_//2]:
+                assert f.seek(i)
+                p = f.read()
+                assert p.file_index == i and p.ekin == ref.ekin[i]
+                assert p.userflags == ref.userflags[i] and p.x == ref.x[i]
+                if i+1 < np_:
+                    assert f.read().ekin == ref.ekin[i+1]
+            assert not f.seek(np_)
+            assert f.read() is None and f.read_block() is None
+            f.seek(bl-1)
+            assert f.read_block().file_offset == bl
+            try:
+                f.seek(-1)
+            except mcpl.MCPLError as e:
+                assert str(e) == 'Requested position is negative'
+            #Read particles at arbitrary positions, in the middle of reading
+            #the file sequentially:
+            f.rewind()
+            f.read_block()
+            p = f.read()
+            for idx in ( rng.integers(0,np_,3*np_), [np_//2,0,np_//2,np_-1], [],
+                         rng.permutation(np_)[:10], np.arange(np_) ):
+                bi = f.read_indices(idx)
+                assert len(bi) == len(idx)
+                for s in fields:
+                    assert np.array_equal(getattr(bi,s),getattr(ref,s)[idx])
+            assert p.file_index == 0 and p.ekin == ref.ekin[0]
+            assert f.read().file_index == 1
+            assert np.array_equal(f.read_block().ekin,ref.ekin[bl:2*bl])
+            for bad in ([np_],[-1],[0.5]):
+                try:
+                    f.read_indices(bad)
+                except mcpl.MCPLError as e:
+                    errors.add(str(e))
+        print('%s: %i particles OK'%('/'.join(str(fn).split('/')[-2:]),np_))
+    for e in sorted(errors):
+        print('MCPLError: %s'%e)
+
+if __name__ == '__main__':
+    main()
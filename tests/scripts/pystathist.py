@@ -0,0 +1,108 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that histograms from collect_stats are identical to those from
+#np.histogram applied block by block (as done in earlier versions of MCPL) when
+#the data is histogrammed from in-memory copies, and that they are within the
+#documented bounds when rebinned from fine histograms (as for large files).
+
+def check_hists(mcpl,np,f,stats,exact):
+    finebins = mcpl._stats._stats_finebins
+    nchecked = 0
+    for s in ('ekin','x','y','z','ux','uy','uz','time','weight','polx','poly','polz'):
+        h,bins = stats[s]['hist'],stats[s]['hist_bins']
+        if ( s=='weight' and f.opt_universalweight ) or ( s.startswith('pol') and not f.opt_polarisation ):
+            continue#constant, not histogrammed from data
+        href, vals, weights = None, [], []
+        for pb in f.particle_blocks:
+            hb,binsref = np.histogram(getattr(pb,s),bins=len(h),range=(bins[0],bins[-1]),
+                                      weights=(None if s=='weight' else pb.weight))
+            href = hb if href is None else href + hb
+            vals.append(np.array(getattr(pb,s),dtype=float))
+            weights.append(np.ones(len(pb)) if s=='weight' else np.array(pb.weight,dtype=float))
+        assert np.array_equal(bins,binsref) and bins.dtype==binsref.dtype
+        assert h.dtype==href.dtype
+        if exact:
+            assert np.array_equal(h,href)
+        else:
+            #Only values closer to a bin edge than the max width of the fine
+            #bins can end up in the neighbouring bin:
+            vals, weights = np.concatenate(vals), np.concatenate(weights)
+            finite = np.isfinite(vals)
+            vals, weights = vals[finite], weights[finite]
+            wfine = 2*(vals.max()-vals.min())/(finebins-2)
+            edges = np.asarray(bins,dtype=float)
+            idx = np.searchsorted(edges,vals)
+            near = np.zeros(len(edges))#weight of values near each edge
+            for i in (idx-1,idx):
+                ok = (i>=0) & (i<len(edges))
+                i = np.clip(i,0,len(edges)-1)
+                sel = ok & ( np.abs(vals-edges[i]) < wfine )
+                np.add.at(near,i[sel],weights[sel])
+            allowed = near[:-1] + near[1:] + 1e-5 * np.abs(href).max()
+            assert np.all( np.abs(np.asarray(h,dtype=float)-href) <= allowed )
+        nchecked += 1
+    return nchecked
+
+def main():
+    import mcpldev as mcpl
+    import mcpldev._stats as mcplimpl
+    import numpy as np
+    from MCPLTestUtils.dirs import test_data_dir as tdir
+    sample_max_orig = mcplimpl._stats_sample_max
+    for fn in ('reffile_12.mcpl','reffile_userflags_is_pos.mcpl.gz',
+               'ref_statsum.mcpl.gz','gammas_uw.mcpl.gz','reffile_encodings.mcpl.gz'):
+        path = tdir.joinpath('ref',fn)
+        for blocklength in (7,10000):
+            for sample_max in (sample_max_orig,0):
+                mcplimpl._stats_sample_max = sample_max
+                f = mcpl.MCPLFile(path,blocklength=blocklength)
+                nchecked = check_hists(mcpl,np,f,mcpl.collect_stats(f),exact=bool(sample_max))
+                print('%s (blocklength=%i, %s): %i %s histograms'
+                      %(fn,blocklength,'in memory' if sample_max else 'rebinned',nchecked,
+                        'identical' if sample_max else 'good'))
+    mcplimpl._stats_sample_max = sample_max_orig
+
+    #A larger file with continuous values, over a range growing along the way
+    #(also processed in parts via MCPLDataset):
+    rng = np.random.default_rng(123)
+    n = 300000
+    d = rng.normal(size=(n,3))
+    d /= np.linalg.norm(d,axis=1)[:,None]
+    pos = rng.normal(size=(n,3)) * np.linspace(1.0,100.0,n)[:,None]
+    w = mcpl.MCPLWriter('big.mcpl')
+    w.add_particles( position = pos, direction = d, ekin = rng.exponential(size=n),
+                     time = np.round(rng.random(n)*100.0), weight = rng.random(n) )
+    w.close()
+    f = mcpl.MCPLFile('big.mcpl')
+    print('big.mcpl: %i good histograms'%check_hists(mcpl,np,f,mcpl.collect_stats(f),exact=False))
+    ds = mcpl.MCPLDataset(['big.mcpl','big.mcpl'])
+    stats_ds = ds.collect_stats(workers=2)
+    stats = mcpl.collect_stats(f)
+    for s in ('ekin','x','time','weight'):
+        assert np.array_equal(stats_ds[s]['hist_bins'],stats[s]['hist_bins'])
+        assert np.allclose(stats_ds[s]['hist'],2*stats[s]['hist'],rtol=1e-5)
+    print('big.mcpl: same histograms with MCPLDataset')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,163 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that files written with MCPLWriter are identical to those written with
+#mcpl_add_particle in the C API (accessed via ctypes).
+
+import ctypes
+
+class mcpl_outfile_t(ctypes.Structure):
+    _fields_ = [('internal',ctypes.c_void_p)]
+
+class mcpl_particle_t(ctypes.Structure):
+    _pack_ = 1
+    _fields_ = [('ekin',ctypes.c_double),('polarisation',ctypes.c_double*3),
+                ('position',ctypes.c_double*3),('direction',ctypes.c_double*3),
+                ('time',ctypes.c_double),('weight',ctypes.c_double),
+                ('pdgcode',ctypes.c_int32),('userflags',ctypes.c_uint32)]
+
+def load_lib():
+    from MCPLTestUtils.dirs import mcpllib
+    lib = ctypes.CDLL(str(mcpllib))
+    OF = mcpl_outfile_t
+    for fct,res,args in (('mcpl_create_outfile',OF,[ctypes.c_char_p]),
+                         ('mcpl_get_empty_particle',ctypes.POINTER(mcpl_particle_t),[OF]),
+                         ('mcpl_add_particle',None,[OF,ctypes.POINTER(mcpl_particle_t)]),
+                         ('mcpl_close_outfile',None,[OF]),
+                         ('mcpl_enable_userflags',None,[OF]),
+                         ('mcpl_enable_polarisation',None,[OF]),
+                         ('mcpl_enable_doubleprec',None,[OF]),
+                         ('mcpl_enable_universal_pdgcode',None,[OF,ctypes.c_int32]),
+                         ('mcpl_enable_universal_weight',None,[OF,ctypes.c_double]),
+                         ('mcpl_hdr_set_srcname',None,[OF,ctypes.c_char_p]),
+                         ('mcpl_hdr_add_comment',None,[OF,ctypes.c_char_p]),
+                         ('mcpl_hdr_add_stat_sum',None,[OF,ctypes.c_char_p,ctypes.c_double]),
+                         ('mcpl_hdr_add_data',None,[OF,ctypes.c_char_p,ctypes.c_uint32,ctypes.c_char_p])):
+        getattr(lib,fct).restype = res
+        getattr(lib,fct).argtypes = args
+    return lib
+
+def main():
+    import mcpldev as mcpl
+    import numpy as np
+    lib = load_lib()
+
+    #Particles, including directions along the axes and at the edges of the
+    #different projections used when packing them:
+    rng = np.random.default_rng(123)
+    n = 1000
+    d = rng.normal(size=(n,3))
+    d[0:10] = [(1,0,0),(0,-1,0),(0,0,-1),(0,0,1),(0.6,0.8,0),(-0.8,0,-0.6),
+               (0,0.6,-0.8),(0.6,-0.6,0),(0.5,-0.5,0.5),(-1,0,0)]
+    d /= np.linalg.norm(d,axis=1)[:,None]
+    cols = dict( position = rng.normal(size=(n,3)) * [1.0,1e3,1e-3],
+                 direction = d,
+                 ekin = np.abs(rng.normal(size=n)),
+                 time = rng.random(n),
+                 weight = rng.random(n),
+                 pdgcode = rng.integers(-3000,3000,n),
+                 polarisation = rng.random((n,3)),
+                 userflags = rng.integers(0,2**32,n,dtype=np.uint64) )
+    cols['ekin'][5] = 0.0
+
+    for opts in ( (), ('doubleprec','polarisation','userflags'),
+                  ('universal_weight','universal_pdgcode'),
+                  ('doubleprec','universal_weight'),
+                  ('polarisation','userflags','universal_pdgcode') ):
+        w = mcpl.MCPLWriter('py')
+        c = lib.mcpl_create_outfile(b'c.mcpl')
+        w.set_srcname('mygen')
+        lib.mcpl_hdr_set_srcname(c,b'mygen')
+        w.add_comment('some comment')
+        lib.mcpl_hdr_add_comment(c,b'some comment')
+        w.add_stat_sum('nsource',-1)
+        lib.mcpl_hdr_add_stat_sum(c,b'nsource',-1.0)
+        w.add_data('someblob',b'\x00\x01abc')
+        lib.mcpl_hdr_add_data(c,b'someblob',5,b'\x00\x01abc')
+        for o in opts:
+            args = { 'universal_weight' : (2.5,),
+                     'universal_pdgcode' : (-11,) }.get(o,())
+            getattr(w,'enable_'+o)(*args)
+            getattr(lib,'mcpl_enable_'+o)(c,*args)
+        #Python, in two chunks:
+        w.add_particles(**dict( (k,v[0:300]) for k,v in cols.items() ))
+        w.add_particles(**dict( (k,v[300:]) for k,v in cols.items() ))
+        #C, one at a time:
+        p = lib.mcpl_get_empty_particle(c).contents
+        for i in range(n):
+            p.ekin = cols['ekin'][i]
+            p.position[:] = cols['position'][i].tolist()
+            p.direction[:] = cols['direction'][i].tolist()
+            p.polarisation[:] = cols['polarisation'][i].tolist()
+            p.time = cols['time'][i]
+            p.weight = cols['weight'][i]
+            p.pdgcode = int(cols['pdgcode'][i])
+            p.userflags = int(cols['userflags'][i])
+            lib.mcpl_add_particle(c,ctypes.byref(p))
+        #Update stat:sum: after particles were added:
+        w.add_stat_sum('nsource',1e6)
+        lib.mcpl_hdr_add_stat_sum(c,b'nsource',1e6)
+        w.close()
+        lib.mcpl_close_outfile(c)
+        with open('py.mcpl','rb') as fh:
+            data_py = fh.read()
+        with open('c.mcpl','rb') as fh:
+            data_c = fh.read()
+        print('Options %s: %i bytes, identical: %s'%(','.join(opts) or 'none',
+                                                      len(data_py),data_py==data_c))
+        assert data_py == data_c
+
+    #Read back, after compressing:
+    with mcpl.MCPLWriter('py2.mcpl') as w:
+        w.enable_doubleprec()
+        w.add_particles(ekin=[1.0,2.0],ux=0.0,uy=0.0,uz=[1.0,-1.0],pdgcode=22)
+        w.add_particles(ekin=3.0,direction=(0.6,0.8,0.0),x=1.5)
+        gzname = w.closeandgzip()
+    f = mcpl.MCPLFile(gzname)
+    print('Wrote %s with %i particles:'%(gzname,f.nparticles))
+    for p in f.particles:
+        print('   ',p.pdgcode,p.ekin,p.position.tolist(),p.direction.tolist(),p.weight)
+
+    #Errors:
+    def expect_error(fct,*args,**kwargs):
+        try:
+            fct(*args,**kwargs)
+        except mcpl.MCPLError as e:
+            print('MCPLError: %s'%e)
+        else:
+            raise RuntimeError('Expected error')
+    w = mcpl.MCPLWriter('py3.mcpl')
+    expect_error(w.add_comment,'stat:bla')
+    expect_error(w.add_particles,ekin=1.0,ux=1.0,uy=1.0,uz=0.0)
+    expect_error(w.add_particles,ekin=-1.0,ux=1.0,uy=0.0,uz=0.0)
+    expect_error(w.add_particles,ekin=1.0,ux=1.0,uy=0.0)
+    expect_error(w.add_particles,ekin=1.0,ux=1.0,uy=0.0,uz=0.0,energy=1.0)
+    expect_error(w.add_particles,ekin=[1.0,2.0],ux=[1.0,0.0,0.0],uy=0.0,uz=0.0)
+    w.add_particles(ekin=1.0,ux=1.0,uy=0.0,uz=0.0)
+    expect_error(w.enable_userflags)
+    expect_error(w.add_stat_sum,'newkey',1.0)
+    w.close()
+    expect_error(w.add_particles,ekin=1.0,ux=1.0,uy=0.0,uz=0.0)
+
+if __name__ == '__main__':
+    main()
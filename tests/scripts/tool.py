@@ -302,5 +302,13 @@ def main():
     #====> extracting and calculating md5sum of blob with key "notutf8key_XXX_":
     #a04637816e7436951f0512d38d48f212
 
+    #Header info as JSON (one line per file, non-utf8 bytes are replaced):
+    cmd('--json-header',fail=True)
+    cmd('--json-header','-j','rf5cp.mcpl',fail=True)
+    copy(dd('reffile_encodings.mcpl.gz'),'rfenc.mcpl.gz')
+    copy(dd('reffile_12.mcpl'),'rf12cp.mcpl')
+    cmd('--json-header','rf5cp.mcpl.gz','rf12cp.mcpl','statsum_copy.mcpl.gz',
+        'rfenc.mcpl.gz','rfcrash.mcpl','rfempty.mcpl')
+
 if __name__ == '__main__':
     main()
@@ -0,0 +1,101 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that mcpltool --from-text reproduces the particles written with --text
+#(by mcpltool or pymcpltool), and that the output does not depend on the
+#number of threads.
+
+import pathlib
+import mcpldev as mcpl
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same )
+
+hdr = ( '#MCPL-ASCII\n#ASCII-FORMAT: v1\n#NPARTICLES: %i\n#END-HEADER\n'
+        'index     pdgcode ekin x y z ux uy uz time weight polx poly polz'
+        '  userflags\n' )
+
+def write_text( fn, lines, nparticles = None ):
+    if nparticles is None:
+        nparticles = len(lines)
+    pathlib.Path(fn).write_text( hdr%nparticles + ''.join(l+'\n' for l in lines) )
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    p1 = '0 22 1.5 0 0 0 0 0 1 0 2 0 0 0 0x00000000'
+    p2 = '1 22 0.25 1 2 3 0 -1 0 0.5 2 0 0 0 0x00000000'
+    p3 = '2 2112 1e-3 -1 -2 -3 0.6 0 0.8 0.1 0.5 0 0.5 0 0x00000007'
+
+    #Illegal usage:
+    write_text('ok.txt',[p1,p2])
+    cmd('--from-text','ok.txt',fail=True)
+    cmd('--from-text','ok.txt','out.mcpl','extra.mcpl',fail=True)
+    cmd('--from-text','--text','ok.txt','out.mcpl',fail=True)
+    cmd('--from-text','ok.txt','ok.txt',fail=True)
+
+    #Universal pdgcode and weight, single precision:
+    cmd('--from-text','ok.txt','ok.mcpl')
+    cmd('-l0','ok.mcpl.gz')
+
+    #Per-particle pdgcode and weight, polarisation and userflags, with extra
+    #whitespace, CRLF line endings and a missing final newline. Values like 0.1
+    #need double precision:
+    pathlib.Path('mixed.txt').write_bytes(
+        ( hdr%3 + '   ' + p1 + '  \n\n' + p2 + '\r\n' + p3 ).replace('\n','\r\n').encode() )
+    cmd('--from-text','--threads=2','mixed.txt','mixed.mcpl')
+    cmd('-l0','mixed.mcpl.gz')
+
+    #Problems in the input are reported with line numbers:
+    write_text('bad1.txt',[p1,p2],nparticles=3)
+    write_text('bad2.txt',[p1,p2.replace('0.25','0.2.5')])
+    write_text('bad3.txt',[p1,p2.replace('-1 0 ','-0.9 0 ')])
+    write_text('bad4.txt',[p1,p2.replace('0.25','-0.25')])
+    write_text('bad5.txt',[p1,p2+' 7'])
+    write_text('bad6.txt',[p1,p2.replace('0x00000000','0')])
+    write_text('bad7.txt',[p1,p2.replace('1 22','1 22x')])
+    pathlib.Path('bad8.txt').write_text( hdr.replace('v1','v2')%1 + p1 + '\n' )
+    pathlib.Path('bad9.txt').write_text( '' )
+    for i in range(1,10):
+        cmd('--from-text',f'bad{i}.txt',f'bad{i}.mcpl',fail=True)
+
+    #Converting --text output back gives the same particles, independently of
+    #the number of threads (and for text written by pymcpltool as well):
+    for fn in ('miscphys.mcpl.gz','reffile_12.mcpl','reffile_skip123.mcpl.gz',
+               'difficult_unitvector.mcpl.gz','reffile_userflags_is_pos.mcpl.gz',
+               'reffile_encodings.mcpl.gz','reffile_uw.mcpl.gz',
+               'reffile_empty.mcpl'):
+        bn = fn.split('.')[0]
+        cmd('--text',dd(fn),f'{bn}.txt')
+        cmd('--from-text',f'{bn}.txt',f'{bn}_rt.mcpl')
+        cmd('-j',f'{bn}_rt.mcpl.gz')
+        cmd('--text',f'{bn}_rt.mcpl.gz',f'{bn}_rt.txt')
+        check_same(f'{bn}.txt',f'{bn}_rt.txt')
+        cmd('--from-text','--threads=3',f'{bn}.txt',f'{bn}_rt_mt.mcpl')
+        check_same(f'{bn}_rt.mcpl.gz',f'{bn}_rt_mt.mcpl.gz')
+        mcpl.convert2ascii(dd(fn),f'{bn}_py.txt')
+        cmd('--from-text',f'{bn}_py.txt',f'{bn}_rt_py.mcpl')
+        check_same(f'{bn}_rt.mcpl.gz',f'{bn}_rt_py.mcpl.gz')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,73 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+
+
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same, copy )
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    fmisc = copy(dd('miscphys.mcpl.gz'),'.')
+    fstat = copy(dd('ref_statsum.mcpl.gz'),'.')
+    fpol = copy(dd('reffile_12.mcpl'),'.')
+    ffmt2 = copy(test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz'),
+                 'miscphys_fmt2.mcpl.gz')
+
+    #Illegal usage:
+    cmd('--rebalance-weights','0.5',fmisc,fail=True)
+    cmd('--rebalance-weights','0.5',fmisc,'out.mcpl','out2.mcpl',fail=True)
+    cmd('--rebalance-weights','0',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','-1',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','abc',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','0.5','--seed','-1',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','0.5','--rebalance-weights','0.5',
+        fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','0.5','-e',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','0.5','--sample','10',fmisc,'out.mcpl',fail=True)
+    cmd('--rebalance-weights','0.5',fmisc,fmisc,fail=True)
+
+    #Splitting and Russian roulette:
+    cmd('--rebalance-weights','0.5',fmisc,'rb_1')
+    cmd('-l0','rb_1.mcpl.gz')
+    cmd('--rebalance-weights','0.5','--seed','17',fmisc,'rb_2')
+    cmd('-l0','-n','rb_2.mcpl.gz')
+    cmd('--reb','0.02',fpol,'rb_3')
+    cmd('-l20','-n','rb_3.mcpl.gz')
+
+    #Results do not depend on the number of threads:
+    cmd('--rebalance-weights','0.5','--threads=3',fmisc,'rb_1_mt')
+    check_same('rb_1.mcpl.gz','rb_1_mt.mcpl.gz')
+    cmd('--rebalance-weights','0.02','--threads=0',fpol,'rb_3_mt')
+    check_same('rb_3.mcpl.gz','rb_3_mt.mcpl.gz')
+
+    #Old MCPL-2 files (processed one particle at a time, with the same result):
+    cmd('--rebalance-weights','0.5',ffmt2,'rb_fmt2')
+    cmd('-l0','-n','rb_fmt2.mcpl.gz')
+
+    #Stat:sum entries are kept:
+    cmd('--rebalance-weights','0.9','--threads=2',fstat,'rb_stat')
+    cmd('-j','rb_stat.mcpl.gz')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,74 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same, copy )
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    fmisc = copy(dd('miscphys.mcpl.gz'),'.')
+    fstat = copy(dd('ref_statsum.mcpl.gz'),'.')
+    ffmt2 = copy(test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz'),
+                 'miscphys_fmt2.mcpl.gz')
+
+    #Illegal usage:
+    cmd('--sample',fail=True)
+    cmd('--sample','10',fmisc,fail=True)
+    cmd('--sample','10','--sample','10',fmisc,'out.mcpl',fail=True)
+    cmd('--sample','10','-e',fmisc,'out.mcpl',fail=True)
+    cmd('--seed','1',fmisc,'out.mcpl',fail=True)
+    cmd('--sample','10','--seed','1','--seed','1',fmisc,'out.mcpl',fail=True)
+    for bad_k in ['0','-1','abc','']:
+        cmd('--sample',bad_k,fmisc,'out.mcpl',fail=True)
+    cmd('--sample','10','--seed','-1',fmisc,'out.mcpl',fail=True)
+    cmd('--sample','10',fmisc,fmisc,fail=True)
+
+    #Sampling:
+    cmd('--sample','20',fmisc,'sample_1')
+    cmd('-l0','sample_1.mcpl.gz')
+    cmd('--sample','20','--seed','12345',fmisc,'sample_2')
+    cmd('-l0','-n','sample_2.mcpl.gz')
+
+    #Same seed gives same results:
+    cmd('--seed','12345','--sample','20',fmisc,'sample_3')
+    check_same('sample_2.mcpl.gz','sample_3.mcpl.gz')
+
+    #Large samples (all particles are selected if K is too large):
+    cmd('--sample','150',fmisc,'sample_4')
+    cmd('-j','sample_4.mcpl.gz')
+    cmd('--sample','1000',fmisc,'sample_5')
+    cmd('-j','sample_5.mcpl.gz')
+
+    #Stat:sum entries are scaled:
+    cmd('-j',fstat)
+    cmd('--sample','2',fstat,'sample_stat')
+    cmd('-j','sample_stat.mcpl.gz')
+
+    #Old MCPL-2 files (transferred one particle at a time) give the same
+    #selection:
+    cmd('--sample','20',ffmt2,'sample_fmt2')
+    cmd('-l0','-n','sample_fmt2.mcpl.gz')
+
+if __name__ == '__main__':
+    main()
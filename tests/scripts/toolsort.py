@@ -0,0 +1,88 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same, copy )
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    fmisc = copy(dd('miscphys.mcpl.gz'),'.')
+    fstat = copy(dd('ref_statsum.mcpl.gz'),'.')
+    fpol = copy(dd('reffile_12.mcpl'),'.')
+    ffmt2 = copy(test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz'),
+                 'miscphys_fmt2.mcpl.gz')
+
+    #Illegal usage:
+    cmd('--sort',fail=True)
+    cmd('--sort','ekin',fmisc,fail=True)
+    cmd('--sort','ekin','--sort','ekin',fmisc,'out.mcpl',fail=True)
+    cmd('--sort','ekin','-e',fmisc,'out.mcpl',fail=True)
+    cmd('--sort','ekin','--where','ekin>1',fmisc,'out.mcpl',fail=True)
+    cmd('--sort','ekin',fmisc,fmisc,fail=True)
+    for bad_keys in ['', 'energy', 'ekin,', ',ekin', 'ekin,,x', '--ekin',
+                     'ekin x', 'x,y,z,ekin,t']:
+        cmd('--sort',bad_keys,fmisc,'out.mcpl',fail=True)
+
+    #Sorting:
+    cmd('--sort','pdg,ekin',fmisc,'sorted_1')
+    cmd('-l0','sorted_1.mcpl.gz')
+    cmd('--sort','-ekin',fmisc,'sorted_2')
+    cmd('-l0','sorted_2.mcpl.gz')
+    cmd('--sort','uf,-polx',fpol,'sorted_3')
+    cmd('-l0','sorted_3.mcpl.gz')
+
+    #Sorting is stable, so sorting an already sorted file changes nothing:
+    cmd('--sort','+weight',fpol,'sorted_4')
+    cmd('-l0','sorted_4.mcpl.gz')
+    cmd('--sort','pdg,ekin','sorted_1.mcpl.gz','sorted_5')
+    check_same('sorted_1.mcpl.gz','sorted_5.mcpl.gz')
+
+    #Metadata (including stat:sum entries) is kept:
+    cmd('--sort','z',fstat,'sorted_stat')
+    cmd('-j','sorted_stat.mcpl.gz')
+
+    #Multi-threaded sorting gives identical results:
+    cmd('--sort','pdg,ekin','--threads=99999',fmisc,'out.mcpl',fail=True)
+    cmd('--sort','pdg,ekin','--threads=3',fmisc,'sorted_1_mt')
+    check_same('sorted_1.mcpl.gz','sorted_1_mt.mcpl.gz')
+    cmd('--threads=0','--sort','-ekin',fmisc,'sorted_2_mt')
+    check_same('sorted_2.mcpl.gz','sorted_2_mt.mcpl.gz')
+
+    #Space-filling curves (adding a spatial index blob, which is dropped when
+    #the particles are sorted again):
+    for bad_keys in ['morton,ekin', 'ekin,hilbert', '-morton', 'morton,morton']:
+        cmd('--sort',bad_keys,fmisc,'out.mcpl',fail=True)
+    cmd('--sort','morton',fmisc,'sorted_morton')
+    cmd('-l0','sorted_morton.mcpl.gz')
+    cmd('--sort','hilbert','--threads=2',fmisc,'sorted_hilbert')
+    cmd('-l0','sorted_hilbert.mcpl.gz')
+    cmd('--sort','ekin','sorted_hilbert.mcpl.gz','sorted_6')
+    cmd('-j','sorted_6.mcpl.gz')
+
+    #Old MCPL-2 files:
+    cmd('--sort','pdg,ekin',ffmt2,'sorted_fmt2')
+    cmd('-l0','sorted_fmt2.mcpl.gz')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,47 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+
+
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import cmd
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    #Illegal usage:
+    cmd('--stats',fail=True)
+    cmd('--stats',dd('miscphys.mcpl.gz'),dd('reffile_12.mcpl'),fail=True)
+    cmd('--stats','-l10',dd('miscphys.mcpl.gz'),fail=True)
+    cmd('--stats','-e',dd('miscphys.mcpl.gz'),fail=True)
+    cmd('--stats',dd('reffile_empty.mcpl'),fail=True)
+
+    #Statistics (output as with pymcpltool --stats):
+    cmd('--stats',dd('miscphys.mcpl.gz'))
+    cmd('--stats','--threads=3',dd('miscphys.mcpl.gz'))
+    cmd('--stats',test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz'))
+    cmd('--stats','--threads=0',dd('reffile_12.mcpl'))
+    cmd('--stats',dd('gammas_uw.mcpl.gz'))
+    cmd('--stats',dd('reffile_encodings.mcpl.gz'))
+
+if __name__ == '__main__':
+    main()
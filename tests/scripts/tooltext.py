@@ -0,0 +1,84 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+# NEEDS: numpy
+
+#Check that mcpltool --text writes values which read back as exactly the same
+#numbers as in the MCPL files, and that the output does not depend on the
+#number of threads.
+
+import pathlib
+import mcpldev as mcpl
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same )
+
+def check_values( mcplfile, textfile ):
+    lines = [ l for l in pathlib.Path(textfile).read_text().splitlines()
+              if not l.startswith('#') ][1:]
+    with mcpl.MCPLFile(mcplfile,blocklength=1) as f:
+        assert len(lines) == f.nparticles
+        for l,p in zip(lines,f.particles):
+            v = l.split()
+            expected = [ p.ekin, p.x, p.y, p.z, p.ux, p.uy, p.uz,
+                         p.time, p.weight, p.polx, p.poly, p.polz ]
+            assert int(v[0]) == p.file_index
+            assert int(v[1]) == p.pdgcode
+            assert int(v[-1],16) == p.userflags
+            #float32 values are stored in double precision after decoding,
+            #so this is an exact comparison in all cases:
+            for s,e in zip(v[2:-1],expected):
+                if float(s) != float(e):
+                    raise SystemExit(f'Value mismatch: {s} vs. {e!r}')
+    print(f"===> Values in {pathlib.Path(textfile).name} are exact.")
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    #Illegal usage:
+    cmd('--text','--threads=2',dd('reffile_12.mcpl'),fail=True)
+    cmd('--text','--threads=-1',dd('reffile_12.mcpl'),'out.txt',fail=True)
+
+    #Short files are shown in full:
+    cmd('--text',dd('reffile_12.mcpl'),'r12.txt')
+    print(pathlib.Path('r12.txt').read_text())
+    cmd('--text',dd('difficult_unitvector.mcpl.gz'),'du.txt')
+    print(pathlib.Path('du.txt').read_text())
+    cmd('--text',dd('reffile_empty.mcpl'),'empty.txt')
+    print(pathlib.Path('empty.txt').read_text())
+
+    #Values read back exactly, independently of the number of threads:
+    for fn in ('miscphys.mcpl.gz','reffile_12.mcpl','reffile_skip123.mcpl.gz',
+               'difficult_unitvector.mcpl.gz','reffile_userflags_is_pos.mcpl.gz',
+               'reffile_encodings.mcpl.gz'):
+        bn = fn.split('.')[0]
+        cmd('--text',dd(fn),f'{bn}.txt')
+        check_values(dd(fn),f'{bn}.txt')
+        cmd('--text','--threads=3',dd(fn),f'{bn}_mt.txt')
+        check_same(f'{bn}.txt',f'{bn}_mt.txt')
+        cmd('--text','--threads=0',dd(fn),f'{bn}_mt0.txt')
+        check_same(f'{bn}.txt',f'{bn}_mt0.txt')
+    ffmt2 = test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz')
+    cmd('--text',ffmt2,'fmt2.txt')
+    check_values(ffmt2,'fmt2.txt')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,124 @@
+
+################################################################################
+##                                                                            ##
+##  This file is part of MCPL (see https://mctools.github.io/mcpl/)           ##
+##                                                                            ##
+##  Copyright 2015-2026 MCPL developers.                                      ##
+##                                                                            ##
+##  Licensed under the Apache License, Version 2.0 (the "License");           ##
+##  you may not use this file except in compliance with the License.          ##
+##  You may obtain a copy of the License at                                   ##
+##                                                                            ##
+##      http://www.apache.org/licenses/LICENSE-2.0                            ##
+##                                                                            ##
+##  Unless required by applicable law or agreed to in writing, software       ##
+##  distributed under the License is distributed on an "AS IS" BASIS,         ##
+##  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  ##
+##  See the License for the specific language governing permissions and       ##
+##  limitations under the License.                                            ##
+##                                                                            ##
+################################################################################
+
+
+from MCPLTestUtils.dirs import test_data_dir
+from MCPLTestUtils.toolcheck_common import ( cmd, check_same, copy )
+
+def main():
+    def dd(fn):
+        return test_data_dir.joinpath('ref',fn)
+
+    fmisc = copy(dd('miscphys.mcpl.gz'),'.')
+    fstat = copy(dd('ref_statsum.mcpl.gz'),'.')
+    fpol = copy(dd('reffile_12.mcpl'),'.')
+    ffmt2 = copy(test_data_dir.joinpath('reffmt2','miscphys.mcpl.gz'),
+                 'miscphys_fmt2.mcpl.gz')
+
+    #Illegal usage:
+    cmd(fmisc,'--where','ekin>1',fail=True)
+    cmd('--merge','--where','ekin>1','out.mcpl',fmisc,fmisc,fail=True)
+    cmd('--extract','--where','ekin>1','--where','ekin<2',
+        fmisc,'out.mcpl',fail=True)
+    for bad_expr in ['', 'ekin>', 'ekin>1 &&', '(ekin>1', 'ekin>1)',
+                     'energy>1', 'ekin>>1', 'ekin=1', 'abs ekin',
+                     'ekin>1 & z<0', 'x y', '1e']:
+        cmd('--extract','--where',bad_expr,fmisc,'out.mcpl',fail=True)
+
+    #Selections:
+    cmd('--extract','--where','pdgcode==2112 && ekin>1e-3 && z>=0',
+        fmisc,'sel_1')
+    cmd('-l0','sel_1.mcpl.gz')
+    cmd('-e','--w','abs(uz)>0.5 || -x>=2*y',fmisc,'sel_2')
+    cmd('-l0','sel_2.mcpl.gz')
+    cmd('-e','--where','!(pdg==22) && (w/2 < 0.6) && t>=0',fmisc,'sel_3')
+    cmd('-l0','sel_3.mcpl.gz')
+    cmd('-e','--where','ux*ux+uy*uy < 0.25',fpol,'sel_4')
+    cmd('-l0','sel_4.mcpl.gz')
+    cmd('-e','--where','polx < -0.015 || uf != 0',fpol,'sel_5')
+    cmd('-l0','sel_5.mcpl.gz')
+    cmd('-e','--where','ekin-1 > 0',fmisc,'sel_6')
+    cmd('-e','--where','ekin > 1',fmisc,'sel_7')
+    check_same('sel_6.mcpl.gz','sel_7.mcpl.gz')
+
+    #Selecting nothing or everything:
+    cmd('-e','--where','0',fmisc,'sel_none')
+    cmd('-e','--where','1',fmisc,'sel_all')
+    cmd('-e',fmisc,'sel_all_ref')
+    check_same('sel_all.mcpl.gz','sel_all_ref.mcpl.gz')
+
+    #Combination with -p is the same as including it in the expression:
+    cmd('-e','-p22','--where','ekin<0.1',fmisc,'sel_8')
+    cmd('-e','--where','pdgcode==22 && ekin<0.1',fmisc,'sel_9')
+    check_same('sel_8.mcpl.gz','sel_9.mcpl.gz')
+    cmd('-l0','sel_8.mcpl.gz')
+
+    #Combination with -l/-s:
+    cmd('-e','-s10','-l100','--where','pdgcode!=2112',fmisc,'sel_10')
+    cmd('-l0','sel_10.mcpl.gz')
+
+    #Stat:sum entries are kept when selecting via --where (as with -p):
+    cmd('-e','--where','weight>0.9',fstat,'sel_stat')
+    cmd('-j','sel_stat.mcpl.gz')
+
+    #Multi-threaded selection gives identical results:
+    cmd(fmisc,'--threads=2',fail=True)
+    cmd('-e','-j2',fmisc,'out.mcpl',fail=True)
+    for bad in ('--threads=','--threads=x','--threads=-2','--threads'):
+        cmd('-e',bad,fmisc,'out.mcpl',fail=True)
+    cmd('-e','--threads=2','--threads=2',fmisc,'out.mcpl',fail=True)
+    cmd('--merge','--threads=2','out.mcpl',fmisc,fmisc,fail=True)
+    cmd('-e','--threads=99999','-p22',fmisc,'out.mcpl',fail=True)
+    cmd('-e','--threads=3','--where','abs(uz)>0.5 || -x>=2*y',fmisc,'sel_2_mt')
+    check_same('sel_2.mcpl.gz','sel_2_mt.mcpl.gz')
+    cmd('-e','--threads=0','-s10','-l100','--where','pdgcode!=2112',fmisc,'sel_10_mt')
+    check_same('sel_10.mcpl.gz','sel_10_mt.mcpl.gz')
+    cmd('-e','--threads=2','-p22','--where','ekin<0.1',fmisc,'sel_8_mt')
+    check_same('sel_8.mcpl.gz','sel_8_mt.mcpl.gz')
+
+    #Old MCPL-2 files (transferred one particle at a time):
+    cmd('-e','--where','pdgcode==2112 && ekin>1e-3 && z>=0',
+        ffmt2,'sel_fmt2')
+    cmd('-l0','sel_fmt2.mcpl.gz')
+
+    #Index files (these small files have just one block of particles, which
+    #can be skipped entirely when nothing can be selected):
+    cmd('--index',fail=True)
+    cmd('--index',fmisc,fstat,fail=True)
+    cmd('-e','--index',fmisc,'out.mcpl',fail=True)
+    cmd('--index',fmisc)
+    cmd('-e','--where','pdgcode==2112 && ekin>1e-3 && z>=0',fmisc,'sel_1_idx')
+    check_same('sel_1.mcpl.gz','sel_1_idx.mcpl.gz')
+    cmd('-e','--threads=2','-p22','--where','ekin<0.1',fmisc,'sel_8_idx')
+    check_same('sel_8.mcpl.gz','sel_8_idx.mcpl.gz')
+    cmd('-e','-p12345',fmisc,'sel_idx_none')
+    cmd('-l0','sel_idx_none.mcpl.gz')
+    cmd('-e','--threads=2','--where','ekin>1e9 || x<-1e9',fmisc,'sel_idx_none_mt')
+    check_same('sel_idx_none.mcpl.gz','sel_idx_none_mt.mcpl.gz')
+    cmd('--index',ffmt2)
+    cmd('-e','--where','pdgcode==2112 && ekin>1e-3 && z>=0',
+        ffmt2,'sel_fmt2_idx')
+    check_same('sel_fmt2.mcpl.gz','sel_fmt2_idx.mcpl.gz')
+    cmd('-e','--where','pdgcode==12345',ffmt2,'sel_fmt2_idx_none')
+    cmd('-l0','sel_fmt2_idx_none.mcpl.gz')
+
+if __name__ == '__main__':
+    main()
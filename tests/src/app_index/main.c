@@ -0,0 +1,139 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test index files created with mcpl_create_index, by verifying that reading
+//with mcpl_set_filter gives the same particles as a brute force selection
+//(both with and without index files, and with outdated index files).
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void create_file( const char * filename, unsigned n, int do_gzip )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_enable_userflags(f);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    //Energies increase through the file, and every 4th range of 50000
+    //particles consists of just gammas. A range near the end has too many
+    //different pdgcodes to keep track of in the index:
+    particle->pdgcode = ( ( i / 50000 ) % 4 == 3 ? 22 : ( i % 3 ? 2112 : 2212 ) );
+    if ( i >= 300000 && i < 340000 )
+      particle->pdgcode = 1000000000 + 10 * (int32_t)( i % 50 );
+    particle->ekin = 0.001 * i + ( i % 7 ) * 0.01;
+    particle->position[0] = ( i % 11 ) - 5.0;
+    particle->position[2] = 0.5 * i;
+    particle->direction[2] = 1.0;
+    particle->time = ( i % 13 ) * 0.1;
+    particle->weight = 1.0;
+    particle->userflags = i;
+    mcpl_add_particle(f,particle);
+  }
+  if ( do_gzip )
+    mcpl_closeandgzip_outfile(f);
+  else
+    mcpl_close_outfile(f);
+}
+
+typedef int (*selectfct_t)(const mcpl_particle_t*);
+int sel1( const mcpl_particle_t* p ) { return p->ekin < 20.0; }
+int sel2( const mcpl_particle_t* p ) { return p->pdgcode == 22; }
+int sel3( const mcpl_particle_t* p ) { return p->pdgcode != 22 && p->ekin > 160.0; }
+int sel4( const mcpl_particle_t* p ) { return p->ekin >= 100.0 && p->ekin < 101.0 && p->position[0] > 3.0; }
+int sel5( const mcpl_particle_t* p ) { return p->ekin * 2 > 1000.0; }
+int sel6( const mcpl_particle_t* p ) { return p->time < 0.05 || p->pdgcode == 2212; }
+int sel7( const mcpl_particle_t* p ) { return p->pdgcode == 1000000170; }
+int sel8( const mcpl_particle_t* p ) { return p->pdgcode > 1000000000 && p->ekin < 310.0; }
+
+void test_selection( const char * filename, const char * expr,
+                     selectfct_t selfct, uint64_t skip )
+{
+  unsigned long long nfound = 0;
+  int ok = 1;
+  mcpl_file_t f1 = mcpl_open_file(filename);
+  mcpl_file_t f2 = mcpl_open_file(filename);
+  mcpl_seek(f1,skip);
+  mcpl_set_filter(f2,expr);
+  mcpl_seek(f2,skip);
+  for (;;) {
+    const mcpl_particle_t * p1 = mcpl_read(f1);
+    while ( p1 && !selfct(p1) )
+      p1 = mcpl_read(f1);
+    const mcpl_particle_t * p2 = mcpl_read(f2);
+    if ( !p1 || !p2 ) {
+      ok = ok && ( !p1 && !p2 );
+      break;
+    }
+    ++nfound;
+    if ( p1->userflags != p2->userflags
+         || mcpl_currentposition(f1) != mcpl_currentposition(f2) )
+      ok = 0;
+  }
+  mcpl_close_file(f1);
+  mcpl_close_file(f2);
+  printf("  %-45s (skip %6llu): %6llu particles selected -> %s\n",
+         expr, (unsigned long long)skip, nfound, ( ok ? "OK" : "FAILED" ) );
+  if ( !ok ) {
+    printf("Selection differs from brute force selection!\n");
+    exit(1);
+  }
+}
+
+void test_selections( const char * filename )
+{
+  printf("Testing selections in %s:\n",filename);
+  test_selection( filename, "ekin<20", sel1, 0 );
+  test_selection( filename, "pdgcode==22", sel2, 0 );
+  test_selection( filename, "pdgcode==22", sel2, 180000 );
+  test_selection( filename, "pdg!=22 && ekin>160", sel3, 0 );
+  test_selection( filename, "ekin>=100 && ekin<101 && x>3", sel4, 0 );
+  test_selection( filename, "ekin*2>1000", sel5, 0 );
+  test_selection( filename, "t<0.05 || pdgcode==2212", sel6, 123 );
+  test_selection( filename, "pdgcode==1000000170", sel7, 0 );
+  test_selection( filename, "pdgcode>1000000000 && ekin<310", sel8, 0 );
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+
+  create_file("f.mcpl",400000,0);
+  create_file("fgz.mcpl",400000,1);
+
+  //Without index files:
+  test_selections("f.mcpl");
+  test_selections("fgz.mcpl.gz");
+
+  //With index files:
+  mcpl_create_index("f.mcpl");
+  mcpl_create_index("fgz.mcpl.gz");
+  test_selections("f.mcpl");
+  test_selections("fgz.mcpl.gz");
+
+  //Outdated index file (should be ignored with a warning):
+  create_file("f_extra.mcpl",1000,0);
+  const char * fns[1] = { "f_extra.mcpl" };
+  mcpl_merge_inplace_files( "f.mcpl", 1, fns );
+  test_selection( "f.mcpl", "pdgcode==22", sel2, 0 );
+
+  return 0;
+}
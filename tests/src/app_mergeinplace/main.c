@@ -0,0 +1,121 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test mcpl_merge_inplace_files, appending several files (some gzipped) to an
+//existing file, and verifying the result against mcpl_merge_files.
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <string.h>
+
+void create_file( const char * filename, int ifile, double statval,
+                  unsigned n, int do_gzip )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_hdr_add_comment(f,"Some comment.");
+  mcpl_hdr_add_stat_sum( f, "nsrc", statval );
+  mcpl_enable_userflags(f);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    particle->position[0] = ifile;
+    particle->position[2] = i;
+    particle->direction[2] = 1.0;
+    particle->ekin = 0.001 * (i+1);
+    particle->pdgcode = 2112;
+    particle->weight = 1.0;
+    particle->userflags = 1000*ifile+i;
+    mcpl_add_particle(f,particle);
+  }
+  if ( do_gzip )
+    mcpl_closeandgzip_outfile(f);
+  else
+    mcpl_close_outfile(f);
+}
+
+int particles_identical( const char * fn1, const char * fn2 )
+{
+  mcpl_file_t f1 = mcpl_open_file(fn1);
+  mcpl_file_t f2 = mcpl_open_file(fn2);
+  int ok = mcpl_hdr_nparticles(f1) == mcpl_hdr_nparticles(f2);
+  while ( ok ) {
+    const mcpl_particle_t * p1 = mcpl_read(f1);
+    const mcpl_particle_t * p2 = mcpl_read(f2);
+    if ( !p1 || !p2 ) {
+      ok = ( !p1 && !p2 );
+      break;
+    }
+    ok = ( memcmp( p1, p2, sizeof(mcpl_particle_t) ) == 0 );
+  }
+  mcpl_close_file(f1);
+  mcpl_close_file(f2);
+  return ok;
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+
+  //Floating point fun as in the app_statsum test: Only when using stablesum
+  //will we end up with 1.0000000000000004 in the end:
+  create_file("f_1.mcpl",1,1.0,5,0);
+  create_file("f_epsa.mcpl",2,1e-16,3000,0);
+  create_file("f_epsb.mcpl",3,1e-16,0,0);
+  create_file("f_epsc.mcpl",4,1e-16,20000,1);
+  create_file("f_epsd.mcpl",5,1e-16,7,1);
+  //Same contents as f_1.mcpl:
+  create_file("f_copy.mcpl",1,1.0,5,0);
+
+  const char *fns[5] = { "f_1.mcpl", "f_epsa.mcpl", "f_epsb.mcpl",
+                         "f_epsc.mcpl.gz", "f_epsd.mcpl.gz" };
+  mcpl_outfile_t of = mcpl_merge_files( "f_mergeall.mcpl", 5, fns );
+  mcpl_close_outfile(of);
+
+  mcpl_merge_inplace_files( "f_copy.mcpl", 4, fns + 1 );
+  mcpl_dump("f_copy.mcpl",0,0,3);
+
+  mcpl_file_t f = mcpl_open_file("f_copy.mcpl");
+  printf("mcpl_hdr_stat_sum(\"nsrc\") = %.17g\n",
+         mcpl_hdr_stat_sum(f,"nsrc"));
+  if ( mcpl_hdr_stat_sum(f,"nsrc") != 1.0 + 4e-16
+       || !(mcpl_hdr_stat_sum(f,"nsrc")>1.0 ) ) {
+    printf("stats were not added in stable manner\n");
+    return 1;
+  }
+  mcpl_close_file(f);
+
+  if ( !particles_identical("f_copy.mcpl","f_mergeall.mcpl") ) {
+    printf("particles differ from those of mcpl_merge_files\n");
+    return 1;
+  }
+  printf("particles are identical to those of mcpl_merge_files\n");
+
+  //Appending just an empty file should still update stat:sum: entries:
+  create_file("f_empty.mcpl",6,2.0,0,0);
+  const char *fns_empty[1] = { "f_empty.mcpl" };
+  mcpl_merge_inplace_files( "f_copy.mcpl", 1, fns_empty );
+  f = mcpl_open_file("f_copy.mcpl");
+  printf("nparticles = %llu, mcpl_hdr_stat_sum(\"nsrc\") = %.17g\n",
+         (unsigned long long)mcpl_hdr_nparticles(f),
+         mcpl_hdr_stat_sum(f,"nsrc"));
+  mcpl_close_file(f);
+
+  return 0;
+}
@@ -0,0 +1,169 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test mcpl_open_header_only, by verifying that it gives the same header data
+//and particles as mcpl_open_file, also for files with headers much larger than
+//the initial read buffer and with blobs loaded on demand while reading.
+
+#include "mcpl.h"
+#include "mcpltestutils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int same_header( mcpl_file_t f1, mcpl_file_t f2 )
+{
+  if ( mcpl_hdr_version(f1) != mcpl_hdr_version(f2)
+       || mcpl_hdr_nparticles(f1) != mcpl_hdr_nparticles(f2)
+       || mcpl_hdr_header_size(f1) != mcpl_hdr_header_size(f2)
+       || mcpl_hdr_particle_size(f1) != mcpl_hdr_particle_size(f2)
+       || mcpl_hdr_has_userflags(f1) != mcpl_hdr_has_userflags(f2)
+       || mcpl_hdr_has_polarisation(f1) != mcpl_hdr_has_polarisation(f2)
+       || mcpl_hdr_has_doubleprec(f1) != mcpl_hdr_has_doubleprec(f2)
+       || mcpl_hdr_universal_pdgcode(f1) != mcpl_hdr_universal_pdgcode(f2)
+       || mcpl_hdr_universal_weight(f1) != mcpl_hdr_universal_weight(f2)
+       || mcpl_hdr_little_endian(f1) != mcpl_hdr_little_endian(f2)
+       || strcmp( mcpl_hdr_srcname(f1), mcpl_hdr_srcname(f2) ) != 0
+       || mcpl_hdr_ncomments(f1) != mcpl_hdr_ncomments(f2)
+       || mcpl_hdr_nblobs(f1) != mcpl_hdr_nblobs(f2) )
+    return 0;
+  for ( unsigned i = 0; i < mcpl_hdr_ncomments(f1); ++i )
+    if ( strcmp( mcpl_hdr_comment(f1,i), mcpl_hdr_comment(f2,i) ) != 0 )
+      return 0;
+  const char ** keys1 = mcpl_hdr_blobkeys(f1);
+  const char ** keys2 = mcpl_hdr_blobkeys(f2);
+  for ( int i = 0; i < mcpl_hdr_nblobs(f1); ++i ) {
+    if ( strcmp( keys1[i], keys2[i] ) != 0 )
+      return 0;
+    uint32_t l1, l2;
+    const char * d1;
+    const char * d2;
+    if ( !mcpl_hdr_blob( f1, keys1[i], &l1, &d1 )
+         || !mcpl_hdr_blob( f2, keys2[i], &l2, &d2 )
+         || l1 != l2 || memcmp( d1, d2, l1 ) != 0 )
+      return 0;
+  }
+  return 1;
+}
+
+int same_particles( mcpl_file_t f1, mcpl_file_t f2, int access_blobs )
+{
+  for (;;) {
+    const mcpl_particle_t * p1 = mcpl_read(f1);
+    if ( access_blobs && mcpl_currentposition(f2) % 100 == 50 ) {
+      //Loading blobs on demand must not disturb the particle reading:
+      uint32_t ldata;
+      const char * data;
+      mcpl_hdr_blob( f2, "largeblob", &ldata, &data );
+      mcpl_hdr_blob( f2, "smallblob", &ldata, &data );
+    }
+    const mcpl_particle_t * p2 = mcpl_read(f2);
+    if ( !p1 || !p2 )
+      return !p1 && !p2;
+    if ( memcmp( p1, p2, sizeof(mcpl_particle_t) ) != 0 )
+      return 0;
+  }
+}
+
+void test_file( const char * filename, const char * label, int access_blobs )
+{
+  mcpl_file_t f1 = mcpl_open_file(filename);
+  mcpl_file_t f2 = mcpl_open_header_only(filename);
+  int ok_hdr = ( access_blobs ? 1 : same_header( f1, f2 ) );
+  int ok_parts = same_particles( f1, f2, access_blobs );
+  if ( access_blobs )
+    ok_hdr = same_header( f1, f2 );
+  printf("  %-32s : %llu particles, %i blobs -> %s\n",label,
+         (unsigned long long)mcpl_hdr_nparticles(f2),mcpl_hdr_nblobs(f2),
+         ( ok_hdr && ok_parts ? "OK" : "FAILED" ) );
+  mcpl_close_file(f1);
+  mcpl_close_file(f2);
+  if ( !ok_hdr || !ok_parts ) {
+    printf("Header-only mode gives different results!\n");
+    exit(1);
+  }
+}
+
+void create_file( const char * filename, int do_gzip )
+{
+  //Many comments and a large blob, followed by a small blob:
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_hdr_set_srcname(f,"app_openheader");
+  char buf[256];
+  for ( unsigned i = 0; i < 200; ++i ) {
+    snprintf(buf,sizeof(buf),"Comment number %u with some extra padding text",i);
+    mcpl_hdr_add_comment(f,buf);
+  }
+  mcpl_hdr_add_stat_sum(f,"nsrc",12345.0);
+  size_t nlarge = 100000;
+  char * large = (char*)malloc(nlarge);
+  for ( size_t i = 0; i < nlarge; ++i )
+    large[i] = (char)( ( i * 7 ) % 251 );
+  mcpl_hdr_add_data(f,"largeblob",(uint32_t)nlarge,large);
+  free(large);
+  mcpl_hdr_add_data(f,"smallblob",5,"hello");
+  mcpl_enable_userflags(f);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for ( unsigned i = 0; i < 1000; ++i ) {
+    particle->pdgcode = ( i % 3 ? 2112 : 22 );
+    particle->ekin = 0.01 * i;
+    particle->position[2] = 0.5 * i;
+    particle->direction[2] = 1.0;
+    particle->weight = 1.0;
+    particle->userflags = i;
+    mcpl_add_particle(f,particle);
+  }
+  if ( do_gzip )
+    mcpl_closeandgzip_outfile(f);
+  else
+    mcpl_close_outfile(f);
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+
+  const char * reffiles[] = { "reffile_1.mcpl", "reffile_2.mcpl.gz",
+                              "reffile_5.mcpl.gz", "reffile_12.mcpl",
+                              "reffile_16.mcpl", "reffile_crash.mcpl",
+                              "reffile_empty.mcpl", "reffile_empty.mcpl.gz",
+                              "miscphys.mcpl.gz", NULL };
+  const char * reffiles_fmt3[] = { "reffile_encodings.mcpl.gz",
+                                   "reffile_uw.mcpl.gz", "ref_statsum.mcpl.gz",
+                                   "ref_statsum_crash.mcpl", NULL };
+  printf("Testing files in ref:\n");
+  for ( const char ** fn = reffiles; *fn; ++fn )
+    test_file( mcpltests_find_data("ref",*fn), *fn, 0 );
+  for ( const char ** fn = reffiles_fmt3; *fn; ++fn )
+    test_file( mcpltests_find_data("ref",*fn), *fn, 0 );
+  printf("Testing files in reffmt2:\n");
+  for ( const char ** fn = reffiles; *fn; ++fn )
+    test_file( mcpltests_find_data("reffmt2",*fn), *fn, 0 );
+
+  printf("Testing files with large headers:\n");
+  create_file("bighdr.mcpl",0);
+  create_file("bighdr_gz.mcpl",1);
+  test_file( "bighdr.mcpl", "bighdr.mcpl", 0 );
+  test_file( "bighdr.mcpl", "bighdr.mcpl (blob access)", 1 );
+  test_file( "bighdr_gz.mcpl.gz", "bighdr_gz.mcpl.gz", 0 );
+  test_file( "bighdr_gz.mcpl.gz", "bighdr_gz.mcpl.gz (blob access)", 1 );
+  return 0;
+}
@@ -0,0 +1,146 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test mcpl_read_particles, by comparing with particles read one at a time with
+//mcpl_read (also when mixing the two, after seeking, and with a filter).
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void create_file( const char * filename, unsigned n )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_enable_userflags(f);
+  mcpl_enable_polarisation(f);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    particle->pdgcode = ( i % 3 ? 2112 : 22 );
+    particle->ekin = 1e-3 * ( ( i * 7919u ) % 1001 );
+    particle->position[0] = 0.5 * ( i % 17 );
+    particle->position[1] = -0.25 * ( i % 7 );
+    particle->position[2] = 0.125 * i;
+    particle->direction[0] = ( i % 2 ? 0.6 : 0.0 );
+    particle->direction[1] = ( i % 2 ? 0.0 : -0.8 );
+    particle->direction[2] = ( i % 2 ? 0.8 : 0.6 ) * ( i % 4 < 2 ? 1.0 : -1.0 );
+    particle->polarisation[1] = 0.01 * ( i % 11 );
+    particle->time = 1e-3 * i;
+    particle->weight = ( i % 5 ? 1.0 : 3.0 );
+    particle->userflags = i;
+    mcpl_add_particle(f,particle);
+  }
+  mcpl_close_outfile(f);
+}
+
+int check( int ok, const char * what )
+{
+  printf("  %s -> %s\n", what, ok ? "OK" : "FAILED");
+  if ( !ok )
+    exit(1);
+  return ok;
+}
+
+//Read the particles in chunks of the given sizes (cycling through them, and
+//using mcpl_read for chunks of size 0), comparing with the particles in ref:
+int read_chunks( const char * filename, const char * filter,
+                 const mcpl_particle_t * ref, uint64_t nref,
+                 const unsigned * chunks, unsigned nchunks )
+{
+  mcpl_file_t f = mcpl_open_file(filename);
+  if ( filter )
+    mcpl_set_filter( f, filter );
+  mcpl_particle_t * buf = (mcpl_particle_t*)malloc( sizeof(mcpl_particle_t) * nref );
+  uint64_t nread = 0;
+  for ( unsigned ichunk = 0; ; ++ichunk ) {
+    unsigned nchunk = chunks[ichunk % nchunks];
+    uint64_t n;
+    if ( nchunk ) {
+      n = mcpl_read_particles( f, buf + nread, nchunk );
+    } else {
+      const mcpl_particle_t * p = mcpl_read( f );
+      n = ( p ? 1 : 0 );
+      if ( p )
+        buf[nread] = *p;
+    }
+    nread += n;
+    if ( n < ( nchunk ? nchunk : 1 ) )
+      break;
+  }
+  int ok = ( nread == nref
+         && memcmp( buf, ref, sizeof(mcpl_particle_t) * nref ) == 0
+         && mcpl_currentposition( f ) == mcpl_hdr_nparticles( f )
+         && mcpl_read_particles( f, buf, 10 ) == 0 );
+  free( buf );
+  mcpl_close_file( f );
+  return ok;
+}
+
+void test_file( const char * filename, const char * filter )
+{
+  printf("Reading %s%s%s:\n",filename,
+         filter ? " with filter " : "", filter ? filter : "");
+  mcpl_file_t f = mcpl_open_file(filename);
+  if ( filter )
+    mcpl_set_filter( f, filter );
+  uint64_t np = mcpl_hdr_nparticles( f );
+  mcpl_particle_t * ref = (mcpl_particle_t*)malloc( sizeof(mcpl_particle_t) * np );
+  uint64_t nref = 0;
+  const mcpl_particle_t * p;
+  while ( ( p = mcpl_read(f) ) )
+    ref[nref++] = *p;
+  mcpl_close_file( f );
+
+  static const unsigned chunks_all[] = { 100000 };
+  static const unsigned chunks_mixed[] = { 1, 0, 7, 1024, 0, 3000, 1025 };
+  check( read_chunks( filename, filter, ref, nref, chunks_all, 1 ),
+         "all particles at once" );
+  check( read_chunks( filename, filter, ref, nref, chunks_mixed, 7 ),
+         "mixed chunk sizes and mcpl_read calls" );
+
+  //After seeking, and reading the last particles:
+  f = mcpl_open_file(filename);
+  mcpl_particle_t buf[2000];
+  int ok = 1;
+  if ( !filter ) {
+    mcpl_seek( f, 1500 );
+    ok = ( mcpl_read_particles( f, buf, 1000 ) == 1000
+           && memcmp( buf, ref + 1500, sizeof(mcpl_particle_t) * 1000 ) == 0 );
+    mcpl_seek( f, np - 10 );
+    ok = ok && ( mcpl_read_particles( f, buf, 2000 ) == 10
+                 && memcmp( buf, ref + np - 10, sizeof(mcpl_particle_t) * 10 ) == 0 );
+    check( ok, "after seeking" );
+  }
+  mcpl_close_file( f );
+  printf("  particles read: %i\n",(int)nref);
+  free( ref );
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+  create_file("f.mcpl",5000);
+  test_file("f.mcpl",NULL);
+  test_file("f.mcpl","ekin<0.3 && uz>0");
+  mcpl_gzip_file("f.mcpl");
+  test_file("f.mcpl.gz",NULL);
+  return 0;
+}
@@ -0,0 +1,184 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test sorting of particles along space-filling curves with mcpl_sort_file, by
+//verifying that mcpl_query_box gives the same particles as a brute force
+//selection (with and without a valid spatial index).
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static uint32_t rndstate = 12345;
+double rnd( void )
+{
+  rndstate = rndstate * 1664525u + 1013904223u;
+  return ( rndstate >> 8 ) / 16777216.0;
+}
+
+void create_file( const char * filename, unsigned n )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_enable_userflags(f);
+  mcpl_hdr_add_comment(f,"Some comment");
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    //Clusters of particles plus a uniform background (and a few particles
+    //with positions which are not finite):
+    particle->pdgcode = ( i % 3 ? 2112 : 22 );
+    double c = ( i % 4 ) * 10.0;
+    for ( int k = 0; k < 3; ++k )
+      particle->position[k] = ( i % 5 ? c + rnd() : 100.0 * rnd() - 50.0 );
+    if ( i % 10007 == 17 )
+      particle->position[i%3] = ( i % 2 ? INFINITY : NAN );
+    particle->direction[2] = 1.0;
+    particle->ekin = rnd();
+    particle->weight = 1.0;
+    particle->userflags = i;
+    mcpl_add_particle(f,particle);
+  }
+  mcpl_close_outfile(f);
+}
+
+typedef struct {
+  unsigned n;
+  unsigned char * found;//number of times each userflag value was found
+  int error;
+} querydata_t;
+
+void query_callback( const mcpl_particle_t * p, void * userdata )
+{
+  querydata_t * qd = (querydata_t*)userdata;
+  if ( p->userflags < qd->n )
+    ++qd->found[p->userflags];
+  else
+    qd->error = 1;
+}
+
+int inside( const mcpl_particle_t * p, const double * boxmin, const double * boxmax )
+{
+  for ( int k = 0; k < 3; ++k )
+    if ( !( p->position[k] >= boxmin[k] && p->position[k] <= boxmax[k] ) )
+      return 0;
+  return 1;
+}
+
+void test_query( const char * filename, double x0, double y0, double z0,
+                 double x1, double y1, double z1, const char * filter )
+{
+  const double boxmin[3] = { x0, y0, z0 };
+  const double boxmax[3] = { x1, y1, z1 };
+  mcpl_file_t f = mcpl_open_file(filename);
+  unsigned n = (unsigned)mcpl_hdr_nparticles(f);
+  querydata_t qd;
+  qd.n = n;
+  qd.found = (unsigned char*)calloc(n,1);
+  qd.error = 0;
+  unsigned char * expected = (unsigned char*)calloc(n,1);
+  mcpl_skipforward(f,10);
+  if ( filter )
+    mcpl_set_filter(f,filter);
+  uint64_t nfound = mcpl_query_box(f,boxmin,boxmax,query_callback,&qd);
+  int ok = ( mcpl_currentposition(f) == 10 && !qd.error );
+  //Brute force:
+  if ( filter )
+    mcpl_set_filter(f,NULL);
+  mcpl_rewind(f);
+  const mcpl_particle_t * p;
+  uint64_t nexpected = 0;
+  while ( ( p = mcpl_read(f) ) ) {
+    if ( inside(p,boxmin,boxmax) && ( !filter || p->pdgcode == 22 ) ) {
+      ++nexpected;
+      ++expected[p->userflags];
+    }
+  }
+  ok = ok && ( nfound == nexpected ) && memcmp( qd.found, expected, n ) == 0;
+  mcpl_close_file(f);
+  free(qd.found);
+  free(expected);
+  printf("  [%g,%g]x[%g,%g]x[%g,%g]%s: %llu particles -> %s\n",
+         x0, x1, y0, y1, z0, z1, ( filter ? " (only gammas)" : "" ),
+         (unsigned long long)nfound, ( ok ? "OK" : "FAILED" ) );
+  if ( !ok ) {
+    printf("Query differs from brute force selection!\n");
+    exit(1);
+  }
+}
+
+void test_queries( const char * filename )
+{
+  printf("Testing queries in %s:\n",filename);
+  test_query( filename, 0.0, 0.0, 0.0, 1.0, 1.0, 1.0, NULL );
+  test_query( filename, 0.25, 0.5, 0.0, 0.5, 0.75, 10.0, NULL );
+  test_query( filename, 9.5, 9.5, 9.5, 20.5, 20.5, 20.5, NULL );
+  test_query( filename, -50.0, -50.0, -50.0, -40.0, 50.0, 50.0, NULL );
+  test_query( filename, -1e9, -1e9, -1e9, 1e9, 1e9, 1e9, NULL );
+  test_query( filename, 0.0, 0.0, 0.0, INFINITY, INFINITY, INFINITY, NULL );
+  test_query( filename, 1000.0, 1000.0, 1000.0, 2000.0, 2000.0, 2000.0, NULL );
+  test_query( filename, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0, NULL );
+  test_query( filename, 1.0, 1.0, 1.0, 0.0, 0.0, 0.0, NULL );
+  test_query( filename, 20.0, 20.0, 20.0, 30.5, 30.5, 30.5, "pdgcode==22" );
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+
+  create_file("f.mcpl",200000);
+  test_queries("f.mcpl");
+
+  mcpl_close_outfile( mcpl_sort_file("f.mcpl","f_morton.mcpl","morton",1,0) );
+  test_queries("f_morton.mcpl");
+  mcpl_close_outfile( mcpl_sort_file("f.mcpl","f_hilbert.mcpl","hilbert",3,1) );
+  test_queries("f_hilbert.mcpl");
+  mcpl_outfile_t fo = mcpl_sort_file("f.mcpl","f_hilbert_gz.mcpl","hilbert",0,0);
+  mcpl_closeandgzip_outfile(fo);
+  test_queries("f_hilbert_gz.mcpl.gz");
+
+  //Spatial indices are transferred with other metadata, but are dropped when
+  //sorting the file again:
+  mcpl_file_t f = mcpl_open_file("f_hilbert.mcpl");
+  mcpl_outfile_t fo2 = mcpl_create_outfile("f_copy.mcpl");
+  mcpl_transfer_metadata(f,fo2);
+  mcpl_close_outfile(fo2);
+  mcpl_close_file(f);
+  f = mcpl_open_file("f_copy.mcpl");
+  printf("Blobs in f_hilbert.mcpl after mcpl_transfer_metadata: %i\n",
+         mcpl_hdr_nblobs(f));
+  mcpl_close_file(f);
+  mcpl_close_outfile( mcpl_sort_file("f_hilbert.mcpl","f_ekin.mcpl","ekin",1,0) );
+  f = mcpl_open_file("f_ekin.mcpl");
+  printf("Blobs in f_hilbert.mcpl after sorting by ekin: %i\n",
+         mcpl_hdr_nblobs(f));
+  mcpl_close_file(f);
+  mcpl_close_outfile( mcpl_sort_file("f_hilbert.mcpl","f_morton3.mcpl","morton",1,0) );
+  test_queries("f_morton3.mcpl");
+
+  //Outdated spatial index (should be ignored with a warning):
+  mcpl_close_outfile( mcpl_sort_file("f.mcpl","f_morton2.mcpl","morton",1,0) );
+  const char * fns[1] = { "f_morton2.mcpl" };
+  mcpl_merge_inplace_files( "f_morton.mcpl", 1, fns );
+  test_query( "f_morton.mcpl", 0.0, 0.0, 0.0, 1.0, 1.0, 1.0, NULL );
+
+  return 0;
+}
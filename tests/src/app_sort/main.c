@@ -0,0 +1,158 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test mcpl_sort_file, both when sorting in memory and when using (possibly
+//many) temporary files, by verifying the order of particles in the output and
+//that the results do not depend on the number of threads or the amount of
+//memory used.
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void create_file( const char * filename, unsigned n )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_enable_userflags(f);
+  mcpl_enable_doubleprec(f);
+  mcpl_hdr_add_comment(f,"Some comment");
+  mcpl_hdr_add_stat_sum(f,"nsrc",1234.0);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    //Few distinct pdgcodes and energies, to test that sorting is stable:
+    particle->pdgcode = ( i % 3 ? 2112 : 22 );
+    particle->ekin = ( ( i * 7919u ) % 101 ) * 0.5;
+    particle->position[2] = 0.001 * ( ( i * 104729u ) % 1000 );
+    particle->direction[2] = 1.0;
+    particle->weight = 1.0;
+    particle->userflags = i;
+    mcpl_add_particle(f,particle);
+  }
+  mcpl_close_outfile(f);
+}
+
+unsigned char * read_all( const char * filename, size_t * size )
+{
+  FILE * fh = fopen(filename,"rb");
+  if ( !fh ) {
+    printf("Could not open %s\n",filename);
+    exit(1);
+  }
+  fseek(fh,0,SEEK_END);
+  *size = (size_t)ftell(fh);
+  fseek(fh,0,SEEK_SET);
+  unsigned char * buf = (unsigned char*)malloc(*size ? *size : 1);
+  if ( fread(buf,1,*size,fh) != *size ) {
+    printf("Could not read %s\n",filename);
+    exit(1);
+  }
+  fclose(fh);
+  return buf;
+}
+
+void check_sorted( const char * filename, unsigned n )
+{
+  //Check order (pdgcode ascending, ekin descending, and original order):
+  mcpl_file_t f = mcpl_open_file(filename);
+  unsigned char * seen = (unsigned char*)calloc(n,1);
+  const mcpl_particle_t * p;
+  mcpl_particle_t prev;
+  memset(&prev,0,sizeof(prev));
+  unsigned nread = 0;
+  int ok = ( mcpl_hdr_nparticles(f) == n && mcpl_hdr_ncomments(f) == 2 );
+  while ( ( p = mcpl_read(f) ) ) {
+    if ( p->userflags >= n || seen[p->userflags] )
+      ok = 0;
+    else
+      seen[p->userflags] = 1;
+    if ( nread++ ) {
+      if ( p->pdgcode < prev.pdgcode )
+        ok = 0;
+      if ( p->pdgcode == prev.pdgcode && p->ekin > prev.ekin )
+        ok = 0;
+      if ( p->pdgcode == prev.pdgcode && p->ekin == prev.ekin
+           && p->userflags < prev.userflags )
+        ok = 0;
+    }
+    prev = *p;
+  }
+  mcpl_close_file(f);
+  free(seen);
+  printf("  %s: %u particles -> %s\n", filename, nread,
+         ( ok && nread == n ? "OK" : "FAILED" ) );
+  if ( !ok || nread != n ) {
+    printf("Particles are not sorted correctly!\n");
+    exit(1);
+  }
+}
+
+void test_sort( const char * infile, const char * reffile, const char * outfile,
+                unsigned nthreads, unsigned max_memory_mb, unsigned n )
+{
+  mcpl_outfile_t f = mcpl_sort_file( infile, outfile, "pdg,-ekin",
+                                     nthreads, max_memory_mb );
+  mcpl_close_outfile(f);
+  check_sorted( outfile, n );
+  //Temporary files must be gone:
+  char tmpfn[256];
+  snprintf( tmpfn, sizeof(tmpfn), "%s.sorttmp1", outfile );
+  FILE * fh = fopen( tmpfn, "rb" );
+  if ( fh ) {
+    printf("%s was not removed!\n",tmpfn);
+    exit(1);
+  }
+  //Results must be identical to the first one:
+  if ( !reffile )
+    return;
+  size_t size_ref, size;
+  unsigned char * ref = read_all( reffile, &size_ref );
+  unsigned char * buf = read_all( outfile, &size );
+  if ( size != size_ref || memcmp( buf, ref, size ) != 0 ) {
+    printf("%s differs from %s!\n",outfile,reffile);
+    exit(1);
+  }
+  free(ref);
+  free(buf);
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+
+  const unsigned n = 40000;
+  create_file("f.mcpl",n);
+
+  printf("Sorting in memory:\n");
+  test_sort( "f.mcpl", NULL, "sorted_ref.mcpl", 1, 0, n );
+  test_sort( "f.mcpl", "sorted_ref.mcpl", "sorted_mt.mcpl", 3, 0, n );
+  printf("Sorting with temporary files:\n");
+  test_sort( "f.mcpl", "sorted_ref.mcpl", "sorted_tmp.mcpl", 1, 1, n );
+  test_sort( "f.mcpl", "sorted_ref.mcpl", "sorted_tmp_mt.mcpl", 4, 1, n );
+
+  //More temporary files than can be merged at once:
+  const unsigned nbig = 500000;
+  create_file("fbig.mcpl",nbig);
+  printf("Sorting with many temporary files:\n");
+  test_sort( "fbig.mcpl", NULL, "sortedbig_ref.mcpl", 1, 0, nbig );
+  test_sort( "fbig.mcpl", "sortedbig_ref.mcpl", "sortedbig_tmp.mcpl", 2, 1, nbig );
+  return 0;
+}
@@ -0,0 +1,160 @@
+
+////////////////////////////////////////////////////////////////////////////////
+//                                                                            //
+//  This file is part of MCPL (see https://mctools.github.io/mcpl/)           //
+//                                                                            //
+//  Copyright 2015-2026 MCPL developers.                                      //
+//                                                                            //
+//  Licensed under the Apache License, Version 2.0 (the "License");           //
+//  you may not use this file except in compliance with the License.          //
+//  You may obtain a copy of the License at                                   //
+//                                                                            //
+//      http://www.apache.org/licenses/LICENSE-2.0                            //
+//                                                                            //
+//  Unless required by applicable law or agreed to in writing, software       //
+//  distributed under the License is distributed on an "AS IS" BASIS,         //
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  //
+//  See the License for the specific language governing permissions and       //
+//  limitations under the License.                                            //
+//                                                                            //
+////////////////////////////////////////////////////////////////////////////////
+
+//Test mcpl_collect_stats, by comparing with values calculated directly from
+//the particles, and verifying that the results do not depend on the number of
+//threads used.
+
+#include "mcpl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+void create_file( const char * filename, unsigned n, unsigned nuserflags )
+{
+  mcpl_outfile_t f = mcpl_create_outfile(filename);
+  mcpl_enable_userflags(f);
+  mcpl_enable_doubleprec(f);
+  mcpl_particle_t * particle = mcpl_get_empty_particle(f);
+  for( unsigned i = 0; i < n; ++i ) {
+    particle->pdgcode = ( i % 3 ? 2112 : 22 );
+    particle->ekin = 1e-3 * ( ( i * 7919u ) % 1001 );
+    particle->position[0] = 1e6 + 0.001 * ( i % 17 );//large mean, small rms
+    particle->position[1] = -0.25 * ( i % 7 );
+    particle->position[2] = ( i % 1000 == 0 ? 1e5 : 0.0 );//outliers
+    particle->direction[2] = 1.0;
+    particle->time = 1e-9 * i;
+    particle->weight = ( i % 5 ? 1.0 : 3.0 );
+    particle->userflags = i % nuserflags;
+    mcpl_add_particle(f,particle);
+  }
+  mcpl_close_outfile(f);
+}
+
+int check( int ok, const char * what )
+{
+  printf("  %s -> %s\n", what, ok ? "OK" : "FAILED");
+  if ( !ok )
+    exit(1);
+  return ok;
+}
+
+int near( double a, double b )
+{
+  return fabs( a - b ) <= 1e-9 * ( fabs( a ) + fabs( b ) ) + 1e-300;
+}
+
+int same_stats( const mcpl_stats_t * a, const mcpl_stats_t * b )
+{
+  if ( a->nparticles != b->nparticles || a->sum_weights != b->sum_weights
+       || a->n_pdgcodes != b->n_pdgcodes || a->n_userflags != b->n_userflags )
+    return 0;
+  for ( int i = 0; i < MCPL_STATS_NFIELDS; ++i ) {
+    const mcpl_fieldstats_t * fa = &a->fields[i];
+    const mcpl_fieldstats_t * fb = &b->fields[i];
+    if ( fa->mean != fb->mean || fa->rms != fb->rms || fa->min != fb->min
+         || fa->max != fb->max || fa->hist_nbins != fb->hist_nbins
+         || fa->hist_xmin != fb->hist_xmin
+         || fa->hist_binwidth != fb->hist_binwidth
+         || memcmp( fa->hist, fb->hist, sizeof(double) * fa->hist_nbins ) != 0 )
+      return 0;
+  }
+  return ( memcmp( a->pdgcodes, b->pdgcodes, sizeof(int64_t) * a->n_pdgcodes ) == 0
+           && memcmp( a->pdgcode_counts, b->pdgcode_counts,
+                      sizeof(double) * a->n_pdgcodes ) == 0
+           && memcmp( a->userflags, b->userflags,
+                      sizeof(int64_t) * a->n_userflags ) == 0
+           && memcmp( a->userflags_counts, b->userflags_counts,
+                      sizeof(double) * a->n_userflags ) == 0 );
+}
+
+void test_file( const char * filename )
+{
+  //Reference values calculated directly (with values shifted by those of the
+  //first particle, for numerical stability):
+  double sumw = 0.0, sumwx[MCPL_STATS_NFIELDS], sumwxx[MCPL_STATS_NFIELDS];
+  double shift[MCPL_STATS_NFIELDS];
+  memset( sumwx, 0, sizeof(sumwx) );
+  memset( sumwxx, 0, sizeof(sumwxx) );
+  int first = 1;
+  mcpl_file_t f = mcpl_open_file(filename);
+  const mcpl_particle_t * p;
+  while ( ( p = mcpl_read(f) ) ) {
+    const double v[MCPL_STATS_NFIELDS]
+      = { p->ekin, p->position[0], p->position[1], p->position[2],
+          p->direction[0], p->direction[1], p->direction[2], p->time,
+          p->weight, p->polarisation[0], p->polarisation[1],
+          p->polarisation[2] };
+    if ( first )
+      memcpy( shift, v, sizeof(shift) );
+    first = 0;
+    for ( int i = 0; i < MCPL_STATS_NFIELDS; ++i ) {
+      const double w = ( i == 8 ? 1.0 : p->weight );
+      sumwx[i] += w * ( v[i] - shift[i] );
+      sumwxx[i] += w * ( v[i] - shift[i] ) * ( v[i] - shift[i] );
+    }
+    sumw += p->weight;
+  }
+  mcpl_close_file(f);
+
+  printf("Statistics of %s:\n",filename);
+  mcpl_stats_t s = mcpl_collect_stats( filename, 1 );
+  check( near( s.sum_weights, sumw ), "sum of weights" );
+  int ok_mean = 1, ok_rms = 1, ok_hist = 1;
+  for ( int i = 0; i < MCPL_STATS_NFIELDS; ++i ) {
+    const mcpl_fieldstats_t * fs = &s.fields[i];
+    const double mean = sumwx[i] / fs->integral;
+    const double rms = sqrt( sumwxx[i] / fs->integral - mean * mean );
+    if ( fabs( fs->mean - shift[i] - mean ) > 1e-9 * ( fabs( fs->mean ) + 1.0 ) )
+      ok_mean = 0;
+    if ( fabs( fs->rms - rms ) > 1e-6 * rms + 1e-12 )
+      ok_rms = 0;
+    //Histograms cover all values and contain the total weight:
+    double h = 0.0;
+    for ( unsigned ib = 0; ib < fs->hist_nbins; ++ib )
+      h += fs->hist[ib];
+    if ( !near( h, fs->integral ) || fs->hist_nbins > 256
+         || fs->hist_xmin > fs->min
+         || fs->hist_xmin + fs->hist_nbins * fs->hist_binwidth <= fs->max )
+      ok_hist = 0;
+  }
+  check( ok_mean, "means" );
+  check( ok_rms, "rms (also for x with large mean and small rms)" );
+  check( ok_hist, "histograms" );
+  //Results do not depend on the number of threads:
+  mcpl_stats_t s_mt = mcpl_collect_stats( filename, 4 );
+  check( same_stats( &s, &s_mt ), "multi-threaded results identical" );
+  mcpl_free_stats( &s_mt );
+  mcpl_dump_stats( &s );
+  mcpl_free_stats( &s );
+}
+
+int main(int argc,char**argv) {
+  (void)argc;
+  (void)argv;
+  create_file("f.mcpl",100000,3);
+  test_file("f.mcpl");
+  //Too many different userflags for a frequency table:
+  create_file("f2.mcpl",50000,20000);
+  test_file("f2.mcpl");
+  return 0;
+}